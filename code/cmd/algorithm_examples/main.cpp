@@ -360,10 +360,10 @@ std::vector<leaf> create_quickload_leaves(const std::vector<vec2>& points) {
 
     std::vector<leaf> leaves;
 
-    // 16 leaves in memory.
+    // 16 leaves in memory, no limit on their size.
     quick_load_pass<vec2, vec2_accessor,
-            block_size, leaf_size, leaf_size
-    > pass(16, 16, vec2_accessor(), 1.0);
+            leaf_size, leaf_size
+    > pass(16, std::numeric_limits<size_t>::max(), vec2_accessor(), 1.0);
     pass.run(entries, [&](gsl::span<const vec2> entries) {
         leaf l;
         l.mbb = get_bounding_box(entries.begin(), entries.end());
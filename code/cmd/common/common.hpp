@@ -2,10 +2,14 @@
 #define COMMON_COMMON_HPP
 
 #include "geodb/common.hpp"
+#include "geodb/filesystem.hpp"
+#include "geodb/irwi/label_forest.hpp"
 #include "geodb/irwi/string_map.hpp"
 #include "geodb/irwi/string_map_external.hpp"
+#include "geodb/irwi/time_forest.hpp"
 #include "geodb/irwi/tree.hpp"
 #include "geodb/irwi/tree_external.hpp"
+#include "geodb/utility/memory_budget.hpp"
 
 #include <tpie/tpie.h>
 #include <fmt/ostream.h>
@@ -13,7 +17,9 @@
 #include <json.hpp>
 
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
 
 using nlohmann::json;
 
@@ -41,6 +47,10 @@ using external_storage = geodb::tree_external<block_size, leaf_fanout_override,
 extern template class geodb::tree<external_storage, lambda>;
 using external_tree = geodb::tree<external_storage, lambda>;
 
+using external_forest = geodb::label_forest<external_storage, lambda>;
+
+using external_time_forest = geodb::time_forest<external_storage, lambda>;
+
 using external_string_map = geodb::string_map<geodb::string_map_external>;
 
 /// Initializes the tpie library, calls the function f and deinitializes tpie.
@@ -64,6 +74,8 @@ struct measure_t {
     u64 total_io = 0;       // reads + writes
     double duration = 0;    // Time taken (seconds)
     u64 block_size = 0;     // Block size in bytes.
+    u64 spills = 0;         // Containers moved to disk (see memory_budget)
+    u64 spilled_bytes = 0;  // Memory released by those containers
     u32 internal_fanout = external_tree::max_internal_entries();
     u32 leaf_fanout = external_tree::max_leaf_entries();
 };
@@ -75,6 +87,8 @@ inline void to_json(json& j, const measure_t& m) {
     j["total_io"] = m.total_io;
     j["duration"] = m.duration;
     j["block_size"] = m.block_size;
+    j["spills"] = m.spills;
+    j["spilled_bytes"] = m.spilled_bytes;
     j["internal_fanout"] = m.internal_fanout;
     j["leaf_fanout"] = m.leaf_fanout;
 }
@@ -89,6 +103,8 @@ measure_t measure_call(Func&& f) {
 
     u64 bytes_read = tpie::get_bytes_read();
     u64 bytes_written = tpie::get_bytes_written();
+    u64 spills = geodb::memory_budget::global().spills();
+    u64 spilled_bytes = geodb::memory_budget::global().spilled_bytes();
     auto start = steady_clock::now();
 
     f();
@@ -99,6 +115,8 @@ measure_t measure_call(Func&& f) {
     m.total_io = m.read_io + m.write_io;
     m.duration = duration_cast<double_seconds>(steady_clock::now() - start).count();
     m.block_size = block_size;
+    m.spills = geodb::memory_budget::global().spills() - spills;
+    m.spilled_bytes = geodb::memory_budget::global().spilled_bytes() - spilled_bytes;
     return m;
 }
 
@@ -113,4 +131,128 @@ inline void write_json(const std::string& file, const json& output) {
     f << output.dump(4) << std::endl;
 }
 
+/// The splitmix64 mixing function. Maps every 64 bit value
+/// to a well distributed 64 bit value (a bijection).
+/// Useful to derive independent seeds from a single seed.
+inline u64 splitmix64(u64 z) {
+    z += 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+/// Returns the path of the catalog of a forest stored in the given directory.
+/// The catalog lists the dominant labels; every tree of the forest
+/// lives in a subdirectory named after its partition.
+inline geodb::fs::path forest_catalog_path(const geodb::fs::path& directory) {
+    return directory / "forest.json";
+}
+
+/// Returns true iff the directory contains a label forest instead of a single tree.
+inline bool is_forest(const geodb::fs::path& directory) {
+    return geodb::fs::exists(forest_catalog_path(directory));
+}
+
+/// Writes the catalog of a forest with the given dominant labels.
+inline void write_forest_catalog(const geodb::fs::path& directory, const std::vector<geodb::label_type>& labels) {
+    json catalog = json::object();
+    catalog["dominant_labels"] = labels;
+    write_json(forest_catalog_path(directory).string(), catalog);
+}
+
+/// Reads the dominant labels from the catalog of a forest.
+inline std::vector<geodb::label_type> read_forest_catalog(const geodb::fs::path& directory) {
+    std::ifstream f(forest_catalog_path(directory).string());
+    if (!f) {
+        throw std::runtime_error("Failed to open the forest catalog");
+    }
+
+    json catalog;
+    f >> catalog;
+    return catalog.at("dominant_labels").get<std::vector<geodb::label_type>>();
+}
+
+/// Opens (or creates) the forest in the given directory.
+/// The dominant labels are taken from its catalog.
+inline std::unique_ptr<external_forest> open_forest(const geodb::fs::path& directory,
+                                                    boost::optional<double> weight = boost::none) {
+    auto storage = [&](const std::string& name) {
+        return external_storage(directory / name);
+    };
+    return std::make_unique<external_forest>(storage, read_forest_catalog(directory), weight);
+}
+
+/// Returns the path of the catalog of a time partitioned forest stored in the given directory.
+/// The catalog contains the slice length and a summary of every partition;
+/// every partition lives in a subdirectory named after its time slice.
+inline geodb::fs::path time_forest_catalog_path(const geodb::fs::path& directory) {
+    return directory / "time_forest.json";
+}
+
+/// Returns true iff the directory contains a time partitioned forest.
+inline bool is_time_forest(const geodb::fs::path& directory) {
+    return geodb::fs::exists(time_forest_catalog_path(directory));
+}
+
+/// Writes the catalog of the given forest.
+inline void write_time_forest_catalog(const geodb::fs::path& directory, const external_time_forest& forest) {
+    json partitions = json::array();
+    for (const geodb::time_partition& p : forest.catalog()) {
+        const geodb::vector3& min = p.mbb.min();
+        const geodb::vector3& max = p.mbb.max();
+
+        json labels = json::array();
+        for (const auto& pair : p.labels) {
+            labels.push_back({pair.first, pair.second});
+        }
+
+        json partition = json::object();
+        partition["slice"] = p.slice;
+        partition["size"] = p.size;
+        partition["mbb"] = {min.x(), min.y(), min.t(), max.x(), max.y(), max.t()};
+        partition["labels"] = labels;
+        partitions.push_back(partition);
+    }
+
+    json catalog = json::object();
+    catalog["slice_length"] = forest.slice_length();
+    catalog["partitions"] = partitions;
+    write_json(time_forest_catalog_path(directory).string(), catalog);
+}
+
+/// Opens the time partitioned forest in the given directory.
+/// The slice length and the partitions are taken from its catalog.
+inline std::unique_ptr<external_time_forest> open_time_forest(const geodb::fs::path& directory,
+                                                              boost::optional<double> weight = boost::none) {
+    std::ifstream f(time_forest_catalog_path(directory).string());
+    if (!f) {
+        throw std::runtime_error("Failed to open the time forest catalog");
+    }
+
+    json catalog;
+    f >> catalog;
+
+    std::vector<geodb::time_partition> partitions;
+    for (const json& partition : catalog.at("partitions")) {
+        const json& mbb = partition.at("mbb");
+
+        geodb::time_partition p;
+        p.slice = partition.at("slice");
+        p.size = partition.at("size");
+        p.mbb = geodb::bounding_box(
+                    geodb::vector3(mbb.at(0).get<float>(), mbb.at(1).get<float>(), mbb.at(2).get<geodb::time_type>()),
+                    geodb::vector3(mbb.at(3).get<float>(), mbb.at(4).get<float>(), mbb.at(5).get<geodb::time_type>()));
+        for (const json& label : partition.at("labels")) {
+            p.labels[label.at(0)] = label.at(1);
+        }
+        partitions.push_back(std::move(p));
+    }
+
+    auto storage = [directory](const std::string& name) {
+        return external_storage(directory / name);
+    };
+    return std::make_unique<external_time_forest>(
+                storage, catalog.at("slice_length").get<geodb::time_type>(), std::move(partitions), weight);
+}
+
 #endif // COMMON_COMMON_HPP
@@ -2,6 +2,7 @@
 
 #include "geodb/vector.hpp"
 #include "geodb/irwi/base.hpp"
+#include "geodb/utility/parallel.hpp"
 
 #include <boost/program_options.hpp>
 #include <fmt/format.h>
@@ -10,6 +11,7 @@
 
 #include <iostream>
 #include <random>
+#include <vector>
 
 namespace po = boost::program_options;
 
@@ -25,6 +27,8 @@ static u32 labels = 0;
 static u32 seed = 0;
 static double highx = 1000;
 static double highy = 1000;
+static bool parallel = false;
+static size_t threads = 1;
 
 static void parse_options(int argc, char** argv) {
     po::options_description options("Options");
@@ -43,7 +47,14 @@ static void parse_options(int argc, char** argv) {
             (",x", po::value(&highx)->value_name("MAX"),
              "Maximum x value for start points.")
             (",y", po::value(&highy)->value_name("MAX"),
-             "Maximum y value for start points.");
+             "Maximum y value for start points.")
+            ("parallel", po::bool_switch(&parallel),
+             "Generate trajectories on multiple threads. Every trajectory uses its own random "
+             "number generator (derived from the seed and the trajectory id). "
+             "The output depends only on the seed, not on the number of threads, but it "
+             "differs from the output of the default (single generator) mode.")
+            ("threads", po::value(&threads)->value_name("N")->default_value(hardware_threads()),
+             "Number of threads used by --parallel.");
 
     po::variables_map vm;
     try {
@@ -69,6 +80,11 @@ static void parse_options(int argc, char** argv) {
         }
 
         po::notify(vm);
+
+        if (threads == 0) {
+            fmt::print(cerr, "Invalid number of threads: {}.\n", threads);
+            throw exit_main(1);
+        }
     } catch (const po::error& e) {
         fmt::print(cerr, "Failed to parse arguments: {}.\n", e.what());
         throw exit_main(1);
@@ -76,60 +92,136 @@ static void parse_options(int argc, char** argv) {
 }
 
 using dist_t = std::uniform_real_distribution<double>;
+using rng_t = std::mt19937_64;
 
-static std::mt19937_64 rng{};
+static rng_t rng{};
 
 /// Returns a value in [0, 1).
-static double get_random() {
+static double get_random(rng_t& rng) {
     return dist_t{0, 1}(rng);
 }
 
 /// Returns a value in [low, high).
-static double get_random(double low, double high) {
+static double get_random(rng_t& rng, double low, double high) {
     geodb_assert(high >= low, "invalid bounds");
     return dist_t{low, high}(rng);
 }
 
 /// Returns the start point for a new random walk.
-static vector3 point() {
-    return vector3(get_random() * highx, get_random() * highy, get_random() * 100000);
+static vector3 point(rng_t& rng) {
+    return vector3(get_random(rng) * highx, get_random(rng) * highy, get_random(rng) * 100000);
 }
 
 /// Returns the next point in the random walk.
-static vector3 point(const vector3& last) {
-    return vector3(last.x() + get_random(-5, 5),
-                   last.y() + get_random(-5, 5),
-                   last.t() + get_random(5, 25)); // Always advance in time.
+static vector3 point(rng_t& rng, const vector3& last) {
+    return vector3(last.x() + get_random(rng, -5, 5),
+                   last.y() + get_random(rng, -5, 5),
+                   last.t() + get_random(rng, 5, 25)); // Always advance in time.
 }
 
 /// Returns a random label.
-static label_type label() {
-    return get_random() * labels;
+static label_type label(rng_t& rng) {
+    return get_random(rng) * labels;
 }
 
 /// Returns the next label in the random walk.
 /// Changes to another random label with a probability of 20%.
-static label_type label(label_type last) {
-    if (get_random() < 0.2) {
-        return label();
+static label_type label(rng_t& rng, label_type last) {
+    if (get_random(rng) < 0.2) {
+        return label(rng);
     }
     return last;
 }
 
+/// Returns the size of the next trajectory, at most `remaining`.
+static u32 walk_size(rng_t& rng, u64 remaining) {
+    u32 size = get_random(rng, trajectory_size * 0.5, trajectory_size * 1.5);
+    if (size > remaining) {
+        size = remaining;
+    }
+    return size;
+}
+
 /// Generates a single trajectory as a random walk with `size` trajectory units.
-static void generate_walk(u64 id, u32 size, tpie::file_stream<tree_entry>& out) {
+/// Every unit is passed to `out`.
+template<typename Output>
+static void generate_walk(rng_t& rng, u64 id, u32 size, Output&& out) {
     if (size == 0)
         return;
 
-    vector3 p = point();
-    label_type l = label();
+    vector3 p = point(rng);
+    label_type l = label(rng);
     for (u32 index = 0; index < size; ++index) {
-        vector3 q = point(p);
-        tree_entry entry(id, index, trajectory_unit(p, q, l));
-        out.write(entry);
+        vector3 q = point(rng, p);
+        out(tree_entry(id, index, trajectory_unit(p, q, l)));
 
         p = q;
-        l = label(l);
+        l = label(rng, l);
+    }
+}
+
+/// Returns the seed for the random number generator of the given trajectory.
+static u64 trajectory_seed(trajectory_id_type id) {
+    return splitmix64(splitmix64(seed) + id);
+}
+
+/// Uses a single random number generator for all trajectories.
+static void generate_sequential(tpie::file_stream<tree_entry>& out) {
+    u64 remaining = trajectory_units;
+    trajectory_id_type id = 1;
+    while (remaining > 0) {
+        u32 size = walk_size(rng, remaining);
+
+        generate_walk(rng, id++, size, [&](const tree_entry& entry) {
+            out.write(entry);
+        });
+
+        remaining -= size;
+    }
+}
+
+/// Generates trajectories in chunks. The sizes of the trajectories
+/// are taken from the main random number generator (in order). Every trajectory
+/// in a chunk is then generated on one of the worker threads,
+/// using its own generator seeded by `trajectory_seed`.
+/// Chunks are written to the output file in order.
+static void generate_parallel(tpie::file_stream<tree_entry>& out) {
+    struct walk {
+        trajectory_id_type id;
+        u32 size;
+        u64 offset; // Position in the chunk.
+    };
+
+    const u64 chunk_units = u64(threads) << 18;
+
+    std::vector<walk> walks;
+    std::vector<tree_entry> chunk;
+
+    u64 remaining = trajectory_units;
+    trajectory_id_type id = 1;
+    while (remaining > 0) {
+        walks.clear();
+
+        u64 units = 0;
+        while (remaining > 0 && units < chunk_units) {
+            u32 size = walk_size(rng, remaining);
+            walks.push_back(walk{id++, size, units});
+
+            units += size;
+            remaining -= size;
+        }
+
+        chunk.resize(units);
+        parallel_for(walks.size(), threads, [&](size_t i) {
+            const walk& w = walks[i];
+
+            rng_t walk_rng(trajectory_seed(w.id));
+            tree_entry* pos = chunk.data() + w.offset;
+            generate_walk(walk_rng, w.id, w.size, [&](const tree_entry& entry) {
+                *pos++ = entry;
+            });
+        });
+        out.write(chunk.begin(), chunk.end());
     }
 }
 
@@ -142,22 +234,11 @@ int main(int argc, char** argv) {
         out.open(output);
         out.truncate(0);
 
-        u64 remaining = trajectory_units;
-        trajectory_id_type id = 1;
-        while (remaining > 0) {
-            u32 size = get_random(trajectory_size * 0.5, trajectory_size * 1.5);
-            if (size > remaining) {
-                size = remaining;
-            }
-
-            generate_walk(id++, size, out);
-
-            remaining -= size;
+        if (parallel) {
+            generate_parallel(out);
+        } else {
+            generate_sequential(out);
         }
-
         return 0;
     });
 }
-
-
-
@@ -4,13 +4,17 @@
 #include "geodb/irwi/string_map_internal.hpp"
 #include "geodb/irwi/tree.hpp"
 #include "geodb/irwi/tree_internal.hpp"
+#include "geodb/utility/parallel.hpp"
 
 #include <boost/program_options.hpp>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
+#include <array>
 #include <iostream>
 #include <random>
+#include <stdexcept>
+#include <vector>
 
 using std::cout;
 using std::cerr;
@@ -20,6 +24,10 @@ namespace po = boost::program_options;
 
 static std::string input_path;
 static std::string output_path;
+static std::string mode;
+static u64 seed;
+static u32 bits;
+static size_t threads;
 
 static void parse_options(int argc, char** argv) {
     po::options_description options("Options");
@@ -28,7 +36,19 @@ static void parse_options(int argc, char** argv) {
             ("input", po::value(&input_path)->value_name("PATH")->required(),
              "The input file.")
             ("output", po::value(&output_path)->value_name("PATH")->required(),
-             "The output file.");
+             "The output file.")
+            ("mode", po::value(&mode)->value_name("MODE")->default_value("table"),
+             "How ids are remapped. Possible choices are:\n"
+             "  table   \tDraw a random id for every trajectory and remember it in a table "
+             "(memory is linear in the number of trajectories).\n"
+             "  feistel \tApply a keyed pseudo random permutation of [0, 2^BITS) to every id "
+             "(constant memory, entries are processed in parallel). Input ids must be smaller than 2^BITS.\n")
+            ("seed", po::value(&seed)->value_name("S"),
+             "The key of the permutation (feistel mode). Defaults to a truly random value.")
+            ("bits", po::value(&bits)->value_name("BITS")->default_value(31),
+             "Size of the id space in bits (feistel mode, 1 to 32).")
+            ("threads", po::value(&threads)->value_name("N")->default_value(hardware_threads()),
+             "Number of threads (feistel mode).");
 
     po::variables_map vm;
     try {
@@ -46,7 +66,24 @@ static void parse_options(int argc, char** argv) {
             throw exit_main(0);
         }
 
+        if (!vm.count("seed")) {
+            seed = std::random_device{}();
+        }
+
         po::notify(vm);
+
+        if (mode != "table" && mode != "feistel") {
+            fmt::print(cerr, "Invalid mode: {}.\n", mode);
+            throw exit_main(1);
+        }
+        if (bits < 1 || bits > 32) {
+            fmt::print(cerr, "Invalid number of bits: {}.\n", bits);
+            throw exit_main(1);
+        }
+        if (threads == 0) {
+            fmt::print(cerr, "Invalid number of threads: {}.\n", threads);
+            throw exit_main(1);
+        }
     } catch (const po::error& e) {
         fmt::print(cerr, "Failed to parse arguments: {}.\n", e.what());
         throw exit_main(1);
@@ -84,12 +121,107 @@ private:
     std::uniform_int_distribution<trajectory_id_type> m_dist;
 };
 
+/// A keyed pseudo random permutation of the integers in [0, 2^bits).
+/// Implemented as a balanced feistel network over an even number of bits.
+/// If `bits` is odd, values outside the domain are encrypted again until
+/// they fall into the domain ("cycle walking"), which preserves the bijection.
+/// Does not require any memory apart from the round keys and can be used
+/// concurrently.
+class feistel_permutation {
+public:
+    /// \pre `1 <= bits <= 32`.
+    feistel_permutation(u32 bits, u64 key)
+        : m_size(u64(1) << bits)
+        , m_half_bits((bits + 1) / 2)
+        , m_half_mask((u64(1) << m_half_bits) - 1)
+    {
+        geodb_assert(bits >= 1 && bits <= 32, "invalid number of bits");
+        for (u64& k : m_keys) {
+            key = splitmix64(key);
+            k = key;
+        }
+    }
+
+    /// Returns the image of `value`.
+    ///
+    /// \pre `value < size()`.
+    u32 operator()(u32 value) const {
+        geodb_assert(value < m_size, "value out of range");
+
+        u64 result = value;
+        do {
+            result = encrypt(result);
+        } while (result >= m_size);
+        return result;
+    }
+
+    /// The number of elements in the domain.
+    u64 size() const { return m_size; }
+
+private:
+    u64 encrypt(u64 value) const {
+        u64 left = value >> m_half_bits;
+        u64 right = value & m_half_mask;
+        for (u64 key : m_keys) {
+            const u64 next = left ^ (splitmix64(right ^ key) & m_half_mask);
+            left = right;
+            right = next;
+        }
+        return (left << m_half_bits) | right;
+    }
+
+private:
+    u64 m_size;
+    u32 m_half_bits;
+    u64 m_half_mask;
+    std::array<u64, 6> m_keys;
+};
+
+/// Remaps the ids with an `id_mapper` (sequentially).
+static void shuffle_table(tpie::file_stream<tree_entry>& input, tpie::file_stream<tree_entry>& output) {
+    id_mapper map_id;
+    while (input.can_read()) {
+        tree_entry entry = input.read();
+        map_id(entry);
+        output.write(entry);
+    }
+}
+
+/// Remaps the ids with a `feistel_permutation`.
+/// The input is processed in chunks, the entries of a chunk are mapped in parallel.
+static void shuffle_feistel(tpie::file_stream<tree_entry>& input, tpie::file_stream<tree_entry>& output) {
+    const feistel_permutation permutation(bits, seed);
+
+    static constexpr size_t chunk_size = size_t(1) << 20;
+    static constexpr size_t block_entries = size_t(1) << 14;
+
+    std::vector<tree_entry> chunk;
+    while (input.can_read()) {
+        chunk.resize(std::min<u64>(chunk_size, input.size() - input.offset()));
+        input.read(chunk.begin(), chunk.end());
+
+        const size_t blocks = (chunk.size() + block_entries - 1) / block_entries;
+        parallel_for(blocks, threads, [&](size_t block) {
+            const size_t begin = block * block_entries;
+            const size_t end = std::min(chunk.size(), begin + block_entries);
+            for (size_t i = begin; i < end; ++i) {
+                tree_entry& entry = chunk[i];
+                if (entry.trajectory_id >= permutation.size()) {
+                    throw std::runtime_error(fmt::format(
+                        "Trajectory id {} is out of range for {} bits", entry.trajectory_id, bits));
+                }
+                entry.trajectory_id = permutation(entry.trajectory_id);
+            }
+        });
+
+        output.write(chunk.begin(), chunk.end());
+    }
+}
+
 int main(int argc, char *argv[]) {
     return tpie_main([&]() {
         parse_options(argc, argv);
 
-        id_mapper map_id;
-
         tpie::file_stream<tree_entry> input;
         input.open(input_path, tpie::open::read_only);
 
@@ -97,12 +229,11 @@ int main(int argc, char *argv[]) {
         output.open(output_path);
         output.truncate(0);
 
-        while (input.can_read()) {
-            tree_entry entry = input.read();
-            map_id(entry);
-            output.write(entry);
+        if (mode == "feistel") {
+            shuffle_feistel(input, output);
+        } else {
+            shuffle_table(input, output);
         }
-
         return 0;
     });
 }
@@ -7,6 +7,10 @@
 #include "geodb/irwi/tree.hpp"
 #include "geodb/irwi/tree_external.hpp"
 
+#include "geodb/utility/external_sort.hpp"
+#include "geodb/utility/parallel.hpp"
+#include "geodb/utility/temp_dir.hpp"
+
 #include <boost/program_options.hpp>
 #include <boost/optional.hpp>
 #include <fmt/ostream.h>
@@ -16,9 +20,13 @@
 #include <tpie/serialization_stream.h>
 #include <tpie/stats.h>
 
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 using namespace std;
@@ -32,18 +40,48 @@ static string entries_path;
 static string tree_path;
 static size_t memory;
 static float beta;
+static bool beta_given = false;
+static string split;
+static double reinsert;
+static double label_weight;
+static size_t threads;
+static string tune_path;
+static u64 tune_sample;
+static std::vector<double> tune_betas;
+static std::vector<string> tune_strategies;
 static string stats_file;
 static boost::optional<u64> limit;
 static boost::optional<u64> offset;
+static boost::optional<double> dominant_share;
+static boost::optional<time_type> time_slice;
 static std::string tmp;
+static bool write_behind = false;
+static block_writer_options output_options;
 
 void parse_options(int argc, char** argv);
 
+// Returns the beta from the command line, if it has been specified explicitly.
+static boost::optional<double> given_beta() {
+    return beta_given ? boost::optional<double>(beta) : boost::none;
+}
+
 void create_entries(const string& path, u64 max_entries,
                     tpie::file_stream<tree_entry>& entries);
 
+void read_entries(tpie::file_stream<tree_entry>& entries);
+
+int load_forest(const algorithm_type& loader);
+
+int load_time_forest(const algorithm_type& loader);
+
 algorithm_type get_algorithm();
 
+void configure_tree(external_tree& tree);
+
+tree_params tune(const algorithm_type& loader, tpie::file_stream<tree_entry>& entries, json& report);
+
+const char* strategy_name(beta_strategy s);
+
 int main(int argc, char** argv) {
     return tpie_main([&]{
         parse_options(argc, argv);
@@ -56,42 +94,45 @@ int main(int argc, char** argv) {
             tpie::tempname::set_default_path(tmp);
         }
 
-        fmt::print(cout, "Opening tree at \"{}\" with beta {}.\n", tree_path, beta);
+        if (time_slice || is_time_forest(tree_path)) {
+            return load_time_forest(get_algorithm());
+        }
+        if (dominant_share || is_forest(tree_path)) {
+            return load_forest(get_algorithm());
+        }
+
+        fmt::print(cout, "Opening tree at \"{}\".\n", tree_path);
 
-        external_tree tree{external_storage(tree_path), beta};
+        // Existing trees use their recorded beta unless it has been specified explicitly.
+        external_tree tree{external_storage(tree_path), given_beta()};
+        configure_tree(tree);
+        fmt::print(cout, "Using split algorithm \"{}\".\n", split);
+        if (reinsert > 0) {
+            fmt::print(cout, "Reinserting {}% of the entries of overflowing nodes.\n", reinsert * 100);
+        }
         fmt::print(cout, "Inserting items into a tree of size {}.\n", tree.size());
 
         auto loader = get_algorithm();
 
         tpie::file_stream<tree_entry> entries;
-        {
-            fmt::print(cout, "Using entry file \"{}\".\n", entries_path);
-            if (offset) {
-                fmt::print("Starting at offset {}.\n", *offset);
-            }
-            if (limit) {
-                fmt::print("Limiting to {} entries.\n", *limit);
+        read_entries(entries);
+
+        json tuning;
+        if (!tune_path.empty()) {
+            if (!tree.empty()) {
+                fmt::print(cerr, "Tuning requires a new (empty) tree.\n");
+                throw exit_main(1);
             }
-            u64 max_entries = limit.get_value_or(std::numeric_limits<u64>::max());
-
-            // Make a private copy of the file (some options are destructive, i.e. STR sorting
-            // alters the order of elements).
-            tpie::file_stream<tree_entry> existing;
-            existing.open(entries_path, tpie::open::read_only);
-            if (offset) {
-                if (existing.size() < *offset) {
-                    fmt::print(cerr, "Offset {} is out of range.\n", *offset);
-                    throw exit_main(1);
-                }
-                existing.seek(*offset);
+            if (algorithm != "obo" && algorithm != "quickload") {
+                fmt::print(cerr, "Tuning requires an algorithm that uses beta (obo or quickload).\n");
+                throw exit_main(1);
             }
 
-            entries.open();
-            entries.truncate(0);
-            while (entries.size() < max_entries && existing.can_read()) {
-                entries.write(existing.read());
-            }
+            const tree_params best = tune(loader, entries, tuning);
+            tree.weight(best.weight);
+            tree.strategy(best.strategy);
         }
+        fmt::print(cout, "Using beta {} with strategy \"{}\".\n", tree.weight(), strategy_name(tree.strategy()));
 
         const measure_t stats = measure_call([&]{
             fmt::print(cout, "Running algorithm \"{}\".\n", algorithm);
@@ -103,16 +144,252 @@ int main(int argc, char** argv) {
                    "Blocks read: {}\n"
                    "Blocks written: {}\n"
                    "Blocks total: {}\n"
-                   "Seconds: {}\n",
-                   stats.read_io, stats.write_io, stats.total_io, stats.duration);
+                   "Seconds: {}\n"
+                   "Spilled containers: {} ({} MB)\n",
+                   stats.read_io, stats.write_io, stats.total_io, stats.duration,
+                   stats.spills, stats.spilled_bytes / (1024 * 1024));
 
         if (!stats_file.empty()) {
-            write_json(stats_file, stats);
+            json output = stats;
+            output["beta"] = tree.weight();
+            output["strategy"] = strategy_name(tree.strategy());
+            if (!tune_path.empty()) {
+                output["tuning"] = tuning;
+            }
+            write_json(stats_file, output);
         }
         return 0;
     });
 }
 
+void read_entries(tpie::file_stream<tree_entry>& entries) {
+    fmt::print(cout, "Using entry file \"{}\".\n", entries_path);
+    if (offset) {
+        fmt::print("Starting at offset {}.\n", *offset);
+    }
+    if (limit) {
+        fmt::print("Limiting to {} entries.\n", *limit);
+    }
+    u64 max_entries = limit.get_value_or(std::numeric_limits<u64>::max());
+
+    // Make a private copy of the file (some options are destructive, i.e. STR sorting
+    // alters the order of elements).
+    tpie::file_stream<tree_entry> existing;
+    existing.open(entries_path, tpie::open::read_only);
+    if (offset) {
+        if (existing.size() < *offset) {
+            fmt::print(cerr, "Offset {} is out of range.\n", *offset);
+            throw exit_main(1);
+        }
+        existing.seek(*offset);
+    }
+
+    entries.open();
+    entries.truncate(0);
+    while (entries.size() < max_entries && existing.can_read()) {
+        entries.write(existing.read());
+    }
+}
+
+// Loads the entries into a label forest. Every tree of the forest is loaded
+// with the chosen algorithm, using only the entries of its partition.
+int load_forest(const algorithm_type& loader) {
+    if (!tune_path.empty()) {
+        fmt::print(cerr, "Tuning is not supported for label forests.\n");
+        throw exit_main(1);
+    }
+    if (dominant_share && !(*dominant_share > 0 && *dominant_share <= 1)) {
+        fmt::print(cerr, "Invalid dominant label share: {}.\n", *dominant_share);
+        throw exit_main(1);
+    }
+
+    tpie::file_stream<tree_entry> entries;
+    read_entries(entries);
+
+    if (!is_forest(tree_path)) {
+        if (fs::exists(tree_path) && !fs::is_empty(tree_path)) {
+            fmt::print(cerr, "Directory {} contains a tree, cannot create a forest there.\n", tree_path);
+            throw exit_main(1);
+        }
+
+        std::map<label_type, u64> counts;
+        entries.seek(0);
+        while (entries.can_read()) {
+            ++counts[entries.read().unit.label];
+        }
+
+        ensure_directory(tree_path);
+        write_forest_catalog(tree_path, dominant_labels(counts, *dominant_share));
+    } else if (dominant_share) {
+        fmt::print(cout, "Using the dominant labels of the existing forest.\n");
+    }
+
+    fmt::print(cout, "Opening forest at \"{}\".\n", tree_path);
+    std::unique_ptr<external_forest> forest = open_forest(tree_path, given_beta());
+    const std::vector<label_type> labels = forest->labels();
+    fmt::print(cout, "Dominant labels:");
+    for (label_type label : labels) {
+        fmt::print(cout, " {}", label);
+    }
+    fmt::print(cout, " ({} trees in total).\n", labels.size() + 1);
+
+    std::vector<external_tree*> trees;
+    for (label_type label : labels) {
+        trees.push_back(&forest->partition(label));
+    }
+    trees.push_back(&forest->tail());
+    for (external_tree* tree : trees) {
+        configure_tree(*tree);
+    }
+    fmt::print(cout, "Inserting items into a forest of size {}.\n", forest->size());
+
+    // Distribute the entries to the partitions, in their original order.
+    std::vector<std::unique_ptr<tpie::file_stream<tree_entry>>> partitions;
+    std::map<external_tree*, size_t> partition_index;
+    for (external_tree* tree : trees) {
+        partition_index[tree] = partitions.size();
+        partitions.push_back(std::make_unique<tpie::file_stream<tree_entry>>());
+        partitions.back()->open();
+        partitions.back()->truncate(0);
+    }
+    entries.seek(0);
+    while (entries.can_read()) {
+        const tree_entry e = entries.read();
+        partitions[partition_index[&forest->route(e.unit.label)]]->write(e);
+    }
+    entries.close();
+
+    const measure_t stats = measure_call([&]{
+        fmt::print(cout, "Running algorithm \"{}\".\n", algorithm);
+        for (external_tree* tree : trees) {
+            tpie::file_stream<tree_entry>& stream = *partitions[partition_index[tree]];
+            if (stream.size() > 0) {
+                stream.seek(0);
+                loader(*tree, stream);
+            }
+        }
+        fmt::print(cout, "Done.\n");
+    });
+
+    fmt::print("\n"
+               "Blocks read: {}\n"
+               "Blocks written: {}\n"
+               "Blocks total: {}\n"
+               "Seconds: {}\n"
+               "Spilled containers: {} ({} MB)\n",
+               stats.read_io, stats.write_io, stats.total_io, stats.duration,
+               stats.spills, stats.spilled_bytes / (1024 * 1024));
+
+    if (!stats_file.empty()) {
+        json output = stats;
+        output["beta"] = forest->tail().weight();
+        output["strategy"] = strategy_name(forest->tail().strategy());
+        output["dominant_labels"] = labels;
+        write_json(stats_file, output);
+    }
+    return 0;
+}
+
+// Loads the entries into a time partitioned forest. Entries are sorted by
+// their time slice, then every affected partition is loaded with the chosen
+// algorithm, using only the entries of its slice.
+int load_time_forest(const algorithm_type& loader) {
+    if (!tune_path.empty()) {
+        fmt::print(cerr, "Tuning is not supported for time partitioned forests.\n");
+        throw exit_main(1);
+    }
+
+    std::unique_ptr<external_time_forest> forest;
+    if (is_time_forest(tree_path)) {
+        fmt::print(cout, "Opening time partitioned forest at \"{}\".\n", tree_path);
+        forest = open_time_forest(tree_path, given_beta());
+        if (time_slice && *time_slice != forest->slice_length()) {
+            fmt::print(cerr, "The forest uses a slice length of {}.\n", forest->slice_length());
+            throw exit_main(1);
+        }
+    } else {
+        if (*time_slice == 0) {
+            fmt::print(cerr, "Invalid time slice: {}.\n", *time_slice);
+            throw exit_main(1);
+        }
+        if (fs::exists(tree_path) && !fs::is_empty(tree_path)) {
+            fmt::print(cerr, "Directory {} is not empty, cannot create a forest there.\n", tree_path);
+            throw exit_main(1);
+        }
+
+        fmt::print(cout, "Creating time partitioned forest at \"{}\".\n", tree_path);
+        ensure_directory(tree_path);
+        auto storage = [](const std::string& name) {
+            return external_storage(fs::path(tree_path) / name);
+        };
+        forest = std::make_unique<external_time_forest>(storage, *time_slice, std::vector<time_partition>(), given_beta());
+    }
+    fmt::print(cout, "Inserting items into a forest of size {} with {} partitions.\n",
+               forest->size(), forest->catalog().size());
+
+    tpie::file_stream<tree_entry> entries;
+    read_entries(entries);
+
+    const external_time_forest& f = *forest;
+    auto slice_of = [&](const tree_entry& e) {
+        return f.slice_of(e.unit.get_bounding_box().min().t());
+    };
+
+    size_t partitions = 0;
+    const measure_t stats = measure_call([&]{
+        fmt::print(cout, "Sorting entries by time slice.\n");
+        if (entries.size() > 0) {
+            external_sort(entries, [&](const tree_entry& a, const tree_entry& b) {
+                return std::make_tuple(slice_of(a), a.trajectory_id, a.unit_index)
+                        < std::make_tuple(slice_of(b), b.trajectory_id, b.unit_index);
+            });
+        }
+
+        fmt::print(cout, "Running algorithm \"{}\".\n", algorithm);
+        tpie::file_stream<tree_entry> partition;
+        partition.open();
+
+        entries.seek(0);
+        while (entries.can_read()) {
+            const u64 slice = slice_of(entries.peek());
+
+            partition.truncate(0);
+            while (entries.can_read() && slice_of(entries.peek()) == slice) {
+                partition.write(entries.read());
+            }
+            partition.seek(0);
+
+            external_tree& tree = forest->partition(slice);
+            configure_tree(tree);
+            fmt::print(cout, "Loading {} entries into partition {}.\n", partition.size(), slice);
+            loader(tree, partition);
+            forest->refresh(slice);
+            ++partitions;
+        }
+        write_time_forest_catalog(tree_path, *forest);
+        fmt::print(cout, "Done.\n");
+    });
+
+    fmt::print("\n"
+               "Partitions modified: {}\n"
+               "Blocks read: {}\n"
+               "Blocks written: {}\n"
+               "Blocks total: {}\n"
+               "Seconds: {}\n"
+               "Spilled containers: {} ({} MB)\n",
+               partitions, stats.read_io, stats.write_io, stats.total_io, stats.duration,
+               stats.spills, stats.spilled_bytes / (1024 * 1024));
+
+    if (!stats_file.empty()) {
+        json output = stats;
+        output["beta"] = beta;
+        output["slice_length"] = forest->slice_length();
+        output["partitions"] = partitions;
+        write_json(stats_file, output);
+    }
+    return 0;
+}
+
 void parse_options(int argc, char** argv) {
     po::options_description options("Options");
     options.add_options()
@@ -122,6 +399,7 @@ void parse_options(int argc, char** argv) {
              "Possible algorithm choices are:\n"
              "  obo        \tOne by one insertion (constant resource usage, very slow).\n"
              "  hilbert    \tSort entries by hilbert values and pack them into leaf nodes.\n"
+             "  hilbert-lf \tLike hilbert, but use the frequency rank of the label as a fourth curve dimension.\n"
              "  str-plain  \tTile entries using the Sort-Tile-Recursive algorithm and pack them into leaf nodes.\n"
              "  str-lf     \tTile like in str-plain, but sort by label as the first dimension.\n"
              "  str-ll     \tTile like in str-plain, but sort by label as the last dimension.\n"
@@ -132,6 +410,32 @@ void parse_options(int argc, char** argv) {
              "Path to irwi tree directory. Will be created if it doesn't exist.")
             ("beta", po::value(&beta)->value_name("BETA")->default_value(0.5f),
              "Weight factor between 0 and 1 for spatial and textual cost (1.0 is a normal rtree).")
+            ("split", po::value(&split)->value_name("SPLIT")->default_value("quadratic"),
+             "The algorithm used to split overflowing nodes (obo and quickload).\n"
+             "Possible choices are:\n"
+             "  quadratic  \tThe quadratic split algorithm (O(n^2) per split).\n"
+             "  rstar      \tThe sort-based R*-Tree split (O(n log n) per split).\n")
+            ("tune", po::value(&tune_path)->value_name("PATH"),
+             "Choose beta and the beta strategy automatically (obo and quickload, new trees only).\n"
+             "Small trees are built from a sample of the entries for every combination of the "
+             "candidate values and the query workload in the given file is run against each of them. "
+             "The full tree is then built with the combination that required the fewest IOs. "
+             "The workload is a json array of queries, for example "
+             "[{\"queries\": [{\"rect\": [xmin, xmax, ymin, ymax, tmin, tmax], \"labels\": [1, 2]}], "
+             "\"gaps\": [[min, max], ...]}] (gaps are optional).")
+            ("tune-sample", po::value(&tune_sample)->value_name("N")->default_value(100000),
+             "Number of entries used for the trees built during tuning.")
+            ("tune-beta", po::value(&tune_betas)->value_name("BETA")->multitoken(),
+             "Candidate values for beta (default: 0.1 0.3 0.5 0.7 0.9 1.0).")
+            ("tune-strategy", po::value(&tune_strategies)->value_name("STRATEGY")->multitoken(),
+             "Candidate beta strategies (normal, increasing, decreasing). Default: all of them.")
+            ("reinsert", po::value(&reinsert)->value_name("P")->default_value(0),
+             "Fraction in [0, 1) of the entries of an overflowing node that are reinserted "
+             "before the node is split (R*-Tree forced reinsertion, e.g. 0.3). 0 disables forced reinsertion.")
+            ("label-weight", po::value(&label_weight)->value_name("W")->default_value(1.0),
+             "Influence in [0, 1] of the label dimension for hilbert-lf (0 makes the label irrelevant).")
+            ("threads", po::value(&threads)->value_name("N")->default_value(hardware_threads()),
+             "Number of threads used to build the internal nodes of bulk loaded trees.")
             ("max-memory", po::value(&memory)->value_name("MB")->default_value(32),
              "Memory limit in megabytes. Don't make this value too small because TPIE seems to allocate a few megabytes (~4) for itself.")
             ("stats", po::value(&stats_file)->value_name("FILE"),
@@ -140,8 +444,24 @@ void parse_options(int argc, char** argv) {
              "Start at the index I instead of the beginning of the file.")
             ("limit", po::value<u64>()->value_name("N"),
              "Only insert the first N entries.")
+            ("dominant-labels", po::value<double>()->value_name("SHARE"),
+             "Build a label forest instead of a single tree: every label with at least the given share "
+             "of all entries (in (0, 1], e.g. 0.05) is stored in its own tree, the remaining labels "
+             "are stored in a common tree. Entries inserted into an existing forest are always routed "
+             "according to its catalog.")
+            ("time-slice", po::value<time_type>()->value_name("T"),
+             "Build a time partitioned forest instead of a single tree: every time slice of length T "
+             "is stored in its own tree (entries belong to the slice of their start time). "
+             "Entries inserted into an existing forest only modify the partitions of their slices.")
             ("tmp", po::value(&tmp)->value_name("PATH"),
-             "Override the default temp directory.");
+             "Override the default temp directory.")
+            ("write-behind", po::bool_switch(&write_behind),
+             "Write the blocks of bulk loaded trees asynchronously in a background thread "
+             "(all algorithms except obo).")
+            ("direct-io", po::bool_switch(&output_options.direct_io),
+             "Bypass the page cache when writing bulk loaded trees (O_DIRECT). Implies --write-behind.")
+            ("drop-cache", po::bool_switch(&output_options.drop_cache),
+             "Drop the written blocks of bulk loaded trees from the page cache. Implies --write-behind.");
 
     po::variables_map vm;
     try {
@@ -166,44 +486,106 @@ void parse_options(int argc, char** argv) {
         if (vm.count("limit")) {
             limit = vm["limit"].as<u64>();
         }
+        if (vm.count("dominant-labels")) {
+            dominant_share = vm["dominant-labels"].as<double>();
+        }
+        if (vm.count("time-slice")) {
+            time_slice = vm["time-slice"].as<time_type>();
+        }
+        if (dominant_share && time_slice) {
+            fmt::print(cerr, "Label forests and time partitioned forests cannot be combined.\n");
+            throw exit_main(1);
+        }
+        beta_given = vm.count("beta") && !vm["beta"].defaulted();
 
         po::notify(vm);
+
+        write_behind = write_behind || output_options.direct_io || output_options.drop_cache;
     } catch (const po::error& e) {
         fmt::print(cerr, "Failed to parse arguments: {}.\n", e.what());
         throw exit_main(1);
     }
 }
 
+// Runs a bulk loading algorithm. Node and postings blocks are written
+// asynchronously if requested on the command line.
+template<typename Load>
+algorithm_type bulk_algorithm(Load&& load) {
+    return [load](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        if (write_behind) {
+            tree.write_behind(output_options);
+        }
+
+        // Pending writes are completed even if the load fails,
+        // so that errors of the background writer are reported.
+        bool done = false;
+        auto finish = gsl::finally([&]{
+            if (done) {
+                return;
+            }
+            try {
+                tree.write_through();
+            } catch (const std::exception& e) {
+                fmt::print(cerr, "Failed to write the tree: {}.\n", e.what());
+            }
+        });
+        load(tree, input);
+        tree.write_through();
+        done = true;
+    };
+}
+
 algorithm_type get_algorithm() {
+    if (threads == 0) {
+        fmt::print(cerr, "Invalid number of threads: {}.\n", threads);
+        throw exit_main(1);
+    }
+
     if (algorithm == "str-lf") {
-        return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             using loader_t = str_loader<external_tree>;
             loader_t loader(tree, loader_t::sort_mode::label_first);
+            loader.threads(threads);
             loader.load(input);
-        };
+        });
     } else if (algorithm == "str-plain") {
-        return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             using loader_t = str_loader<external_tree>;
             loader_t loader(tree, loader_t::sort_mode::label_ignored);
+            loader.threads(threads);
             loader.load(input);
-        };
+        });
     } else if (algorithm == "str-ll") {
-        return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             using loader_t = str_loader<external_tree>;
             loader_t loader(tree, loader_t::sort_mode::label_last);
+            loader.threads(threads);
             loader.load(input);
-        };
+        });
     } else if (algorithm == "hilbert") {
-        return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             hilbert_loader<external_tree> loader(tree);
+            loader.threads(threads);
             loader.load(input);
-        };
+        });
+    } else if (algorithm == "hilbert-lf") {
+        if (label_weight < 0 || label_weight > 1) {
+            fmt::print(cerr, "Invalid label weight: {}.\n", label_weight);
+            throw exit_main(1);
+        }
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+            using loader_t = hilbert_loader<external_tree>;
+            loader_t loader(tree, loader_t::label_mode::frequency, label_weight);
+            loader.threads(threads);
+            loader.load(input);
+        });
     } else if (algorithm == "quickload") {
-        return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
+        return bulk_algorithm([&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             // TODO: Adjust cache size.
             quick_loader<external_tree> loader(tree, 4);
+            loader.threads(threads);
             loader.load(input);
-        };
+        });
     } else if (algorithm == "obo") {
         return [&](external_tree& tree, tpie::file_stream<tree_entry>& input) {
             tpie::progress_indicator_arrow progress("Inserting", 100);
@@ -223,3 +605,190 @@ algorithm_type get_algorithm() {
         throw exit_main(1);
     }
 }
+
+// Applies the split and reinsertion options to the tree.
+void configure_tree(external_tree& tree) {
+    if (split == "quadratic") {
+        tree.split(split_strategy::quadratic);
+    } else if (split == "rstar") {
+        tree.split(split_strategy::rstar);
+    } else {
+        fmt::print(cerr, "Invalid split algorithm: {}.\n", split);
+        throw exit_main(1);
+    }
+
+    if (reinsert < 0 || reinsert >= 1) {
+        fmt::print(cerr, "Invalid reinsert fraction: {}.\n", reinsert);
+        throw exit_main(1);
+    }
+    tree.reinsert_fraction(reinsert);
+}
+
+const char* strategy_name(beta_strategy s) {
+    switch (s) {
+    case beta_strategy::normal:     return "normal";
+    case beta_strategy::increasing: return "increasing";
+    case beta_strategy::decreasing: return "decreasing";
+    }
+    unreachable("invalid beta strategy");
+}
+
+static beta_strategy parse_strategy(const string& name) {
+    for (beta_strategy s : {beta_strategy::normal, beta_strategy::increasing, beta_strategy::decreasing}) {
+        if (name == strategy_name(s)) {
+            return s;
+        }
+    }
+    fmt::print(cerr, "Invalid beta strategy: {}.\n", name);
+    throw exit_main(1);
+}
+
+// Reads a query workload (see the description of the --tune option).
+static std::vector<sequenced_query> read_workload(const string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        fmt::print(cerr, "Failed to open the workload file \"{}\".\n", path);
+        throw exit_main(1);
+    }
+
+    std::vector<sequenced_query> workload;
+    try {
+        const json input = json::parse(in);
+        for (const json& jq : input) {
+            sequenced_query query;
+            for (const json& js : jq.at("queries")) {
+                const json& rect = js.at("rect");
+                if (rect.size() != 6) {
+                    throw std::invalid_argument("rectangles must have 6 coordinates");
+                }
+
+                vector3 min(rect[0].get<float>(), rect[2].get<float>(), rect[4].get<time_type>());
+                vector3 max(rect[1].get<float>(), rect[3].get<float>(), rect[5].get<time_type>());
+                if (!vector3::less_eq(min, max)) {
+                    throw std::invalid_argument("minimum coordinates must be <= maximum coordinates");
+                }
+
+                simple_query simple;
+                simple.rect = bounding_box(min, max);
+                for (const json& label : js.at("labels")) {
+                    simple.labels.insert(label.get<label_type>());
+                }
+                query.queries.push_back(std::move(simple));
+            }
+            if (jq.count("gaps")) {
+                for (const json& gap : jq.at("gaps")) {
+                    query.gaps.push_back(time_gap(gap.at(0).get<time_type>(), gap.at(1).get<time_type>()));
+                }
+            }
+            query.validate();
+            workload.push_back(std::move(query));
+        }
+    } catch (const std::exception& e) {
+        fmt::print(cerr, "Invalid workload file \"{}\": {}.\n", path, e.what());
+        throw exit_main(1);
+    }
+
+    if (workload.empty()) {
+        fmt::print(cerr, "The workload file \"{}\" contains no queries.\n", path);
+        throw exit_main(1);
+    }
+    return workload;
+}
+
+// Builds small trees from a sample of the entries for every candidate combination of
+// beta and beta strategy and runs the workload against them.
+// Returns the combination with the fewest IOs. The individual results are stored in `report`.
+tree_params tune(const algorithm_type& loader, tpie::file_stream<tree_entry>& entries, json& report) {
+    const std::vector<sequenced_query> workload = read_workload(tune_path);
+
+    std::vector<double> betas = tune_betas;
+    if (betas.empty()) {
+        betas = {0.1, 0.3, 0.5, 0.7, 0.9, 1.0};
+    }
+    for (double b : betas) {
+        if (b < 0 || b > 1) {
+            fmt::print(cerr, "Invalid beta value: {}.\n", b);
+            throw exit_main(1);
+        }
+    }
+
+    std::vector<beta_strategy> strategies;
+    for (const string& name : tune_strategies) {
+        strategies.push_back(parse_strategy(name));
+    }
+    if (strategies.empty()) {
+        strategies = {beta_strategy::normal, beta_strategy::increasing, beta_strategy::decreasing};
+    }
+
+    // Take every n-th entry to cover the whole data set.
+    tpie::file_stream<tree_entry> sample;
+    sample.open();
+    sample.truncate(0);
+    {
+        const u64 size = entries.size();
+        const u64 stride = std::max<u64>(1, tune_sample ? size / tune_sample : 1);
+        entries.seek(0);
+        for (u64 i = 0; i < size && sample.size() < tune_sample; ++i) {
+            const tree_entry e = entries.read();
+            if (i % stride == 0) {
+                sample.write(e);
+            }
+        }
+        entries.seek(0);
+    }
+    fmt::print(cout, "Tuning with {} sample entries and {} queries.\n", sample.size(), workload.size());
+
+    report = json::array();
+    boost::optional<tree_params> best;
+    u64 best_io = 0;
+    for (beta_strategy strategy : strategies) {
+        for (double b : betas) {
+            temp_dir dir("tuning");
+
+            // Some algorithms modify their input.
+            tpie::file_stream<tree_entry> input;
+            input.open();
+            input.truncate(0);
+            sample.seek(0);
+            while (sample.can_read()) {
+                input.write(sample.read());
+            }
+
+            measure_t build;
+            {
+                external_tree sample_tree{external_storage(dir.path()), b};
+                sample_tree.strategy(strategy);
+                configure_tree(sample_tree);
+                build = measure_call([&]{
+                    loader(sample_tree, input);
+                });
+            }
+
+            // Reopen the tree to start with empty caches.
+            external_tree sample_tree{external_storage(dir.path())};
+            const measure_t queries = measure_call([&]{
+                for (const sequenced_query& q : workload) {
+                    sample_tree.find(q);
+                }
+            });
+
+            fmt::print(cout, "Beta {} with strategy \"{}\": {} IOs ({} seconds) for the workload.\n",
+                       b, strategy_name(strategy), queries.total_io, queries.duration);
+
+            json result = json::object();
+            result["beta"] = b;
+            result["strategy"] = strategy_name(strategy);
+            result["build"] = build;
+            result["queries"] = queries;
+            report.push_back(result);
+
+            if (!best || queries.total_io < best_io) {
+                best = tree_params(b, strategy);
+                best_io = queries.total_io;
+            }
+        }
+    }
+
+    fmt::print(cout, "Selected beta {} with strategy \"{}\".\n", best->weight, strategy_name(best->strategy));
+    return *best;
+}
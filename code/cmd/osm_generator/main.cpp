@@ -1,4 +1,5 @@
 #include "common/common.hpp"
+#include "geodb/utility/parallel.hpp"
 
 #include <boost/program_options.hpp>
 
@@ -14,8 +15,10 @@
 #include <osrm/status.hpp>
 #include <osrm/storage_config.hpp>
 
-#include <sstream>
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 using std::cout;
@@ -138,6 +141,7 @@ static std::string map;
 static std::string strings;
 static std::string output;
 static u64 entries;
+static size_t threads;
 
 static void parse_options(int argc, char** argv) {
     po::options_description options("Options");
@@ -150,7 +154,9 @@ static void parse_options(int argc, char** argv) {
             ("output,o", po::value(&output)->required(),
              "The output file.")
             (",n", po::value(&entries)->value_name("N")->required(),
-             "Stop when N entries have been generated.");
+             "Stop when N entries have been generated.")
+            ("threads,j", po::value(&threads)->value_name("N")->default_value(hardware_threads()),
+             "Number of routes computed concurrently. The output does not depend on this value.");
 
     po::variables_map vm;
     try {
@@ -173,72 +179,73 @@ static void parse_options(int argc, char** argv) {
         }
 
         po::notify(vm);
+
+        if (threads == 0) {
+            fmt::print(cerr, "Invalid number of threads: {}.\n", threads);
+            throw exit_main(1);
+        }
     } catch (const po::error& e) {
         fmt::print(cerr, "Failed to parse arguments: {}.\n", e.what());
         throw exit_main(1);
     }
 }
 
-/// Map a osrm::json::Value to a better json struct (which is actually usable).
-static json map_json(const osrm::json::Value& v) {
-    struct mapper {
-        json operator()(const osrm::json::Object& o) const {
-            json j = json::object();
-            for (const auto& pair : o.values) {
-                j[pair.first] = map_json(pair.second);
-            }
-            return j;
-        }
-
-        json operator()(const osrm::json::Array& a) const {
-            json j = json::array();
-            for (const auto& value : a.values) {
-                j.push_back(map_json(value));
-            }
-            return j;
-        }
-
-        json operator()(const osrm::json::String& str) const {
-            return str.value;
-        }
-
-        json operator()(const osrm::json::Number& num) const {
-            return num.value;
-        }
-
-        json operator()(const osrm::json::True&) const {
-            return true;
-        }
-
-        json operator()(const osrm::json::False&) const {
-            return false;
-        }
+/// Returns the member `key` of the given json object.
+/// Throws if the member does not exist or if it does not have the type `T`.
+template<typename T>
+static const T& json_get(const osrm::json::Object& object, const std::string& key) {
+    auto pos = object.values.find(key);
+    if (pos == object.values.end()) {
+        throw std::runtime_error(fmt::format("Missing key in route result: {}", key));
+    }
+    return pos->second.get<T>();
+}
 
-        json operator()(const osrm::json::Null&) const {
-            return nullptr;
-        }
-    };
+/// Returns the element at `index` of the given json array.
+/// Throws if the index is out of bounds or if the element does not have the type `T`.
+template<typename T>
+static const T& json_get(const osrm::json::Array& array, size_t index) {
+    if (index >= array.values.size()) {
+        throw std::runtime_error(fmt::format("Index out of bounds in route result: {}", index));
+    }
+    return array.values[index].get<T>();
+}
 
-    return mapbox::util::apply_visitor(mapper(), v);
+/// Returns the string member `key` of the given json object
+/// or an empty string if there is no such member.
+static std::string json_string_or_empty(const osrm::json::Object& object, const std::string& key) {
+    auto pos = object.values.find(key);
+    if (pos == object.values.end() || !pos->second.is<osrm::json::String>()) {
+        return std::string();
+    }
+    return pos->second.get<osrm::json::String>().value;
 }
 
+/// The trajectory units of a route between two cities.
+/// The labels of the units are indices into `names`, the
+/// names are ordered by their first appearance in the route.
+struct route {
+    std::vector<trajectory_unit> units;
+    std::vector<std::string> names;
+};
+
 /// Generates routes between two cities.
+/// The osrm engine is shared between threads, `generate`
+/// can be called concurrently.
 struct route_generator {
     osrm::EngineConfig config;
     osrm::OSRM router;
-    external_string_map& strings;
 
-    route_generator(const std::string& db, external_string_map& strings)
+    route_generator(const std::string& db)
         : config(get_config(db))
         , router(config)
-        , strings(strings)
     {}
 
     /// Generates a list of trajectory units by computing a route between
     /// the two cities and taking the individual route segments.
     /// Long segments are split into short ones by simulating the beginning
     /// of a new segment about every 15 seconds.
-    std::vector<trajectory_unit> generate(const city& a, const city& b) {
+    route generate(const city& a, const city& b) const {
         osrm::RouteParameters params;
 
         // API has longitude and latitude reversed...
@@ -252,65 +259,77 @@ struct route_generator {
         osrm::json::Object result;
         const auto status = router.Route(params, result);
         if (status != osrm::Status::Ok) {
-            throw std::runtime_error(fmt::format("Failed to compute route: {}\n", map_json(result).dump(4)));
+            throw std::runtime_error(fmt::format("Failed to compute route from {} to {}: {} ({})\n",
+                                                 a.name, b.name,
+                                                 json_string_or_empty(result, "code"),
+                                                 json_string_or_empty(result, "message")));
         }
 
-        return get_route(a, b, map_json(result));
+        return get_route(a, b, result);
     }
 
 private:
     /// Returns the name of the given route step.
     /// Prefers the ref, then the name and finally falls back to "N/A".
-    std::string get_name(const json& step) {
-        if (step.count("ref")) {
-            std::string ref = step.at("ref");
-            if (!ref.empty())
-                return ref;
-        }
-        if (step.count("name")) {
-            std::string name = step.at("name");
-            if (!name.empty())
-                return name;
-        }
+    static std::string get_name(const osrm::json::Object& step) {
+        std::string ref = json_string_or_empty(step, "ref");
+        if (!ref.empty())
+            return ref;
+
+        std::string name = json_string_or_empty(step, "name");
+        if (!name.empty())
+            return name;
+
         return "N/A";
     }
 
-    /// Transforms the route result obtained from osrm into a vector of trajectory units.
-    std::vector<trajectory_unit> get_route(const city& a, const city& b, const json& result) {
+    /// Transforms the route result obtained from osrm into a route.
+    /// Reads the steps directly from osrm's result object.
+    static route get_route(const city& a, const city& b, const osrm::json::Object& result) {
+        using osrm::json::Array;
+        using osrm::json::Number;
+        using osrm::json::Object;
+
         // The last step of the route should have this endpoint already.
         unused(b);
 
         // route data is at routes[0]->legs[0]->steps.
-        const json& steps = result
-                .at("routes").at(0)
-                .at("legs").at(0)
-                .at("steps");
+        const Object& first_route = json_get<Object>(json_get<Array>(result, "routes"), 0);
+        const Object& first_leg = json_get<Object>(json_get<Array>(first_route, "legs"), 0);
+        const Array& steps = json_get<Array>(first_leg, "steps");
 
-        std::vector<trajectory_unit> units;
+        route r;
+        std::unordered_map<std::string, label_type> name_index;
 
         double x = a.position.x();
         double y = a.position.y();
         time_type t = 0;
 
-        for (const json& step : steps) {
-            const json& location = step.at("maneuver").at("location");
+        for (const auto& step_value : steps.values) {
+            const Object& step = step_value.get<Object>();
+            const Array& location = json_get<Array>(json_get<Object>(step, "maneuver"), "location");
 
-            const double duration = step.at("duration"); // seconds
+            const double duration = json_get<Number>(step, "duration").value; // seconds
             const std::string name = get_name(step);
 
-            const double nx = location.at(1);
-            const double ny = location.at(0);
+            const double nx = json_get<Number>(location, 1).value;
+            const double ny = json_get<Number>(location, 0).value;
             const time_type dt = std::max(time_type(1), time_type(duration));
 
+            auto inserted = name_index.emplace(name, r.names.size());
+            if (inserted.second) {
+                r.names.push_back(name);
+            }
+
             trajectory_unit unit;
-            unit.label = strings.label_id_or_insert(name);
+            unit.label = inserted.first->second;
             unit.start = vector3(x, y, t);
             unit.end = vector3(nx, ny, t + dt);
 
             if (dt >= 20) {
-                split_segments(unit, 15, units);
+                split_segments(unit, 15, r.units);
             } else {
-                units.push_back(unit);
+                r.units.push_back(unit);
             }
 
             x = nx;
@@ -318,14 +337,14 @@ private:
             t += dt;
         }
 
-        return units;
+        return r;
     }
 
     /// Split the large unit into smaller units of duration `max_duration`,
     /// assuming linear movement.
-    void split_segments(const trajectory_unit& unit,
-                        time_type max_duration,
-                        std::vector<trajectory_unit>& units) {
+    static void split_segments(const trajectory_unit& unit,
+                               time_type max_duration,
+                               std::vector<trajectory_unit>& units) {
         const time_type total_duration = unit.end.t() - unit.start.t();
         const double dx = (unit.end.x() - unit.start.x()) / total_duration;
         const double dy = (unit.end.y() - unit.start.y()) / total_duration;
@@ -375,34 +394,63 @@ int main(int argc, char** argv) {
         parse_options(argc, argv);
 
         external_string_map string_map({strings});
-        route_generator gen(map, string_map);
+        const route_generator gen(map);
 
         tpie::file_stream<tree_entry> out;
         out.open(output);
         out.truncate(0);
 
+        // Routes are computed concurrently in batches but written in
+        // the order of the city pairs. Labels are assigned while writing,
+        // so the output is the same for every number of threads.
+        const auto pairs = city_pairs();
+        const size_t batch_size = threads * 4;
+        std::vector<route> routes;
+        std::vector<label_type> labels;
+
         trajectory_id_type tid = 0;
-        for (const auto& pair : city_pairs()) {
+        for (size_t batch_begin = 0; batch_begin < pairs.size(); batch_begin += batch_size) {
             if (out.size() >= entries) {
                 fmt::print(cout, "Generated {} entries in {} trajectories.\n", out.size(), tid);
                 return 0;
             }
 
-            // Generate a route between the two cities.
-            const auto units = gen.generate(cities[pair.first], cities[pair.second]);
-
-            // Save all trajectory units in the output file as a single
-            // logical trajectory.
-            u32 unit_index = 0;
-            for (const trajectory_unit& unit : units) {
-                tree_entry entry(tid, unit_index++, unit);
-                out.write(entry);
+            const size_t batch_end = std::min(pairs.size(), batch_begin + batch_size);
+            routes.resize(batch_end - batch_begin);
+            parallel_for(routes.size(), threads, [&](size_t i) {
+                const auto& pair = pairs[batch_begin + i];
+                routes[i] = gen.generate(cities[pair.first], cities[pair.second]);
+            });
+
+            for (size_t i = 0; i < routes.size(); ++i) {
+                if (out.size() >= entries) {
+                    fmt::print(cout, "Generated {} entries in {} trajectories.\n", out.size(), tid);
+                    return 0;
+                }
+
+                const auto& pair = pairs[batch_begin + i];
+                const route& r = routes[i];
+
+                labels.clear();
+                for (const std::string& name : r.names) {
+                    labels.push_back(string_map.label_id_or_insert(name));
+                }
+
+                // Save all trajectory units in the output file as a single
+                // logical trajectory.
+                u32 unit_index = 0;
+                for (trajectory_unit unit : r.units) {
+                    unit.label = labels[unit.label];
+
+                    tree_entry entry(tid, unit_index++, unit);
+                    out.write(entry);
+                }
+
+                fmt::print("{} -> {}: Trajectory #{} ({} units)\n",
+                           cities[pair.first].name, cities[pair.second].name, tid, unit_index);
+
+                ++tid;
             }
-
-            fmt::print("{} -> {}: Trajectory #{} ({} units)\n",
-                       cities[pair.first].name, cities[pair.second].name, tid, unit_index);
-
-            ++tid;
         }
 
         fmt::print(cout, "Cities pairs exhausted before the requested number of "
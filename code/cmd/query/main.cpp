@@ -1,11 +1,17 @@
 #include "common/common.hpp"
 
+#include "geodb/irwi/label_dictionary.hpp"
+#include "geodb/utility/parallel.hpp"
+
 #include <boost/program_options.hpp>
 #include <boost/fusion/adapted.hpp>
 #include <boost/spirit/home/x3.hpp>
 #include <fmt/ostream.h>
 
+#include <algorithm>
+#include <cctype>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <sstream>
 
@@ -26,6 +32,15 @@ struct raw_bounding_box {
 
 struct raw_labels {
     std::vector<u32> list;
+    std::vector<std::string> names;     ///< Exact label names.
+    std::vector<std::string> prefixes;  ///< Label name prefixes.
+
+    bool empty() const { return list.empty() && names.empty() && prefixes.empty(); }
+};
+
+struct raw_gap {
+    u32 min = 0;
+    u32 max = 0;
 };
 
 BOOST_FUSION_ADAPT_STRUCT(
@@ -33,6 +48,11 @@ BOOST_FUSION_ADAPT_STRUCT(
     x_min, x_max, y_min, y_max, t_min, t_max
 );
 
+BOOST_FUSION_ADAPT_STRUCT(
+    raw_gap,
+    min, max
+);
+
 namespace grammar {
     using namespace boost::spirit::x3;
 
@@ -56,13 +76,21 @@ namespace grammar {
             > coord > lit(',')      // y max
             > time > lit(',')       // t min
             > time;                 // t max
+
+    const auto gap
+        = rule<class gap, raw_gap>("gap")
+        =     time > lit(',')       // min
+            > time;                 // max
 }
 
 static std::string tree_path;
 static std::string results_path;
 static std::string stats_path;
+static std::string dictionary_path;
+static size_t threads;
 static std::vector<raw_bounding_box> rects;
 static std::vector<raw_labels> labels;
+static std::vector<raw_gap> gaps;
 
 // Parser for bounding boxes on the command line.
 void validate(boost::any& v,
@@ -99,14 +127,61 @@ void validate(boost::any& v,
     validators::check_first_occurrence(v);
     const std::string& s = validators::get_single_string(values);
 
+    // Every element is either a label id, a label name or
+    // a name prefix (a name followed by "*").
+    auto trim = [](std::string str) {
+        const auto is_space = [](char c) { return std::isspace(static_cast<unsigned char>(c)); };
+        str.erase(str.begin(), std::find_if_not(str.begin(), str.end(), is_space));
+        str.erase(std::find_if_not(str.rbegin(), str.rend(), is_space).base(), str.end());
+        return str;
+    };
+
     raw_labels result;
+    if (!trim(s).empty()) {
+        std::stringstream stream(s);
+        std::string token;
+        while (std::getline(stream, token, ',')) {
+            token = trim(token);
+            if (token.empty()) {
+                throw validation_error(validation_error::invalid_option_value);
+            }
+
+            u32 id;
+            auto iter = token.begin();
+            if (x3::parse(iter, token.end(), x3::uint32, id) && iter == token.end()) {
+                result.list.push_back(id);
+            } else if (token.back() == '*') {
+                result.prefixes.push_back(token.substr(0, token.size() - 1));
+            } else {
+                result.names.push_back(token);
+            }
+        }
+        if (s.back() == ',') {
+            throw validation_error(validation_error::invalid_option_value);
+        }
+    }
+    v = result;
+}
+
+void validate(boost::any& v,
+              const std::vector<std::string>& values,
+              raw_gap*, int)
+{
+    using namespace boost::program_options;
+    namespace x3 = boost::spirit::x3;
+
+    validators::check_first_occurrence(v);
+    const std::string& s = validators::get_single_string(values);
+
+    raw_gap result;
     auto iter = s.begin();
     auto end = s.end();
+
     bool ok = x3::phrase_parse(iter, end,
-                               x3::eoi | (x3::uint32 % ','),
-                               x3::ascii::space, result.list);
+                               grammar::gap,
+                               x3::ascii::space, result);
 
-    if (!ok || iter != end) {
+    if (!ok || iter != end || result.min > result.max) {
         throw validation_error(validation_error::invalid_option_value);
     }
     v = result;
@@ -117,7 +192,7 @@ static void parse_options(int argc, char** argv) {
     options.add_options()
             ("help,h", "Show this message.")
             ("tree", po::value(&tree_path)->value_name("PATH")->required(),
-             "The path to the tree on disk.")
+             "The path to the tree (or label forest) on disk.")
             ("results", po::value(&results_path)->value_name("PATH"),
              "The path to the result file on disk (optional).")
             ("stats", po::value(&stats_path)->value_name("PATH"),
@@ -127,7 +202,17 @@ static void parse_options(int argc, char** argv) {
              "The syntax is \"xmin, xmax, ymin, ymax, tmin, tmax\".\n"
              "Supports placeholders MIN and MAX.")
             ("label,l", po::value(&labels)->value_name("LIST"),
-             "Add a list of comma separated labels to the query. Use zero labels to express \"any\".")
+             "Add a list of comma separated labels to the query. Use zero labels to express \"any\".\n"
+             "Labels can be given as ids, as names or as name prefixes (\"NAME*\"). "
+             "Names and prefixes require a label dictionary.")
+            ("dictionary", po::value(&dictionary_path)->value_name("PATH"),
+             "The path to the label dictionary (optional).")
+            ("threads", po::value(&threads)->value_name("N")->default_value(hardware_threads()),
+             "Number of threads used to search the partitions of a time partitioned forest.")
+            ("gap,g", po::value(&gaps)->value_name("GAP"),
+             "Add a time gap constraint between two consecutive simple queries (optional).\n"
+             "The syntax is \"min, max\". Supports placeholders MIN and MAX.\n"
+             "Either no gaps or one gap between every pair of rectangles must be specified.")
             ;
 
     po::variables_map vm;
@@ -159,6 +244,49 @@ static void parse_options(int argc, char** argv) {
         fmt::print(cerr, "Must specify the same number of rectangles and label lists.");
         throw exit_main(1);
     }
+
+    if (!gaps.empty() && gaps.size() + 1 != rects.size()) {
+        fmt::print(cerr, "Must specify exactly one gap between every pair of rectangles.");
+        throw exit_main(1);
+    }
+
+    if (threads == 0) {
+        fmt::print(cerr, "Invalid number of threads: {}.\n", threads);
+        throw exit_main(1);
+    }
+
+    if (dictionary_path.empty()) {
+        for (const raw_labels& rlabels : labels) {
+            if (!rlabels.names.empty() || !rlabels.prefixes.empty()) {
+                fmt::print(cerr, "Must specify a label dictionary in order to use label names.");
+                throw exit_main(1);
+            }
+        }
+    }
+}
+
+// Resolves label names and prefixes to their ids.
+static std::vector<u32> resolve_labels(const raw_labels& rlabels, const label_dictionary* dict) {
+    std::vector<u32> result = rlabels.list;
+    for (const std::string& name : rlabels.names) {
+        if (auto id = dict->find(name)) {
+            result.push_back(*id);
+        } else {
+            fmt::print(cerr, "Unknown label name \"{}\".", name);
+            throw exit_main(1);
+        }
+    }
+    for (const std::string& prefix : rlabels.prefixes) {
+        std::vector<label_type> ids = dict->find_prefix(prefix);
+        result.insert(result.end(), ids.begin(), ids.end());
+    }
+
+    // An empty set would mean "any label".
+    if (result.empty() && !rlabels.empty()) {
+        fmt::print(cerr, "No labels match the given label list.");
+        throw exit_main(1);
+    }
+    return result;
 }
 
 template<typename Container>
@@ -196,6 +324,11 @@ int main(int argc, char** argv) {
     return tpie_main([&]{
         parse_options(argc, argv);
 
+        std::unique_ptr<label_dictionary> dictionary;
+        if (!dictionary_path.empty()) {
+            dictionary = std::make_unique<label_dictionary>(dictionary_path);
+        }
+
         fmt::print(cout, "Building the query.\n");
         sequenced_query query;
         for (size_t i = 0; i < rects.size(); ++i) {
@@ -211,11 +344,18 @@ int main(int argc, char** argv) {
 
             simple_query q;
             q.rect = bounding_box(min, max);
-            q.labels.insert(rlabels.list.begin(), rlabels.list.end());
+            const std::vector<u32> ids = resolve_labels(rlabels, dictionary.get());
+            q.labels.insert(ids.begin(), ids.end());
             query.queries.push_back(q);
 
             fmt::print("Simple query #{}: {}, {}.\n", i + 1, q.rect, container_to_string(q.labels));
         }
+        for (size_t i = 0; i < gaps.size(); ++i) {
+            const raw_gap& rgap = gaps.at(i);
+            query.gaps.push_back(time_gap(rgap.min, rgap.max));
+
+            fmt::print("Time gap #{}: [{}, {}].\n", i + 1, rgap.min, rgap.max);
+        }
         fmt::print(cout, "\n");
 
 
@@ -225,15 +365,37 @@ int main(int argc, char** argv) {
             throw exit_main(1);
         }
 
-        external_tree tree{external_storage(tree_path)};
-        fmt::print(cout, "Tree contains {} entries.\n", tree.size());
-        fmt::print(cout, "\n");
-
-        fmt::print(cout, "Running the query.\n");
         std::vector<trajectory_match> result;
-        const measure_t stats = measure_call([&]{
-            result = tree.find(query);
-        });
+        measure_t stats;
+        if (is_time_forest(tree_path)) {
+            std::unique_ptr<external_time_forest> forest = open_time_forest(tree_path);
+            forest->threads(threads);
+            fmt::print(cout, "Forest contains {} entries in {} partitions.\n", forest->size(), forest->catalog().size());
+            fmt::print(cout, "\n");
+
+            fmt::print(cout, "Running the query with {} threads.\n", threads);
+            stats = measure_call([&]{
+                result = forest->find(query);
+            });
+        } else if (is_forest(tree_path)) {
+            std::unique_ptr<external_forest> forest = open_forest(tree_path);
+            fmt::print(cout, "Forest contains {} entries in {} trees.\n", forest->size(), forest->labels().size() + 1);
+            fmt::print(cout, "\n");
+
+            fmt::print(cout, "Running the query.\n");
+            stats = measure_call([&]{
+                result = forest->find(query);
+            });
+        } else {
+            external_tree tree{external_storage(tree_path)};
+            fmt::print(cout, "Tree contains {} entries.\n", tree.size());
+            fmt::print(cout, "\n");
+
+            fmt::print(cout, "Running the query.\n");
+            stats = measure_call([&]{
+                result = tree.find(query);
+            });
+        }
 
         u64 units = 0;
         for (const auto& match: result) {
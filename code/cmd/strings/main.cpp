@@ -1,6 +1,7 @@
 #include "common/common.hpp"
 
 #include "geodb/klee.hpp"
+#include "geodb/irwi/label_dictionary.hpp"
 
 #include <boost/program_options.hpp>
 #include <fmt/ostream.h>
@@ -14,6 +15,7 @@ using namespace geodb;
 namespace po = boost::program_options;
 
 static std::string input;
+static std::string dictionary;
 static bool json_format = false;
 
 static void parse_options(int argc, char** argv) {
@@ -23,7 +25,10 @@ static void parse_options(int argc, char** argv) {
             ("input", po::value(&input)->value_name("PATH")->required(),
              "Path to the strings database.")
             ("json", po::bool_switch(&json_format),
-             "Enable json output format.");
+             "Enable json output format.")
+            ("dictionary", po::value(&dictionary)->value_name("PATH"),
+             "Write a label dictionary for the strings database to the given path "
+             "instead of displaying its content.");
 
     po::variables_map vm;
     try {
@@ -54,6 +59,13 @@ int main(int argc, char** argv) {
 
         external_string_map string_map({input});
 
+        if (!dictionary.empty()) {
+            label_dictionary::build(dictionary, string_map);
+            fmt::print(cerr, "Wrote label dictionary with {} labels to {}.\n",
+                       string_map.size(), dictionary);
+            return 0;
+        }
+
         if (json_format) {
             json result = json::object();
             for (const auto& mapping : string_map) {
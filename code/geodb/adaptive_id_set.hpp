@@ -0,0 +1,555 @@
+#ifndef GEODB_ADAPTIVE_ID_SET_HPP
+#define GEODB_ADAPTIVE_ID_SET_HPP
+
+#include "geodb/bloom_filter.hpp"
+#include "geodb/common.hpp"
+#include "geodb/interval.hpp"
+#include "geodb/interval_set.hpp"
+#include "geodb/utility/arena.hpp"
+
+#include <boost/range/adaptor/indirected.hpp>
+#include <tpie/serialization2.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+/// \file
+/// An id set that chooses its representation for every instance.
+
+namespace geodb {
+
+/// A set of ids with a fixed byte budget that picks one of several representations
+/// for every instance, depending on the ids it has to store:
+///
+///     - exact:     A sorted list of ids. Used whenever the ids fit (no false positives).
+///     - intervals: Up to `Lambda` sorted, disjoint intervals (like \ref inline_interval_set).
+///     - bloom:     A bloom filter, together with the smallest interval that contains all ids.
+///     - all:       Contains every id.
+///
+/// When the ids no longer fit into an exact list, the representation that is expected
+/// to produce the fewest false positives within the span of the ids is chosen.
+/// Dense ids are therefore stored as intervals, while scattered ids end up in a bloom filter.
+/// Union and intersection work across all representations; their results are
+/// always supersets of the exact results.
+///
+/// The payload consists of `2 * Lambda` 64-bit words, which is the same budget
+/// as `Lambda` intervals. Instances are trivially copyable and can be stored
+/// in external memory. Unused words are always zero, equal sets
+/// therefore have equal binary representations.
+template<u32 Lambda>
+class adaptive_id_set {
+    static_assert(Lambda > 0, "Lambda must not be zero");
+
+public:
+    using point_type = u64;
+    using interval_type = interval<u64>;
+
+    /// The representations supported by this class.
+    enum class representation : u32 {
+        exact = 0, intervals = 1, bloom = 2, all = 3
+    };
+
+public:
+    /// The number of 64-bit words available for the payload.
+    static constexpr u32 words() { return 2 * Lambda; }
+
+    /// The maximum number of ids in an exact list.
+    static constexpr u32 max_ids() { return words(); }
+
+    /// The maximum number of intervals.
+    static constexpr u32 max_intervals() { return Lambda; }
+
+    /// The number of bits in the bloom filter (the first two words store the bounds).
+    static constexpr u32 filter_bits() { return (words() - 2) * 64; }
+
+    /// The number of hash functions used by the bloom filter.
+    static constexpr u32 filter_hashes() { return 5; }
+
+    /// The approximate false positive rate of the bloom filter after inserting `n` ids.
+    static double filter_error_rate(u64 n) {
+        if (filter_bits() == 0) {
+            return 1;
+        }
+        const double k = filter_hashes();
+        const double m = filter_bits();
+        return std::pow(1.0 - std::pow(1.0 - 1.0 / m, k * double(n)), k);
+    }
+
+    /// Returns a set that contains every id.
+    static adaptive_id_set all() {
+        adaptive_id_set result;
+        result.m_kind = representation::all;
+        return result;
+    }
+
+    /// Returns the union of all sets in `rng`.
+    template<typename Range>
+    static adaptive_id_set set_union(Range&& rng) {
+        arena_scope scope(thread_arena());
+
+        // Non-filter sets are combined into a single list of intervals,
+        // filters are combined by or-ing their bits.
+        buffer_type ids;
+        adaptive_id_set filter;
+        bool have_filter = false;
+        for (const adaptive_id_set& set : rng) {
+            switch (set.m_kind) {
+            case representation::all:
+                return all();
+            case representation::bloom:
+                if (!have_filter) {
+                    filter = set;
+                    have_filter = true;
+                } else {
+                    filter.filter_merge(set);
+                }
+                break;
+            default:
+                set.append_intervals(ids);
+                break;
+            }
+        }
+        normalize(ids);
+
+        if (!have_filter) {
+            return from_intervals(ids);
+        }
+        if (coverage(ids) <= enumeration_limit()) {
+            for (const interval_type& i : ids) {
+                for (u64 id = i.begin(); ; ++id) {
+                    filter.filter_add(id);
+                    if (id == i.end()) {
+                        break;
+                    }
+                }
+            }
+            return filter;
+        }
+
+        // Too many ids to insert them into the filter. Fall back to intervals
+        // and use the bounds of the filter as an approximation of its content.
+        ids.push_back(interval_type(filter.m_data[0], filter.m_data[1]));
+        normalize(ids);
+        return from_intervals(ids);
+    }
+
+    /// Returns the intersection of all sets in `rng`.
+    template<typename Range>
+    static adaptive_id_set set_intersection(Range&& rng) {
+        auto pos = boost::begin(rng);
+        auto end = boost::end(rng);
+        if (pos == end) {
+            return adaptive_id_set();
+        }
+
+        adaptive_id_set result = *pos;
+        for (++pos; pos != end && !result.empty(); ++pos) {
+            result = intersect(result, *pos);
+        }
+        return result;
+    }
+
+public:
+    /// Creates an empty set.
+    adaptive_id_set() = default;
+
+    /// Creates a set that contains the given intervals.
+    adaptive_id_set(std::initializer_list<interval_type> list)
+        : adaptive_id_set(list.begin(), list.end()) {}
+
+    /// Creates a set that contains the given intervals.
+    /// The intervals may be unsorted and may overlap.
+    template<typename FwdIter>
+    adaptive_id_set(FwdIter first, FwdIter last) {
+        assign(first, last);
+    }
+
+    /// Returns the current representation of this set.
+    representation kind() const { return m_kind; }
+
+    /// Returns true iff this set contains no ids.
+    bool empty() const {
+        return m_kind == representation::exact && m_size == 0;
+    }
+
+    /// Returns the number of stored elements: the number of ids (exact),
+    /// the number of intervals (intervals), or an upper bound for the number
+    /// of inserted ids (bloom). Returns 0 for the set of all ids.
+    size_t size() const { return m_size; }
+
+    /// Replaces the content of this set with the given intervals.
+    template<typename FwdIter>
+    void assign(FwdIter first, FwdIter last) {
+        arena_scope scope(thread_arena());
+        buffer_type ids(first, last);
+        normalize(ids);
+        *this = from_intervals(ids);
+    }
+
+    /// Removes all ids from this set.
+    void clear() { *this = adaptive_id_set(); }
+
+    /// Returns true if this set contains the given id.
+    /// Only exact lists are free of false positives.
+    bool contains(point_type id) const {
+        switch (m_kind) {
+        case representation::exact:
+            return std::binary_search(m_data, m_data + m_size, id);
+        case representation::intervals: {
+            // The first interval i with i.begin() > id.
+            u32 first = 0, count = m_size;
+            while (count > 0) {
+                const u32 step = count / 2;
+                if (m_data[2 * (first + step)] <= id) {
+                    first += step + 1;
+                    count -= step + 1;
+                } else {
+                    count = step;
+                }
+            }
+            return first > 0 && m_data[2 * (first - 1) + 1] >= id;
+        }
+        case representation::bloom:
+            return filter_test(id);
+        case representation::all:
+            return true;
+        }
+        unreachable("invalid representation");
+    }
+
+    /// Adds the id to the set. The representation changes if the
+    /// id does not fit into the current one.
+    ///
+    /// \return Returns true iff adding the id caused the set to change.
+    bool add(point_type id) {
+        if (contains(id)) {
+            return false;
+        }
+
+        switch (m_kind) {
+        case representation::exact:
+            if (m_size < max_ids()) {
+                u64* pos = std::upper_bound(m_data, m_data + m_size, id);
+                std::copy_backward(pos, m_data + m_size, m_data + m_size + 1);
+                *pos = id;
+                ++m_size;
+                return true;
+            }
+            break;
+        case representation::bloom:
+            filter_add(id);
+            return true;
+        default:
+            break;
+        }
+
+        arena_scope scope(thread_arena());
+        buffer_type ids;
+        append_intervals(ids);
+        ids.push_back(interval_type(id));
+        normalize(ids);
+        *this = from_intervals(ids);
+        return true;
+    }
+
+    /// Returns the union of `*this` and `other`.
+    adaptive_id_set union_with(const adaptive_id_set& other) const {
+        std::array<const adaptive_id_set*, 2> args{this, &other};
+        return set_union(args | boost::adaptors::indirected);
+    }
+
+    /// Returns the intersection of `*this` and `other`.
+    adaptive_id_set intersection_with(const adaptive_id_set& other) const {
+        return intersect(*this, other);
+    }
+
+    friend bool operator==(const adaptive_id_set& a, const adaptive_id_set& b) {
+        return a.m_kind == b.m_kind && a.m_size == b.m_size
+                && std::equal(a.m_data, a.m_data + words(), b.m_data);
+    }
+
+    friend bool operator!=(const adaptive_id_set& a, const adaptive_id_set& b) {
+        return !(a == b);
+    }
+
+private:
+    using buffer_type = arena_vector<interval_type>;
+
+    /// Filters are only built from (or intersected with) intervals
+    /// that contain at most this many ids. The filter is nearly useless
+    /// beyond that point.
+    static constexpr u64 enumeration_limit() { return filter_bits() / 2; }
+
+    static u64 coverage(const buffer_type& ids) { return detail::interval_coverage(ids); }
+
+    static void normalize(buffer_type& ids) { detail::normalize_intervals(ids); }
+
+    /// Chooses the best representation for the given normalized list of intervals.
+    static adaptive_id_set from_intervals(const buffer_type& ids) {
+        adaptive_id_set result;
+        if (ids.empty()) {
+            return result;
+        }
+
+        const u64 n = coverage(ids);
+        if (n <= max_ids()) {
+            result.m_kind = representation::exact;
+            for (const interval_type& i : ids) {
+                for (u64 id = i.begin(); ; ++id) {
+                    result.m_data[result.m_size++] = id;
+                    if (id == i.end()) {
+                        break;
+                    }
+                }
+            }
+            return result;
+        }
+
+        if (ids.size() <= max_intervals()) {
+            result.set_intervals(ids);
+            return result;
+        }
+
+        // Both approximations are judged by the expected number
+        // of false positives within the span of the ids.
+        buffer_type merged(ids);
+        detail::merge_intervals(merged, max_intervals());
+        const double interval_errors = double(coverage(merged) - n);
+
+        if (n <= enumeration_limit()) {
+            const double span = double(ids.back().end() - ids.front().begin()) + 1;
+            const double filter_errors = filter_error_rate(n) * (span - double(n));
+            if (filter_errors < interval_errors) {
+                result.m_kind = representation::bloom;
+                result.m_data[0] = ids.front().begin();
+                result.m_data[1] = ids.back().end();
+                for (const interval_type& i : ids) {
+                    for (u64 id = i.begin(); ; ++id) {
+                        result.filter_add(id);
+                        if (id == i.end()) {
+                            break;
+                        }
+                    }
+                }
+                return result;
+            }
+        }
+
+        result.set_intervals(merged);
+        return result;
+    }
+
+    /// Computes a superset of the intersection of `a` and `b`.
+    static adaptive_id_set intersect(const adaptive_id_set& a, const adaptive_id_set& b) {
+        if (a.m_kind == representation::all) {
+            return b;
+        }
+        if (b.m_kind == representation::all || a.empty()) {
+            return a;
+        }
+        if (b.empty()) {
+            return b;
+        }
+
+        // Exact lists are filtered by the other set.
+        if (a.m_kind == representation::exact || b.m_kind == representation::exact) {
+            const adaptive_id_set& list = a.m_kind == representation::exact ? a : b;
+            const adaptive_id_set& other = &list == &a ? b : a;
+
+            adaptive_id_set result;
+            for (u32 i = 0; i < list.m_size; ++i) {
+                if (other.contains(list.m_data[i])) {
+                    result.m_data[result.m_size++] = list.m_data[i];
+                }
+            }
+            return result;
+        }
+
+        if (a.m_kind == representation::bloom && b.m_kind == representation::bloom) {
+            adaptive_id_set result = a;
+            result.m_data[0] = std::max(a.m_data[0], b.m_data[0]);
+            result.m_data[1] = std::min(a.m_data[1], b.m_data[1]);
+            result.m_size = std::min(a.m_size, b.m_size);
+
+            bool bits = false;
+            for (u32 i = 2; i < words(); ++i) {
+                result.m_data[i] &= b.m_data[i];
+                bits |= result.m_data[i] != 0;
+            }
+            if (!bits || result.m_data[0] > result.m_data[1]) {
+                return adaptive_id_set();
+            }
+            return result;
+        }
+
+        arena_scope scope(thread_arena());
+        if (a.m_kind == representation::intervals && b.m_kind == representation::intervals) {
+            buffer_type lhs, rhs, ids;
+            a.append_intervals(lhs);
+            b.append_intervals(rhs);
+            std::array<buffer_type*, 2> args{&lhs, &rhs};
+            detail::sweep_intersection(args | boost::adaptors::indirected, ids);
+            return from_intervals(ids);
+        }
+
+        // Intervals and a filter: clip the intervals to the bounds of the filter
+        // and test the remaining ids if there are not too many of them.
+        const adaptive_id_set& filter = a.m_kind == representation::bloom ? a : b;
+        const adaptive_id_set& other = &filter == &a ? b : a;
+
+        buffer_type ids;
+        for (u32 i = 0; i < other.m_size; ++i) {
+            const u64 begin = std::max(other.m_data[2 * i], filter.m_data[0]);
+            const u64 end = std::min(other.m_data[2 * i + 1], filter.m_data[1]);
+            if (begin <= end) {
+                ids.push_back(interval_type(begin, end));
+            }
+        }
+        if (coverage(ids) <= enumeration_limit()) {
+            buffer_type matches;
+            for (const interval_type& i : ids) {
+                for (u64 id = i.begin(); ; ++id) {
+                    if (filter.filter_test(id)) {
+                        matches.push_back(interval_type(id));
+                    }
+                    if (id == i.end()) {
+                        break;
+                    }
+                }
+            }
+            normalize(matches);
+            return from_intervals(matches);
+        }
+        return from_intervals(ids);
+    }
+
+    /// Appends the content of an exact list or interval set to `ids`.
+    void append_intervals(buffer_type& ids) const {
+        switch (m_kind) {
+        case representation::exact:
+            for (u32 i = 0; i < m_size; ++i) {
+                ids.push_back(interval_type(m_data[i]));
+            }
+            break;
+        case representation::intervals:
+            for (u32 i = 0; i < m_size; ++i) {
+                ids.push_back(interval_type(m_data[2 * i], m_data[2 * i + 1]));
+            }
+            break;
+        default:
+            unreachable("representation cannot be enumerated");
+        }
+    }
+
+    void set_intervals(const buffer_type& ids) {
+        geodb_assert(ids.size() <= max_intervals(), "too many intervals");
+        m_kind = representation::intervals;
+        m_size = ids.size();
+        for (u32 i = 0; i < m_size; ++i) {
+            m_data[2 * i] = ids[i].begin();
+            m_data[2 * i + 1] = ids[i].end();
+        }
+    }
+
+    /// Computes the filter bit positions for the given id
+    /// (see \ref bloom_filter for the hashing scheme).
+    static std::array<u32, filter_hashes()> filter_positions(u64 id) {
+        const std::array<u64, 2> murmur = murmur3(id);
+
+        std::array<u32, filter_hashes()> result;
+        for (u32 i = 0; i < filter_hashes(); ++i) {
+            result[i] = (murmur[0] + i * murmur[1]) % std::max(filter_bits(), 1u);
+        }
+        return result;
+    }
+
+    void filter_add(u64 id) {
+        geodb_assert(m_kind == representation::bloom, "not a filter");
+        for (u32 bit : filter_positions(id)) {
+            m_data[2 + bit / 64] |= u64(1) << (bit % 64);
+        }
+        m_data[0] = std::min(m_data[0], id);
+        m_data[1] = std::max(m_data[1], id);
+        if (m_size != std::numeric_limits<u32>::max()) {
+            ++m_size;
+        }
+    }
+
+    bool filter_test(u64 id) const {
+        geodb_assert(m_kind == representation::bloom, "not a filter");
+        if (id < m_data[0] || id > m_data[1]) {
+            return false;
+        }
+        for (u32 bit : filter_positions(id)) {
+            if (!(m_data[2 + bit / 64] & (u64(1) << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void filter_merge(const adaptive_id_set& other) {
+        geodb_assert(m_kind == representation::bloom && other.m_kind == representation::bloom,
+                     "not a filter");
+        m_data[0] = std::min(m_data[0], other.m_data[0]);
+        m_data[1] = std::max(m_data[1], other.m_data[1]);
+        for (u32 i = 2; i < words(); ++i) {
+            m_data[i] |= other.m_data[i];
+        }
+        m_size = u32(std::min<u64>(u64(m_size) + other.m_size, std::numeric_limits<u32>::max()));
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const adaptive_id_set& set) {
+        switch (set.m_kind) {
+        case representation::exact:
+            o << "{";
+            for (u32 i = 0; i < set.m_size; ++i) {
+                o << (i > 0 ? ", " : "") << set.m_data[i];
+            }
+            return o << "}";
+        case representation::intervals: {
+            arena_scope scope(thread_arena());
+            buffer_type ids;
+            set.append_intervals(ids);
+            detail::print_intervals(o, ids.begin(), ids.end());
+            return o;
+        }
+        case representation::bloom:
+            return o << "bloom{" << interval_type(set.m_data[0], set.m_data[1])
+                     << ", ~" << set.m_size << " ids}";
+        case representation::all:
+            return o << "{*}";
+        }
+        return o;
+    }
+
+    template<typename Dest>
+    friend void serialize(Dest& dst, const adaptive_id_set& set) {
+        using tpie::serialize;
+        serialize(dst, static_cast<u32>(set.m_kind));
+        serialize(dst, set.m_size);
+        serialize(dst, set.m_data, set.m_data + words());
+    }
+
+    template<typename Src>
+    friend void unserialize(Src& src, adaptive_id_set& set) {
+        using tpie::unserialize;
+        u32 kind = 0;
+        unserialize(src, kind);
+        unserialize(src, set.m_size);
+        unserialize(src, set.m_data, set.m_data + words());
+        set.m_kind = static_cast<representation>(kind);
+    }
+
+private:
+    representation m_kind = representation::exact;
+    u32 m_size = 0;
+    u64 m_data[2 * Lambda] = {};
+};
+
+} // namespace geodb
+
+#endif // GEODB_ADAPTIVE_ID_SET_HPP
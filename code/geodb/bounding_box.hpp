@@ -6,6 +6,8 @@
 #include "geodb/rectangle.hpp"
 #include "geodb/vector.hpp"
 
+#include <cmath>
+
 /// \file
 /// Contains the implementation of a bounding box for IRWI trees.
 
@@ -34,6 +36,25 @@ public:
         };
     }
 
+    /// Returns the minimum spatial distance between `p` and any point
+    /// of this bounding box (MINDIST). The time dimension is ignored.
+    /// The distance is 0 if `p` lies within the spatial projection of the box.
+    double spatial_distance(const vector2d& p) const {
+        auto axis_distance = [](double v, double min, double max) {
+            if (v < min) {
+                return min - v;
+            }
+            if (v > max) {
+                return v - max;
+            }
+            return 0.0;
+        };
+
+        const double dx = axis_distance(p.x(), min().x(), max().x());
+        const double dy = axis_distance(p.y(), min().y(), max().y());
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
     /// Returns true if this bounding box fully contains `other`.
     bool contains(const bounding_box& other) const {
         return vector3::less_eq(min(), other.min()) && vector3::less_eq(other.max(), max());
@@ -0,0 +1,362 @@
+#ifndef GEODB_COMPRESSED_ID_SET_HPP
+#define GEODB_COMPRESSED_ID_SET_HPP
+
+#include "geodb/common.hpp"
+#include "geodb/interval.hpp"
+#include "geodb/interval_set.hpp"
+#include "geodb/utility/arena.hpp"
+
+#include <boost/range/adaptor/indirected.hpp>
+#include <tpie/serialization2.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <ostream>
+
+/// \file
+/// An id set that stores small sets exactly.
+
+namespace geodb {
+
+/// A set of ids with the fixed byte budget of `Lambda` intervals.
+///
+/// As long as they fit into the budget, the ids are stored exactly as a sorted
+/// list of delta encoded varints. Sets that are too large fall back to (at most)
+/// `Lambda` intervals, which are merged as neccessary (like \ref inline_interval_set).
+///
+/// Postings that point to leaves count the units of a single leaf,
+/// so their sets are small and usually stored exactly. This removes the false
+/// positives of merged intervals at the bottom level of the tree, where
+/// every wasted candidate costs a leaf read. Sets at higher levels
+/// overflow the budget and behave like normal interval sets.
+///
+/// Ids that do not fit into 32 bits are never stored exactly.
+/// Instances are trivially copyable and can be stored in external memory.
+/// Unused bytes are always zero, equal sets therefore have equal binary representations.
+template<u32 Lambda>
+class compressed_id_set {
+    static_assert(Lambda > 0, "Lambda must not be zero");
+    static_assert(Lambda * 16 <= std::numeric_limits<u16>::max(), "Lambda is too large");
+
+public:
+    using point_type = u64;
+    using interval_type = interval<u64>;
+
+    /// The representations supported by this class.
+    enum class representation : u8 {
+        exact = 0, intervals = 1
+    };
+
+public:
+    /// The number of bytes available for the encoded ids.
+    static constexpr u32 max_bytes() { return 16 * Lambda; }
+
+    /// The maximum number of intervals.
+    static constexpr u32 max_intervals() { return Lambda; }
+
+    /// Returns the union of all sets in `rng`.
+    template<typename Range>
+    static compressed_id_set set_union(Range&& rng) {
+        arena_scope scope(thread_arena());
+        buffer_type ids;
+        for (const compressed_id_set& set : rng) {
+            set.append_intervals(ids);
+        }
+        detail::normalize_intervals(ids);
+        return from_intervals(ids);
+    }
+
+    /// Returns the intersection of all sets in `rng`.
+    template<typename Range>
+    static compressed_id_set set_intersection(Range&& rng) {
+        auto pos = boost::begin(rng);
+        auto end = boost::end(rng);
+        if (pos == end) {
+            return compressed_id_set();
+        }
+
+        compressed_id_set result = *pos;
+        for (++pos; pos != end && !result.empty(); ++pos) {
+            result = intersect(result, *pos);
+        }
+        return result;
+    }
+
+public:
+    /// Creates an empty set.
+    compressed_id_set() = default;
+
+    /// Creates a set that contains the given intervals.
+    compressed_id_set(std::initializer_list<interval_type> list)
+        : compressed_id_set(list.begin(), list.end()) {}
+
+    /// Creates a set that contains the given intervals.
+    /// The intervals may be unsorted and may overlap.
+    template<typename FwdIter>
+    compressed_id_set(FwdIter first, FwdIter last) {
+        assign(first, last);
+    }
+
+    /// Returns the current representation of this set.
+    representation kind() const { return m_kind; }
+
+    /// Returns true iff this set contains no ids.
+    bool empty() const { return m_size == 0; }
+
+    /// Returns the number of ids (exact) or the number of intervals (intervals).
+    size_t size() const { return m_size; }
+
+    /// Replaces the content of this set with the given intervals.
+    template<typename FwdIter>
+    void assign(FwdIter first, FwdIter last) {
+        arena_scope scope(thread_arena());
+        buffer_type ids(first, last);
+        detail::normalize_intervals(ids);
+        *this = from_intervals(ids);
+    }
+
+    /// Removes all ids from this set.
+    void clear() { *this = compressed_id_set(); }
+
+    /// Returns true if this set contains the given id.
+    /// Exact sets have no false positives.
+    bool contains(point_type id) const {
+        if (m_kind == representation::exact) {
+            bool found = false;
+            for_each_id([&](u64 value) {
+                found = value == id;
+                return value < id;  // Continue while smaller.
+            });
+            return found;
+        }
+
+        // The first interval i with i.begin() > id.
+        u32 first = 0, count = m_size;
+        while (count > 0) {
+            const u32 step = count / 2;
+            if (m_data[2 * (first + step)] <= id) {
+                first += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        return first > 0 && m_data[2 * (first - 1) + 1] >= id;
+    }
+
+    /// Adds the id to the set. Switches to intervals once the
+    /// ids no longer fit.
+    ///
+    /// \return Returns true iff adding the id caused the set to change.
+    bool add(point_type id) {
+        if (contains(id)) {
+            return false;
+        }
+
+        arena_scope scope(thread_arena());
+        buffer_type ids;
+        append_intervals(ids);
+        ids.push_back(interval_type(id));
+        detail::normalize_intervals(ids);
+        *this = from_intervals(ids);
+        return true;
+    }
+
+    /// Returns the union of `*this` and `other`.
+    compressed_id_set union_with(const compressed_id_set& other) const {
+        std::array<const compressed_id_set*, 2> args{this, &other};
+        return set_union(args | boost::adaptors::indirected);
+    }
+
+    /// Returns the intersection of `*this` and `other`.
+    compressed_id_set intersection_with(const compressed_id_set& other) const {
+        return intersect(*this, other);
+    }
+
+    friend bool operator==(const compressed_id_set& a, const compressed_id_set& b) {
+        return a.m_kind == b.m_kind && a.m_size == b.m_size && a.m_bytes == b.m_bytes
+                && std::equal(a.m_data, a.m_data + 2 * Lambda, b.m_data);
+    }
+
+    friend bool operator!=(const compressed_id_set& a, const compressed_id_set& b) {
+        return !(a == b);
+    }
+
+private:
+    using buffer_type = arena_vector<interval_type>;
+
+    /// Chooses the representation for the given normalized list of intervals.
+    static compressed_id_set from_intervals(const buffer_type& ids) {
+        compressed_id_set result;
+        if (ids.empty()) {
+            return result;
+        }
+
+        // Every id takes at least one byte.
+        if (ids.back().end() <= std::numeric_limits<u32>::max()
+                && detail::interval_coverage(ids) <= max_bytes()
+                && result.encode(ids)) {
+            return result;
+        }
+
+        result = compressed_id_set();
+        result.m_kind = representation::intervals;
+        if (ids.size() <= max_intervals()) {
+            result.set_intervals(ids);
+        } else {
+            buffer_type merged(ids);
+            detail::merge_intervals(merged, max_intervals());
+            result.set_intervals(merged);
+        }
+        return result;
+    }
+
+    /// Computes a superset of the intersection of `a` and `b`.
+    static compressed_id_set intersect(const compressed_id_set& a, const compressed_id_set& b) {
+        if (a.empty() || b.empty()) {
+            return compressed_id_set();
+        }
+
+        arena_scope scope(thread_arena());
+        buffer_type ids;
+        if (a.m_kind == representation::exact || b.m_kind == representation::exact) {
+            // Exact ids are filtered by the other set.
+            const compressed_id_set& list = a.m_kind == representation::exact ? a : b;
+            const compressed_id_set& other = &list == &a ? b : a;
+            list.for_each_id([&](u64 id) {
+                if (other.contains(id)) {
+                    ids.push_back(interval_type(id));
+                }
+                return true;
+            });
+            detail::normalize_intervals(ids);
+        } else {
+            buffer_type lhs, rhs;
+            a.append_intervals(lhs);
+            b.append_intervals(rhs);
+            std::array<buffer_type*, 2> args{&lhs, &rhs};
+            detail::sweep_intersection(args | boost::adaptors::indirected, ids);
+        }
+        return from_intervals(ids);
+    }
+
+    /// Appends the content of this set to `ids`.
+    void append_intervals(buffer_type& ids) const {
+        if (m_kind == representation::exact) {
+            for_each_id([&](u64 id) {
+                ids.push_back(interval_type(id));
+                return true;
+            });
+        } else {
+            for (u32 i = 0; i < m_size; ++i) {
+                ids.push_back(interval_type(m_data[2 * i], m_data[2 * i + 1]));
+            }
+        }
+    }
+
+    /// Encodes all ids in `ids` as delta varints.
+    /// Returns false if they do not fit.
+    bool encode(const buffer_type& ids) {
+        u8* const out = bytes();
+        u32 pos = 0;
+        u64 prev = 0;
+        for (const interval_type& i : ids) {
+            for (u64 id = i.begin(); ; ++id) {
+                u64 delta = id - prev;
+                prev = id;
+                do {
+                    if (pos == max_bytes()) {
+                        return false;
+                    }
+                    out[pos++] = u8(delta & 0x7f) | (delta >= 0x80 ? 0x80 : 0);
+                    delta >>= 7;
+                } while (delta != 0);
+
+                ++m_size;
+                if (id == i.end()) {
+                    break;
+                }
+            }
+        }
+        m_kind = representation::exact;
+        m_bytes = pos;
+        return true;
+    }
+
+    /// Invokes `f(id)` for every id of an exact set, in ascending order,
+    /// until `f` returns false.
+    template<typename Func>
+    void for_each_id(Func&& f) const {
+        geodb_assert(m_kind == representation::exact, "not an exact set");
+        const u8* pos = bytes();
+        const u8* end = pos + m_bytes;
+        u64 id = 0;
+        while (pos != end) {
+            u64 delta = 0;
+            for (u32 shift = 0; ; shift += 7) {
+                const u8 byte = *pos++;
+                delta |= u64(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            id += delta;
+            if (!f(id)) {
+                return;
+            }
+        }
+    }
+
+    void set_intervals(const buffer_type& ids) {
+        geodb_assert(ids.size() <= max_intervals(), "too many intervals");
+        m_kind = representation::intervals;
+        m_size = ids.size();
+        for (u32 i = 0; i < m_size; ++i) {
+            m_data[2 * i] = ids[i].begin();
+            m_data[2 * i + 1] = ids[i].end();
+        }
+    }
+
+    u8* bytes() { return reinterpret_cast<u8*>(m_data); }
+    const u8* bytes() const { return reinterpret_cast<const u8*>(m_data); }
+
+    friend std::ostream& operator<<(std::ostream& o, const compressed_id_set& set) {
+        arena_scope scope(thread_arena());
+        buffer_type ids;
+        set.append_intervals(ids);
+        detail::print_intervals(o, ids.begin(), ids.end());
+        return o;
+    }
+
+    template<typename Dest>
+    friend void serialize(Dest& dst, const compressed_id_set& set) {
+        using tpie::serialize;
+        serialize(dst, set.m_size);
+        serialize(dst, set.m_bytes);
+        serialize(dst, static_cast<u8>(set.m_kind));
+        serialize(dst, set.m_data, set.m_data + 2 * Lambda);
+    }
+
+    template<typename Src>
+    friend void unserialize(Src& src, compressed_id_set& set) {
+        using tpie::unserialize;
+        u8 kind = 0;
+        unserialize(src, set.m_size);
+        unserialize(src, set.m_bytes);
+        unserialize(src, kind);
+        unserialize(src, set.m_data, set.m_data + 2 * Lambda);
+        set.m_kind = static_cast<representation>(kind);
+    }
+
+private:
+    u32 m_size = 0;     ///< Number of ids or intervals.
+    u16 m_bytes = 0;    ///< Number of encoded bytes (exact sets).
+    representation m_kind = representation::exact;
+    u8 m_unused = 0;
+    u64 m_data[2 * Lambda] = {};
+};
+
+} // namespace geodb
+
+#endif // GEODB_COMPRESSED_ID_SET_HPP
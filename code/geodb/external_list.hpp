@@ -11,6 +11,11 @@
 #include <gsl/span>
 #include <tpie/blocks/block_collection_cache.h>
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
 /// \file
 /// A generic append-only list in external storage.
 
@@ -22,11 +27,12 @@ namespace geodb {
 ///
 /// A number of blocks are cached in memory. That number can
 /// be modified using the constructor.
+/// The last block (the one that receives appended values) is kept
+/// in memory and cannot be evicted from the cache.
 ///
-/// TODO: The last block should not be allowed to leave the cache (?).
-/// TODO: It would make some algorithms more efficient (for example 
-/// bulk loading of inverted indices and quickload) if one could/
-/// pin blocks in the middle of the list into the cache.
+/// Ranges of values can be pinned in memory (see \ref pin()).
+/// Sequences of values can be read with a single lookup per block
+/// (see \ref read()).
 template<typename Value, size_t block_size>
 class external_list {
 private:
@@ -64,6 +70,7 @@ public:
         : m_path(path)
         , m_read_only(read_only)
         , m_blocks((path / "list.blocks").string(), std::max(cache_blocks, (size_t) 1), m_read_only)
+        , m_tail(new char[block_size]())
     {
         raw_stream rf;
         if (rf.try_open(state_path())) {
@@ -78,10 +85,19 @@ public:
             rf.read(m_value_count);
             rf.read(m_block_value_count);
             rf.read(m_current_block);
+
+            if (m_block_count > 0) {
+                auto data = read_block(m_current_block);
+                std::copy(data.begin(), data.end(), m_tail.get());
+            }
         }
     }
 
     ~external_list() {
+        geodb_assert(m_pinned.empty(), "blocks are still pinned");
+        flush_pinned();
+        flush_tail();
+
         raw_stream rf;
         rf.open_new(state_path());
         rf.write(block_size);
@@ -118,6 +134,27 @@ public:
         return get(block_index, index_in_block);
     }
 
+    /// Reads the values `[first, first + out.size())` into `out`.
+    /// Every block is only looked up once, which is much cheaper
+    /// than reading the values one by one.
+    ///
+    /// \pre `first + out.size() <= size()`.
+    void read(size_type first, gsl::span<value_type> out) const {
+        geodb_assert(first + size_type(out.size()) <= m_value_count, "range out of bounds");
+
+        size_type pos = 0;
+        const size_type count = out.size();
+        while (pos < count) {
+            const size_type index = first + pos;
+            const size_type index_in_block = index % block_capacity();
+            const size_type n = std::min(count - pos, block_capacity() - index_in_block);
+
+            const char* data = block_data(index / block_capacity());
+            memcpy(out.data() + pos, data + index_in_block * sizeof(value_type), n * sizeof(value_type));
+            pos += n;
+        }
+    }
+
     /// Replaces the value at the given index with a new one.
     /// \pre `index < size()`.
     void set(size_t index, const value_type& value) {
@@ -143,26 +180,165 @@ public:
         ++m_value_count;
     }
 
+    /// Pins the blocks that contain the values `[first, last)` in memory.
+    /// Pinned blocks are never evicted and can be accessed without a cache lookup
+    /// until they are released by a matching call to \ref unpin().
+    /// Ranges may overlap, blocks are reference counted.
+    ///
+    /// \pre `first <= last && last <= size()`.
+    void pin(size_type first, size_type last) const {
+        geodb_assert(first <= last && last <= m_value_count, "range out of bounds");
+        for_each_block(first, last, [&](size_type block) {
+            pinned_block& p = m_pinned[block];
+            if (p.refs++ == 0 && !is_tail(block)) {
+                auto data = read_block(block);
+                p.data.reset(new char[block_size]);
+                std::copy(data.begin(), data.end(), p.data.get());
+            }
+        });
+    }
+
+    /// Releases the blocks pinned by a previous call to `pin(first, last)`.
+    /// Modified blocks are written back once they are no longer pinned.
+    void unpin(size_type first, size_type last) const {
+        geodb_assert(first <= last && last <= m_value_count, "range out of bounds");
+        for_each_block(first, last, [&](size_type block) {
+            auto pos = m_pinned.find(block);
+            geodb_assert(pos != m_pinned.end(), "block is not pinned");
+            if (--pos->second.refs == 0) {
+                flush_pinned(*pos);
+                m_pinned.erase(pos);
+            }
+        });
+    }
+
 private:
+    /// A block that is held in memory by \ref pin().
+    /// Pinning the tail block does not create a copy.
+    struct pinned_block {
+        std::unique_ptr<char[]> data;
+        size_t refs = 0;
+        bool dirty = false;
+    };
+
+    using pinned_map = std::unordered_map<size_type, pinned_block>;
+
     fs::path state_path() const {
         return m_path / "list.state";
     }
 
+    bool is_tail(size_type block) const {
+        return m_block_count > 0 && block == m_current_block.index();
+    }
+
+    template<typename Func>
+    void for_each_block(size_type first, size_type last, Func&& f) const {
+        if (first == last) {
+            return;
+        }
+
+        const size_type last_block = (last - 1) / block_capacity();
+        for (size_type block = first / block_capacity(); block <= last_block; ++block) {
+            f(block);
+        }
+    }
+
     void next_block() {
-        block_handle_type handle = m_blocks.get_free_block();
-        geodb_assert(handle.index() == m_block_count,
-                     "blocks are allocated sequentially and are never freed.");
+        // The tail becomes an ordinary block, its pinned copy (if any)
+        // is initialized from the tail buffer.
+        if (m_block_count > 0) {
+            auto pos = m_pinned.find(m_current_block.index());
+            if (pos != m_pinned.end()) {
+                pos->second.data.reset(new char[block_size]);
+                std::copy(m_tail.get(), m_tail.get() + block_size, pos->second.data.get());
+            }
+        }
+        flush_tail();
 
+        // The new block is allocated once it is written for the first time.
+        m_current_block = block_handle_type(m_block_count);
         ++m_block_count;
-        m_current_block = handle;
+        std::fill(m_tail.get(), m_tail.get() + block_size, 0);
+        m_tail_allocated = false;
+        m_tail_dirty = true;
+    }
+
+    /// Writes the tail buffer to the block collection.
+    void flush_tail() {
+        if (!m_tail_dirty) {
+            return;
+        }
+
+        if (!m_tail_allocated) {
+            // New blocks are inserted into the cache, this does not read from disk.
+            block_handle_type handle = m_blocks.get_free_block();
+            geodb_assert(handle == m_current_block,
+                         "blocks are allocated sequentially and are never freed.");
+            unused(handle);
+            m_tail_allocated = true;
+        }
+
+        auto data = read_block(m_current_block);
+        std::copy(m_tail.get(), m_tail.get() + block_size, data.begin());
+        write_block(m_current_block);
+        m_tail_dirty = false;
+    }
+
+    /// Writes a pinned block back to the block collection, if it was modified.
+    void flush_pinned(typename pinned_map::value_type& entry) const {
+        pinned_block& p = entry.second;
+        if (p.dirty && p.data) {
+            auto data = read_block(entry.first);
+            std::copy(p.data.get(), p.data.get() + block_size, data.begin());
+            m_blocks.write_block(entry.first);
+        }
+        p.dirty = false;
+    }
+
+    void flush_pinned() {
+        for (auto& entry : m_pinned) {
+            flush_pinned(entry);
+        }
+    }
+
+    /// Returns the in-memory data of the given block (without a cache lookup)
+    /// or null if the block is neither the tail nor pinned.
+    char* memory_block(size_type block) const {
+        if (is_tail(block)) {
+            return m_tail.get();
+        }
+        if (!m_pinned.empty()) {
+            auto pos = m_pinned.find(block);
+            if (pos != m_pinned.end()) {
+                return pos->second.data.get();
+            }
+        }
+        return nullptr;
+    }
+
+    /// Returns the current content of the given block.
+    const char* block_data(size_type block) const {
+        if (const char* data = memory_block(block)) {
+            return data;
+        }
+        return read_block(block).data();
     }
 
     void set(block_handle_type block, size_type index, const value_type& value) {
         geodb_assert(index < block_capacity(), "index out of bounds");
 
-        auto data = read_block(block);
         size_type offset = index * sizeof(value_type);
+        if (char* data = memory_block(block.index())) {
+            memcpy(data + offset, std::addressof(value), sizeof(value_type));
+            if (is_tail(block.index())) {
+                m_tail_dirty = true;
+            } else {
+                m_pinned.find(block.index())->second.dirty = true;
+            }
+            return;
+        }
 
+        auto data = read_block(block);
         memcpy(&data[offset], std::addressof(value), sizeof(value_type));
         write_block(block);
     }
@@ -170,11 +346,11 @@ private:
     value_type get(block_handle_type block, size_type index) const {
         geodb_assert(index < block_capacity(), "index out of bounds");
 
-        auto data = read_block(block);
+        const char* data = block_data(block.index());
         size_type offset = index * sizeof(value_type);
         value_type result;
 
-        memcpy(std::addressof(result), &data[offset], sizeof(value_type));
+        memcpy(std::addressof(result), data + offset, sizeof(value_type));
         return result;
     }
 
@@ -212,6 +388,19 @@ private:
 
     /// Block storage on disk + cache.
     mutable block_collection<block_size> m_blocks;
+
+    /// In-memory copy of the current block. Written to the
+    /// block collection once the block is full.
+    std::unique_ptr<char[]> m_tail;
+
+    /// True if the tail has been modified since it was last written.
+    bool m_tail_dirty = false;
+
+    /// False if the tail block has not been allocated in the block collection yet.
+    bool m_tail_allocated = true;
+
+    /// Blocks pinned in memory, indexed by block index.
+    mutable pinned_map m_pinned;
 };
 
 }
@@ -2,11 +2,15 @@
 #define GEODB_HYBRID_BUFFER_HPP
 
 #include "geodb/common.hpp"
+#include "geodb/utility/memory_budget.hpp"
 
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/variant.hpp>
 #include <tpie/file_stream.h>
 
+#include <algorithm>
+#include <memory>
+
 /// \file
 /// Contains a buffer that lives either in internal or external storage.
 
@@ -79,6 +83,11 @@ public:
         m_buffer.push_back(value);
     }
 
+    /// Reserves space for (at least) `capacity` items.
+    void reserve(size_t capacity) {
+        m_buffer.reserve(capacity);
+    }
+
     /// Returns the number of items in this buffer.
     size_t size() const {
         return m_buffer.size();
@@ -183,6 +192,12 @@ private:
 /// until a certain threshold is reached.
 /// Then, all items are moved to external storage.
 ///
+/// Instead of a fixed threshold, a buffer can also draw from a
+/// \ref memory_budget that is shared with other containers.
+/// The buffer then requests memory from the budget whenever it grows
+/// and moves to disk when the request is denied or when the budget
+/// asks it to spill (at the next append).
+///
 /// \tparam Value       The value type.
 /// \tparam block_size  The block size (on disk).
 template<typename Value, size_t block_size>
@@ -248,6 +263,7 @@ public:
 private:
     backend_t m_backend;
     size_t m_limit = 0;
+    std::unique_ptr<memory_budget::consumer> m_consumer;
 
 public:
     /// Contructs a new buffer with a default item limit.
@@ -261,6 +277,14 @@ public:
         , m_limit(limit)
     {}
 
+    /// Constructs a new buffer that draws its internal memory
+    /// from the given budget. All items will be moved into external storage
+    /// when the budget runs out.
+    explicit hybrid_buffer(memory_budget& budget)
+        : m_backend()
+        , m_consumer(std::make_unique<memory_budget::consumer>(budget, "hybrid_buffer"))
+    {}
+
     hybrid_buffer(hybrid_buffer&&) noexcept = default;
 
     hybrid_buffer& operator=(hybrid_buffer&&) noexcept = default;
@@ -296,6 +320,8 @@ public:
 
     /// Returns the limit (in number of items) at which the storage
     /// will be moved to disk automatically.
+    /// For buffers that use a \ref memory_budget, this is the number of items
+    /// that have been granted by the budget so far.
     size_t limit() const {
         return m_limit;
     }
@@ -313,6 +339,9 @@ public:
             external.append(value);
         }
         m_backend = std::move(external); // Invalidates reference to `internal`
+        if (m_consumer) {
+            m_consumer->spilled();
+        }
     }
 
     /// Returns true if the buffer resides in internal storage.
@@ -329,11 +358,36 @@ private:
     void append_impl(internal_backend& backend, const Value& value) {
         geodb_assert(backend.size() <= m_limit, "internal backend grew too large");
 
-        backend.append(value);
-        if (backend.size() > m_limit) {
+        if (m_consumer && m_consumer->spill_requested()) {
+            make_external();
+            boost::get<external_backend>(m_backend).append(value);
+            return;
+        }
+
+        if (backend.size() == m_limit && !grow_limit(backend)) {
             make_external();
             // reference to `backend` is invalid now.
+            boost::get<external_backend>(m_backend).append(value);
+            return;
+        }
+        backend.append(value);
+    }
+
+    /// Requests more memory from the budget (if any).
+    /// The limit doubles with every successful request, the granted
+    /// capacity is reserved immediately.
+    bool grow_limit(internal_backend& backend) {
+        if (!m_consumer) {
+            return false;
+        }
+
+        const size_t items = std::max(m_limit, block_size / sizeof(Value));
+        if (!m_consumer->grow(items * sizeof(Value))) {
+            return false;
         }
+        m_limit += items;
+        backend.reserve(m_limit);
+        return true;
     }
 
     void append_impl(external_backend& backend, const Value& value) {
@@ -2,6 +2,7 @@
 #define GEODB_HYBRID_MAP_HPP
 
 #include "geodb/common.hpp"
+#include "geodb/utility/memory_budget.hpp"
 #include "geodb/utility/movable_adapter.hpp"
 #include "geodb/utility/temp_dir.hpp"
 
@@ -11,6 +12,7 @@
 #include <tpie/btree.h>
 #include <tpie/tempname.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 
@@ -306,6 +308,12 @@ private:
 /// Insertions that trigger the migration to disk invalidate
 /// all iterators.
 ///
+/// Instead of a fixed threshold, a map can also draw from a
+/// \ref memory_budget that is shared with other containers.
+/// The map then requests memory from the budget whenever it grows
+/// and moves to disk when the request is denied or when the budget
+/// asks it to spill (at the next insertion).
+///
 /// Note: Key and Value types must be trivially copyable.
 /// The key type must be comparable using < and =.
 ///
@@ -384,10 +392,17 @@ public:
         return (blocks * block_size) / (sizeof(Key) + sizeof(Value));
     }
 
+    /// The estimated size of a single item in internal storage,
+    /// including the bookkeeping of the tree node.
+    static constexpr size_t item_bytes() {
+        return sizeof(value_type) + 4 * sizeof(void*);
+    }
+
 private:
     backend_t m_backend;
     size_t m_limit = 0;
     boost::optional<fs::path> m_path;
+    std::unique_ptr<memory_budget::consumer> m_consumer;
 
 public:
     /// Constructs a new map that keeps 2 blocks in memory
@@ -424,6 +439,25 @@ public:
     {
     }
 
+    /// Constructs a new map that draws its internal memory
+    /// from the given budget. All items will be moved into external storage
+    /// when the budget runs out.
+    explicit hybrid_map(memory_budget& budget)
+        : m_backend()
+        , m_consumer(std::make_unique<memory_budget::consumer>(budget, "hybrid_map"))
+    {}
+
+    /// Constructs a new map that draws its internal memory
+    /// from the given budget.
+    /// When the budget runs out, the map will move to external
+    /// storage at the given directory location.
+    /// See the constructor of \ref external_map.
+    hybrid_map(const fs::path& path, memory_budget& budget)
+        : m_backend()
+        , m_path(path)
+        , m_consumer(std::make_unique<memory_budget::consumer>(budget, "hybrid_map"))
+    {}
+
     hybrid_map(hybrid_map&&) noexcept = default;
 
     hybrid_map& operator=(hybrid_map&&) noexcept = default;
@@ -472,6 +506,8 @@ public:
     }
 
     /// Returns the size limit for internal memory storage.
+    /// For maps that use a \ref memory_budget, this is the number of items
+    /// that have been granted by the budget so far.
     size_t limit() const {
         return m_limit;
     }
@@ -505,6 +541,9 @@ public:
             external.insert(pair.first, pair.second);
         }
         m_backend = std::move(external); // Invalidates reference `internal`.
+        if (m_consumer) {
+            m_consumer->spilled();
+        }
     }
 
     /// Returns true if the items in this map are located in memory.
@@ -521,8 +560,13 @@ private:
     bool insert_impl(internal_backend& backend, const Key& key, const Value& value) {
         geodb_assert(backend.size() <= m_limit, "internal backend grew too large.");
 
+        if (m_consumer && m_consumer->spill_requested()) {
+            make_external();
+            return boost::get<external_backend>(m_backend).insert(key, value);
+        }
+
         bool inserted = backend.insert(key, value);
-        if (inserted && backend.size() > m_limit) {
+        if (inserted && backend.size() > m_limit && !grow_limit()) {
             make_external();
             // reference to `backend` is invalid because the variant
             // was modified.
@@ -530,6 +574,21 @@ private:
         return inserted;
     }
 
+    /// Requests more memory from the budget (if any).
+    /// The limit doubles with every successful request.
+    bool grow_limit() {
+        if (!m_consumer) {
+            return false;
+        }
+
+        const size_t items = std::max(m_limit, limit_for_blocks(1));
+        if (!m_consumer->grow(items * item_bytes())) {
+            return false;
+        }
+        m_limit += items;
+        return true;
+    }
+
     bool insert_impl(external_backend& backend, const Key& key, const Value& value) {
         return backend.insert(key, value);
     }
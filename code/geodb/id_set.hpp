@@ -1,62 +1,51 @@
 #ifndef GEODB_ID_SET_HPP
 #define GEODB_ID_SET_HPP
 
+#include "geodb/adaptive_id_set.hpp"
 #include "geodb/bloom_filter.hpp"
 #include "geodb/common.hpp"
+#include "geodb/compressed_id_set.hpp"
 #include "geodb/interval_set.hpp"
 
+#include <type_traits>
+
 /// \file
 /// Defines the id set class used by this project.
 ///
-/// Uses either the interval set or the bloom filter,
-/// depending on preprocessor flags.
+/// Uses the interval set, the bloom filter, the adaptive id set
+/// or the compressed id set, depending on preprocessor flags.
+/// Both representations have a fixed size and no external storage,
+/// which means that they can be embedded into blocks on disk.
 
 namespace geodb {
 
 #if defined(GEODB_ID_SET_INTERVALS)
 
 template<u32 Lambda>
-using id_set = static_interval_set<u64, Lambda>;
-
-template<u32 Lambda>
-struct id_set_binary {
-    size_t size = 0;
-    interval<u64> intervals[Lambda];
-};
-
-template<u32 Lambda>
-void to_binary(const id_set<Lambda>& set, id_set_binary<Lambda>& binary) {
-    binary.size = set.size();
-    std::copy(set.begin(), set.end(), binary.intervals);
-}
-
-template<u32 Lambda>
-void from_binary(id_set<Lambda>& set, const id_set_binary<Lambda>& binary) {
-    set.assign(binary.intervals, binary.intervals + binary.size);
-}
+using id_set = inline_interval_set<u64, Lambda>;
 
 #elif defined(GEODB_ID_SET_BLOOM)
 
 template<u32 Lambda>
 using id_set = bloom_filter<u64, Lambda * sizeof(interval<u64>) * 8>;
 
-template<u32 Lambda>
-using id_set_binary = id_set<Lambda>;
+#elif defined(GEODB_ID_SET_ADAPTIVE)
 
 template<u32 Lambda>
-void to_binary(const id_set<Lambda>& set, id_set_binary<Lambda>& binary) {
-    binary = set;
-}
+using id_set = adaptive_id_set<Lambda>;
+
+#elif defined(GEODB_ID_SET_COMPRESSED)
 
 template<u32 Lambda>
-void from_binary(id_set<Lambda>& set, const id_set_binary<Lambda>& binary) {
-    set = binary;
-}
+using id_set = compressed_id_set<Lambda>;
 
 #else
     #error Unsupported id set type.
 #endif
 
+static_assert(std::is_trivially_copyable<id_set<1>>::value,
+              "id sets must be trivially copyable");
+
 } // namespace geodb
 
 #endif // GEODB_ID_SET_HPP
@@ -5,6 +5,7 @@
 #include "geodb/common.hpp"
 #include "geodb/interval.hpp"
 #include "geodb/type_traits.hpp"
+#include "geodb/utility/arena.hpp"
 
 #include <boost/range/adaptor/indirected.hpp>
 #include <boost/range/adaptor/transformed.hpp>
@@ -20,8 +21,12 @@
 #include <tpie/serialization2.h>
 
 #include <algorithm>
+#include <iterator>
+#include <limits>
 #include <ostream>
 #include <queue>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 /// \file
@@ -149,9 +154,10 @@ namespace detail {
     /// Every iterator in `gaps` gives the position after which a new merged interval begins.
     /// \pre `gaps` must be sorted.
     /// \warning `gaps` must not contain the last iterator.
-    template<typename T, typename IteratorRange>
-    void merge_positions(std::vector<interval<T>>& intervals, const IteratorRange& gaps) {
-        using iterator = typename std::vector<interval<T>>::iterator;
+    template<typename Vector, typename IteratorRange>
+    void merge_positions(Vector& intervals, const IteratorRange& gaps) {
+        using iterator = typename Vector::iterator;
+        using T = typename Vector::value_type::value_type;
 
         auto gaps_pos = boost::begin(gaps);
         auto gaps_end = boost::end(gaps);
@@ -191,9 +197,9 @@ namespace detail {
     /// `capacity` intervals in total. Chooses the intervals with the
     /// smallest gaps in between.
     /// The interval vector is modified in-place.
-    template<typename T>
-    void merge_intervals(std::vector<interval<T>>& intervals, size_t capacity) {
-        using iterator = typename std::vector<interval<T>>::iterator;
+    template<typename Vector>
+    void merge_intervals(Vector& intervals, size_t capacity) {
+        using iterator = typename Vector::iterator;
 
         geodb_assert(capacity > 0, "invalid capacity");
 
@@ -205,17 +211,20 @@ namespace detail {
         // Compute the `capacity - 1` largest gaps.
         // We will keep these gaps and merge all other intervals between them.
         // Then, the size of the new set will have the size `capacity`.
+        arena_scope scope(thread_arena());
         const size_t k = capacity - 1;
-        std::vector<iterator> gaps(k);
-        k_smallest(boost::counting_range(intervals.begin(), intervals.end() - 1), k, gaps,
-            // Compare the distances between the interval pairs.
-            [](const iterator& pos1, const iterator& pos2) {
-                geodb_assert(pos1[1].begin() > pos1[0].end(), "intervals must be ordered");
-                geodb_assert(pos2[1].begin() > pos2[0].end(), "intervals must be ordered");
-                // ">": compute largest instead of k_smallest.
-                return pos1[1].begin() - pos1[0].end() > pos2[1].begin() - pos2[0].end();
-            }
-        );
+        arena_vector<iterator> gaps(k);
+        if (k > 0) {
+            k_smallest(boost::counting_range(intervals.begin(), intervals.end() - 1), k, gaps,
+                // Compare the distances between the interval pairs.
+                [](const iterator& pos1, const iterator& pos2) {
+                    geodb_assert(pos1[1].begin() > pos1[0].end(), "intervals must be ordered");
+                    geodb_assert(pos2[1].begin() > pos2[0].end(), "intervals must be ordered");
+                    // ">": compute largest instead of k_smallest.
+                    return pos1[1].begin() - pos1[0].end() > pos2[1].begin() - pos2[0].end();
+                }
+            );
+        }
 
         // Intervals are ordered by merge cost, now sort them in positional order.
         std::sort(gaps.begin(), gaps.end());
@@ -224,6 +233,116 @@ namespace detail {
         return merge_positions(intervals, gaps);
     }
 
+    /// Computes the union of a range of interval sets (see \ref interval_events()).
+    /// The intervals of the union are appended to `result`.
+    template<typename Range, typename Vector>
+    void sweep_union(const Range& rng, Vector& result) {
+        using interval_type = typename Vector::value_type;
+        using point_type = typename interval_type::value_type;
+
+        // Sweep over the plane and keep track of open intervals.
+        // Whenever the open counter reaches zero, an element of the union has been found.
+        point_type begin = 0;   // Start of the earliest still active interval.
+        size_t open = 0;        // Number of open intervals.
+        interval_events(rng, [&](const auto& event) {
+            if (event.kind == event.open) {
+                if (++open == 1) {
+                    begin = event.point;
+                }
+            } else {
+                if (open-- == 1) {
+                    result.push_back(interval_type(begin, event.point));
+                }
+            }
+        });
+    }
+
+    /// Computes the intersection of a range of interval sets (see \ref interval_events()).
+    /// The intervals of the intersection are appended to `result`.
+    template<typename Range, typename Vector>
+    void sweep_intersection(const Range& rng, Vector& result) {
+        using interval_type = typename Vector::value_type;
+        using point_type = typename interval_type::value_type;
+
+        // Sweep over the plane and keep track of open intervals.
+        // When a close event is encountered and the count of open intervals
+        // equals the number of sets in `rng`, then the closing interval
+        // is a member of the intersection.
+        // Note: Intervals in individual sets do not overlap, thus the count
+        // of open intervals can never be greater than `size`.
+        size_t size = boost::size(rng);
+        point_type begin = 0;   // Start of the intersection interval.
+        size_t open = 0;        // Number of open intervals.
+        interval_events(rng, [&](const auto& event) {
+            geodb_assert(open <= size, "too many active intervals");
+
+            if (event.kind == event.open) {
+                if (++open == size) {
+                    begin = event.point;
+                }
+            } else {
+                if (open-- == size) {
+                    result.push_back(interval_type(begin, event.point));
+                }
+            }
+        });
+    }
+
+    /// Sorts a vector of intervals and merges overlapping or adjacent intervals.
+    /// The result is a valid (unbounded) interval set.
+    template<typename Vector>
+    void normalize_intervals(Vector& intervals) {
+        using interval_type = typename Vector::value_type;
+        using point_type = typename interval_type::value_type;
+
+        std::sort(intervals.begin(), intervals.end(), [](const interval_type& a, const interval_type& b) {
+            return a.begin() < b.begin();
+        });
+
+        auto out = intervals.begin();
+        for (auto in = intervals.begin(); in != intervals.end(); ++in) {
+            if (out != intervals.begin() && (out[-1].end() == std::numeric_limits<point_type>::max()
+                                             || in->begin() <= out[-1].end() + 1)) {
+                out[-1] = interval_type(out[-1].begin(), std::max(out[-1].end(), in->end()));
+            } else {
+                *out++ = *in;
+            }
+        }
+        intervals.erase(out, intervals.end());
+    }
+
+    /// Returns the number of points covered by a range of disjoint intervals.
+    /// Saturates at the maximum value of `u64`.
+    template<typename Range>
+    u64 interval_coverage(const Range& intervals) {
+        u64 result = 0;
+        for (const auto& i : intervals) {
+            const u64 size = u64(i.end() - i.begin()) + 1;
+            if (size == 0 || result + size < result) {
+                return std::numeric_limits<u64>::max();
+            }
+            result += size;
+        }
+        return result;
+    }
+
+    /// Prints the intervals in `[first, last)`, but merges adjacent intervals
+    /// that do not have a gap between them (for cleaner display functionality).
+    template<typename Iterator>
+    void print_intervals(std::ostream& o, Iterator first, Iterator last) {
+        using interval_type = typename std::iterator_traits<Iterator>::value_type;
+
+        o << "{";
+        for (auto i = first; i != last; ) {
+            interval_type c = *i;
+            while (++i != last && i->begin() == c.end() + 1) {
+                c = interval_type(c.begin(), i->end());
+            }
+            o << c;
+        }
+        o << "}";
+    }
+
 } // namespace detail
 
 /// Represents a set of integers as intervals.
@@ -257,24 +376,8 @@ public:
     template<typename Range>
     static interval_set set_union(Range&& rng)
     {
-        using detail::interval_events;
-
-        // Sweep over the plane and keep track of open intervals.
-        // Whenever the open counter reaches zero, an element of the union has been found.
         std::vector<interval_type> result;
-        point_type begin;   // Start of the earliest still active interval.
-        size_t open = 0;    // Number of open intervals.
-        interval_events(rng, [&](const auto& event) {
-            if (event.kind == event.open) {
-                if (++open == 1) {
-                    begin = event.point;
-                }
-            } else {
-                if (open-- == 1) {
-                    result.push_back(interval_type(begin, event.point));
-                }
-            }
-        });
+        detail::sweep_union(rng, result);
         return interval_set(std::move(result));
     }
 
@@ -284,31 +387,8 @@ public:
     /// and M is the number of ranges.
     template<typename Range>
     static interval_set set_intersection(Range&& rng) {
-        using detail::interval_events;
-
-        // Sweep over the plane and keep track of open intervals.
-        // When a close event is encountered and the count of open intervals
-        // equals the number of sets in `rng`, then the closing interval
-        // is a member of the intersection.
-        // Note: Intervals in individual sets do not overlap, thus the count
-        // of open intervals can never be greater than `size`.
         std::vector<interval_type> result;
-        size_t size = boost::size(rng);
-        point_type begin = 0;   // Start of the intersection interval.
-        size_t open = 0;        // Number of open intervals.
-        interval_events(rng, [&](const auto& event) {
-            geodb_assert(open <= size, "too many active intervals");
-
-            if (event.kind == event.open) {
-                if (++open == size) {
-                    begin = event.point;
-                }
-            } else {
-                if (open-- == size) {
-                    result.push_back(interval_type(begin, event.point));
-                }
-            }
-        });
+        detail::sweep_intersection(rng, result);
         return interval_set(std::move(result));
     }
 
@@ -459,25 +539,8 @@ private:
                     const_cast<interval_set*>(this)->interval_before(point));
     }
 
-    /// Iterate over the intervals, but merge adjacent intervals
-    /// that do not have a gap between them (for cleaner display functionality).
-    template<typename Func>
-    void adjacent_merged(Func&& f) const {
-        for (auto i = begin(), e = end(); i != e; ) {
-            interval_type c = *i;
-            while (++i != e && i->begin() == c.end() + 1) {
-                c = interval_type(c.begin(), i->end());
-            }
-            f(c);
-        }
-    }
-
     friend std::ostream& operator<<(std::ostream& o, const interval_set& set) {
-        o << "{";
-        set.adjacent_merged([&](const interval_type& i) {
-            o << i;
-        });
-        o << "}";
+        detail::print_intervals(o, set.begin(), set.end());
         return o;
     }
 
@@ -642,6 +705,226 @@ private:
     inner_t inner;
 };
 
+/// A fixed-capacity variant of \ref static_interval_set that stores
+/// its intervals in place, without any heap allocations.
+/// The number of intervals will always be lesser than or equal to `Capacity`,
+/// intervals are merged as neccessary in order to keep this invariant.
+///
+/// Instances are trivially copyable and have a fixed binary layout
+/// (the number of intervals, followed by an array of `Capacity` intervals).
+/// They can therefore be stored directly in external memory.
+/// Unused slots are kept in their default state so that equal sets
+/// have equal binary representations.
+template<typename T, size_t Capacity>
+class inline_interval_set {
+    static_assert(Capacity > 0, "Capacity must not be zero");
+
+public:
+    using interval_type = interval<T>;
+    using point_type = T;
+
+    using iterator = const interval_type*;
+    using const_iterator = iterator;
+
+public:
+    /// Returns the union of the sets in `rng`, adjusted for capacity.
+    template<typename Range>
+    static inline_interval_set set_union(Range&& rng) {
+        arena_scope scope(thread_arena());
+        arena_vector<interval_type> result;
+        detail::sweep_union(rng, result);
+        return inline_interval_set(result.begin(), result.end());
+    }
+
+    /// Returns the intersection of the sets in `rng`, adjusted for capacity.
+    template<typename Range>
+    static inline_interval_set set_intersection(Range&& rng) {
+        arena_scope scope(thread_arena());
+        arena_vector<interval_type> result;
+        detail::sweep_intersection(rng, result);
+        return inline_interval_set(result.begin(), result.end());
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+public:
+    inline_interval_set() {}
+
+    inline_interval_set(std::initializer_list<interval_type> list)
+        : inline_interval_set(list.begin(), list.end()) {}
+
+    template<typename FwdIter>
+    inline_interval_set(FwdIter first, FwdIter last) {
+        assign(first, last);
+    }
+
+    iterator begin() const { return m_intervals; }
+    iterator end() const { return m_intervals + m_size; }
+
+    /// \copydoc interval_set<T>::operator[]
+    const interval_type& operator[](size_t index) const {
+        geodb_assert(index < size(), "index out of bounds");
+        return m_intervals[index];
+    }
+
+    /// \copydoc interval_set<T>::empty
+    bool empty() const { return m_size == 0; }
+
+    /// \copydoc interval_set<T>::size
+    size_t size() const { return m_size; }
+
+    /// Assign a new set of intervals, merging them if neccessary.
+    /// The list must be sorted (by start coordinate, ascending) and
+    /// adjacent intervals must not overlap.
+    template<typename FwdIter>
+    void assign(FwdIter first, FwdIter last) {
+        const size_t count = std::distance(first, last);
+        if (count <= Capacity) {
+            std::copy(first, last, m_intervals);
+            set_size(count);
+        } else {
+            arena_scope scope(thread_arena());
+            arena_vector<interval_type> buffer(first, last);
+            detail::merge_intervals(buffer, Capacity);
+            std::copy(buffer.begin(), buffer.end(), m_intervals);
+            set_size(buffer.size());
+        }
+        assert_invariant();
+    }
+
+    /// Adds the point to the set, merging intervals if the set becomes full.
+    ///
+    /// \sa interval_set::add
+    bool add(point_type point) {
+        interval_type* const pos = upper_bound(point);
+        if (pos != m_intervals && pos[-1].contains(point)) {
+            // Point already represented.
+            return false;
+        }
+
+        if (m_size < Capacity) {
+            std::copy_backward(pos, m_intervals + m_size, m_intervals + m_size + 1);
+            *pos = interval_type(point);
+            ++m_size;
+        } else {
+            // Insert into a temporary buffer with room for one more interval
+            // and merge the buffer down to the capacity.
+            arena_scope scope(thread_arena());
+            arena_vector<interval_type> buffer;
+            buffer.reserve(Capacity + 1);
+            buffer.insert(buffer.end(), m_intervals, pos);
+            buffer.push_back(interval_type(point));
+            buffer.insert(buffer.end(), pos, m_intervals + m_size);
+            detail::merge_intervals(buffer, Capacity);
+            std::copy(buffer.begin(), buffer.end(), m_intervals);
+            set_size(buffer.size());
+        }
+
+        geodb_assert(contains(point), "postcondition violated");
+        assert_invariant();
+        return true;
+    }
+
+    /// \copydoc interval_set<T>::contains
+    bool contains(point_type point) const {
+        const interval_type* pos = const_cast<inline_interval_set*>(this)->upper_bound(point);
+        return pos != m_intervals && pos[-1].contains(point);
+    }
+
+    /// \copydoc interval_set<T>::trim
+    void trim(size_t size) {
+        geodb_assert(size > 0, "invalid size");
+        if (m_size > size) {
+            arena_scope scope(thread_arena());
+            arena_vector<interval_type> buffer(begin(), end());
+            detail::merge_intervals(buffer, size);
+            std::copy(buffer.begin(), buffer.end(), m_intervals);
+            set_size(buffer.size());
+        }
+    }
+
+    /// Equivalent to `trim(capacity())`.
+    void trim() { trim(capacity()); }
+
+    /// \copydoc interval_set<T>::clear
+    void clear() { set_size(0); }
+
+    /// Returns the union of `*this` and `other`, adjusted for capacity.
+    inline_interval_set union_with(const inline_interval_set& other) const {
+        std::array<const inline_interval_set*, 2> args{this, &other};
+        return set_union(args | boost::adaptors::indirected);
+    }
+
+    /// Returns the intersection of `*this` and `other`, adjusted for capacity.
+    inline_interval_set intersection_with(const inline_interval_set& other) const {
+        std::array<const inline_interval_set*, 2> args{this, &other};
+        return set_intersection(args | boost::adaptors::indirected);
+    }
+
+    friend bool operator==(const inline_interval_set& a, const inline_interval_set& b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(const inline_interval_set& a, const inline_interval_set& b) {
+        return !(a == b);
+    }
+
+private:
+    /// Returns the first interval i with i.begin() > point.
+    interval_type* upper_bound(point_type point) {
+        return std::upper_bound(m_intervals, m_intervals + m_size, point,
+                                [](point_type p, const interval_type& i) {
+            return p < i.begin();
+        });
+    }
+
+    /// Changes the size and resets the slots that are no longer in use.
+    void set_size(size_t size) {
+        geodb_assert(size <= Capacity, "size exceeds capacity");
+        std::fill(m_intervals + size, m_intervals + std::max(size, m_size), interval_type());
+        m_size = size;
+    }
+
+    void assert_invariant() const {
+#ifdef GEODB_DEBUG
+        for (size_t i = 1; i < m_size; ++i) {
+            geodb_assert(!m_intervals[i].overlaps(m_intervals[i - 1]), "Intervals must not overlap");
+            geodb_assert(m_intervals[i].begin() >= m_intervals[i - 1].end(), "intervals must be sorted");
+        }
+#endif
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const inline_interval_set& set) {
+        detail::print_intervals(o, set.begin(), set.end());
+        return o;
+    }
+
+    // Same format as the serialization of static_interval_set.
+    template<typename Dest>
+    friend void serialize(Dest& dst, const inline_interval_set& set) {
+        using tpie::serialize;
+        serialize(dst, set.m_size);
+        serialize(dst, set.begin(), set.end());
+    }
+
+    template<typename Src>
+    friend void unserialize(Src& src, inline_interval_set& set) {
+        using tpie::unserialize;
+        size_t size = 0;
+        unserialize(src, size);
+        if (size > Capacity) {
+            throw std::runtime_error("Too many intervals in serialized interval set");
+        }
+        set.set_size(size);
+        unserialize(src, set.m_intervals, set.m_intervals + size);
+        set.assert_invariant();
+    }
+
+private:
+    size_t m_size = 0;
+    interval_type m_intervals[Capacity];
+};
+
 } // namespace geodb
 
 #endif // GEODB_INTERVAL_SET_HPP
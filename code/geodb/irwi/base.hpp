@@ -65,6 +65,27 @@ inline bool operator!=(const tree_entry& a, const tree_entry& b) {
 
 static_assert(std::is_trivially_copyable<tree_entry>::value, "Must be trivially copyable");
 
+/// Determines how the weight beta of the cost function
+/// depends on the level of a node (see \ref tree_state::cost).
+enum class beta_strategy : u32 {
+    normal = 0,     ///< Use beta on every level.
+    increasing = 1, ///< Beta grows towards 1 for nodes near the root.
+    decreasing = 2, ///< Beta shrinks towards 0 for nodes near the root.
+};
+
+/// Parameters of the cost function that are stored together with a tree,
+/// so that later insertions use the same values that were used to build it.
+struct tree_params {
+    double weight = 0.5;
+    beta_strategy strategy = beta_strategy::normal;
+
+    tree_params() = default;
+
+    tree_params(double weight, beta_strategy strategy)
+        : weight(weight), strategy(strategy)
+    {}
+};
+
 namespace detail {
 
 struct tree_entry_accessor {
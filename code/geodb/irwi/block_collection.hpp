@@ -4,8 +4,16 @@
 #include "geodb/common.hpp"
 #include "geodb/filesystem.hpp"
 #include "geodb/irwi/block_handle.hpp"
+#include "geodb/utility/block_writer.hpp"
 
-#include <tpie/blocks/block_collection_cache.h>
+#include <boost/noncopyable.hpp>
+#include <tpie/blocks/block_collection.h>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 /// \file
 /// A collection of blocks on disk.
@@ -14,9 +22,14 @@ namespace geodb {
 
 /// A block file that hands out blocks of the given BlockSize.
 /// Free blocks are managed by a free list.
-/// A number of blocks can be cached in memory.
+/// A number of blocks can be cached in memory, the least recently
+/// used block is evicted (and written, if it is dirty) when the cache is full.
+///
+/// Evicted blocks are normally written synchronously. Bulk loads can
+/// switch to a write-behind mode (see \ref write_behind()) where evicted
+/// blocks are handed to a \ref block_writer instead.
 template<size_t BlockSize>
-class block_collection {
+class block_collection : boost::noncopyable {
 public:
     using handle_type = block_handle<BlockSize>;
 
@@ -24,41 +37,268 @@ public:
     /// A block collection at the given file system location
     /// with the specified cache size.
     block_collection(const fs::path& path, size_t max_cache = 32, bool read_only = false)
-        : m_blocks(path.string(), BlockSize, std::max(max_cache, size_t(4)), !read_only)
+        : m_path(path)
+        , m_blocks(path.string(), BlockSize, !read_only)
+        , m_max_cache(std::max(max_cache, size_t(4)))
     {}
 
+    ~block_collection() {
+        // Queued blocks are older than the cached ones.
+        // Write errors that have not been reported by write_through() abort the program.
+        m_writer.reset();
+
+        std::vector<u64> dirty;
+        for (const auto& pair : m_cache) {
+            if (pair.second.dirty) {
+                dirty.push_back(pair.first);
+            }
+        }
+        std::sort(dirty.begin(), dirty.end());
+        for (u64 index : dirty) {
+            m_blocks.write_block(handle_type(index), *m_cache.at(index).data);
+        }
+    }
+
     /// Allocates a new block.
     handle_type get_free_block() {
         handle_type handle = m_blocks.get_free_block();
+        add_to_cache(handle, tpie::make_unique<tpie::blocks::block>(BlockSize), true);
         return handle;
     }
 
+    /// Allocates `count` contiguous blocks and returns a handle to the first one.
+    /// The blocks are not part of the cache, every block must be
+    /// prepared by \ref use_reserved_block() before it can be accessed.
+    /// See \ref block_extent.
+    ///
+    /// Blocks from the free list that do not form a contiguous run are
+    /// returned to it afterwards. Blocks at the end of the file are
+    /// always contiguous, so the search terminates once the free list is exhausted.
+    /// \pre `count > 0`.
+    handle_type get_free_extent(size_t count) {
+        geodb_assert(count > 0, "extent must not be empty");
+
+        std::vector<handle_type> skipped;
+        handle_type first = m_blocks.get_free_block();
+        size_t size = 1;
+        while (size < count) {
+            handle_type handle = m_blocks.get_free_block();
+            if (handle.index() == first.index() + size) {
+                ++size;
+                continue;
+            }
+
+            for (size_t i = 0; i < size; ++i) {
+                skipped.push_back(handle_type(first.index() + i));
+            }
+            first = handle;
+            size = 1;
+        }
+
+        // Restore the previous order of the free list.
+        for (auto i = skipped.rbegin(); i != skipped.rend(); ++i) {
+            m_blocks.free_block(*i);
+        }
+        return first;
+    }
+
+    /// Prepares a block allocated by \ref get_free_extent() for its first use.
+    /// The block is inserted into the cache (filled with zeroes) without being
+    /// read from disk, just like a block returned by \ref get_free_block().
+    void use_reserved_block(handle_type handle) {
+        geodb_assert(m_cache.find(handle.index()) == m_cache.end(), "block is already in use");
+        add_to_cache(handle, tpie::make_unique<tpie::blocks::block>(BlockSize), true);
+    }
+
     /// Frees the given block.
     /// Free'd blocks are reused when a new block is allocated.
     void free_block(handle_type handle) {
+        auto pos = m_cache.find(handle.index());
+        if (pos != m_cache.end()) {
+            m_lru.erase(pos->second.lru);
+            m_cache.erase(pos);
+        }
+
+        // A late write must not extend the file after it has been truncated.
+        if (m_writer && m_writer->pending(offset(handle))) {
+            m_writer->flush();
+        }
         m_blocks.free_block(handle);
     }
 
     /// Read the data at the given block index.
     tpie::blocks::block* read_block(handle_type handle) {
-        return m_blocks.read_block(handle);
+        auto pos = m_cache.find(handle.index());
+        if (pos != m_cache.end()) {
+            used(pos->second);
+            return pos->second.data.get();
+        }
+
+        auto data = tpie::make_unique<tpie::blocks::block>();
+        data->resize(BlockSize);
+        if (!m_writer || !m_writer->read_pending(offset(handle), data->get())) {
+            m_blocks.read_block(handle, *data);
+        }
+        return add_to_cache(handle, std::move(data), false);
     }
 
     /// Mark the given block as "dirty", causing any changes
     /// to be written to disk eventually.
+    /// \pre The block is in the cache, i.e. it has been read (or allocated)
+    /// and not evicted since.
     void write_block(handle_type handle) {
-        m_blocks.write_block(handle);
+        auto pos = m_cache.find(handle.index());
+        geodb_assert(pos != m_cache.end(), "the block is not in the cache");
+
+        used(pos->second);
+        pos->second.dirty = true;
     }
 
-    /// For compatibility.
-    operator tpie::blocks::block_collection_cache& () {
-        return m_blocks;
+    /// Evicted blocks will be written asynchronously by a \ref block_writer
+    /// with the given options.
+    /// Blocks that are still waiting for their write are served
+    /// from the writer's queue.
+    void write_behind(const block_writer_options& options) {
+        write_through();
+        m_writer = std::make_unique<block_writer>(m_path, BlockSize, options);
     }
 
+    /// Waits for all pending writes and returns to synchronous writes.
+    /// Rethrows errors that occurred in the background.
+    void write_through() {
+        if (m_writer) {
+            m_writer->flush();
+            m_writer.reset();
+        }
+    }
+
+    /// Returns true if evicted blocks are written asynchronously.
+    bool is_write_behind() const { return m_writer != nullptr; }
+
     static constexpr size_t block_size() { return BlockSize; }
 
 private:
-    tpie::blocks::block_collection_cache m_blocks;
+    using block_ptr = tpie::unique_ptr<tpie::blocks::block>;
+
+    struct cache_entry {
+        block_ptr data;
+        std::list<u64>::iterator lru;
+        bool dirty = false;
+    };
+
+    static u64 offset(handle_type handle) {
+        return handle.index() * BlockSize;
+    }
+
+    tpie::blocks::block* add_to_cache(handle_type handle, block_ptr data, bool dirty) {
+        if (m_cache.size() >= m_max_cache) {
+            evict();
+        }
+
+        m_lru.push_back(handle.index());
+
+        cache_entry& entry = m_cache[handle.index()];
+        entry.data = std::move(data);
+        entry.lru = std::prev(m_lru.end());
+        entry.dirty = dirty;
+        return entry.data.get();
+    }
+
+    /// Removes the least recently used block from the cache.
+    void evict() {
+        const u64 index = m_lru.front();
+        m_lru.pop_front();
+
+        auto pos = m_cache.find(index);
+        if (pos->second.dirty) {
+            if (m_writer) {
+                m_writer->write(offset(index), pos->second.data->get());
+            } else {
+                m_blocks.write_block(handle_type(index), *pos->second.data);
+            }
+        }
+        m_cache.erase(pos);
+    }
+
+    void used(cache_entry& entry) {
+        m_lru.splice(m_lru.end(), m_lru, entry.lru);
+    }
+
+private:
+    fs::path m_path;
+    tpie::blocks::block_collection m_blocks;
+    size_t m_max_cache;
+
+    /// Block indices, least recently used first.
+    std::list<u64> m_lru;
+    std::unordered_map<u64, cache_entry> m_cache;
+
+    /// Writes evicted blocks in write-behind mode (null otherwise).
+    std::unique_ptr<block_writer> m_writer;
+};
+
+/// A range of contiguous blocks reserved by \ref block_collection::get_free_extent().
+/// Blocks are handed out in ascending order, which lays out the data
+/// of related objects (e.g. all postings lists of a single node) sequentially on disk.
+/// Blocks that have not been used are returned to the collection by \ref release().
+template<size_t BlockSize>
+class block_extent : boost::noncopyable {
+public:
+    using handle_type = block_handle<BlockSize>;
+
+public:
+    block_extent(block_collection<BlockSize>& blocks)
+        : m_blocks(blocks)
+    {}
+
+    ~block_extent() {
+        release();
+    }
+
+    /// Reserves `count` contiguous blocks.
+    /// The unused blocks of the previous reservation are released.
+    void reserve(size_t count) {
+        release();
+        if (count > 0) {
+            m_next = m_blocks.get_free_extent(count).index();
+            m_end = m_next + count;
+        }
+    }
+
+    /// Returns the next block of the extent, ready for use.
+    /// Falls back to the collection's free list once all
+    /// reserved blocks have been handed out.
+    handle_type get_free_block() {
+        if (m_next == m_end) {
+            return m_blocks.get_free_block();
+        }
+
+        handle_type handle(m_next++);
+        m_blocks.use_reserved_block(handle);
+        return handle;
+    }
+
+    /// Returns the number of reserved blocks that have not been handed out yet.
+    size_t remaining() const { return m_end - m_next; }
+
+    /// Returns all unused blocks to the collection.
+    void release() {
+        // Blocks are freed in descending order, which means that
+        // the free list hands them out in ascending order again.
+        while (m_end != m_next) {
+            m_blocks.free_block(handle_type(--m_end));
+        }
+        m_next = m_end = 0;
+    }
+
+private:
+    block_collection<BlockSize>& m_blocks;
+
+    /// Index of the next unused block.
+    u64 m_next = 0;
+
+    /// One past the last reserved block.
+    u64 m_end = 0;
 };
 
 } // namespace geodb
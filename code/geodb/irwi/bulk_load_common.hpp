@@ -8,12 +8,20 @@
 #include "geodb/trajectory.hpp"
 #include "geodb/type_traits.hpp"
 #include "geodb/irwi/tree.hpp"
+#include "geodb/utility/arena.hpp"
 #include "geodb/utility/noop.hpp"
+#include "geodb/utility/parallel.hpp"
 
 #include <tpie/serialization2.h>
 #include <tpie/serialization_stream.h>
 
 #include <boost/optional.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <gsl/span>
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
 
 /// \file
 /// Common definitions used by different bulk loading strategies.
@@ -140,6 +148,22 @@ protected:
 
 
 public:
+    /// Returns the number of threads used to build internal nodes.
+    size_t threads() const { return m_threads; }
+
+    /// Sets the number of threads used to build internal nodes.
+    /// The inverted indices of sibling nodes are computed concurrently (see \ref internal_level_builder).
+    /// The resulting tree does not depend on the number of threads.
+    /// With a single thread, every node is built sequentially using constant memory.
+    ///
+    /// \pre `threads > 0`.
+    void threads(size_t threads) {
+        if (threads == 0) {
+            throw std::invalid_argument("thread count must be positive");
+        }
+        m_threads = threads;
+    }
+
     /// Loads the given stream of leaf entries into the tree referenced by this loader.
     ///
     /// This is the main bulk loading function and should be called by the user.
@@ -157,11 +181,22 @@ public:
 
         tree_insertion<state_type> inserter{state()};
         inserter.insert_node(result.root, result.height, size);
+
+        if (standing_query_index* standing = tree().standing_queries()) {
+            entries.seek(0);
+            while (entries.can_read()) {
+                standing->probe(entries.read());
+            }
+        }
     }
 
 protected:
     /// An iterator that visits the label summaries of a single node.
     /// It maps the summary to a posting automatically.
+    ///
+    /// Summaries are read in batches (the remaining entries of the current block),
+    /// which avoids a cache lookup for every entry.
+    /// The buffer is allocated from the thread's arena.
     class label_iterator : public boost::iterator_facade<
             label_iterator,
             label_posting,
@@ -180,8 +215,13 @@ protected:
         /// The marker for the end of this sublist.
         u64 m_end = 0;
 
-        /// We cache the current entry to avoid excessive disk
-        /// operations.
+        /// Summaries starting at `m_position - m_buffer_pos`.
+        mutable arena_vector<label_summary> m_buffer;
+
+        /// Index of the current position in the buffer.
+        mutable size_t m_buffer_pos = 0;
+
+        /// The posting for the current position.
         mutable boost::optional<label_posting> m_cached;
 
     public:
@@ -205,7 +245,7 @@ protected:
             geodb_assert(m_file, "dereferencing invalid iterator");
             geodb_assert(m_position != m_end, "dereferencing end iterator");
             if (!m_cached) {
-                const label_summary ls = (*m_file)[m_position];
+                const label_summary& ls = current();
                 m_cached.emplace(ls.label, posting_type(m_node, ls.summary));
             }
             return *m_cached;
@@ -216,6 +256,7 @@ protected:
             geodb_assert(m_position != m_end, "position out of bounds");
 
             ++m_position;
+            ++m_buffer_pos;
             m_cached.reset();
         }
 
@@ -228,6 +269,20 @@ protected:
                          "comparing iterators of different sublists");
             return m_position == other.m_position;
         }
+
+        /// Returns the summary at the current position, reading
+        /// the next batch if necessary.
+        const label_summary& current() const {
+            if (m_buffer_pos >= m_buffer.size()) {
+                // Batches end at block boundaries, every refill reads a single block.
+                const u64 capacity = label_summary_list::block_capacity();
+                const u64 count = std::min(m_end - m_position, capacity - m_position % capacity);
+                m_buffer.resize(count);
+                m_file->read(m_position, gsl::make_span(m_buffer));
+                m_buffer_pos = 0;
+            }
+            return m_buffer[m_buffer_pos];
+        }
     };
 
     internal_ptr build_internal_node(const std::vector<node_summary>& summaries,
@@ -260,9 +315,23 @@ protected:
         geodb_assert(summaries.size() <= state_type::max_internal_entries(),
                      "Too many entries for an internal node");
 
+        // Label iterators buffer their summaries in the thread's arena.
+        arena_scope scope(thread_arena());
+
         internal_ptr node = storage().create_internal();
         index_builder_ptr builder = storage().index_builder(node);
 
+        // Every child contributes one posting for each of its labels.
+        // The number of distinct labels is not known in advance, but a list
+        // never needs more than one block per posting. Unused blocks are returned by build().
+        {
+            u64 postings = 0;
+            for (const node_summary& ns : summaries) {
+                postings += ns.labels_size;
+            }
+            builder->reserve(index_builder::required_blocks(summaries.size()) + postings);
+        }
+
         // A range of ranges. Every individual range is sorted.
         std::vector<boost::iterator_range<label_iterator>> child_labels;
         child_labels.reserve(summaries.size());
@@ -341,6 +410,247 @@ protected:
         return node;
     }
 
+    /// The content of an internal node whose inverted index has been
+    /// computed in memory but has not been written to the tree yet.
+    struct prepared_node {
+        /// Summaries of the node's children.
+        std::vector<node_summary> children;
+
+        /// The label summaries of all children (concatenated, in child order).
+        std::vector<label_summary> child_labels;
+
+        /// The postings of the node's inverted index, ordered by label and node index.
+        std::vector<label_posting> postings;
+
+        /// Summary of the node's "total" list.
+        posting_data_type total;
+
+        /// Summary of every postings list in the node's index, ordered by label.
+        std::vector<label_summary> labels;
+    };
+
+    /// Creates the internal nodes of a single level and writes their summaries
+    /// to the next level. Nodes are created in the order in which they were pushed.
+    ///
+    /// With more than one thread, nodes are collected in batches.
+    /// The inverted indices and summaries of the nodes in a batch are computed
+    /// concurrently in memory. All storage access (reading the label summaries,
+    /// allocating nodes and postings lists, writing summaries) happens
+    /// on the calling thread, which keeps the block files single threaded
+    /// and makes the tree independent of the number of threads.
+    class internal_level_builder {
+    public:
+        /// Invoked for every new node with the summary that has been written for it.
+        using callback_type = std::function<void(internal_ptr, const node_summary&)>;
+
+        internal_level_builder(bulk_load_common& loader,
+                               const label_summary_list& input,
+                               next_level_streams& output,
+                               callback_type callback = {})
+            : m_loader(loader)
+            , m_input(input)
+            , m_output(output)
+            , m_callback(std::move(callback))
+            , m_max_batch_nodes(loader.threads() * 4)
+        {}
+
+        /// Creates an internal node with the given children.
+        /// The node might only be created by a later call to \ref push or \ref flush.
+        void push(const std::vector<node_summary>& children) {
+            geodb_assert(children.size() <= state_type::max_internal_entries(),
+                         "Too many entries for an internal node");
+
+            u64 labels = 0;
+            for (const node_summary& ns : children) {
+                labels += ns.labels_size;
+            }
+
+#ifdef GEODB_NAIVE_NODE_BUILDING
+            const bool sequential = true;
+#else
+            const bool sequential = m_loader.threads() <= 1 || labels > max_batch_labels;
+#endif
+            if (sequential) {
+                flush();
+                internal_ptr node = m_loader.build_internal_node(children, m_input);
+                finish(node, m_loader.write_summary(m_output, node));
+                return;
+            }
+
+            if (m_batch_size == m_max_batch_nodes || m_batch_labels + labels > max_batch_labels) {
+                flush();
+            }
+
+            if (m_batch.size() == m_batch_size) {
+                m_batch.emplace_back();
+            }
+
+            prepared_node& node = m_batch[m_batch_size++];
+            node.children = children;
+            node.child_labels.resize(labels);
+            u64 offset = 0;
+            for (const node_summary& ns : children) {
+                m_input.read(ns.labels_begin, gsl::make_span(node.child_labels).subspan(offset, ns.labels_size));
+                offset += ns.labels_size;
+            }
+            m_batch_labels += labels;
+        }
+
+        /// Creates all nodes that have been pushed but not yet created.
+        /// Must be called after the last node has been pushed.
+        void flush() {
+            if (m_batch_size == 0) {
+                return;
+            }
+
+            parallel_for(m_batch_size, m_loader.threads(), [&](size_t i) {
+                prepare_node(m_batch[i]);
+            });
+
+            for (size_t i = 0; i < m_batch_size; ++i) {
+                prepared_node& node = m_batch[i];
+                internal_ptr ptr = m_loader.build_internal_node(node);
+                finish(ptr, m_loader.write_summary(m_output, ptr, node));
+            }
+            m_batch_size = 0;
+            m_batch_labels = 0;
+        }
+
+    private:
+        void finish(internal_ptr node, const node_summary& summary) {
+            if (m_callback) {
+                m_callback(node, summary);
+            }
+        }
+
+    private:
+        /// Upper bound for the number of label summaries held in memory by a single batch.
+        /// Nodes with more labels than this are built sequentially.
+        static constexpr u64 max_batch_labels = u64(1) << 15;
+
+        bulk_load_common& m_loader;
+        const label_summary_list& m_input;
+        next_level_streams& m_output;
+        callback_type m_callback;
+
+        /// Maximum number of nodes per batch.
+        const size_t m_max_batch_nodes;
+
+        /// The first `m_batch_size` entries are in use. The remaining nodes are
+        /// kept so their memory can be reused.
+        std::vector<prepared_node> m_batch;
+        size_t m_batch_size = 0;
+        u64 m_batch_labels = 0;
+    };
+
+    /// Computes the inverted index and the summaries of the given node
+    /// from the label summaries of its children.
+    /// Does not access the tree and can therefore be called concurrently
+    /// for different nodes.
+    static void prepare_node(prepared_node& node) {
+        const u32 count = node.children.size();
+
+        // Turn the label summaries of every child into postings.
+        // Every child's postings are already sorted by label.
+        std::vector<label_posting> child_postings;
+        std::vector<u64> child_offsets;
+        child_postings.reserve(node.child_labels.size());
+        child_offsets.reserve(count + 1);
+        {
+            u64 pos = 0;
+            for (u32 i = 0; i < count; ++i) {
+                child_offsets.push_back(child_postings.size());
+                for (u64 j = 0; j < node.children[i].labels_size; ++j, ++pos) {
+                    const label_summary& ls = node.child_labels[pos];
+                    child_postings.emplace_back(ls.label, posting_type(i, ls.summary));
+                }
+            }
+            child_offsets.push_back(child_postings.size());
+        }
+
+        std::vector<boost::iterator_range<const label_posting*>> child_ranges;
+        child_ranges.reserve(count);
+        for (u32 i = 0; i < count; ++i) {
+            child_ranges.emplace_back(child_postings.data() + child_offsets[i],
+                                      child_postings.data() + child_offsets[i + 1]);
+        }
+
+        node.postings.clear();
+        node.postings.reserve(child_postings.size());
+        for_each_sorted(child_ranges, [&](const label_posting& lp) {
+            node.postings.push_back(lp);
+        });
+
+        // Summarize the lists in the same way as `write_summary` would.
+        node.total = combine_summaries(node.children, [](const node_summary& ns) -> const posting_data_type& {
+            return ns.total;
+        });
+
+        node.labels.clear();
+        const auto postings_end = node.postings.end();
+        for (auto group_begin = node.postings.begin(); group_begin != postings_end; ) {
+            const label_type label = group_begin->label;
+            auto group_end = std::find_if(group_begin, postings_end, [&](const label_posting& lp) {
+                return lp.label != label;
+            });
+
+            label_summary ls;
+            ls.label = label;
+            ls.summary = combine_summaries(boost::make_iterator_range(group_begin, group_end),
+                                           [](const label_posting& lp) -> const posting_data_type& {
+                return lp.posting;
+            });
+            node.labels.push_back(ls);
+            group_begin = group_end;
+        }
+    }
+
+    /// Returns the number of blocks occupied by the postings lists
+    /// of the prepared node (including the "total" list).
+    static size_t required_blocks(const prepared_node& node) {
+        size_t blocks = index_builder::required_blocks(node.children.size());
+
+        const auto postings_end = node.postings.end();
+        for (auto group_begin = node.postings.begin(); group_begin != postings_end; ) {
+            const label_type label = group_begin->label;
+            auto group_end = std::find_if(group_begin, postings_end, [&](const label_posting& lp) {
+                return lp.label != label;
+            });
+            blocks += index_builder::required_blocks(group_end - group_begin);
+            group_begin = group_end;
+        }
+        return blocks;
+    }
+
+    /// Writes the prepared node (see \ref prepare_node) to the tree
+    /// and returns a pointer to the new internal node.
+    internal_ptr build_internal_node(const prepared_node& node) {
+        internal_ptr ptr = storage().create_internal();
+        index_builder_ptr builder = storage().index_builder(ptr);
+        builder->reserve(required_blocks(node));
+
+        u32 count = 0;
+        for (const node_summary& ns : node.children) {
+            storage().set_mbb(ptr, count, ns.mbb);
+            storage().set_child(ptr, count, ns.ptr);
+            builder->total().append(posting_type(count, ns.total));
+            ++count;
+        }
+        storage().set_count(ptr, count);
+
+        boost::optional<label_type> current_label;
+        boost::optional<list_type> current_list;
+        for (const label_posting& lp : node.postings) {
+            if (!current_label || *current_label != lp.label) {
+                current_list.emplace(builder->push(lp.label));
+                current_label = lp.label;
+            }
+            current_list->append(lp.posting);
+        }
+        builder->build();
+        return ptr;
+    }
+
 protected:
     /// Writes the node summary of `leaf` to the given output file.
     void write_summary(next_level_streams& streams, leaf_ptr leaf)
@@ -382,7 +692,8 @@ protected:
     }
 
     /// Writes the node summary of `internal` to the given output file.
-    void write_summary(next_level_streams& streams, internal_ptr internal)
+    /// Returns the summary that was written.
+    node_summary write_summary(next_level_streams& streams, internal_ptr internal)
     {
         geodb_assert(streams.summaries.offset() == streams.summaries.size(),
                      "File must be positioned at the end.");
@@ -405,9 +716,52 @@ protected:
             label_sum.summary = make_summary(entry.postings_list());
             streams.label_summaries.append(label_sum);
         }
+        return node_sum;
+    }
+
+    /// Writes the node summary of `internal`, which has been built from
+    /// the prepared `node`, to the given output file.
+    /// The summaries have already been computed by \ref prepare_node.
+    /// Returns the summary that was written.
+    node_summary write_summary(next_level_streams& streams, internal_ptr internal, const prepared_node& node)
+    {
+        geodb_assert(streams.summaries.offset() == streams.summaries.size(),
+                     "File must be positioned at the end.");
+
+        node_summary& node_sum = m_node_summary_buf;
+        node_sum.ptr = internal;
+        node_sum.mbb = state().get_mbb(internal);
+        node_sum.total = node.total;
+        node_sum.labels_begin = streams.label_summaries.size();
+        node_sum.labels_size = node.labels.size();
+        streams.summaries.write(node_sum);
+
+        for (const label_summary& ls : node.labels) {
+            streams.label_summaries.append(ls);
+        }
+        return node_sum;
     }
 
 private:
+    /// Combines a range of posting summaries in the same way
+    /// as the summary of a postings list is computed.
+    template<typename Range, typename Getter>
+    static posting_data_type combine_summaries(const Range& range, Getter&& get) {
+        using id_set_t = typename posting_data_type::id_set_type;
+
+        u64 count = 0;
+        std::vector<id_set_t> sets;
+        for (const auto& item : range) {
+            const posting_data_type& data = get(item);
+            count += data.count();
+            sets.push_back(data.id_set());
+        }
+
+        posting_data_type result;
+        result.count(count);
+        result.id_set(id_set_t::set_union(sets));
+        return result;
+    }
 
     posting_data_type make_summary(const_list_ptr list) {
         list_summary sum = list->summarize();
@@ -452,6 +806,7 @@ protected:
 
 private:
     tree_type& m_tree;
+    size_t m_threads = 1;
     node_summary m_node_summary_buf;
     label_summary m_label_summary_buf;
 };
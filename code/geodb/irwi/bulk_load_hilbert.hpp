@@ -11,6 +11,10 @@
 #include <tpie/file_stream.h>
 #include <tpie/serialization_stream.h>
 
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
 /// \file
 /// Bulk loading based on hilbert values.
 
@@ -21,6 +25,10 @@ namespace geodb {
 /// Entries are then visited in linear order to form leaf nodes,
 /// which in turn are packed together into internal nodes until
 /// only the root remains.
+///
+/// Labels can optionally be used as a fourth dimension of the curve
+/// (see \ref label_mode), which produces subtrees with fewer distinct labels
+/// (and thus smaller inverted indices) while keeping the single sort pass.
 template<typename Tree>
 class hilbert_loader : public bulk_load_common<Tree, hilbert_loader<Tree>> {
     using common_t = typename hilbert_loader::bulk_load_common;
@@ -36,6 +44,7 @@ class hilbert_loader : public bulk_load_common<Tree, hilbert_loader<Tree>> {
     using typename common_t::last_level_streams;
     using typename common_t::next_level_streams;
     using typename common_t::subtree_result;
+    using typename common_t::internal_level_builder;
 
     using leaf_ptr = typename state_type::leaf_ptr;
     using internal_ptr = typename state_type::internal_ptr;
@@ -49,13 +58,45 @@ class hilbert_loader : public bulk_load_common<Tree, hilbert_loader<Tree>> {
     // for a total of 2^48 possible hilbert index values.
     using curve = hilbert_curve<3, 16>;
 
+    // Four dimensional curve (x, y, t, label) with 16 bits per coordinate (2^64 values).
+    using label_curve = hilbert_curve<4, 16>;
+
     using curve_coordiante = typename curve::coordinate_t;
     using curve_point = typename curve::point_t;
 
+    static_assert(curve::precision == label_curve::precision, "Curves must use the same precision");
+
 public:
-    explicit hilbert_loader(Tree& tree)
+    /// Determines whether labels are used as a dimension of the hilbert curve.
+    enum class label_mode {
+        /// Entries are ordered by the (x, y, t) coordinates of their center.
+        ignored,
+
+        /// Labels are ranked by their frequency (the most frequent label has rank 0)
+        /// and the rank is used as the fourth coordinate of the curve.
+        /// Entries with the same label share that coordinate, labels of
+        /// similar frequency are close to each other.
+        frequency,
+    };
+
+    /// \param tree
+    ///     The target of the bulk loading operation.
+    /// \param mode
+    ///     Determines whether labels are part of the curve.
+    /// \param label_weight
+    ///     A factor in [0, 1] for the influence of the label dimension.
+    ///     The label coordinates are scaled into `[0, label_weight * max]`.
+    ///     Because the hilbert curve orders points by their most significant bits first,
+    ///     a smaller range means that labels only influence the order at a finer granularity.
+    ///     Only used if `mode != label_mode::ignored`.
+    explicit hilbert_loader(Tree& tree, label_mode mode = label_mode::ignored, double label_weight = 1.0)
         : common_t(tree)
-    {}
+        , m_mode(mode)
+        , m_label_weight(label_weight)
+    {
+        if (m_label_weight < 0 || m_label_weight > 1)
+            throw std::invalid_argument("label weight must be in [0, 1]");
+    }
 
 private:
     friend common_t;
@@ -154,9 +195,45 @@ private:
         }
     };
 
+    /// Maps every label to its coordinate in the label dimension of the curve.
+    /// Labels are ranked by their frequency in the input (ties are broken by label id).
+    std::unordered_map<label_type, curve_coordiante> map_labels(tpie::file_stream<tree_entry>& input) {
+        std::unordered_map<label_type, u64> counts;
+        input.seek(0);
+        while (input.can_read()) {
+            ++counts[input.read().unit.label];
+        }
+
+        std::vector<std::pair<u64, label_type>> ranked;
+        ranked.reserve(counts.size());
+        for (const auto& pair : counts) {
+            ranked.emplace_back(pair.second, pair.first);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        static constexpr u64 coord_max = (1 << curve::precision) - 1;
+        const double max_rank = std::max<size_t>(ranked.size(), 2) - 1;
+        const double scale = m_label_weight * static_cast<double>(coord_max);
+
+        std::unordered_map<label_type, curve_coordiante> result;
+        result.reserve(ranked.size());
+        for (size_t rank = 0; rank < ranked.size(); ++rank) {
+            const u64 c = static_cast<u64>(static_cast<double>(rank) / max_rank * scale);
+            result.emplace(ranked[rank].second, curve_coordiante{std::min(c, coord_max)});
+        }
+        return result;
+    }
+
     void map_entries(tpie::file_stream<tree_entry>& input, tpie::file_stream<hilbert_entry>& output) {
         point_mapper mapper(get_total(input));
 
+        std::unordered_map<label_type, curve_coordiante> labels;
+        if (m_mode != label_mode::ignored) {
+            labels = map_labels(input);
+        }
+
         input.seek(0);
         output.truncate(input.size());
         output.seek(0);
@@ -166,7 +243,17 @@ private:
 
             hilbert_entry result;
             result.inner = entry;
-            result.hilbert_index = curve::hilbert_index(mapper(center));
+            switch (m_mode) {
+            case label_mode::ignored:
+                result.hilbert_index = curve::hilbert_index(mapper(center));
+                break;
+            case label_mode::frequency: {
+                const curve_point p = mapper(center);
+                typename label_curve::point_t lp{ p[0], p[1], p[2], labels.at(entry.unit.label) };
+                result.hilbert_index = label_curve::hilbert_index(lp);
+                break;
+            }
+            }
             output.write(result);
         }
     }
@@ -235,6 +322,7 @@ private:
         u64 internals = 0;
         u64 remaining = count;
 
+        internal_level_builder builder(*this, input.label_summaries, output);
         std::vector<node_summary> node_content;
         node_content.reserve(state_type::max_internal_entries());
         while (remaining) {
@@ -244,13 +332,12 @@ private:
             for (u32 i = 0; i < count; ++i) {
                 node_content.push_back(input.summaries.read());
             }
-
-            internal_ptr internal = common_t::build_internal_node(node_content, input.label_summaries);
-            common_t::write_summary(output, internal);
+            builder.push(node_content);
 
             remaining -= count;
             ++internals;
         }
+        builder.flush();
         return internals;
     }
 
@@ -259,6 +346,12 @@ private:
     using common_t::storage;
 
 private:
+    /// Determines whether labels are part of the curve.
+    const label_mode m_mode;
+
+    /// Influence of the label dimension (in [0, 1]).
+    const double m_label_weight;
+
     /// Threshold after which the heuristic becomes active at the leaf level.
     /// When this many items are already within the current leaf,
     /// new items will only be accepted under certain conditions.
@@ -36,11 +36,9 @@ namespace geodb {
 /// Values are inserted as usual until the tree reaches a certain number of leaves,
 /// at which point all leaf nodes are flushed to disk and then deleted from internal memory.
 /// However, the internal nodes are retained to distribute any remaining values.
-template<typename Value, typename Accessor, size_t block_size, u32 fanout_leaf, u32 fanout_internal>
+template<typename Value, typename Accessor, u32 fanout_leaf, u32 fanout_internal>
 class quick_load_tree {
-    // TODO: Make our own storage implementation derived from the normal internal storage.
-    // Inverted indices and postings can grow large and should then be stored in external memory.
-    using storage_spec = quickload::tree_storage<block_size, fanout_leaf, fanout_internal>;
+    using storage_spec = quickload::tree_storage<fanout_leaf, fanout_internal>;
 
     using value_type = Value;
 
@@ -73,9 +71,14 @@ private:
     bool m_leaves_flushed = false;
 
 public:
-    quick_load_tree(Accessor accessor, double weight, size_t posting_cache_blocks)
-        : m_state(storage_spec(posting_cache_blocks), std::move(accessor), weight)
-    {}
+    quick_load_tree(Accessor accessor, double weight,
+                    split_strategy split = split_strategy::quadratic,
+                    beta_strategy strategy = default_beta_strategy())
+        : m_state(storage_spec(), std::move(accessor), weight)
+    {
+        m_state.split(split);
+        m_state.strategy(strategy);
+    }
 
     /// Inserts the value into the tree. Grows the tree if necessary.
     /// Can only be used before the leaves have been flushed.
@@ -138,6 +141,11 @@ public:
         return storage().get_leaf_count();
     }
 
+    /// Returns the number of bytes occupied by the nodes of this tree.
+    size_t memory() const {
+        return storage().memory();
+    }
+
 private:
     state_type& state() { return m_state; }
 
@@ -208,9 +216,9 @@ using container = multi_index_container<
 /// into nodes for the current level.
 /// This process is repeated until only one node remains.
 /// This node becomes the root of the tree.
-template<typename Value, typename Accessor, size_t block_size, u32 fanout_leaf, u32 fanout_internal>
+template<typename Value, typename Accessor, u32 fanout_leaf, u32 fanout_internal>
 class quick_load_pass {
-    using tree_type = quick_load_tree<Value, Accessor, block_size, fanout_leaf, fanout_internal>;
+    using tree_type = quick_load_tree<Value, Accessor, fanout_leaf, fanout_internal>;
 
     using node_id = typename tree_type::node_id;
 
@@ -279,21 +287,28 @@ private:
     /// Maximum number of leaf nodes until we switch to external buckets.
     size_t m_max_leaves = 0;
 
-    /// Number of cached blocks for all internal nodes.
-    size_t m_cache_blocks = 0;
+    /// Maximum size of the tree in bytes. The tree stops growing once this
+    /// limit has been reached, even if it has fewer than m_max_leaves leaves.
+    size_t m_max_memory = 0;
 
     // Tree parameters
     Accessor m_accessor;
     double m_weight = 0;
+    split_strategy m_split = split_strategy::quadratic;
+    beta_strategy m_strategy = beta_strategy::normal;
 
 public:
-    quick_load_pass(size_t max_leaves, size_t cache_blocks, Accessor accessor, double weight)
+    quick_load_pass(size_t max_leaves, size_t max_memory, Accessor accessor, double weight,
+                    split_strategy split = split_strategy::quadratic,
+                    beta_strategy strategy = default_beta_strategy())
         : m_bucket_dir("buckets")
         , m_bucket_alloc(m_bucket_dir.path(), ".bucket")
         , m_max_leaves(max_leaves)
-        , m_cache_blocks(cache_blocks)
+        , m_max_memory(max_memory)
         , m_accessor(std::move(accessor))
         , m_weight(weight)
+        , m_split(split)
+        , m_strategy(strategy)
     {
         clear_tree();
         m_leaf_buffer.open();
@@ -358,7 +373,7 @@ private:
         // Create an in-memory tree with the requested maximum number of leaves.
         {
             STATS_GUARD(guard, "Creating leaves");
-            while (source.can_read() && m_tree->leaf_node_count() < m_max_leaves) {
+            while (source.can_read() && !tree_full()) {
                 m_tree->insert(source.read());
             }
 
@@ -410,6 +425,13 @@ private:
         reset();
     }
 
+    /// Returns true if no more values should be inserted into the in-memory tree.
+    /// The tree always gets at least two leaves so that every pass makes progress.
+    bool tree_full() const {
+        const size_t leaves = m_tree->leaf_node_count();
+        return leaves >= m_max_leaves || (leaves >= 2 && m_tree->memory() >= m_max_memory);
+    }
+
     /// Takes the leaf's entries and forwards them to the target.
     /// The leaf must not have an associated bucket.
     template<typename NextLevel>
@@ -476,7 +498,7 @@ private:
     /// Clear the tree.
     void clear_tree() {
         m_tree.reset();
-        m_tree.emplace(m_accessor, m_weight, m_cache_blocks);
+        m_tree.emplace(m_accessor, m_weight, m_split, m_strategy);
     }
 
     u64 alloc_bucket() {
@@ -553,6 +575,7 @@ class quick_loader : public bulk_load_common<Tree, quick_loader<Tree>> {
     using posting_type = typename state_type::posting_type;
 
     using node_summary = typename common_t::node_summary;
+    using internal_level_builder = typename common_t::internal_level_builder;
     using label_summary = typename common_t::label_summary;
     using list_summary = typename common_t::list_summary;
 
@@ -562,14 +585,12 @@ class quick_loader : public bulk_load_common<Tree, quick_loader<Tree>> {
 
     using leaf_pass_t = quick_load_pass<
         tree_entry, detail::tree_entry_accessor,
-        storage_type::get_block_size(),
         tree_type::max_leaf_entries(), tree_type::max_internal_entries()>;
 
     class pseudo_leaf_entry_accessor;
 
     using internal_pass_t = quick_load_pass<
         pseudo_leaf_entry, pseudo_leaf_entry_accessor,
-        storage_type::get_block_size(),
         tree_type::max_internal_entries(), tree_type::max_internal_entries()>;
 
     struct level_files : common_t::level_files {
@@ -610,16 +631,19 @@ class quick_loader : public bulk_load_common<Tree, quick_loader<Tree>> {
     struct params_t {
         size_t max_leaves;
         size_t max_internal;
-        size_t total_cache_blocks;
+        size_t postings_blocks;
+        size_t max_memory;
 
-        params_t(size_t memory, size_t blocks_per_internal) {
+        params_t(size_t memory, size_t blocks_per_internal)
+            : max_memory(memory)
+        {
             // Available blocks in memory.
-            size_t blocks = memory / block_size;
+            size_t blocks = memory / storage_type::get_block_size();
 
             // Minimum fanout for internal nodes.
             size_t min_fanout = state_type::min_internal_entries();
 
-            // Cost of an internal node (including the additional cache).
+            // Cost of an internal node (including its postings lists, which are kept in memory).
             double internal_cost = 1 + blocks_per_internal;
 
             // Total leaf cost (including additional cost for internal nodes).
@@ -629,7 +653,7 @@ class quick_loader : public bulk_load_common<Tree, quick_loader<Tree>> {
 
             max_leaves = leaves - internal_cost * leaf_log;
             max_internal = max_leaves / (min_fanout - 1);
-            total_cache_blocks = max_internal * blocks_per_internal;
+            postings_blocks = max_internal * blocks_per_internal;
         }
     };
 
@@ -637,10 +661,15 @@ public:
     /// Creates a new instance from the given tree and the specified maximum number of nodes.
     ///
     /// \param tree         The target of the bulk loading operation.
+    /// \param blocks_per_internal
+    ///     The (estimated) number of blocks occupied by the postings lists
+    ///     of a single internal node in the in-memory tree.
     explicit quick_loader(Tree& tree, size_t blocks_per_internal)
         : common_t(tree)
         , m_leaf_params(tpie::get_memory_manager().available(), blocks_per_internal)
         , m_weight(tree.weight())
+        , m_split(tree.split())
+        , m_strategy(tree.strategy())
     {
         if (m_leaf_params.max_leaves < 2)
             throw std::logic_error("Must have enough space for at least two leaf nodes.");
@@ -656,10 +685,12 @@ private:
         fmt::print("Quickload parameters:\n"
                    "    max-leaves: {}\n"
                    "    max-internal: {}\n"
-                   "    cache-blocks: {}\n",
+                   "    postings-blocks: {}\n"
+                   "    max-memory: {} MB\n",
                    m_leaf_params.max_leaves,
                    m_leaf_params.max_internal,
-                   m_leaf_params.total_cache_blocks);
+                   m_leaf_params.postings_blocks,
+                   m_leaf_params.max_memory / (1024 * 1024));
 
         STATS_GUARD(guard, "Quickload");
 
@@ -748,8 +779,8 @@ private:
             ++created_nodes;
         };
 
-        leaf_pass_t pass(m_leaf_params.max_leaves, m_leaf_params.total_cache_blocks,
-                         detail::tree_entry_accessor(), m_weight);
+        leaf_pass_t pass(m_leaf_params.max_leaves, m_leaf_params.max_memory,
+                         detail::tree_entry_accessor(), m_weight, m_split, m_strategy);
         pass.run(source, node_callback);
         return created_nodes;
     }
@@ -853,6 +884,33 @@ private:
         next_level_t next_level(next_files);
 
         u64 created_nodes = 0;
+
+        // Invoked once the node has been written to the tree.
+        auto node_created = [&](internal_ptr node, const node_summary& summary) {
+            unused(node);
+
+            // The label summaries of the new node have just been
+            // appended to the next level.
+            const u64 labels_ptr = next_level.label_counts.size();
+            const u64 labels_end = summary.labels_begin + summary.labels_size;
+            for (u64 pos = summary.labels_begin; pos < labels_end; ++pos) {
+                const label_summary ls = next_level.label_summaries[pos];
+                next_level.label_counts.append({ls.label, ls.summary.count()});
+            }
+
+            // Represents this subtree in the next level.
+            pseudo_leaf_entry entry;
+            entry.summary_ptr = next_level.summaries.size() - 1;
+            entry.labels_begin = labels_ptr;
+            entry.labels_size = summary.labels_size;
+            entry.mbb = summary.mbb;
+            entry.unit_count = summary.total.count();
+            next_level.entries.write(entry);
+
+            ++created_nodes;
+        };
+        internal_level_builder builder(*this, last_level.label_summaries, next_level, node_created);
+
         std::vector<node_summary> summaries;
         summaries.reserve(state_type::max_internal_entries());
 
@@ -870,34 +928,13 @@ private:
                 last_summaries.seek(summary_ptr);
                 summaries.push_back(last_summaries.peek());
             }
-
-            internal_ptr node = common_t::build_internal_node(summaries, last_level.label_summaries);
-            const_index_ptr index = storage().const_index(node);
-
-            const u64 summary_ptr = next_level.summaries.size();
-            common_t::write_summary(next_level, node);
-
-            const u64 labels_ptr = next_level.label_counts.size();
-            for (auto entry : *index) {
-                next_level.label_counts.append({entry.label(), entry.postings_list()->summarize_count()});
-            }
-
-            // Represents this subtree in the next level.
-            pseudo_leaf_entry entry;
-            entry.summary_ptr = summary_ptr;
-            entry.labels_begin = labels_ptr;
-            entry.labels_size = index->size();
-            entry.mbb = state().get_mbb(node);
-            entry.unit_count = index->total()->summarize_count();
-            next_level.entries.write(entry);
-
-            ++created_nodes;
+            builder.push(summaries);
         };
 
-        internal_pass_t pass(m_leaf_params.max_leaves * size_factor,
-                             m_leaf_params.total_cache_blocks * size_factor,
-                             pseudo_leaf_entry_accessor(last_level.label_counts), m_weight);
+        internal_pass_t pass(m_leaf_params.max_leaves * size_factor, m_leaf_params.max_memory,
+                             pseudo_leaf_entry_accessor(last_level.label_counts), m_weight, m_split, m_strategy);
         pass.run(last_level.entries, node_callback);
+        builder.flush();
         return created_nodes;
     }
 
@@ -912,6 +949,12 @@ private:
 
     /// beta
     const double m_weight;
+
+    /// Split algorithm used by the in-memory trees.
+    const split_strategy m_split;
+
+    /// Beta strategy used by the in-memory trees.
+    const beta_strategy m_strategy;
 };
 
 } // namespace geodb
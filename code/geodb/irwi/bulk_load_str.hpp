@@ -51,6 +51,7 @@ class str_loader : public bulk_load_common<Tree, str_loader<Tree>> {
     using typename common_t::level_files;
     using typename common_t::last_level_streams;
     using typename common_t::next_level_streams;
+    using typename common_t::internal_level_builder;
 
     static vector3 center(const tree_entry& e) {
         return e.unit.center();
@@ -183,6 +184,7 @@ private:
         u64 internals = 0;
         u64 items_remaining = count;
 
+        internal_level_builder builder(*this, input.label_summaries, output);
         std::vector<node_summary> node_content;
         node_content.reserve(m_internal_size);
         while (items_remaining) {
@@ -192,13 +194,12 @@ private:
             for (u32 i = 0; i < count; ++i) {
                 node_content.push_back(input.summaries.read());
             }
-
-            internal_ptr internal = common_t::build_internal_node(node_content, input.label_summaries);
-            common_t::write_summary(output, internal);
+            builder.push(node_content);
 
             items_remaining -= count;
             ++internals;
         }
+        builder.flush();
 
         return internals;
     }
@@ -194,9 +194,11 @@ public:
     ///     The map will be filled with an element for each matching child entry.
     ///     The index of the child entry is used as the map key. The map
     ///     value is the union of trajectory identifiers stored within
-    ///     the entry's subtree.
-    void matching_children(const std::unordered_set<label_type>& labels,
-                           std::unordered_map<entry_id_type, id_set<Lambda>>& entries) const
+    ///     the entry's subtree. Any map type with the interface of
+    ///     `std::unordered_map<entry_id_type, id_set<Lambda>>` can be used
+    ///     (e.g. a map that allocates from an \ref arena).
+    template<typename EntryMap>
+    void matching_children(const std::unordered_set<label_type>& labels, EntryMap& entries) const
     {
         entries.clear();
 
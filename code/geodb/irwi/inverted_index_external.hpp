@@ -107,10 +107,11 @@ protected:
 
     /// Create a new list in the block storage and return both its
     /// block number and the new instance.
-    std::tuple<list_handle, list_type> create_list() {
-        list_handle handle = m_list_blocks.get_free_block();
+    /// All blocks of the list are taken from the given extent (if not null).
+    std::tuple<list_handle, list_type> create_list(block_extent<block_size>* extent = nullptr) {
+        list_handle handle = extent ? extent->get_free_block() : m_list_blocks.get_free_block();
         // Create a new list instance to initialize the base page.
-        list_type list(list_storage_type(m_list_blocks, handle, true));
+        list_type list(list_storage_type(m_list_blocks, handle, true, extent));
         return std::make_tuple(handle, std::move(list));
     }
 
@@ -280,6 +281,10 @@ private:
 /// An index is a mapping from label index to posting list.
 /// This class allows label indices to be pushed in sorted (and unique)
 /// order and their posting lists to be filled at will.
+///
+/// The blocks of all lists can be allocated from a single contiguous
+/// extent (see \ref reserve()), which places the postings of a node
+/// next to each other on disk.
 template<size_t block_size, u32 Lambda>
 class inverted_index_external_builder
         : public inverted_index_external_common<block_size, Lambda>
@@ -288,6 +293,7 @@ class inverted_index_external_builder
     using common_t = typename inverted_index_external_builder::inverted_index_external_common;
 
     using typename common_t::list_handle;
+    using typename common_t::list_storage_type;
     using typename common_t::builder_type;
     using typename common_t::value_type;
 
@@ -301,15 +307,11 @@ public:
                                    block_collection<block_size>& list_blocks)
         : common_t(directory, list_blocks)
         , m_builder(common_t::tree_path().string())
+        , m_extent(list_blocks)
     {
         if (this->read_state()) {
             throw std::logic_error("A previous state already exists, cannot build a new index!");
         }
-
-        // Create the "total" list in the constructor because its required anyway.
-        auto result = this->create_list();
-        this->m_total = std::get<0>(result);
-        this->m_total_list.emplace(std::move(std::get<1>(result)));
     }
 
     ~inverted_index_external_builder() {
@@ -318,9 +320,30 @@ public:
         }
     }
 
+    /// Returns the number of blocks required for a single list with `size` entries.
+    static constexpr size_t required_blocks(size_t size) {
+        return list_storage_type::template required_blocks<typename list_type::posting_type>(size);
+    }
+
+    /// Reserves a contiguous extent of `blocks` blocks for the lists of this index.
+    /// Lists are laid out in the order in which they are created
+    /// (the "total" list is created by the first call to \ref total()).
+    /// Lists continue in ordinary blocks once the extent has been used up,
+    /// unused blocks are returned when the index is built.
+    ///
+    /// \pre Neither \ref total() nor \ref push() have been called.
+    void reserve(size_t blocks) {
+        geodb_assert(!m_total_list && !m_pushed, "lists have already been created");
+        m_extent.reserve(blocks);
+    }
+
     /// Returns a reference to the "total" posting list.
     list_type& total() {
-        geodb_assert(m_total_list, "optional must never be empty.");
+        if (!m_total_list) {
+            auto result = common_t::create_list(&m_extent);
+            this->m_total = std::get<0>(result);
+            m_total_list.emplace(std::move(std::get<1>(result)));
+        }
         return *m_total_list;
     }
 
@@ -332,12 +355,13 @@ public:
             throw std::logic_error("build() has already been called");
         }
 
-        auto result = common_t::create_list();
+        auto result = common_t::create_list(&m_extent);
 
         value_type value;
         value.label_id = label;
         value.handle = std::get<0>(result);
         m_builder.push(value);
+        m_pushed = true;
 
         return std::move(std::get<1>(result));
     }
@@ -348,6 +372,9 @@ public:
             throw std::logic_error("build() called more than once.");
         }
         m_built = true;
+
+        total(); // The "total" list always exists.
+        m_extent.release();
         m_builder.build(); // do not care about the btree at this point.
         this->write_state();
     }
@@ -355,9 +382,15 @@ public:
 private:
     builder_type m_builder;
 
-    // optional for delayed initializtion. never empty after construction.
+    /// Blocks reserved for the lists of this index.
+    block_extent<block_size> m_extent;
+
+    // optional for delayed initialization. created by the first call to total().
     boost::optional<list_type> m_total_list;
 
+    /// True if push() has been called.
+    bool m_pushed = false;
+
     /// True if build() has been called once.
     bool m_built = false;
 };
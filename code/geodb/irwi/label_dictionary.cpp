@@ -0,0 +1,455 @@
+#include "geodb/irwi/label_dictionary.hpp"
+
+#include "geodb/bloom_filter.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+namespace geodb {
+
+namespace {
+
+constexpr u64 dictionary_magic = 0x5443494442444547; // "GEDBDICT"
+constexpr u64 dictionary_version = 1;
+
+/// Marks ids in the id -> rank table that have no name.
+constexpr u32 no_rank = u32(-1);
+
+/// Number of seeds tried before giving up on the perfect hash function.
+constexpr u64 max_hash_attempts = 64;
+
+u64 mix(u64 x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+struct name_hash {
+    u64 bucket;
+    u64 slot;
+};
+
+name_hash hash_name(const char* data, size_t size, u64 seed) {
+    std::array<u64, 2> h = murmur3(reinterpret_cast<const u8*>(data), size);
+    return name_hash{mix(h[0] ^ seed), mix(h[1] + seed)};
+}
+
+u64 hash_slot(const name_hash& h, u64 displacement, u64 slots) {
+    return mix(h.slot + displacement * 0x9e3779b97f4a7c15ULL) % slots;
+}
+
+u64 hash_bucket(const name_hash& h, u64 buckets) {
+    return h.bucket % buckets;
+}
+
+void write_varint(std::string& out, u64 value) {
+    while (value >= 0x80) {
+        out.push_back(char(u8(value) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+template<typename T>
+void write_array(std::string& out, const std::vector<T>& values) {
+    out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+void align(std::string& out) {
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+}
+
+/// Computes a minimal perfect hash function for the given names
+/// using "hash and displace": names are distributed into buckets,
+/// then, starting with the largest bucket, a displacement is searched
+/// that maps all names of the bucket into free slots.
+///
+/// Returns false if no displacement could be found for some bucket
+/// using the given seed.
+bool build_hash(const std::vector<label_mapping>& mappings, u64 seed,
+                std::vector<u32>& displacements, std::vector<u32>& slot_ranks)
+{
+    const u64 size = mappings.size();
+    const u64 buckets = displacements.size();
+
+    std::vector<name_hash> hashes;
+    hashes.reserve(size);
+    for (const label_mapping& m : mappings) {
+        hashes.push_back(hash_name(m.name.data(), m.name.size(), seed));
+    }
+
+    std::vector<std::vector<u32>> members(buckets);
+    for (u64 rank = 0; rank < size; ++rank) {
+        members[hash_bucket(hashes[rank], buckets)].push_back(rank);
+    }
+
+    std::vector<u32> order(buckets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        return members[a].size() > members[b].size();
+    });
+
+    // The last buckets have to find one of very few free slots,
+    // the number of tries is proportional to the table size.
+    const u64 max_displacement = std::min<u64>(size * 16 + 1024, u32(-1));
+
+    std::fill(slot_ranks.begin(), slot_ranks.end(), no_rank);
+    std::fill(displacements.begin(), displacements.end(), 0);
+
+    std::vector<u64> slots;
+    for (u32 bucket : order) {
+        const std::vector<u32>& names = members[bucket];
+        if (names.empty()) {
+            break;
+        }
+
+        bool placed = false;
+        for (u64 d = 0; d < max_displacement && !placed; ++d) {
+            slots.clear();
+            placed = true;
+            for (u32 rank : names) {
+                const u64 slot = hash_slot(hashes[rank], d, size);
+                if (slot_ranks[slot] != no_rank
+                        || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+                    placed = false;
+                    break;
+                }
+                slots.push_back(slot);
+            }
+
+            if (placed) {
+                for (size_t i = 0; i < names.size(); ++i) {
+                    slot_ranks[slots[i]] = names[i];
+                }
+                displacements[bucket] = d;
+            }
+        }
+        if (!placed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+struct label_dictionary::header {
+    u64 magic;
+    u64 version;
+    u64 size;
+    u64 bucket_size;
+    u64 buckets;
+    u64 min_id;
+    u64 id_count;
+    u64 hash_seed;
+    u64 hash_buckets;
+    u64 bucket_offsets;
+    u64 strings;
+    u64 strings_size;
+    u64 sorted_ids;
+    u64 id_ranks;
+    u64 displacements;
+    u64 slot_ranks;
+    u64 file_size;
+};
+
+/// Decodes the front coded names, starting at some bucket.
+class label_dictionary::cursor {
+public:
+    cursor(const label_dictionary& dict, u64 rank)
+        : m_dict(dict)
+        , m_rank(rank - rank % bucket_size)
+    {
+        if (m_rank < m_dict.m_size) {
+            m_pos = m_dict.m_strings + m_dict.m_bucket_offsets[m_rank / bucket_size];
+            decode();
+            while (m_rank < rank) {
+                next();
+            }
+        } else {
+            m_rank = m_dict.m_size;
+        }
+    }
+
+    bool valid() const { return m_rank < m_dict.m_size; }
+
+    u64 rank() const { return m_rank; }
+
+    const std::string& name() const { return m_name; }
+
+    void next() {
+        geodb_assert(valid(), "cursor is at the end");
+        if (++m_rank < m_dict.m_size) {
+            decode();
+        }
+    }
+
+private:
+    void decode() {
+        const u64 shared = read_varint();
+        const u64 suffix = read_varint();
+        geodb_assert(shared <= m_name.size(), "invalid shared prefix length");
+        m_name.resize(shared);
+        m_name.append(m_pos, suffix);
+        m_pos += suffix;
+    }
+
+    u64 read_varint() {
+        u64 value = 0;
+        for (u32 shift = 0; ; shift += 7) {
+            const u8 byte = u8(*m_pos++);
+            value |= u64(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+    }
+
+private:
+    const label_dictionary& m_dict;
+    u64 m_rank;
+    const char* m_pos = nullptr;
+    std::string m_name;
+};
+
+constexpr u32 label_dictionary::bucket_size;
+
+void label_dictionary::build(const fs::path& path, std::vector<label_mapping> mappings) {
+    std::sort(mappings.begin(), mappings.end(), [](const label_mapping& a, const label_mapping& b) {
+        return a.name < b.name;
+    });
+    for (size_t i = 1; i < mappings.size(); ++i) {
+        if (mappings[i - 1].name == mappings[i].name) {
+            throw std::invalid_argument(fmt::format("Duplicate label name \"{}\".", mappings[i].name));
+        }
+    }
+
+    const u64 size = mappings.size();
+
+    header h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic = dictionary_magic;
+    h.version = dictionary_version;
+    h.size = size;
+    h.bucket_size = bucket_size;
+    h.buckets = (size + bucket_size - 1) / bucket_size;
+
+    // Sorted ids and the inverse mapping.
+    std::vector<u32> sorted_ids(size);
+    std::vector<u32> id_ranks;
+    if (size > 0) {
+        auto minmax = std::minmax_element(mappings.begin(), mappings.end(),
+                                          [](const label_mapping& a, const label_mapping& b) {
+            return a.id < b.id;
+        });
+        h.min_id = minmax.first->id;
+        h.id_count = u64(minmax.second->id) - h.min_id + 1;
+        id_ranks.resize(h.id_count, no_rank);
+        for (u64 rank = 0; rank < size; ++rank) {
+            const u64 index = mappings[rank].id - h.min_id;
+            if (id_ranks[index] != no_rank) {
+                throw std::invalid_argument(fmt::format("Duplicate label id {}.", mappings[rank].id));
+            }
+            id_ranks[index] = rank;
+            sorted_ids[rank] = mappings[rank].id;
+        }
+    }
+
+    // Front coded names.
+    std::string strings;
+    std::vector<u64> bucket_offsets;
+    bucket_offsets.reserve(h.buckets);
+    for (u64 rank = 0; rank < size; ++rank) {
+        const std::string& name = mappings[rank].name;
+        u64 shared = 0;
+        if (rank % bucket_size == 0) {
+            bucket_offsets.push_back(strings.size());
+        } else {
+            const std::string& prev = mappings[rank - 1].name;
+            shared = std::mismatch(prev.begin(), prev.end(), name.begin(), name.end()).first - prev.begin();
+        }
+        write_varint(strings, shared);
+        write_varint(strings, name.size() - shared);
+        strings.append(name, shared, std::string::npos);
+    }
+
+    // Perfect hash function.
+    h.hash_buckets = std::max<u64>(1, size / 2);
+    std::vector<u32> displacements(h.hash_buckets);
+    std::vector<u32> slot_ranks(size);
+    for (u64 attempt = 0; ; ++attempt) {
+        if (attempt == max_hash_attempts) {
+            throw std::runtime_error("Failed to construct a perfect hash function for the label names.");
+        }
+        h.hash_seed = mix(attempt + 1);
+        if (build_hash(mappings, h.hash_seed, displacements, slot_ranks)) {
+            break;
+        }
+    }
+
+    // Layout: header, bucket offsets, strings, sorted ids, id ranks, displacements, slot ranks.
+    std::string out(sizeof(header), '\0');
+    h.bucket_offsets = out.size();
+    write_array(out, bucket_offsets);
+    h.strings = out.size();
+    h.strings_size = strings.size();
+    out += strings;
+    align(out);
+    h.sorted_ids = out.size();
+    write_array(out, sorted_ids);
+    align(out);
+    h.id_ranks = out.size();
+    write_array(out, id_ranks);
+    align(out);
+    h.displacements = out.size();
+    write_array(out, displacements);
+    align(out);
+    h.slot_ranks = out.size();
+    write_array(out, slot_ranks);
+    align(out);
+    h.file_size = out.size();
+    std::memcpy(&out[0], &h, sizeof(h));
+
+    std::ofstream file(path.string(), std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    file.close();
+    if (!file) {
+        throw std::runtime_error(fmt::format("Failed to write the label dictionary to {}.", path.string()));
+    }
+}
+
+label_dictionary::label_dictionary(const fs::path& path)
+    : m_file(path.string())
+{
+    if (m_file.size() < sizeof(header)) {
+        throw std::invalid_argument("Invalid label dictionary: file is too small.");
+    }
+
+    header h;
+    std::memcpy(&h, m_file.data(), sizeof(h));
+    if (h.magic != dictionary_magic) {
+        throw std::invalid_argument("Invalid label dictionary: wrong magic number.");
+    }
+    if (h.version != dictionary_version) {
+        throw std::invalid_argument(fmt::format("Invalid file format version. Expected {} but got {}.",
+                                                dictionary_version, h.version));
+    }
+    if (h.bucket_size != bucket_size) {
+        throw std::invalid_argument(fmt::format("Invalid bucket size. Expected {} but got {}.",
+                                                bucket_size, h.bucket_size));
+    }
+
+    auto check_section = [&](u64 offset, u64 bytes) {
+        if (offset > m_file.size() || bytes > m_file.size() - offset) {
+            throw std::invalid_argument("Invalid label dictionary: section out of bounds.");
+        }
+    };
+    check_section(h.bucket_offsets, h.buckets * sizeof(u64));
+    check_section(h.strings, h.strings_size);
+    check_section(h.sorted_ids, h.size * sizeof(u32));
+    check_section(h.id_ranks, h.id_count * sizeof(u32));
+    check_section(h.displacements, h.hash_buckets * sizeof(u32));
+    check_section(h.slot_ranks, h.size * sizeof(u32));
+    if (h.hash_buckets == 0) {
+        throw std::invalid_argument("Invalid label dictionary: no hash buckets.");
+    }
+
+    m_size = h.size;
+    m_buckets = h.buckets;
+    m_min_id = h.min_id;
+    m_id_count = h.id_count;
+    m_hash_seed = h.hash_seed;
+    m_hash_buckets = h.hash_buckets;
+
+    m_bucket_offsets = section<u64>(h.bucket_offsets);
+    m_strings = section<char>(h.strings);
+    m_sorted_ids = section<u32>(h.sorted_ids);
+    m_id_ranks = section<u32>(h.id_ranks);
+    m_displacements = section<u32>(h.displacements);
+    m_slot_ranks = section<u32>(h.slot_ranks);
+}
+
+label_dictionary::~label_dictionary() = default;
+
+boost::optional<label_type> label_dictionary::find(const std::string& name) const {
+    if (m_size == 0) {
+        return {};
+    }
+
+    const name_hash h = hash_name(name.data(), name.size(), m_hash_seed);
+    const u64 displacement = m_displacements[hash_bucket(h, m_hash_buckets)];
+    const u64 rank = m_slot_ranks[hash_slot(h, displacement, m_size)];
+
+    // The hash function maps unknown names to arbitrary slots.
+    if (rank >= m_size || name_at(rank) != name) {
+        return {};
+    }
+    return m_sorted_ids[rank];
+}
+
+boost::optional<std::string> label_dictionary::name(label_type id) const {
+    if (id < m_min_id || id - m_min_id >= m_id_count) {
+        return {};
+    }
+    const u32 rank = m_id_ranks[id - m_min_id];
+    if (rank == no_rank) {
+        return {};
+    }
+    return name_at(rank);
+}
+
+std::vector<label_type> label_dictionary::find_prefix(const std::string& prefix) const {
+    std::vector<label_type> result;
+    for (cursor c(*this, lower_bound(prefix)); c.valid(); c.next()) {
+        if (c.name().compare(0, prefix.size(), prefix) != 0) {
+            break;
+        }
+        result.push_back(m_sorted_ids[c.rank()]);
+    }
+    return result;
+}
+
+std::vector<label_type> label_dictionary::find_range(const std::string& first, const std::string& last) const {
+    std::vector<label_type> result;
+    for (cursor c(*this, lower_bound(first)); c.valid() && c.name() < last; c.next()) {
+        result.push_back(m_sorted_ids[c.rank()]);
+    }
+    return result;
+}
+
+u64 label_dictionary::lower_bound(const std::string& name) const {
+    // Find the first bucket whose head is greater than `name`.
+    // The result must be in the bucket before it (or at the start of that bucket).
+    u64 lo = 0, hi = m_buckets;
+    while (lo < hi) {
+        const u64 mid = lo + (hi - lo) / 2;
+        if (cursor(*this, mid * bucket_size).name() <= name) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return 0;
+    }
+
+    cursor c(*this, (lo - 1) * bucket_size);
+    while (c.valid() && c.rank() < lo * bucket_size && c.name() < name) {
+        c.next();
+    }
+    return c.rank();
+}
+
+std::string label_dictionary::name_at(u64 rank) const {
+    geodb_assert(rank < m_size, "rank out of bounds");
+    return cursor(*this, rank).name();
+}
+
+} // namespace geodb
@@ -0,0 +1,115 @@
+#ifndef GEODB_IRWI_LABEL_DICTIONARY_HPP
+#define GEODB_IRWI_LABEL_DICTIONARY_HPP
+
+#include "geodb/common.hpp"
+#include "geodb/filesystem.hpp"
+#include "geodb/irwi/string_map.hpp"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include <string>
+#include <vector>
+
+/// \file
+/// A read-only, memory mapped dictionary for label names.
+
+namespace geodb {
+
+/// A read-only dictionary that maps label names to label ids and back.
+/// The dictionary is a single file on disk that is memory mapped when opened,
+/// so lookups only touch the pages they need (no file is loaded as a whole).
+///
+/// The file contains
+///     - the label names in sorted order, front coded in buckets of
+///       `bucket_size` names (for prefix and range lookups),
+///     - the label id of every name (in sorted order),
+///     - the sorted position of every label id (for id -> name lookups), and
+///     - a minimal perfect hash function over the names (for name -> id lookups),
+///       implemented using the "hash and displace" technique.
+///
+/// Dictionaries are created from the content of a \ref string_map
+/// using \ref label_dictionary::build.
+class label_dictionary : boost::noncopyable {
+public:
+    /// Number of names per front coded bucket.
+    static constexpr u32 bucket_size = 16;
+
+    /// Writes a dictionary for the given mappings to `path`.
+    /// An existing file will be overwritten.
+    ///
+    /// \pre Names and ids must be unique.
+    static void build(const fs::path& path, std::vector<label_mapping> mappings);
+
+    /// Writes a dictionary for the content of the given string map to `path`.
+    template<typename StorageSpec>
+    static void build(const fs::path& path, const string_map<StorageSpec>& map) {
+        build(path, std::vector<label_mapping>(map.begin(), map.end()));
+    }
+
+public:
+    /// Opens the dictionary at the given path.
+    /// Throws if the file does not exist or if it is not a valid dictionary.
+    explicit label_dictionary(const fs::path& path);
+
+    ~label_dictionary();
+
+    /// Returns the number of labels in this dictionary.
+    u64 size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    /// Returns the id of the label with the given name
+    /// or an empty optional if no such label exists.
+    boost::optional<label_type> find(const std::string& name) const;
+
+    /// Returns the name of the label with the given id
+    /// or an empty optional if no such label exists.
+    boost::optional<std::string> name(label_type id) const;
+
+    /// Returns the ids of all labels whose names start with `prefix`,
+    /// ordered by name. An empty prefix matches every label.
+    std::vector<label_type> find_prefix(const std::string& prefix) const;
+
+    /// Returns the ids of all labels whose names are in `[first, last)`,
+    /// ordered by name.
+    std::vector<label_type> find_range(const std::string& first, const std::string& last) const;
+
+private:
+    struct header;
+    class cursor;
+
+    /// Returns the sorted position of the first name `>= name`.
+    u64 lower_bound(const std::string& name) const;
+
+    /// Decodes the name at the given sorted position.
+    std::string name_at(u64 rank) const;
+
+    /// Returns a pointer to the first element of the given section.
+    template<typename T>
+    const T* section(u64 offset) const {
+        return reinterpret_cast<const T*>(m_file.data() + offset);
+    }
+
+private:
+    boost::iostreams::mapped_file_source m_file;
+
+    u64 m_size = 0;
+    u64 m_buckets = 0;
+    u64 m_min_id = 0;
+    u64 m_id_count = 0;
+    u64 m_hash_seed = 0;
+    u64 m_hash_buckets = 0;
+
+    const u64* m_bucket_offsets = nullptr;  ///< Offset of every front coded bucket.
+    const char* m_strings = nullptr;        ///< Front coded names.
+    const u32* m_sorted_ids = nullptr;      ///< Label id of every sorted name.
+    const u32* m_id_ranks = nullptr;        ///< Sorted position of every label id.
+    const u32* m_displacements = nullptr;   ///< Displacement of every hash bucket.
+    const u32* m_slot_ranks = nullptr;      ///< Sorted position of the name in every hash slot.
+};
+
+} // namespace geodb
+
+#endif // GEODB_IRWI_LABEL_DICTIONARY_HPP
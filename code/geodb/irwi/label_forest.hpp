@@ -0,0 +1,223 @@
+#ifndef GEODB_IRWI_LABEL_FOREST_HPP
+#define GEODB_IRWI_LABEL_FOREST_HPP
+
+#include "geodb/common.hpp"
+#include "geodb/irwi/query.hpp"
+#include "geodb/irwi/tree.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// \file
+/// A hybrid index that stores the units of dominant labels in separate trees.
+
+namespace geodb {
+
+/// Returns the labels whose share of the `total` number of units
+/// is at least `threshold`, in ascending order.
+///
+/// \param counts       The number of units for every label.
+/// \param threshold    The minimum share of a dominant label. Must be in (0, 1].
+template<typename LabelCounts>
+std::vector<label_type> dominant_labels(const LabelCounts& counts, double threshold) {
+    if (!(threshold > 0 && threshold <= 1)) {
+        throw std::invalid_argument("threshold must be in (0, 1]");
+    }
+
+    u64 total = 0;
+    for (const auto& pair : counts) {
+        total += pair.second;
+    }
+
+    std::vector<label_type> result;
+    for (const auto& pair : counts) {
+        if (pair.second > 0 && double(pair.second) >= threshold * double(total)) {
+            result.push_back(pair.first);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+/// A hybrid index for labels with a very skewed frequency distribution.
+///
+/// Every dominant label gets its own tree that contains all units with that label.
+/// The units of all other labels (the "long tail") are stored in a single IRWI tree.
+/// Queries for rare labels therefore never visit nodes filled with the units
+/// of common labels, and queries for common labels do not have to read long
+/// postings lists.
+///
+/// Every simple query is routed to the trees that can contain matching units.
+/// The units are then merged and checked for the correct order (see \ref check_order()),
+/// so trajectories may match different simple queries in different trees.
+///
+/// \tparam StorageSpec
+///     The storage type of the individual trees.
+/// \tparam Lambda
+///     The maximum number of intervals in each posting.
+template<typename StorageSpec, u32 Lambda>
+class label_forest : boost::noncopyable {
+public:
+    using tree_type = tree<StorageSpec, Lambda>;
+
+    /// Returns the storage for the partition with the given name.
+    /// Partition names are unique and can be used as file names.
+    using storage_factory = std::function<StorageSpec(const std::string& name)>;
+
+public:
+    /// Returns the partition name of the tree for the given dominant label.
+    static std::string partition_name(label_type label) {
+        return "label-" + std::to_string(label);
+    }
+
+    /// Returns the partition name of the tree for all other labels.
+    static std::string tail_name() { return "tail"; }
+
+public:
+    /// Constructs (or opens) a forest.
+    ///
+    /// \param factory
+    ///     Creates the storage for every tree in the forest.
+    /// \param labels
+    ///     The dominant labels. Every label gets its own tree.
+    ///     Must be the same set of labels when an existing forest is reopened.
+    /// \param weight
+    ///     Weighting factor for the tree of the remaining labels (see \ref tree::tree).
+    ///     If not given, an existing tree keeps its recorded weight.
+    ///     The trees of dominant labels contain a single label; they always
+    ///     use a purely spatial cost function (a weight of 1).
+    label_forest(const storage_factory& factory, std::vector<label_type> labels,
+                 boost::optional<double> weight = boost::none)
+        : m_tail(std::make_unique<tree_type>(factory(tail_name()), weight))
+    {
+        std::sort(labels.begin(), labels.end());
+        labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+        for (label_type label : labels) {
+            m_dominant.emplace(label, std::make_unique<tree_type>(factory(partition_name(label)), 1.0));
+        }
+    }
+
+    /// Returns the dominant labels in ascending order.
+    std::vector<label_type> labels() const {
+        std::vector<label_type> result;
+        for (const auto& pair : m_dominant) {
+            result.push_back(pair.first);
+        }
+        return result;
+    }
+
+    /// Returns true iff `label` has its own tree.
+    bool is_dominant(label_type label) const { return m_dominant.count(label) > 0; }
+
+    /// Returns the tree for the given dominant label.
+    /// \pre `is_dominant(label)`.
+    tree_type& partition(label_type label) {
+        geodb_assert(is_dominant(label), "label is not dominant");
+        return *m_dominant.at(label);
+    }
+
+    const tree_type& partition(label_type label) const {
+        geodb_assert(is_dominant(label), "label is not dominant");
+        return *m_dominant.at(label);
+    }
+
+    /// Returns the tree that contains the units of all labels that are not dominant.
+    tree_type& tail() { return *m_tail; }
+    const tree_type& tail() const { return *m_tail; }
+
+    /// Returns the tree responsible for units with the given label.
+    tree_type& route(label_type label) {
+        auto pos = m_dominant.find(label);
+        return pos != m_dominant.end() ? *pos->second : *m_tail;
+    }
+
+    /// Returns the total number of trajectory units in all trees.
+    size_t size() const {
+        size_t result = m_tail->size();
+        for (const auto& pair : m_dominant) {
+            result += pair.second->size();
+        }
+        return result;
+    }
+
+    /// True iff all trees are empty.
+    bool empty() const { return size() == 0; }
+
+    /// Inserts a single leaf entry into the tree responsible for its label.
+    void insert(const tree_entry& e) {
+        route(e.unit.label).insert(e);
+    }
+
+    /// Finds all trajectories that satisfy the given query.
+    /// Returns the same result as a single tree that contains all units.
+    std::vector<trajectory_match> find(const sequenced_query& seq_query) const {
+        STATS_GUARD(guard, "Forest query");
+
+        seq_query.validate();
+
+        const size_t n = seq_query.queries.size();
+        if (n == 0) {
+            return {};
+        }
+
+        std::vector<unit_candidates> candidates(n);
+        std::vector<tree_entry> units;
+        for (size_t i = 0; i < n; ++i) {
+            units.clear();
+            find_units(seq_query.queries[i], units);
+            if (units.empty()) {
+                return {};  // Every simple query must be satisfied.
+            }
+            candidates[i] = group_units(units);
+        }
+        return check_order(seq_query, candidates);
+    }
+
+private:
+    /// Routes the simple query `q` to the relevant trees and appends the matching units to `units`.
+    void find_units(const simple_query& q, std::vector<tree_entry>& units) const {
+        auto append = [&](const tree_type& tree, const simple_query& query) {
+            std::vector<tree_entry> result = tree.find_units(query);
+            units.insert(units.end(), result.begin(), result.end());
+        };
+
+        // The trees of dominant labels contain a single label,
+        // which means that the label filter can be omitted.
+        simple_query any{q.rect, {}};
+        if (q.labels.empty()) {
+            for (const auto& pair : m_dominant) {
+                append(*pair.second, any);
+            }
+            append(*m_tail, any);
+            return;
+        }
+
+        simple_query rest{q.rect, {}};
+        for (label_type label : q.labels) {
+            auto pos = m_dominant.find(label);
+            if (pos != m_dominant.end()) {
+                append(*pos->second, any);
+            } else {
+                rest.labels.insert(label);
+            }
+        }
+        if (!rest.labels.empty()) {
+            append(*m_tail, rest);
+        }
+    }
+
+private:
+    std::unique_ptr<tree_type> m_tail;
+    std::map<label_type, std::unique_ptr<tree_type>> m_dominant;
+};
+
+} // namespace geodb
+
+#endif // GEODB_IRWI_LABEL_FOREST_HPP
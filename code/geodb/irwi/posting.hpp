@@ -66,9 +66,6 @@ class posting_data {
 public:
     using id_set_type = geodb::id_set<Lambda>;
 
-private:
-    using id_set_binary_type = geodb::id_set_binary<Lambda>;
-
 public:
     /// Creates an empty instance (with a count of zero and an empty id set).
     posting_data() = default;
@@ -92,20 +89,19 @@ public:
     /// counted by this instance.
     /// This set can be used to quickly exclude some node froms being searched,
     /// e.g. if the associated subtree contains none of the required trajectory ids.
-    id_set_type id_set() const {
-        id_set_type set;
-        from_binary<Lambda>(set, m_binary_ids);
-        return set;
+    ///
+    /// The set is stored inline, no copy is required to inspect it.
+    const id_set_type& id_set() const {
+        return m_ids;
     }
 
     /// Updates the id_set of this instance.
     void id_set(const id_set_type& set) {
-        to_binary<Lambda>(set, m_binary_ids);
+        m_ids = set;
     }
 
     friend bool operator==(const posting_data& a, const posting_data& b) {
-        return a.count() == b.count()
-                && std::memcmp(&a.m_binary_ids, &b.m_binary_ids, sizeof(id_set_binary_type)) == 0;
+        return a.count() == b.count() && a.m_ids == b.m_ids;
     }
 
     friend bool operator!=(const posting_data& a, const posting_data& b) {
@@ -119,7 +115,7 @@ public:
 
 private:
     u64 m_count = 0;
-    id_set_binary_type m_binary_ids;
+    id_set_type m_ids;
 };
 
 /// Every posting `p` belongs to a postings list `pl` which in
@@ -29,6 +29,7 @@ private:
     block_collection<block_size>& m_blocks;
     block_handle<block_size> m_base;
     bool m_first_time;
+    block_extent<block_size>* m_extent;
 
 public:
     /// \param blocks
@@ -40,14 +41,25 @@ public:
     /// \param first_time
     ///     True if a new instance should be created at the given base block.
     ///     False if some previous state exists which should be restored instead.
+    /// \param extent
+    ///     If not null, new data blocks are taken from this extent
+    ///     (until it has been used up). The extent must outlive the list.
     postings_list_blocks(block_collection<block_size>& blocks,
                          block_handle<block_size> base,
-                         bool first_time)
+                         bool first_time,
+                         block_extent<block_size>* extent = nullptr)
         : m_blocks(blocks)
         , m_base(base)
         , m_first_time(first_time)
+        , m_extent(extent)
     {}
 
+    /// Returns the number of blocks occupied by a list of the given size.
+    template<typename Posting>
+    static constexpr size_t required_blocks(size_t size) {
+        return postings_list_blocks_impl<Posting, block_size>::required_blocks(size);
+    }
+
 private:
     template<typename StorageSpec, u32 Lambda>
     friend class postings_list;
@@ -58,12 +70,14 @@ private:
     template<typename Posting>
     movable_adapter<implementation<Posting>>
     construct() const {
-        return { in_place_t(), m_blocks, m_base, m_first_time };
+        return { in_place_t(), m_blocks, m_base, m_first_time, m_extent };
     }
 };
 
 /// Implements a linked list of blocks in a shared block file.
-/// Every list has a (constant) base block in which its state can be stored.
+/// Every list has a (constant) base block which is also its first data block.
+/// The list's state is stored in front of the entries of the base block,
+/// which means that small lists occupy a single block.
 /// Data blocks are doubly linked.
 template<typename Posting, size_t block_size>
 class postings_list_blocks_impl : boost::noncopyable {
@@ -79,10 +93,9 @@ private:
 
 #pragma pack(push, 1)
 
-    /// The content of the base block.
+    /// The state of the list, stored at the start of the base block.
     struct state_type {
-        size_t size;
-        handle_type first;
+        u64 size;
         handle_type last;
     };
 
@@ -101,7 +114,11 @@ private:
         return (block_size - sizeof(data_header)) / sizeof(Posting);
     }
 
-    static_assert(block_entry_count() >= 1, "block size too small to fit a single entry");
+    static constexpr u32 base_entry_count() {
+        return (block_size - sizeof(state_type) - sizeof(data_header)) / sizeof(Posting);
+    }
+
+    static_assert(base_entry_count() >= 1, "block size too small to fit a single entry");
 
     /// The content of the data blocks.
     struct data_type {
@@ -111,14 +128,33 @@ private:
         Posting entries[block_entry_count()];
     };
 
+    /// The content of the base block.
+    struct base_type {
+        state_type state;
+
+        data_header hdr;
+
+        /// Data array.
+        Posting entries[base_entry_count()];
+    };
+
 #pragma pack(pop)
 
-    static_assert(sizeof(state_type) <= block_size,
-                  "State type too large");
+    static_assert(sizeof(base_type) <= block_size,
+                  "Base type too large");
 
     static_assert(sizeof(data_type) <= block_size,
                   "Data type too large");
 
+public:
+    /// Returns the number of blocks occupied by a list of the given size.
+    static constexpr size_t required_blocks(size_t size) {
+        if (size <= base_entry_count()) {
+            return 1;
+        }
+        return 1 + (size - base_entry_count() + block_entry_count() - 1) / block_entry_count();
+    }
+
 private:
     block_type* read_block(handle_type h) const {
         geodb_assert(h != invalid, "accessing invalid block index");
@@ -130,34 +166,53 @@ private:
         m_blocks.write_block(h);
     }
 
-    state_type* get_state(block_type* block) const {
-        return reinterpret_cast<state_type*>(block->get());
+    base_type* get_base(block_type* block) const {
+        return reinterpret_cast<base_type*>(block->get());
     }
 
     data_type* get_data(block_type* block) const {
         return reinterpret_cast<data_type*>(block->get());
     }
 
+    data_header* get_header(handle_type h) const {
+        block_type* block = read_block(h);
+        return h == m_base ? &get_base(block)->hdr : &get_data(block)->hdr;
+    }
+
+    /// Returns the maximum number of entries in the given block.
+    u32 capacity(handle_type h) const {
+        return h == m_base ? base_entry_count() : block_entry_count();
+    }
+
+    /// Initializes the base block of a new list.
+    void init_base() {
+        base_type* b = get_base(read_block(m_base));
+        b->hdr.prev = invalid;
+        b->hdr.next = invalid;
+        b->hdr.count = 0;
+        memset(&b->entries, 0, sizeof(b->entries));
+        write_block(m_base);
+    }
+
     /// Loads the list state from the base block.
     void load_state() {
-        state_type* s = get_state(read_block(m_base));
-        m_size = s->size;
-        m_first = s->first;
-        m_last = s->last;
+        base_type* b = get_base(read_block(m_base));
+        m_size = b->state.size;
+        m_last = b->state.last;
     }
 
     /// Save the list state into the base block.
     void save_state() {
-        state_type* s = get_state(read_block(m_base));
-        s->size = m_size;
-        s->first = m_first;
-        s->last = m_last;
+        base_type* b = get_base(read_block(m_base));
+        b->state.size = m_size;
+        b->state.last = m_last;
         write_block(m_base);
     }
 
     /// Create a new data block.
+    /// The block is taken from the extent, if there is one.
     handle_type create_data() {
-        handle_type h = m_blocks.get_free_block();
+        handle_type h = m_extent ? m_extent->get_free_block() : m_blocks.get_free_block();
 
         data_type* d = get_data(read_block(h));
         d->hdr.prev = invalid;
@@ -170,56 +225,68 @@ private:
     }
 
     u32 get_count(handle_type h) const {
-        data_type* d = get_data(read_block(h));
-        return d->hdr.count;
+        return get_header(h)->count;
     }
 
     void set_count(handle_type h, u32 size) {
-        geodb_assert(size <= block_entry_count(), "count too large");
-        data_type* d = get_data(read_block(h));
-        d->hdr.count = size;
+        geodb_assert(size <= capacity(h), "count too large");
+        get_header(h)->count = size;
         write_block(h);
     }
 
     handle_type get_next(handle_type h) const {
-        data_type* d = get_data(read_block(h));
-        return d->hdr.next;
+        return get_header(h)->next;
     }
 
     void set_next(handle_type h, handle_type n) {
-        data_type* d = get_data(read_block(h));
-        d->hdr.next = n;
+        get_header(h)->next = n;
         write_block(h);
     }
 
     handle_type get_prev(handle_type h) const {
-        data_type* d = get_data(read_block(h));
-        return d->hdr.prev;
+        return get_header(h)->prev;
     }
 
     void set_prev(handle_type h, handle_type p) {
-        data_type* d = get_data(read_block(h));
-        d->hdr.prev = p;
+        get_header(h)->prev = p;
         write_block(h);
     }
 
     posting_type get_entry(handle_type h, u32 index) const {
-        geodb_assert(index < block_entry_count(), "index out of bounds");
-        data_type* d = get_data(read_block(h));
-        return d->entries[index];
+        geodb_assert(index < capacity(h), "index out of bounds");
+        block_type* block = read_block(h);
+        return h == m_base ? get_base(block)->entries[index] : get_data(block)->entries[index];
     }
 
     void set_entry(handle_type h, u32 index, const posting_type& entry) {
-        geodb_assert(index < block_entry_count(), "index out of bounds");
-        data_type* d = get_data(read_block(h));
-        d->entries[index] = entry;
+        geodb_assert(index < capacity(h), "index out of bounds");
+        block_type* block = read_block(h);
+        if (h == m_base) {
+            get_base(block)->entries[index] = entry;
+        } else {
+            get_data(block)->entries[index] = entry;
+        }
         write_block(h);
     }
 
     void clear_entry(handle_type h, u32 index) {
-        geodb_assert(index < block_entry_count(), "index out of bounds");
-        data_type* d = get_data(read_block(h));
-        memset(&d->entries[index], 0, sizeof(d->entries[index]));
+        geodb_assert(index < capacity(h), "index out of bounds");
+        block_type* block = read_block(h);
+        if (h == m_base) {
+            memset(&get_base(block)->entries[index], 0, sizeof(posting_type));
+        } else {
+            memset(&get_data(block)->entries[index], 0, sizeof(posting_type));
+        }
+    }
+
+    /// Returns the first data block or invalid, if the list is empty.
+    handle_type first() const {
+        return m_size > 0 ? m_base : invalid;
+    }
+
+    /// Returns the last data block or invalid, if the list is empty.
+    handle_type last() const {
+        return m_size > 0 ? m_last : invalid;
     }
 
 public:
@@ -262,7 +329,7 @@ public:
         void increment() {
             geodb_assert(list, "incrementing invalid iterator");
             if (node == invalid) {
-                node = list->m_first;
+                node = list->first();
                 index = 0;
                 return;
             }
@@ -280,7 +347,7 @@ public:
             geodb_assert(list, "decrementing invalid iterator");
 
             if (node == invalid) {
-                node = list->m_last;
+                node = list->last();
                 if (node == invalid) {
                     index = 0;
                 } else {
@@ -315,7 +382,7 @@ public:
 
 public:
     iterator begin() const {
-        return iterator(this, m_first, 0);
+        return iterator(this, first(), 0);
     }
 
     iterator end() const {
@@ -333,26 +400,17 @@ public:
         m_dirty = true;
 
         handle_type block = m_last;
-        if (block == invalid || get_count(block) == block_entry_count()) {
-            {
-                // Allocate a new block and link it with the last one.
-                handle_type new_block = create_data();
-
-                set_prev(new_block, block);
-                if (block != invalid) {
-                    set_next(block, new_block);
-                }
-                block = new_block;
-            }
+        if (get_count(block) == capacity(block)) {
+            // Allocate a new block and link it with the last one.
+            handle_type new_block = create_data();
+            set_prev(new_block, block);
+            set_next(block, new_block);
 
-            // Update first and last pointer.
+            block = new_block;
             m_last = block;
-            if (m_first == invalid) {
-                m_first = block;
-            }
         }
 
-        geodb_assert(block != invalid && get_count(block) < block_entry_count(),
+        geodb_assert(get_count(block) < capacity(block),
                      "block has capacity for one more entry");
 
         const u32 count = get_count(block);
@@ -363,7 +421,6 @@ public:
 
     void pop_back() {
         geodb_assert(m_size > 0, "cannot pop back on an empty list");
-        geodb_assert(m_last != invalid, "last block must be valid (invariant)");
 
         m_dirty = true;
 
@@ -371,7 +428,8 @@ public:
         geodb_assert(count > 0, "data blocks cannot be empty");
 
         // Simple case: decrement entry count in last block.
-        if (count > 1) {
+        // The base block is never destroyed.
+        if (count > 1 || m_last == m_base) {
             clear_entry(m_last, count - 1);
             set_count(m_last, count - 1);
             --m_size;
@@ -381,13 +439,8 @@ public:
         // Destroy the last block and unlink it from the list.
         const handle_type block = m_last;
         const handle_type prev = get_prev(block);
-        if (prev == invalid) {
-            m_first = invalid;
-            m_last = invalid;
-        } else {
-            set_next(prev, invalid);
-            m_last = prev;
-        }
+        set_next(prev, invalid);
+        m_last = prev;
         --m_size;
         m_blocks.free_block(block);
     }
@@ -398,13 +451,14 @@ public:
         }
 
         m_dirty = true;
-        for (handle_type block = m_first; block != invalid; ) {
+        for (handle_type block = get_next(m_base); block != invalid; ) {
             handle_type next = get_next(block);
             m_blocks.free_block(block);
             block = next;
         }
-        m_first = invalid;
-        m_last = invalid;
+        set_next(m_base, invalid);
+        set_count(m_base, 0);
+        m_last = m_base;
         m_size = 0;
     }
 
@@ -415,13 +469,17 @@ public:
 public:
     postings_list_blocks_impl(block_collection<block_size>& blocks,
                               block_handle<block_size> base,
-                              bool first_time)
+                              bool first_time,
+                              block_extent<block_size>* extent)
         : m_blocks(blocks)
+        , m_extent(extent)
         , m_base(base)
+        , m_last(base)
     {
         if (!first_time) {
             load_state();
         } else {
+            init_base();
             m_dirty = true;
         }
     }
@@ -436,22 +494,22 @@ private:
     /// The block collection file is shared among all instances.
     block_collection<block_size>& m_blocks;
 
+    /// New data blocks are taken from this extent (if not null).
+    block_extent<block_size>* m_extent;
+
     /// True if this list was modified since it has been loaded.
     bool m_dirty = false;
 
-    /// Every list has its own base page that never changes.
-    /// The base page is used to store the list' size, a reference
-    /// to its first and last data block etc.
+    /// Every list has its own base block that never changes.
+    /// The base block is the first data block and stores
+    /// the list's size and a reference to its last data block.
     const handle_type m_base;
 
     /// The number of elements in this list.
     size_t m_size = 0;
 
-    /// Pointer to the first data page (or invalid).
-    handle_type m_first = invalid;
-
-    /// Pointer to the last data page (or invalid).
-    handle_type m_last = invalid;
+    /// Pointer to the last data block (the base block if there is only one).
+    handle_type m_last;
 };
 
 template<typename Posting, size_t block_size>
@@ -0,0 +1,243 @@
+#include "geodb/irwi/query.hpp"
+
+#include <boost/range/sub_range.hpp>
+
+namespace geodb {
+
+namespace {
+
+// Returns the trajectories that have their matches correctly ordered in time.
+std::vector<trajectory_match> check_order_plain(const std::vector<unit_candidates>& candidates) {
+    geodb_assert(!candidates.empty(), "range must not be empty");
+
+    std::vector<trajectory_match> matches;
+    std::vector<boost::sub_range<const std::vector<tree_entry>>> unit_candiates;
+    unit_candiates.reserve(candidates.size());
+
+    // For every potential trajectory match.
+    for (const auto& first : candidates.front()) {
+        const trajectory_id_type id = first.first;
+        std::vector<unit_match> unit_matches;
+
+        // Inspect the trajectory unit matches for every simple query.
+        unit_candiates.clear();
+        for (const auto& map : candidates) {
+            auto iter = map.find(id);
+            if (iter == map.end()) {
+                // the trajectory must have matching units for every simple query.
+                goto skip;
+            }
+
+            const std::vector<tree_entry>& entries = iter->second;
+            geodb_assert(entries.size() > 0, "no matching entries");
+            unit_candiates.emplace_back(entries);
+        }
+
+        for (size_t i = 0; i < unit_candiates.size(); ++i) {
+            auto& current = unit_candiates[i];
+
+            // The first unit that satisfies queries[i].
+            u32 min = current.front().unit_index;
+
+            // We compute the number of elements until the
+            // next query becomes active.
+            if (i < unit_candiates.size() - 1) {
+                // Index-wise comparison for tree entries.
+                auto entry_compare = [](const tree_entry& a, u32 index) {
+                    return a.unit_index < index;
+                };
+
+                auto& next = unit_candiates[i + 1];
+                {
+                    // Find "min" or something greater in the next query.
+                    const auto pos = std::lower_bound(next.begin(), next.end(), min, entry_compare);
+                    if (pos == next.end()) {
+                        goto skip; // Both queries cannot be satisfied at the same time.
+                    }
+                    geodb_assert(pos->unit_index >= min, "invalid result of binary search.");
+
+                    // Shrink the "next" range to only include values >= min.
+                    next = { pos, next.end() };
+                }
+
+                // We include every result in the current sequence until we reach the following value,
+                // at which point the next query will become active.
+                // Note: max itself is not included anymore in "current", i.e. we prefer the later query
+                // in case that a unit satisfies more than one query at the same time.
+                {
+                    u32 max = next.front().unit_index;
+                    const auto pos = std::lower_bound(current.begin(), current.end(), max, entry_compare);
+                    geodb_assert(pos == current.end() || pos->unit_index >= max, "invalid result of binary search");
+
+                    // Shrink the current sequence. The range may become empty as a result,
+                    // which is fine (the overlapping part will be seen in the next iteration).
+                    current = { current.begin(), pos };
+                }
+            }
+
+            // Include all units up until the computed end of the candidate list.
+            for (const tree_entry& entry : current) {
+                unit_matches.emplace_back(entry.unit_index, entry.unit);
+            }
+        }
+
+
+        // A trajectory only matches if there are matching units for every simple query.
+        // This code will be skipped (see the goto above) if that is not the case.
+        matches.emplace_back(id, std::move(unit_matches));
+
+    skip:
+        continue;
+    }
+    return matches;
+}
+
+// Like check_order_plain(), but also enforces the time gap constraints of `seq_query`.
+// Returns the trajectories that have a sequence of matching units which satisfies
+// the query. Every unit that is part of such a sequence is reported.
+std::vector<trajectory_match> check_order_gaps(const sequenced_query& seq_query,
+                                               const std::vector<unit_candidates>& candidates) {
+    geodb_assert(!candidates.empty(), "range must not be empty");
+
+    std::vector<trajectory_match> matches;
+    std::vector<std::vector<unit_match>> steps(candidates.size());
+    std::vector<std::vector<bool>> valid;
+
+    // For every potential trajectory match.
+    for (const auto& first : candidates.front()) {
+        const trajectory_id_type id = first.first;
+        size_t i = 0;
+        bool complete = true;
+        for (const auto& map : candidates) {
+            auto iter = map.find(id);
+            if (iter == map.end()) {
+                // the trajectory must have matching units for every simple query.
+                complete = false;
+                break;
+            }
+
+            steps[i].clear();
+            for (const tree_entry& entry : iter->second) {
+                steps[i].emplace_back(entry.unit_index, entry.unit);
+            }
+            ++i;
+        }
+
+        if (!complete || !match_sequences(seq_query, steps, valid)) {
+            continue;
+        }
+
+        // Report every unit that is part of a valid sequence (once).
+        std::vector<unit_match> unit_matches;
+        for (size_t s = 0; s < steps.size(); ++s) {
+            for (size_t j = 0; j < steps[s].size(); ++j) {
+                if (valid[s][j]) {
+                    unit_matches.push_back(steps[s][j]);
+                }
+            }
+        }
+        std::sort(unit_matches.begin(), unit_matches.end(), [](const unit_match& a, const unit_match& b) {
+            return a.index < b.index;
+        });
+        unit_matches.erase(std::unique(unit_matches.begin(), unit_matches.end(), [](const unit_match& a, const unit_match& b) {
+            return a.index == b.index;
+        }), unit_matches.end());
+
+        matches.emplace_back(id, std::move(unit_matches));
+    }
+    return matches;
+}
+
+} // namespace
+
+bool match_sequences(const sequenced_query& q,
+                     const std::vector<std::vector<unit_match>>& steps,
+                     std::vector<std::vector<bool>>& valid)
+{
+    geodb_assert(steps.size() == q.queries.size(), "need one unit list per simple query");
+
+    const size_t n = steps.size();
+    valid.resize(n);
+    if (n == 0) {
+        return false;
+    }
+    for (const auto& units : steps) {
+        if (units.empty()) {
+            return false;
+        }
+    }
+
+    // Returns true if `b` may follow `a` in a sequence (a matches query i).
+    auto compatible = [&](size_t i, const unit_match& a, const unit_match& b) {
+        return a.index <= b.index && q.gap(i).satisfied(a.unit, b.unit);
+    };
+
+    // Forward pass: valid[i][j] is true if steps[i][j] ends a valid prefix.
+    valid[0].assign(steps[0].size(), true);
+    for (size_t i = 1; i < n; ++i) {
+        const auto& prev = steps[i - 1];
+        const auto& current = steps[i];
+
+        bool any = false;
+        valid[i].assign(current.size(), false);
+        for (size_t j = 0; j < current.size(); ++j) {
+            for (size_t k = 0; k < prev.size(); ++k) {
+                if (valid[i - 1][k] && compatible(i - 1, prev[k], current[j])) {
+                    valid[i][j] = true;
+                    any = true;
+                    break;
+                }
+            }
+        }
+
+        if (!any) {
+            return false;
+        }
+    }
+
+    // Backward pass: only keep units that can be completed to a full sequence.
+    for (size_t i = n - 1; i-- > 0; ) {
+        const auto& current = steps[i];
+        const auto& next = steps[i + 1];
+
+        for (size_t j = 0; j < current.size(); ++j) {
+            if (!valid[i][j]) {
+                continue;
+            }
+
+            bool found = false;
+            for (size_t k = 0; k < next.size(); ++k) {
+                if (valid[i + 1][k] && compatible(i, current[j], next[k])) {
+                    found = true;
+                    break;
+                }
+            }
+            valid[i][j] = found;
+        }
+    }
+    return true;
+}
+
+unit_candidates group_units(const std::vector<tree_entry>& units) {
+    unit_candidates result;
+    for (const tree_entry& e : units) {
+        result[e.trajectory_id].push_back(e);
+    }
+    for (auto& pair : result) {
+        std::vector<tree_entry>& entries = pair.second;
+        std::sort(entries.begin(), entries.end(), [&](const tree_entry& a, const tree_entry& b) {
+            return a.unit_index < b.unit_index;
+        });
+    }
+    return result;
+}
+
+std::vector<trajectory_match> check_order(const sequenced_query& q,
+                                          const std::vector<unit_candidates>& candidates) {
+    if (!q.gaps.empty()) {
+        return check_order_gaps(q, candidates);
+    }
+    return check_order_plain(candidates);
+}
+
+} // namespace geodb
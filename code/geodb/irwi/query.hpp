@@ -4,7 +4,12 @@
 #include "geodb/common.hpp"
 #include "geodb/trajectory.hpp"
 #include "geodb/interval.hpp"
+#include "geodb/irwi/base.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
 #include <unordered_set>
 #include <vector>
 
@@ -18,11 +23,156 @@ struct simple_query {
     std::unordered_set<label_type> labels;  ///< Empty means "any".
 };
 
+/// Constrains the time between the matches of two consecutive simple queries.
+/// The constraint is satisfied by two units `a` (matching the first query) and `b`
+/// (matching the second query) if there are points in time `ta` of `a` and `tb` of `b`
+/// with `min <= tb - ta <= max`.
+struct time_gap {
+    time_type min = 0;
+    time_type max = std::numeric_limits<time_type>::max();
+
+    time_gap() = default;
+
+    time_gap(time_type min, time_type max)
+        : min(min)
+        , max(max)
+    {
+        geodb_assert(min <= max, "invalid time gap");
+    }
+
+    /// Returns true iff the time intervals of `a` and `b` satisfy this constraint.
+    bool satisfied(const trajectory_unit& a, const trajectory_unit& b) const {
+        const bounding_box ab = a.get_bounding_box();
+        const bounding_box bb = b.get_bounding_box();
+
+        // The range of possible values for tb - ta.
+        const i64 lower = i64(bb.min().t()) - i64(ab.max().t());
+        const i64 upper = i64(bb.max().t()) - i64(ab.min().t());
+        return upper >= i64(min) && lower <= i64(max);
+    }
+};
+
 struct sequenced_query {
     /// A list of simple query that have to be satisfied by every
     /// trajectory in the result set (i.e. the sequenced query is the logical AND
     /// of all simple queries).
     std::vector<simple_query> queries;
+
+    /// Optional time constraints between the matches of consecutive simple queries.
+    /// Either empty (no constraints) or `gaps[i]` applies to `queries[i]` and `queries[i + 1]`.
+    std::vector<time_gap> gaps;
+
+    /// Returns the constraint between `queries[i]` and `queries[i + 1]`.
+    time_gap gap(size_t i) const {
+        geodb_assert(i + 1 < queries.size(), "index out of bounds");
+        return gaps.empty() ? time_gap() : gaps[i];
+    }
+
+    /// Throws an exception if the number of gaps is invalid.
+    void validate() const {
+        if (!gaps.empty() && gaps.size() + 1 != queries.size()) {
+            throw std::invalid_argument("sequenced query must have one gap between every pair of simple queries");
+        }
+    }
+};
+
+/// Searches for the `k` trajectories that come closest to a spatial point
+/// within a time window (use a window of length 1 for a single point in time).
+/// Only units whose label is in `labels` are considered (empty means "any").
+struct nearest_query {
+    vector2d point;                         ///< Spatial anchor of the query.
+    interval<time_type> time;               ///< Temporal anchor of the query.
+    std::unordered_set<label_type> labels;  ///< Empty means "any".
+    size_t k = 1;                           ///< Number of requested trajectories.
+};
+
+/// Divides a query rectangle into a regular grid of cells
+/// (`x_cells * y_cells` spatial cells and `t_cells` time buckets).
+struct aggregate_grid {
+    u32 x_cells = 1;
+    u32 y_cells = 1;
+    u32 t_cells = 1;
+
+    /// Returns the total number of cells.
+    size_t size() const { return size_t(x_cells) * y_cells * t_cells; }
+};
+
+/// The result of an aggregate query: the number of trajectory units
+/// in every cell of the grid.
+/// A unit belongs to the cell that contains the center of its bounding box.
+class aggregate_result {
+public:
+    aggregate_result(const bounding_box& rect, const aggregate_grid& grid)
+        : m_rect(rect)
+        , m_grid(grid)
+        , m_counts(grid.size(), 0)
+    {
+        geodb_assert(grid.x_cells > 0 && grid.y_cells > 0 && grid.t_cells > 0,
+                     "grid must have at least one cell");
+    }
+
+    /// The rectangle covered by the grid.
+    const bounding_box& rect() const { return m_rect; }
+
+    /// The dimensions of the grid.
+    const aggregate_grid& grid() const { return m_grid; }
+
+    /// Returns the number of units in the given cell.
+    u64 count(u32 x, u32 y, u32 t) const { return m_counts[index(x, y, t)]; }
+
+    /// Returns the number of units in all cells.
+    u64 total() const {
+        u64 sum = 0;
+        for (u64 c : m_counts) {
+            sum += c;
+        }
+        return sum;
+    }
+
+    /// Returns the unit counts of all cells, indexed by `(t * y_cells + y) * x_cells + x`.
+    const std::vector<u64>& counts() const { return m_counts; }
+
+    /// Finds the cell that contains the point `p`.
+    /// Returns false if `p` is not within the grid's rectangle.
+    bool find_cell(const vector3& p, size_t& cell) const {
+        const vector3& min = m_rect.min();
+        const vector3& max = m_rect.max();
+        if (!vector3::less_eq(min, p) || !vector3::less_eq(p, max)) {
+            return false;
+        }
+
+        cell = index(bucket(p.x(), min.x(), max.x(), m_grid.x_cells),
+                     bucket(p.y(), min.y(), max.y(), m_grid.y_cells),
+                     bucket(p.t(), min.t(), max.t(), m_grid.t_cells));
+        return true;
+    }
+
+    /// Adds `n` units to the given cell.
+    void add(size_t cell, u64 n) {
+        geodb_assert(cell < m_counts.size(), "cell index out of bounds");
+        m_counts[cell] += n;
+    }
+
+private:
+    size_t index(u32 x, u32 y, u32 t) const {
+        geodb_assert(x < m_grid.x_cells && y < m_grid.y_cells && t < m_grid.t_cells,
+                     "cell out of bounds");
+        return (size_t(t) * m_grid.y_cells + y) * m_grid.x_cells + x;
+    }
+
+    /// Maps `v` in [min, max] to one of `n` equally sized buckets.
+    /// The mapping is monotonic in `v`.
+    static u32 bucket(double v, double min, double max, u32 n) {
+        if (max <= min) {
+            return 0;
+        }
+        return std::min(u32((v - min) / (max - min) * n), n - 1);
+    }
+
+private:
+    bounding_box m_rect;
+    aggregate_grid m_grid;
+    std::vector<u64> m_counts;
 };
 
 /// Represents a single matching trajectory unit.
@@ -59,6 +209,60 @@ struct trajectory_match {
     {}
 };
 
+/// Computes which units are part of a sequence that satisfies the sequenced query `q`.
+/// A sequence contains one unit for every simple query, the unit indices must be
+/// non-decreasing and the time gaps between consecutive units must be satisfied.
+///
+/// \param q
+///     The query (only the gaps are used).
+/// \param steps
+///     `steps[i]` contains the units that match `q.queries[i]`, sorted by index.
+/// \param[out] valid
+///     `valid[i][j]` will be true iff `steps[i][j]` is part of a valid sequence.
+/// \return
+///     True iff there is at least one valid sequence.
+bool match_sequences(const sequenced_query& q,
+                     const std::vector<std::vector<unit_match>>& steps,
+                     std::vector<std::vector<bool>>& valid);
+
+/// The units that satisfy a single simple query, grouped by their trajectory id.
+/// The units of every trajectory are sorted by their index.
+using unit_candidates = std::map<trajectory_id_type, std::vector<tree_entry>>;
+
+/// Groups the given units by their trajectory id and sorts every group by unit index.
+unit_candidates group_units(const std::vector<tree_entry>& units);
+
+/// Returns the trajectories that satisfy the sequenced query `q`, i.e. the trajectories
+/// that have matching units for every simple query in the correct order
+/// (and that satisfy the time gap constraints of `q`, if there are any).
+///
+/// \param q
+///     The query.
+/// \param candidates
+///     `candidates[i]` contains the units that satisfy `q.queries[i]`.
+std::vector<trajectory_match> check_order(const sequenced_query& q,
+                                          const std::vector<unit_candidates>& candidates);
+
+/// Represents a trajectory returned by a nearest neighbor query.
+struct nearest_match {
+    /// The id of the matching trajectory.
+    trajectory_id_type id = 0;
+
+    /// The spatial distance between the query point and the trajectory.
+    double distance = 0;
+
+    /// The unit of the trajectory that is closest to the query point.
+    unit_match unit;
+
+    nearest_match() = default;
+
+    nearest_match(trajectory_id_type id, double distance, unit_match unit)
+        : id(id)
+        , distance(distance)
+        , unit(unit)
+    {}
+};
+
 } // namespace geodb
 
 #endif // GEODB_IRWI_QUERY_HPP
@@ -0,0 +1,207 @@
+#include "geodb/irwi/standing_query.hpp"
+
+#include "geodb/algorithm.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace geodb {
+
+namespace bgi = boost::geometry::index;
+
+standing_query_index::standing_query_index(callback_type callback)
+    : m_callback(std::move(callback))
+{}
+
+standing_query_index::~standing_query_index() {}
+
+standing_query_id standing_query_index::add(sequenced_query q) {
+    if (q.queries.empty()) {
+        throw std::invalid_argument("a standing query must not be empty");
+    }
+    q.validate();
+
+    const standing_query_id id = m_next_id++;
+    for (u32 step = 0; step < q.queries.size(); ++step) {
+        m_rtree.insert(rtree_value(convert(q.queries[step].rect), step_ref{id, step}));
+    }
+
+    query_data& data = m_queries[id];
+    data.query = std::move(q);
+    return id;
+}
+
+void standing_query_index::remove(standing_query_id id) {
+    auto pos = m_queries.find(id);
+    if (pos == m_queries.end()) {
+        throw std::invalid_argument("invalid standing query id");
+    }
+
+    m_removed_steps += pos->second.query.queries.size();
+    m_queries.erase(pos);
+    if (m_removed_steps > m_rtree.size() / 2) {
+        repack();
+    }
+}
+
+void standing_query_index::probe(const tree_entry& e) {
+    const bounding_box box = e.unit.get_bounding_box();
+
+    // Keep the state of known trajectories alive.
+    auto seen = m_last_seen.find(e.trajectory_id);
+    if (seen != m_last_seen.end()) {
+        seen->second = std::max(seen->second, box.max().t());
+    }
+
+    m_steps.clear();
+    m_affected.clear();
+    m_rtree.query(bgi::intersects(convert(box)), std::back_inserter(m_steps));
+
+    // Record the unit for every simple query it satisfies.
+    for (const rtree_value& value : m_steps) {
+        const step_ref& ref = value.second;
+        auto query_pos = m_queries.find(ref.query);
+        if (query_pos == m_queries.end()) {
+            continue; // Removed.
+        }
+
+        query_data& data = query_pos->second;
+        if (data.matched.count(e.trajectory_id)) {
+            continue;
+        }
+
+        const simple_query& q = data.query.queries[ref.step];
+        if (!(q.labels.empty() || contains(q.labels, e.unit.label)) || !e.unit.intersects(q.rect)) {
+            continue;
+        }
+
+        progress_type& progress = data.progress[e.trajectory_id];
+        progress.resize(data.query.queries.size());
+
+        std::vector<unit_match>& units = progress[ref.step];
+        auto pos = std::lower_bound(units.begin(), units.end(), e.unit_index,
+                                    [](const unit_match& m, u32 index) { return m.index < index; });
+        if (pos == units.end() || pos->index != e.unit_index) {
+            units.emplace(pos, e.unit_index, e.unit);
+        }
+        m_affected.push_back(ref.query);
+    }
+    if (!m_affected.empty() && seen == m_last_seen.end()) {
+        m_last_seen.emplace(e.trajectory_id, box.max().t());
+    }
+
+    // Emit matches in query id order.
+    std::sort(m_affected.begin(), m_affected.end());
+    m_affected.erase(std::unique(m_affected.begin(), m_affected.end()), m_affected.end());
+
+    standing_match match;
+    for (standing_query_id id : m_affected) {
+        query_data& data = m_queries.at(id);
+        auto pos = data.progress.find(e.trajectory_id);
+        geodb_assert(pos != data.progress.end(), "progress must exist");
+
+        if (!find_sequence(data.query, pos->second, match.units)) {
+            continue;
+        }
+
+        data.progress.erase(pos);
+        data.matched.insert(e.trajectory_id);
+
+        match.query = id;
+        match.trajectory = e.trajectory_id;
+        m_callback(match);
+    }
+}
+
+void standing_query_index::finish(trajectory_id_type id) {
+    if (m_last_seen.erase(id)) {
+        evict(id);
+    }
+}
+
+void standing_query_index::expire(time_type t) {
+    for (auto pos = m_last_seen.begin(); pos != m_last_seen.end(); ) {
+        if (pos->second < t) {
+            evict(pos->first);
+            pos = m_last_seen.erase(pos);
+        } else {
+            ++pos;
+        }
+    }
+}
+
+void standing_query_index::evict(trajectory_id_type id) {
+    for (auto& pair : m_queries) {
+        pair.second.progress.erase(id);
+        pair.second.matched.erase(id);
+    }
+}
+
+standing_query_index::box_type standing_query_index::convert(const bounding_box& b) {
+    return box_type(point_type(b.min().x(), b.min().y(), b.min().t()),
+                    point_type(b.max().x(), b.max().y(), b.max().t()));
+}
+
+void standing_query_index::repack() {
+    std::vector<rtree_value> values;
+    values.reserve(m_rtree.size() - m_removed_steps);
+    for (const rtree_value& value : m_rtree) {
+        if (m_queries.count(value.second.query)) {
+            values.push_back(value);
+        }
+    }
+
+    // The range constructor uses the packing algorithm.
+    m_rtree = rtree_type(values.begin(), values.end());
+    m_removed_steps = 0;
+}
+
+bool standing_query_index::find_sequence(const sequenced_query& q, const progress_type& progress,
+                                         std::vector<unit_match>& result)
+{
+    result.clear();
+
+    if (q.gaps.empty()) {
+        // Greedily pick the earliest unit for every simple query.
+        // Consecutive queries may be satisfied by the same unit, just like in tree::find().
+        u32 min_index = 0;
+        for (const std::vector<unit_match>& units : progress) {
+            auto pos = std::lower_bound(units.begin(), units.end(), min_index,
+                                        [](const unit_match& m, u32 index) { return m.index < index; });
+            if (pos == units.end()) {
+                return false;
+            }
+
+            result.push_back(*pos);
+            min_index = pos->index;
+        }
+        return true;
+    }
+
+    // Time gaps: find the units that are part of a valid sequence and pick one of them.
+    // Every valid unit has a valid successor, so the walk always completes.
+    std::vector<std::vector<bool>> valid;
+    if (!match_sequences(q, progress, valid)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < progress.size(); ++i) {
+        for (size_t j = 0; j < progress[i].size(); ++j) {
+            const unit_match& unit = progress[i][j];
+            if (!valid[i][j]) {
+                continue;
+            }
+            if (i > 0 && (result.back().index > unit.index
+                          || !q.gap(i - 1).satisfied(result.back().unit, unit.unit))) {
+                continue;
+            }
+
+            result.push_back(unit);
+            break;
+        }
+        geodb_assert(result.size() == i + 1, "must find a successor");
+    }
+    return true;
+}
+
+} // namespace geodb
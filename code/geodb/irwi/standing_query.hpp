@@ -0,0 +1,160 @@
+#ifndef GEODB_IRWI_STANDING_QUERY_HPP
+#define GEODB_IRWI_STANDING_QUERY_HPP
+
+#include "geodb/common.hpp"
+#include "geodb/trajectory.hpp"
+#include "geodb/irwi/base.hpp"
+#include "geodb/irwi/query.hpp"
+
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/// \file
+/// Contains an index for long-lived (standing) queries that are
+/// evaluated against newly inserted tree entries.
+
+namespace geodb {
+
+/// Identifies a registered standing query.
+using standing_query_id = u64;
+
+/// Emitted when a trajectory satisfies a standing query.
+struct standing_match {
+    /// The id of the satisfied query.
+    standing_query_id query = 0;
+
+    /// The id of the matching trajectory.
+    trajectory_id_type trajectory = 0;
+
+    /// One matching unit for every simple query (in query order).
+    /// The unit indices are non-decreasing.
+    std::vector<unit_match> units;
+};
+
+/// An index over registered sequenced queries.
+/// Every new tree entry is probed against the index, which keeps track
+/// of the partial progress of every trajectory for every query.
+/// A match is emitted (exactly once per query and trajectory) as soon as
+/// a trajectory satisfies all simple queries in the correct order,
+/// using the same semantics as \ref tree::find().
+///
+/// The units of a trajectory may be probed in any order (e.g. in the order
+/// produced by a bulk loader).
+///
+/// The index keeps state for every trajectory that has been probed with
+/// a matching unit. That state is only discarded by \ref finish() and \ref expire(),
+/// long running indices must call one of them to bound their memory usage.
+class standing_query_index : boost::noncopyable {
+public:
+    using callback_type = std::function<void(const standing_match&)>;
+
+public:
+    /// Constructs an empty index.
+    /// \param callback Invoked for every emitted match.
+    explicit standing_query_index(callback_type callback);
+
+    ~standing_query_index();
+
+    /// Registers a new standing query and returns its id.
+    /// \pre `!q.queries.empty()`.
+    standing_query_id add(sequenced_query q);
+
+    /// Removes the standing query with the given id.
+    /// Its partial matches are discarded.
+    void remove(standing_query_id id);
+
+    /// Returns the number of registered queries.
+    size_t size() const { return m_queries.size(); }
+
+    /// Returns the number of trajectories for which the index keeps state
+    /// (partial or reported matches).
+    size_t trajectories() const { return m_last_seen.size(); }
+
+    /// Probes a newly inserted entry against all registered queries.
+    /// Invokes the callback for every query that becomes satisfied by
+    /// the entry's trajectory.
+    void probe(const tree_entry& e);
+
+    /// Discards the state of a trajectory that will not receive any more units.
+    void finish(trajectory_id_type id);
+
+    /// Discards the state of all trajectories whose units (probed so far)
+    /// all end before time `t`. If such a trajectory is probed again,
+    /// it starts from scratch and may be reported again.
+    void expire(time_type t);
+
+private:
+    struct step_ref {
+        standing_query_id query;
+        u32 step;
+    };
+
+    /// Matching units of a trajectory for every simple query (sorted by index).
+    using progress_type = std::vector<std::vector<unit_match>>;
+
+    struct query_data {
+        sequenced_query query;
+
+        /// Partial matches of trajectories that have not yet satisfied the query.
+        std::unordered_map<trajectory_id_type, progress_type> progress;
+
+        /// Trajectories that have already been reported.
+        std::unordered_set<trajectory_id_type> matched;
+    };
+
+    using point_type = boost::geometry::model::point<double, 3, boost::geometry::cs::cartesian>;
+    using box_type = boost::geometry::model::box<point_type>;
+    using rtree_value = std::pair<box_type, step_ref>;
+    using rtree_type = boost::geometry::index::rtree<rtree_value, boost::geometry::index::quadratic<16>>;
+
+private:
+    static box_type convert(const bounding_box& b);
+
+    /// Rebuilds the rtree without the steps of removed queries.
+    void repack();
+
+    /// Discards the state of the given trajectory in all queries.
+    void evict(trajectory_id_type id);
+
+    /// Finds one unit for every simple query so that the units satisfy the
+    /// order and time gap constraints of `q`. Returns false if there are none.
+    static bool find_sequence(const sequenced_query& q, const progress_type& progress,
+                              std::vector<unit_match>& result);
+
+private:
+    callback_type m_callback;
+
+    /// Contains the rectangle of every simple query of every registered query.
+    /// Steps of removed queries are only dropped when the tree is repacked:
+    /// rtree::remove() compares values, which step_ref does not support,
+    /// and repacking yields a better tree than many individual removals.
+    rtree_type m_rtree;
+
+    /// Number of steps in the rtree that belong to removed queries.
+    size_t m_removed_steps = 0;
+
+    /// Maps query ids to their state.
+    std::unordered_map<standing_query_id, query_data> m_queries;
+
+    /// Maps trajectories with state in any query to the
+    /// latest end time of their probed units.
+    std::unordered_map<trajectory_id_type, time_type> m_last_seen;
+
+    standing_query_id m_next_id = 1;
+
+    // Buffers reused by probe().
+    std::vector<rtree_value> m_steps;
+    std::vector<standing_query_id> m_affected;
+};
+
+} // namespace geodb
+
+#endif // GEODB_IRWI_STANDING_QUERY_HPP
@@ -0,0 +1,321 @@
+#ifndef GEODB_IRWI_TIME_FOREST_HPP
+#define GEODB_IRWI_TIME_FOREST_HPP
+
+#include "geodb/bounding_box.hpp"
+#include "geodb/common.hpp"
+#include "geodb/irwi/query.hpp"
+#include "geodb/irwi/tree.hpp"
+#include "geodb/utility/parallel.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// \file
+/// A forest of trees that are partitioned by time.
+
+namespace geodb {
+
+/// Catalog entry of a single partition of a \ref time_forest.
+/// Summarizes the content of the partition so that queries
+/// can skip it without opening the tree.
+struct time_partition {
+    /// The index of the time slice covered by this partition.
+    u64 slice = 0;
+
+    /// The number of trajectory units in this partition.
+    u64 size = 0;
+
+    /// Contains all units in this partition (only meaningful if `size > 0`).
+    bounding_box mbb;
+
+    /// The number of units for every label in this partition.
+    std::map<label_type, u64> labels;
+
+    /// Adds a single unit to the summary.
+    void add(const trajectory_unit& unit) {
+        const bounding_box b = unit.get_bounding_box();
+        mbb = size == 0 ? b : mbb.extend(b);
+        ++size;
+        ++labels[unit.label];
+    }
+
+    /// Returns true if this partition may contain units that satisfy `q`.
+    bool may_match(const simple_query& q) const {
+        if (size == 0 || !mbb.intersects(q.rect)) {
+            return false;
+        }
+        if (q.labels.empty()) {
+            return true;
+        }
+        for (label_type label : q.labels) {
+            if (labels.count(label)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/// A forest of IRWI trees, one for every time slice of a fixed length.
+/// A unit belongs to the slice that contains its start time.
+///
+/// New data (e.g. a new day) only touches the partitions of its time slices,
+/// and old partitions can be dropped without touching the rest of the forest.
+/// The forest keeps a catalog of all partitions (see \ref time_partition),
+/// queries only visit the partitions whose summary matches a simple query.
+/// These partitions are searched in parallel, then the units of every trajectory
+/// are merged across all partitions and checked for the correct order
+/// (see \ref check_order()).
+///
+/// \tparam StorageSpec
+///     The storage type of the individual trees.
+/// \tparam Lambda
+///     The maximum number of intervals in each posting.
+template<typename StorageSpec, u32 Lambda>
+class time_forest : boost::noncopyable {
+public:
+    using tree_type = tree<StorageSpec, Lambda>;
+
+    /// Returns the storage for the partition with the given name.
+    /// Partition names are unique and can be used as file names.
+    using storage_factory = std::function<StorageSpec(const std::string& name)>;
+
+public:
+    /// Returns the name of the partition for the given time slice.
+    static std::string partition_name(u64 slice) {
+        return "slice-" + std::to_string(slice);
+    }
+
+public:
+    /// Constructs (or opens) a forest.
+    ///
+    /// \param factory
+    ///     Creates the storage for every partition.
+    /// \param slice_length
+    ///     The length of a time slice. Must be positive and must not change
+    ///     when an existing forest is reopened.
+    /// \param catalog
+    ///     The catalog of an existing forest (empty for a new forest).
+    /// \param weight
+    ///     Weighting factor for all partitions (see \ref tree::tree).
+    ///     If not given, existing partitions keep their recorded weight.
+    time_forest(storage_factory factory, time_type slice_length,
+                std::vector<time_partition> catalog = {}, boost::optional<double> weight = boost::none)
+        : m_factory(std::move(factory))
+        , m_slice_length(slice_length)
+        , m_weight(weight)
+    {
+        if (slice_length == 0) {
+            throw std::invalid_argument("slice length must be positive");
+        }
+        for (time_partition& p : catalog) {
+            const u64 slice = p.slice;
+            partition_data& data = m_partitions[slice];
+            data.info = std::move(p);
+            data.tree = std::make_unique<tree_type>(m_factory(partition_name(slice)), m_weight);
+        }
+    }
+
+    /// Returns the length of a time slice.
+    time_type slice_length() const { return m_slice_length; }
+
+    /// Returns the time slice that contains the given point in time.
+    u64 slice_of(time_type t) const { return t / m_slice_length; }
+
+    /// Returns the catalog of all partitions, ordered by slice.
+    std::vector<time_partition> catalog() const {
+        std::vector<time_partition> result;
+        for (const auto& pair : m_partitions) {
+            result.push_back(pair.second.info);
+        }
+        return result;
+    }
+
+    /// Returns the number of threads used to search partitions in parallel.
+    size_t threads() const { return m_threads; }
+
+    /// Sets the number of threads used to search partitions in parallel.
+    /// \pre `threads > 0`.
+    void threads(size_t threads) {
+        if (threads == 0) {
+            throw std::invalid_argument("thread count must be positive");
+        }
+        m_threads = threads;
+    }
+
+    /// Returns true iff there is a partition for the given slice.
+    bool contains(u64 slice) const { return m_partitions.count(slice) > 0; }
+
+    /// Returns the tree of the given slice. A new (empty)
+    /// partition will be created if it does not exist yet.
+    ///
+    /// Entries that are inserted directly into the tree are not
+    /// reflected by the catalog, call \ref refresh() after modifying the tree.
+    tree_type& partition(u64 slice) {
+        partition_data& data = m_partitions[slice];
+        if (!data.tree) {
+            data.info.slice = slice;
+            data.tree = std::make_unique<tree_type>(m_factory(partition_name(slice)), m_weight);
+        }
+        return *data.tree;
+    }
+
+    /// Recomputes the catalog entry of the given partition from the
+    /// root of its tree.
+    /// \pre `contains(slice)`.
+    void refresh(u64 slice) {
+        geodb_assert(contains(slice), "partition does not exist");
+        partition_data& data = m_partitions.at(slice);
+        data.info = summarize(slice, *data.tree);
+    }
+
+    /// Removes the partition of the given slice from the forest.
+    /// The storage of the partition is not touched; the caller
+    /// is responsible for deleting it (e.g. by removing its directory).
+    /// Returns false if there was no such partition.
+    bool drop(u64 slice) {
+        return m_partitions.erase(slice) > 0;
+    }
+
+    /// Returns the total number of trajectory units in all partitions.
+    size_t size() const {
+        size_t result = 0;
+        for (const auto& pair : m_partitions) {
+            result += pair.second.tree->size();
+        }
+        return result;
+    }
+
+    /// True iff all partitions are empty.
+    bool empty() const { return size() == 0; }
+
+    /// Inserts a single leaf entry into the partition of its time slice.
+    void insert(const tree_entry& e) {
+        const u64 slice = slice_of(e.unit.get_bounding_box().min().t());
+        partition(slice).insert(e);
+        m_partitions.at(slice).info.add(e.unit);
+    }
+
+    /// Finds all trajectories that satisfy the given query.
+    /// Returns the same result as a single tree that contains all units.
+    std::vector<trajectory_match> find(const sequenced_query& seq_query) const {
+        STATS_GUARD(guard, "Time forest query");
+
+        seq_query.validate();
+
+        const size_t n = seq_query.queries.size();
+        if (n == 0) {
+            return {};
+        }
+
+        // Select the partitions that have to be searched for every simple query.
+        // Every task searches a single partition, trees are not safe for
+        // concurrent use.
+        struct task {
+            const tree_type* tree;
+            std::vector<size_t> queries;
+            std::vector<std::vector<tree_entry>> units;
+        };
+
+        std::vector<task> tasks;
+        std::vector<size_t> partitions(n, 0);
+        for (const auto& pair : m_partitions) {
+            const partition_data& data = pair.second;
+
+            task t;
+            t.tree = data.tree.get();
+            for (size_t i = 0; i < n; ++i) {
+                if (data.info.may_match(seq_query.queries[i])) {
+                    t.queries.push_back(i);
+                    ++partitions[i];
+                }
+            }
+            if (!t.queries.empty()) {
+                tasks.push_back(std::move(t));
+            }
+        }
+        for (size_t count : partitions) {
+            if (count == 0) {
+                return {};  // Every simple query must be satisfied.
+            }
+        }
+
+        parallel_for(tasks.size(), m_threads, [&](size_t index) {
+            task& t = tasks[index];
+            for (size_t i : t.queries) {
+                t.units.push_back(t.tree->find_units(seq_query.queries[i]));
+            }
+        });
+
+        // Merge the units of every simple query across all partitions.
+        std::vector<std::vector<tree_entry>> units(n);
+        for (const task& t : tasks) {
+            for (size_t k = 0; k < t.queries.size(); ++k) {
+                std::vector<tree_entry>& dest = units[t.queries[k]];
+                dest.insert(dest.end(), t.units[k].begin(), t.units[k].end());
+            }
+        }
+
+        std::vector<unit_candidates> candidates(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (units[i].empty()) {
+                return {};
+            }
+            candidates[i] = group_units(units[i]);
+        }
+        return check_order(seq_query, candidates);
+    }
+
+private:
+    /// Computes the catalog entry of a partition by inspecting the root of its tree.
+    static time_partition summarize(u64 slice, const tree_type& tree) {
+        time_partition info;
+        info.slice = slice;
+        if (tree.empty()) {
+            return info;
+        }
+
+        auto root = tree.root();
+        info.size = tree.size();
+        info.mbb = root.mbb();
+        if (root.is_leaf()) {
+            for (size_t i = 0; i < root.size(); ++i) {
+                ++info.labels[root.value(i).unit.label];
+            }
+        } else {
+            auto index = root.inverted_index();
+            for (const auto& entry : *index) {
+                u64 count = 0;
+                const auto list = entry.postings_list();
+                for (const auto& posting : *list) {
+                    count += posting.count();
+                }
+                info.labels[entry.label()] = count;
+            }
+        }
+        return info;
+    }
+
+private:
+    struct partition_data {
+        std::unique_ptr<tree_type> tree;
+        time_partition info;
+    };
+
+    storage_factory m_factory;
+    time_type m_slice_length;
+    boost::optional<double> m_weight;
+    size_t m_threads = 1;
+    std::map<u64, partition_data> m_partitions;
+};
+
+} // namespace geodb
+
+#endif // GEODB_IRWI_TIME_FOREST_HPP
@@ -9,22 +9,30 @@
 #include "geodb/irwi/label_count.hpp"
 #include "geodb/irwi/posting.hpp"
 #include "geodb/irwi/query.hpp"
+#include "geodb/irwi/standing_query.hpp"
 #include "geodb/irwi/tree_insertion.hpp"
 #include "geodb/irwi/tree_state.hpp"
+#include "geodb/utility/arena.hpp"
+#include "geodb/utility/block_writer.hpp"
 #include "geodb/utility/range_utils.hpp"
 #include "geodb/utility/stats_guard.hpp"
 
 #include <boost/container/static_vector.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 #include <boost/range/adaptor/filtered.hpp>
+#include <boost/range/adaptor/indirected.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include <boost/range/algorithm/max_element.hpp>
 #include <boost/range/algorithm/min_element.hpp>
 
 #include <algorithm>
+#include <functional>
 #include <set>
 #include <map>
 #include <ostream>
+#include <queue>
+#include <unordered_set>
 
 /// \file
 /// Contains the main IRWI Tree class.
@@ -58,9 +66,10 @@ public:
 
     using posting_type = typename list_type::posting_type;
 
-private:
+    /// The id set type used by this tree's postings.
     using id_set_type = typename posting_type::id_set_type;
 
+private:
     using node_id_type = typename state_type::node_id;
     using node_ptr = typename state_type::node_ptr;
     using leaf_ptr = typename state_type::leaf_ptr;
@@ -74,9 +83,45 @@ private:
         id_set_type ids;
     };
 
+    /// Status of a simple query while descending the tree.
+    /// Simple queries are evaluated in parallel.
+    /// The containers allocate from the arena of the current thread;
+    /// states must not outlive the \ref arena_scope of the query.
+    struct query_state {
+        query_state(size_t id, const simple_query& query): id(id), query(&query) {}
+
+        size_t id;
+        const simple_query* query;
+        arena_vector<node_ptr> parents;             // nodes of the previous level
+        arena_vector<node_ptr> nodes;               // set of remaining nodes (sorted)
+        arena_vector<candidate_entry> candidates;   // children of the parent nodes
+        interval<time_type> time_window;            // time interval containing the candidates
+        id_set_type ids;                            // union of ids in candidates
+    };
+
 public:
     using value_type = tree_entry;
 
+    /// The result of \ref find_candidates().
+    struct candidate_result {
+        /// Contains (at least) the ids of all trajectories that satisfy the query.
+        /// Might contain false positives.
+        id_set_type ids;
+
+        /// The level of the nodes whose id sets have been used (the root has level 1).
+        size_t level = 0;
+
+        /// The number of nodes (summed over all simple queries) that survived the filtering
+        /// and contributed to `ids`.
+        size_t nodes = 0;
+
+        /// An upper bound for the number of trajectories that can satisfy the query,
+        /// derived from the postings counts of the surviving nodes.
+        /// At most `max_matches` ids in `ids` are true matches, every other id is
+        /// a false positive.
+        u64 max_matches = 0;
+    };
+
     using cursor = tree_cursor<state_type>;
 
 public:
@@ -99,13 +144,45 @@ public:
     ///     Weighting factor for the weighted average between
     ///     spatial and textual cost. A value of 1 yields a classic
     ///     rtree. Must be in [0, 1].
-    tree(const StorageSpec& s = StorageSpec(), double weight = 0.5f)
+    ///     If given, it overrides (and replaces) the weight recorded
+    ///     in an existing tree. Otherwise, existing trees use their
+    ///     recorded weight and new trees use 0.5.
+    tree(const StorageSpec& s = StorageSpec(), boost::optional<double> weight = boost::none)
         : state(std::move(s), detail::tree_entry_accessor(), weight)
     {}
 
     /// Returns the weighting factor for cost calculation.
     double weight() const { return state.weight(); }
 
+    /// Changes the weighting factor for cost calculation.
+    /// The new value is recorded with the tree and applies to future insertions.
+    /// \pre `0 <= weight <= 1`.
+    void weight(double weight) { state.weight(weight); }
+
+    /// Returns the strategy that derives the weight of a node from its level.
+    beta_strategy strategy() const { return state.strategy(); }
+
+    /// Changes the beta strategy. The new value is recorded with the tree
+    /// and applies to future insertions.
+    void strategy(beta_strategy strategy) { state.strategy(strategy); }
+
+    /// Returns the algorithm used to split overflowing nodes.
+    split_strategy split() const { return state.split(); }
+
+    /// Changes the algorithm used to split overflowing nodes.
+    /// The setting is not persisted; it only applies to this instance
+    /// (and to bulk loaders that use it).
+    void split(split_strategy s) { state.split(s); }
+
+    /// Returns the fraction of entries of an overflowing node that are
+    /// reinserted before the node is split (0 if forced reinsertion is disabled).
+    double reinsert_fraction() const { return state.reinsert_fraction(); }
+
+    /// Enables forced reinsertion (as in the R*-Tree) for future insertions.
+    /// The setting is not persisted.
+    /// \pre `0 <= fraction < 1`.
+    void reinsert_fraction(double fraction) { state.reinsert_fraction(fraction); }
+
     /// Returns the height of the tree. The height is at least 1.
     /// The empty tree has a single, empty leaf node.
     size_t height() const { return storage().get_height(); }
@@ -125,6 +202,14 @@ public:
     /// Returns the total number of nodes.
     size_t node_count() const { return internal_node_count() + leaf_node_count(); }
 
+    /// Writes evicted blocks asynchronously until \ref write_through() is called.
+    /// Only supported by external storage (used for bulk loading).
+    void write_behind(const block_writer_options& options) { storage().write_behind(options); }
+
+    /// Waits for all pending writes and returns to synchronous writes.
+    /// Only supported by external storage.
+    void write_through() { storage().write_through(); }
+
     /// Returns a cursor pointing to the root of the tree.
     /// \pre `!empty()`.
     cursor root() const {
@@ -140,18 +225,32 @@ public:
         using insertion_type = tree_insertion<state_type>;
 
         insertion_type(state).insert(v, path_buf);
+        if (standing) {
+            standing->probe(v);
+        }
     }
 
+    /// Sets the index of standing queries that will be probed
+    /// for every entry inserted into this tree (including entries
+    /// inserted by bulk loading).
+    /// The index must outlive the tree or be reset by passing `nullptr`.
+    void standing_queries(standing_query_index* index) { standing = index; }
+
+    /// Returns the index of standing queries (may be null).
+    standing_query_index* standing_queries() const { return standing; }
+
     /// Finds all trajectories that satisfy the given query.
     std::vector<trajectory_match> find(const sequenced_query& seq_query) const {
         STATS_GUARD(guard, "Query");
+        arena_scope scope(thread_arena());
 
+        seq_query.validate();
         if (empty()) {
             return {}; // no root.
         }
 
         const size_t n = seq_query.queries.size();
-        std::vector<std::vector<leaf_ptr>> nodes = find_leaves(seq_query.queries);
+        auto nodes = find_leaves(seq_query);
         if (nodes.empty()) {
             return {};
         }
@@ -159,17 +258,324 @@ public:
         geodb_assert(nodes.size() == n, "not enough node lists");
 
         // Iterate over all leaf nodes and gather the matching entries.
-        std::vector<std::map<trajectory_id_type, std::vector<tree_entry>>> candidates(n);
+        std::vector<unit_candidates> candidates(n);
         std::vector<tree_entry> units;
         for (size_t i = 0; i < n; ++i) {
             geodb_assert(!nodes[i].empty(), "node list must be non-empty");
             get_matching_units(seq_query.queries[i], nodes[i], units);
-            candidates[i] = group_by_key(units, [](const tree_entry& e) { return e.trajectory_id; });
-            sort_groups(candidates[i]);
+            candidates[i] = group_units(units);
         }
 
         // Trajectories must satisfy every simple query and must do so in the correct order.
-        return check_order(candidates);
+        return check_order(seq_query, candidates);
+    }
+
+    /// Finds all trajectory units that satisfy the given simple query.
+    /// The units are returned in no particular order.
+    ///
+    /// This is the building block for structures that combine the results
+    /// of several trees (see \ref check_order()).
+    std::vector<tree_entry> find_units(const simple_query& query) const {
+        STATS_GUARD(guard, "Unit query");
+        arena_scope scope(thread_arena());
+
+        std::vector<tree_entry> units;
+        if (empty()) {
+            return units;
+        }
+
+        sequenced_query seq_query;
+        seq_query.queries.push_back(query);
+
+        auto nodes = find_leaves(seq_query);
+        if (!nodes.empty()) {
+            get_matching_units(query, nodes[0], units);
+        }
+        return units;
+    }
+
+    /// Approximates the result of \ref find() without looking at leaf entries.
+    /// The search descends the tree exactly like \ref find(), but it stops
+    /// at the given level (the root has level 1, the leaves have level `height()`).
+    /// The id sets of the surviving nodes are then intersected across all simple queries.
+    /// A lower `level` yields a faster but less precise answer.
+    ///
+    /// The result never misses a matching trajectory, but it may contain false positives
+    /// (because of the approximate nature of the id sets and because time order
+    /// is not checked). Leaves are only read if the tree consists of a single leaf.
+    ///
+    /// \param seq_query
+    ///     The query.
+    /// \param level
+    ///     The level at which the search stops. Clamped to `[2, height()]`.
+    candidate_result find_candidates(const sequenced_query& seq_query, size_t level) const {
+        STATS_GUARD(guard, "Candidate query");
+        arena_scope scope(thread_arena());
+
+        seq_query.validate();
+
+        candidate_result result;
+        if (empty() || seq_query.queries.empty()) {
+            return result;
+        }
+
+        const size_t height = storage().get_height();
+        if (height == 1) {
+            // There are no inverted indices in a tree without internal nodes.
+            // The root is the only leaf.
+            result.level = 1;
+            result.nodes = 1;
+            for (const trajectory_match& match : find(seq_query)) {
+                result.ids.add(match.id);
+                ++result.max_matches;
+            }
+            return result;
+        }
+
+        result.level = std::min(std::max(level, size_t(2)), height);
+
+        arena_vector<query_state> states;
+        if (!descend(seq_query, result.level, states)) {
+            return result;
+        }
+
+        // The ids of a node are stored in its parent's postings. Consider only
+        // the candidates that survived the last round of filtering.
+        std::vector<u64> label_counts;
+        arena_vector<const id_set_type*> surviving_ids;
+        for (query_state& state : states) {
+            auto survived = [&](node_ptr ptr) {
+                return std::binary_search(state.nodes.begin(), state.nodes.end(), ptr);
+            };
+
+            surviving_ids.clear();
+            for (const candidate_entry& c : state.candidates) {
+                if (survived(c.ptr)) {
+                    surviving_ids.push_back(&c.ids);
+                }
+            }
+            state.ids = id_set_type::set_union(surviving_ids | boost::adaptors::indirected);
+
+            // Every unit belongs to exactly one trajectory, so the number of matching
+            // units is an upper bound for the number of matching trajectories.
+            u64 units = 0;
+            for (node_ptr parent : state.parents) {
+                const internal_ptr internal = storage().to_internal(parent);
+                get_label_counts(internal, state.query->labels, label_counts);
+                for (u32 i = 0; i < label_counts.size(); ++i) {
+                    if (label_counts[i] != 0 && survived(storage().get_child(internal, i))) {
+                        units += label_counts[i];
+                    }
+                }
+            }
+
+            result.nodes += state.nodes.size();
+            result.max_matches = state.id == 1 ? units : std::min(result.max_matches, units);
+        }
+
+        result.ids = id_set_type::set_intersection(states | transformed_member(&query_state::ids));
+        if (result.ids.empty()) {
+            result.max_matches = 0;
+        }
+        STATS_PRINT(guard, "stopped at level {} with {} nodes, at most {} matches.",
+                    result.level, result.nodes, result.max_matches);
+        return result;
+    }
+
+    /// Finds the `q.k` trajectories that come closest to `q.point` within the
+    /// time window `q.time`. Only units with a matching label are considered.
+    ///
+    /// Nodes are visited in best-first order (ordered by the spatial distance
+    /// of their bounding box to the query point), which guarantees that only nodes
+    /// that might contain one of the results are read.
+    /// Subtrees without matching labels are skipped by consulting the
+    /// inverted index of their parent.
+    ///
+    /// \return
+    ///     Up to `q.k` trajectories, ordered by their distance to the query point.
+    std::vector<nearest_match> find_nearest(const nearest_query& q) const {
+        STATS_GUARD(guard, "Nearest neighbor query");
+
+        if (empty() || q.k == 0) {
+            return {};
+        }
+
+        // The priority queue contains both nodes and leaf entries.
+        // A leaf entry that reaches the top of the queue is at least as close
+        // as every entry that has not yet been seen.
+        struct queue_entry {
+            double distance = 0;
+            size_t level = 0;       // 0 for leaf entries.
+            node_ptr node{};        // Valid if level != 0.
+            tree_entry entry;       // Valid if level == 0.
+
+            bool operator>(const queue_entry& other) const {
+                return distance > other.distance;
+            }
+        };
+
+        std::priority_queue<queue_entry, std::vector<queue_entry>, std::greater<queue_entry>> queue;
+        std::vector<nearest_match> result;
+        std::unordered_set<trajectory_id_type> seen;
+        std::vector<u64> label_counts;
+
+        auto time_matches = [&](const bounding_box& b) {
+            return q.time.overlaps({b.min().t(), b.max().t()});
+        };
+
+        {
+            queue_entry root;
+            root.level = 1;
+            root.node = storage().get_root();
+            queue.push(root);
+        }
+
+        const size_t height = storage().get_height();
+        size_t visited_nodes = 0;
+        while (!queue.empty()) {
+            const queue_entry top = queue.top();
+            queue.pop();
+
+            if (top.level == 0) {
+                // Closest remaining unit. Its trajectory has not been reported yet.
+                if (seen.insert(top.entry.trajectory_id).second) {
+                    result.emplace_back(top.entry.trajectory_id, top.distance,
+                                        unit_match(top.entry.unit_index, top.entry.unit));
+                    if (result.size() == q.k) {
+                        break;
+                    }
+                }
+                continue;
+            }
+
+            ++visited_nodes;
+            if (top.level == height) {
+                const leaf_ptr leaf = storage().to_leaf(top.node);
+                const u32 count = storage().get_count(leaf);
+                for (u32 i = 0; i < count; ++i) {
+                    const tree_entry data = storage().get_data(leaf, i);
+                    if (seen.count(data.trajectory_id)
+                            || !(q.labels.empty() || contains(q.labels, data.unit.label))
+                            || !time_matches(data.unit.get_bounding_box())) {
+                        continue;
+                    }
+
+                    queue_entry e;
+                    e.distance = data.unit.spatial_distance(q.point, q.time);
+                    e.entry = data;
+                    queue.push(e);
+                }
+                continue;
+            }
+
+            const internal_ptr internal = storage().to_internal(top.node);
+            get_label_counts(internal, q.labels, label_counts);
+
+            const u32 count = storage().get_count(internal);
+            for (u32 i = 0; i < count; ++i) {
+                if (label_counts[i] == 0) {
+                    continue;
+                }
+
+                const bounding_box mbb = storage().get_mbb(internal, i);
+                if (!time_matches(mbb)) {
+                    continue;
+                }
+
+                queue_entry e;
+                e.distance = mbb.spatial_distance(q.point);
+                e.level = top.level + 1;
+                e.node = storage().get_child(internal, i);
+                queue.push(e);
+            }
+        }
+        STATS_PRINT(guard, "visited {} nodes, found {} trajectories.", visited_nodes, result.size());
+        return result;
+    }
+
+    /// Counts the trajectory units within `rect` that have one of the given labels
+    /// (or any label, if `labels` is empty). The counts are reported for every cell
+    /// of a regular grid over `rect`, a unit is counted in the cell that contains
+    /// the center of its bounding box.
+    ///
+    /// The count of every posting is exact, which means that subtrees whose bounding box
+    /// falls completely into a single cell are answered from the inverted index
+    /// of their parent. Only subtrees that cross cell boundaries are visited.
+    aggregate_result aggregate(const bounding_box& rect,
+                               const std::unordered_set<label_type>& labels,
+                               const aggregate_grid& grid) const
+    {
+        STATS_GUARD(guard, "Aggregate query");
+
+        aggregate_result result(rect, grid);
+        if (empty()) {
+            return result;
+        }
+
+        struct todo_entry {
+            node_ptr node;
+            size_t level;
+        };
+
+        std::vector<todo_entry> todo;
+        std::vector<u64> label_counts;
+        todo.push_back({storage().get_root(), 1});
+
+        const size_t height = storage().get_height();
+        size_t visited_nodes = 0;
+        size_t summarized_nodes = 0;
+        while (!todo.empty()) {
+            const todo_entry top = todo.back();
+            todo.pop_back();
+            ++visited_nodes;
+
+            if (top.level == height) {
+                const leaf_ptr leaf = storage().to_leaf(top.node);
+                const u32 count = storage().get_count(leaf);
+                for (u32 i = 0; i < count; ++i) {
+                    const tree_entry data = storage().get_data(leaf, i);
+                    if (!(labels.empty() || contains(labels, data.unit.label))) {
+                        continue;
+                    }
+
+                    size_t cell;
+                    if (result.find_cell(data.unit.get_bounding_box().center(), cell)) {
+                        result.add(cell, 1);
+                    }
+                }
+                continue;
+            }
+
+            const internal_ptr internal = storage().to_internal(top.node);
+            get_label_counts(internal, labels, label_counts);
+
+            const u32 count = storage().get_count(internal);
+            for (u32 i = 0; i < count; ++i) {
+                if (label_counts[i] == 0) {
+                    continue;
+                }
+
+                const bounding_box mbb = storage().get_mbb(internal, i);
+                if (!mbb.intersects(rect)) {
+                    continue;
+                }
+
+                // The cell mapping is monotonic, all units of the subtree
+                // belong to the same cell if both corners do.
+                size_t min_cell, max_cell;
+                if (result.find_cell(mbb.min(), min_cell)
+                        && result.find_cell(mbb.max(), max_cell)
+                        && min_cell == max_cell) {
+                    result.add(min_cell, label_counts[i]);
+                    ++summarized_nodes;
+                    continue;
+                }
+
+                todo.push_back({storage().get_child(internal, i), top.level + 1});
+            }
+        }
+        STATS_PRINT(guard, "visited {} nodes, summarized {} subtrees.", visited_nodes, summarized_nodes);
+        return result;
     }
 
 private:
@@ -180,50 +586,65 @@ private:
     /// Finds a set of leaf nodes for each query. These leaves may contain units that satisfy the
     /// associated simple query.
     /// Returns an empty vector if the queries cannot be satisfied at the same time.
-    template<typename QueryRange>
-    std::vector<std::vector<leaf_ptr>> find_leaves(QueryRange&& queries) const {
+    /// The result is allocated from the arena of the current thread.
+    arena_vector<arena_vector<leaf_ptr>> find_leaves(const sequenced_query& seq_query) const {
         geodb_assert(!empty(), "requires a root node.");
 
         STATS_GUARD(guard, "Find Leaves");
 
-        // Status of a simple query. Simple queries are evaluated in parallel.
-        struct state_t {
-            state_t(size_t id, const simple_query& query): id(id), query(query) {}
+        arena_vector<query_state> states;
+        if (!descend(seq_query, storage().get_height(), states)) {
+            return {};
+        }
 
-            const size_t id;
-            const simple_query& query;
-            std::vector<node_ptr> nodes;                // set of remaining nodes
-            std::vector<candidate_entry> candidates;    // children of these nodes
-            interval<time_type> time_window;            // time interval containing the candidates
-            id_set_type ids;                    // union of ids in candidates
-        };
+        arena_vector<arena_vector<leaf_ptr>> result;
+        result.reserve(states.size());
+        for (const query_state& state : states) {
+            arena_vector<leaf_ptr> leaves;
+            leaves.reserve(state.nodes.size());
+            for (node_ptr ptr : state.nodes) {
+                leaves.push_back(storage().to_leaf(ptr));
+            }
+            result.push_back(std::move(leaves));
+        }
+        return result;
+    }
+
+    /// Descends the tree (starting from the root) until the nodes at level `last_level`
+    /// are known. Every simple query has its own state.
+    /// After a successful return, `state.nodes` contains the sorted set of nodes at `last_level`
+    /// that may contain units satisfying the associated query.
+    ///
+    /// \return
+    ///     False if the queries cannot be satisfied at the same time.
+    bool descend(const sequenced_query& seq_query, size_t last_level, arena_vector<query_state>& states) const {
+        geodb_assert(last_level >= 1 && last_level <= storage().get_height(), "invalid level");
 
         // Create a query state for every query.
         // The search starts at the root.
-        std::vector<state_t> states;
+        states.clear();
         {
-            states.reserve(queries.size());
+            states.reserve(seq_query.queries.size());
             size_t i = 0;
-            for (const auto& query : queries) {
+            for (const auto& query : seq_query.queries) {
                 states.emplace_back(++i, query);
                 states.back().nodes.push_back(storage().get_root());
             }
         }
 
-        // For every non-leaf level.
-        const size_t height = storage().get_height();
-        for (size_t level = 1; level < height; ++level) {
+        // For every non-leaf level above `last_level`.
+        for (size_t level = 1; level < last_level; ++level) {
             STATS_GUARD(loop_guard, "Level {}", level);
 
             // Gather candidate entries by looking at the inverted index
             // and bounding boxes.
-            for (state_t& state : states) {
+            for (query_state& state : states) {
                 STATS_GUARD(query_guard, "Query {}", state.id);
 
                 auto to_internal = [&](auto ptr) {
                     return this->storage().to_internal(ptr);
                 };
-                get_matching_entries(state.query, state.nodes | transformed(to_internal), state.candidates);
+                get_matching_entries(*state.query, state.nodes | transformed(to_internal), state.candidates);
                 state.time_window = get_time_window(state.candidates);
                 state.ids = get_ids(state.candidates);
 
@@ -233,22 +654,23 @@ private:
             }
 
             auto shared_ids = id_set_type::set_intersection(
-                        states | transformed_member(&state_t::ids));
+                        states | transformed_member(&query_state::ids));
             if (shared_ids.empty()) {
                 STATS_PRINT(loop_guard, "No common ids.");
-                return {}; // No common ids.
+                return false; // No common ids.
             }
             //STATS_PRINT(loop_guard, "Shared ids: {}.", shared_ids);
 
-            if (!trim_time_windows(states | transformed_member(&state_t::time_window))) {
+            if (!trim_time_windows(states | transformed_member(&query_state::time_window), seq_query)) {
                 STATS_PRINT(loop_guard, "No time overlap.");
-                return {}; // Time windows contradict each other.
+                return false; // Time windows contradict each other.
             }
 
-            for (state_t& state : states) {
+            for (query_state& state : states) {
                 STATS_GUARD(query_guard, "Query {}", state.id);
                 STATS_PRINT(query_guard, "trimmed time window: {}.", state.time_window);
 
+                state.parents.swap(state.nodes);
                 state.nodes.clear();
 
                 size_t time_window_filtered = 0;
@@ -276,36 +698,29 @@ private:
 
                 if (state.nodes.empty()) {
                     STATS_PRINT(query_guard, "No more nodes.");
-                    return {}; // This query has no further nodes.
+                    return false; // This query has no further nodes.
                 }
 
                 std::sort(state.nodes.begin(), state.nodes.end());
             }
         }
-
-        std::vector<std::vector<leaf_ptr>> result;
-        for (const state_t& state : states) {
-            std::vector<leaf_ptr> leaves;
-            for (node_ptr ptr : state.nodes) {
-                leaves.push_back(storage().to_leaf(ptr));
-            }
-            result.push_back(std::move(leaves));
-        }
-        return result;
+        return true;
     }
 
     /// Returns matching candiate entries for the given list of internal nodes.
     template<typename InternalNodeRange>
     void get_matching_entries(const simple_query& q, const InternalNodeRange& nodes,
-                              std::vector<candidate_entry>& result) const
+                              arena_vector<candidate_entry>& result) const
     {
         result.clear();
+
+        // The map is reused for all nodes; its buckets live in the query's arena.
+        arena_unordered_map<entry_id_type, id_set_type> matches;
         for (internal_ptr ptr : nodes) {
             auto index = storage().const_index(ptr);
 
             // Retrieve all child entries from the inverted index that contain
             // any of the labels in "q.labels".
-            std::unordered_map<entry_id_type, id_set_type> matches;
             index->matching_children(q.labels, matches);
 
             // Test the resulting matches against the query rectangle (which includes the time dimension).
@@ -321,6 +736,37 @@ private:
         }
     }
 
+    /// Computes the number of units in the subtree of every child of `ptr`
+    /// that have one of the given labels (or any label at all, if `labels` is empty).
+    /// `counts[i]` will be 0 iff the subtree of child `i` contains no matching units.
+    void get_label_counts(internal_ptr ptr, const std::unordered_set<label_type>& labels,
+                          std::vector<u64>& counts) const
+    {
+        const u32 count = storage().get_count(ptr);
+        counts.assign(count, 0);
+
+        auto add = [&](const auto& list) {
+            for (const posting_type& p : *list) {
+                geodb_assert(p.node() < count, "invalid entry id");
+                counts[p.node()] += p.count();
+            }
+        };
+
+        auto index = storage().const_index(ptr);
+        if (labels.empty()) {
+            add(index->total());
+            return;
+        }
+
+        const auto e = index->end();
+        for (label_type label : labels) {
+            auto iter = index->find(label);
+            if (iter != e) {
+                add(iter->postings_list());
+            }
+        }
+    }
+
     /// Returns the time interval that contains the time intervals of all entries.
     template<typename CandidateEntryRange>
     interval<time_type> get_time_window(const CandidateEntryRange& entries) const {
@@ -356,6 +802,10 @@ private:
     ///
     /// An analogue reasoning holds for the end of w1.
     ///
+    /// Time gap constraints between q1 and q2 are handled in the same way:
+    /// w2 is trimmed to [b1 + min_gap, e1 + max_gap] and w1 is trimmed to [b2 - max_gap, e2 - min_gap].
+    /// The constraints are propagated forwards and then backwards over all windows.
+    ///
     /// If some of the intervals become empty, then fulfilling the query is impossible
     /// for all known trajectories.
     ///
@@ -363,29 +813,50 @@ private:
     ///     False, if the query operation cannot return any results.
     ///     True if the search should continue.
     template<typename TimeWindowRange>
-    bool trim_time_windows(TimeWindowRange&& windows) const {
-        BOOST_CONCEPT_ASSERT(( boost::ForwardRangeConcept<TimeWindowRange> ));
+    bool trim_time_windows(TimeWindowRange&& windows, const sequenced_query& seq_query) const {
+        BOOST_CONCEPT_ASSERT(( boost::BidirectionalRangeConcept<TimeWindowRange> ));
 
-        auto i = boost::begin(windows);
-        auto e = boost::end(windows);
+        const auto b = boost::begin(windows);
+        const auto e = boost::end(windows);
 
-        if (i == e)
+        if (b == e)
             return false;
 
-        // Iterate over all adjacent pairs.
-        auto n = std::next(i);
-        for (; n != e; ++i, ++n) {
-            interval<time_type>& w1 = *i;
+        // Intersects `w` with [begin, end]. Returns false if the result is empty.
+        auto trim = [](interval<time_type>& w, i64 begin, i64 end) {
+            begin = std::max(begin, i64(w.begin()));
+            end = std::min(end, i64(w.end()));
+            if (begin > end) {
+                return false;
+            }
+            w = { time_type(begin), time_type(end) };
+            return true;
+        };
+
+        // Forward pass over all adjacent pairs, trims the later window.
+        size_t index = 0;
+        for (auto i = b, n = std::next(b); n != e; ++i, ++n, ++index) {
+            const interval<time_type>& w1 = *i;
             interval<time_type>& w2 = *n;
+            const time_gap gap = seq_query.gap(index);
 
-            const time_type w1_end = std::min(w1.end(), w2.end());
-            const time_type w2_begin = std::max(w1.begin(), w2.begin());
-            if (w1_end < w1.begin() || w2_begin > w2.end()) {
-                // Interval empty!
+            if (!trim(w2, i64(w1.begin()) + gap.min, i64(w1.end()) + gap.max)) {
+                return false;
+            }
+        }
+
+        // Backward pass, trims the earlier window.
+        for (auto n = std::prev(e); n != b; --n) {
+            auto i = std::prev(n);
+            --index;
+
+            interval<time_type>& w1 = *i;
+            const interval<time_type>& w2 = *n;
+            const time_gap gap = seq_query.gap(index);
+
+            if (!trim(w1, i64(w2.begin()) - gap.max, i64(w2.end()) - gap.min)) {
                 return false;
             }
-            w1 = { w1.begin(), w1_end };
-            w2 = { w2_begin, w2.end() };
         }
         return true;
     }
@@ -412,104 +883,6 @@ private:
         }
     }
 
-    /// Takes a range of trajectory_id -> [units] maps (one map for each simple query).
-    /// Returns a set of trajectories that have their matches correctly ordered in time.
-    template<typename CandidateTractoriesRange>
-    std::vector<trajectory_match> check_order(const CandidateTractoriesRange& candidates) const {
-        geodb_assert(!boost::empty(candidates), "range must not be empty");
-
-        std::vector<trajectory_match> matches;
-        std::vector<boost::sub_range<const std::vector<tree_entry>>> unit_candiates;
-        unit_candiates.reserve(boost::size(candidates));
-
-        // For every potential trajectory match.
-        for (trajectory_id_type id : *boost::begin(candidates) | boost::adaptors::map_keys) {
-            std::vector<unit_match> unit_matches;
-
-            // Inspect the trajectory unit matches for every simple query.
-            unit_candiates.clear();
-            for (const auto& map : candidates) {
-                auto iter = map.find(id);
-                if (iter == map.end()) {
-                    // the trajectory must have matching units for every simple query.
-                    goto skip;
-                }
-
-                const std::vector<tree_entry>& entries = iter->second;
-                geodb_assert(entries.size() > 0, "no matching entries");
-                unit_candiates.emplace_back(entries);
-            }
-
-            for (size_t i = 0; i < unit_candiates.size(); ++i) {
-                auto& current = unit_candiates[i];
-
-                // The first unit that satisfies queries[i].
-                u32 min = current.front().unit_index;
-
-                // We compute the number of elements until the
-                // next query becomes active.
-                if (i < unit_candiates.size() - 1) {
-                    // Index-wise comparison for tree entries.
-                    auto entry_compare = [](const tree_entry& a, u32 index) {
-                        return a.unit_index < index;
-                    };
-
-                    auto& next = unit_candiates[i + 1];
-                    {
-                        // Find "min" or something greater in the next query.
-                        const auto pos = std::lower_bound(next.begin(), next.end(), min, entry_compare);
-                        if (pos == next.end()) {
-                            goto skip; // Both queries cannot be satisfied at the same time.
-                        }
-                        geodb_assert(pos->unit_index >= min, "invalid result of binary search.");
-
-                        // Shrink the "next" range to only include values >= min.
-                        next = { pos, next.end() };
-                    }
-
-                    // We include every result in the current sequence until we reach the following value,
-                    // at which point the next query will become active.
-                    // Note: max itself is not included anymore in "current", i.e. we prefer the later query
-                    // in case that a unit satisfies more than one query at the same time.
-                    {
-                        u32 max = next.front().unit_index;
-                        const auto pos = std::lower_bound(current.begin(), current.end(), max, entry_compare);
-                        geodb_assert(pos == current.end() || pos->unit_index >= max, "invalid result of binary search");
-
-                        // Shrink the current sequence. The range may become empty as a result,
-                        // which is fine (the overlapping part will be seen in the next iteration).
-                        current = { current.begin(), pos };
-                    }
-                }
-
-                // Include all units up until the computed end of the candidate list.
-                for (const tree_entry& entry : current) {
-                    unit_matches.emplace_back(entry.unit_index, entry.unit);
-                }
-            }
-
-
-            // A trajectory only matches if there are matching units for every simple query.
-            // This code will be skipped (see the goto above) if that is not the case.
-            matches.emplace_back(id, std::move(unit_matches));
-
-        skip:
-            continue;
-        }
-        return matches;
-    }
-
-    /// Sorts every tree_entry vector in the given map by unit index.
-    template<typename CandidateMap>
-    void sort_groups(CandidateMap& map) const {
-        for (auto& pair : map) {
-            std::vector<tree_entry>& entries = pair.second;
-            std::sort(entries.begin(), entries.end(), [&](const tree_entry& a, const tree_entry& b) {
-                return a.unit_index < b.unit_index;
-            });
-        }
-    }
-
 private:
     template<typename State>
     friend class tree_cursor;
@@ -524,6 +897,7 @@ private:
 private:
     state_type state;
     std::vector<internal_ptr> path_buf;
+    standing_query_index* standing = nullptr;
 };
 
 /// Prints a string representation of the subtree rooted at `c`
@@ -11,11 +11,13 @@
 #include "geodb/irwi/inverted_index_external.hpp"
 #include "geodb/utility/as_const.hpp"
 #include "geodb/utility/file_allocator.hpp"
+#include "geodb/utility/memory_budget.hpp"
 #include "geodb/utility/movable_adapter.hpp"
 #include "geodb/utility/raw_stream.hpp"
 #include "geodb/utility/shared_values.hpp"
 
 #include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 #include <fmt/format.h>
 #include <tpie/blocks/block_collection_cache.h>
 
@@ -191,6 +193,10 @@ public:
 
     void set_root(node_ptr n) { m_root = n.handle; }
 
+    const boost::optional<tree_params>& get_params() const { return m_params; }
+
+    void set_params(const tree_params& params) { m_params = params; }
+
     internal_ptr create_internal() {
         internal_ptr i(m_blocks.get_free_block());
 
@@ -310,9 +316,11 @@ public:
     template<typename Key, typename Value>
     using map_type = hybrid_map<Key, Value, block_size>;
 
+    /// Temporary maps and buffers share the global memory budget,
+    /// they only move to disk when it runs out.
     template<typename Key, typename Value>
     map_type<Key, Value> make_map() {
-        return map_type<Key, Value>();
+        return map_type<Key, Value>(memory_budget::global());
     }
 
     template<typename Value>
@@ -320,11 +328,25 @@ public:
 
     template<typename Value>
     buffer_type<Value> make_buffer() {
-        return buffer_type<Value>();
+        return buffer_type<Value>(memory_budget::global());
+    }
+
+    /// Writes evicted node and postings blocks asynchronously,
+    /// see \ref block_collection::write_behind(). Meant for bulk loading,
+    /// where new blocks are written once and rarely read again.
+    void write_behind(const block_writer_options& options) {
+        m_blocks.write_behind(options);
+        m_lists_blocks.write_behind(options);
+    }
+
+    /// Waits for all pending writes and returns to synchronous writes.
+    void write_through() {
+        m_blocks.write_through();
+        m_lists_blocks.write_through();
     }
 
 public:
-    static constexpr int version() { return 2; }
+    static constexpr int version() { return 4; }
 
     // ----------------------------------------
     //      Construction/Destruction
@@ -337,6 +359,7 @@ public:
     {
         raw_stream rf;
         if (rf.try_open(state_path())) {
+            // Older versions store the state of postings lists in a separate block.
             int file_version;
             rf.read(file_version);
             if (file_version != version()) {
@@ -378,6 +401,19 @@ public:
             rf.read(m_leaf_count);
             rf.read(m_internal_count);
             rf.read(m_root);
+
+            u8 has_params;
+            rf.read(has_params);
+            if (has_params) {
+                double weight;
+                u32 strategy;
+                rf.read(weight);
+                rf.read(strategy);
+                if (strategy > u32(beta_strategy::decreasing)) {
+                    throw std::invalid_argument(fmt::format("Invalid beta strategy {}.", strategy));
+                }
+                m_params = tree_params(weight, beta_strategy(strategy));
+            }
         }
     }
 
@@ -402,6 +438,14 @@ public:
         rf.write(m_leaf_count);
         rf.write(m_internal_count);
         rf.write(m_root);
+
+        u8 has_params = m_params ? 1 : 0;
+        rf.write(has_params);
+        if (m_params) {
+            u32 strategy = u32(m_params->strategy);
+            rf.write(m_params->weight);
+            rf.write(strategy);
+        }
     }
 
 private:
@@ -439,6 +483,9 @@ private:
     /// Always points to either a leaf (height: 1) or an internal node (anything else).
     block_handle_type m_root;
 
+    /// Cost function parameters (weight and beta strategy) of this tree, if known.
+    boost::optional<tree_params> m_params;
+
     /// Allocator for inverted-index directories.
     mutable directory_allocator_type m_index_alloc;
 
@@ -15,6 +15,7 @@
 #include <boost/range/adaptor/reversed.hpp>
 #include <gsl/span>
 
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 
@@ -107,6 +108,11 @@ private:
     State& state;
     storage_type& storage;
 
+    /// Bit i is set if forced reinsertion has already happened for
+    /// nodes with height i + 1 (leaves have height 1) during the current
+    /// top-level insert operation.
+    u64 m_reinserted = 0;
+
 public:
     tree_insertion(State& state)
         : state(state), storage(state.storage())
@@ -184,14 +190,9 @@ public:
             return;
         }
 
-        leaf_ptr leaf = traverse_tree(v, path);
+        m_reinserted = 0;
         storage.set_size(storage.get_size() + 1);
-        if (storage.get_count(leaf) < State::max_leaf_entries()) {
-            insert_entry(leaf, v);
-            return;
-        }
-
-        insert_at_full(leaf, v, path);
+        insert_value(v, path);
     }
 
     /// Insert a new leaf node at some appropriate place in the tree.
@@ -223,10 +224,23 @@ public:
     }
 
 private:
+    /// Inserts the value into the (non-empty) tree.
+    /// The size of the tree must have been updated by the caller.
+    void insert_value(const value_type& v, std::vector<internal_ptr>& path) {
+        leaf_ptr leaf = traverse_tree(v, path);
+        if (storage.get_count(leaf) < State::max_leaf_entries()) {
+            insert_entry(leaf, v);
+            return;
+        }
+
+        insert_at_full(leaf, v, path);
+    }
+
     /// Handles the simple edge cases of subtree insertion (e.g. the current tree
     /// is empty or has the same height as the new subtree).
     /// Dispatches all other cases to \ref insert_subtree_impl.
     void insert_subtree(node_ptr node, size_t height, size_t size) {
+        m_reinserted = 0;
         storage.set_size(storage.get_size() + size);
 
         // If the tree is empty, simply set the new root.
@@ -307,6 +321,10 @@ private:
     void insert_at_full(leaf_ptr leaf, const value_type& v, gsl::span<const internal_ptr> path) {
         geodb_assert(storage.get_count(leaf) == State::max_leaf_entries(), "leaf is not full");
 
+        if (!path.empty() && reinsert_entries(leaf, v, path)) {
+            return;
+        }
+
         size_t level = path.size() + 1;
         return handle_split(leaf, split_and_insert(leaf, level, v), path);
     }
@@ -316,6 +334,10 @@ private:
     void insert_at_full(internal_ptr internal, const node_summary& child, gsl::span<const internal_ptr> path) {
         geodb_assert(storage.get_count(internal) == State::max_internal_entries(), "internal node is not full");
 
+        if (!path.empty() && reinsert_entries(internal, child, path.size() + 1, path)) {
+            return;
+        }
+
         size_t level = path.size() + 1;
         return handle_split(internal, split_and_insert(internal, level, child), path);
     }
@@ -345,6 +367,10 @@ private:
                 return;
             }
 
+            if (path.size() > 1 && reinsert_entries(parent, new_summary, level, path.first(path.size() - 1))) {
+                return;
+            }
+
             new_summary = summarize(split_and_insert(parent, level, new_summary));
             old_summary = summarize(parent);
             pop_back(path);
@@ -360,6 +386,239 @@ private:
         storage.set_height(storage.get_height() + 1);
     }
 
+    /// Returns the number of entries that should be removed from an overflowing
+    /// node of the given height (with `count` entries, including the new one) for
+    /// forced reinsertion. Returns 0 if the node must be split instead.
+    /// Marks the height as handled; forced reinsertion happens at most once per
+    /// height and top-level insert operation.
+    u32 reinsert_count(size_t height, u32 count, u32 min_entries) {
+        geodb_assert(height >= 1, "invalid height");
+
+        const double fraction = state.reinsert_fraction();
+        if (fraction <= 0 || height > 64) {
+            return 0;
+        }
+
+        const u64 bit = u64(1) << (height - 1);
+        if (m_reinserted & bit) {
+            return 0;
+        }
+        m_reinserted |= bit;
+
+        const u32 n = std::min(u32(fraction * count), count - min_entries);
+        return n;
+    }
+
+    /// Selects the `n` entries (out of `mbbs`) whose centers are farthest
+    /// away from the center of the node.
+    /// Returns their indices, ordered by increasing distance (the
+    /// order in which they will be reinserted).
+    std::vector<u32> select_reinsert(const std::vector<bounding_box>& mbbs, u32 n) const {
+        geodb_assert(n > 0 && n < mbbs.size(), "invalid number of entries");
+
+        bounding_box node_mbb = mbbs[0];
+        for (const bounding_box& b : mbbs) {
+            node_mbb = node_mbb.extend(b);
+        }
+
+        // Distances are normalized by the extent of the node in every dimension.
+        const vector3 center = node_mbb.center();
+        const vector3 widths = node_mbb.widths();
+        const double nx = state.inverse(widths.x());
+        const double ny = state.inverse(widths.y());
+        const double nt = state.inverse(widths.t());
+        auto distance = [&](const bounding_box& b) {
+            const vector3 c = b.center();
+            const double dx = (double(c.x()) - double(center.x())) * nx;
+            const double dy = (double(c.y()) - double(center.y())) * ny;
+            const double dt = (double(c.t()) - double(center.t())) * nt;
+            return dx * dx + dy * dy + dt * dt;
+        };
+
+        std::vector<std::pair<double, u32>> distances;
+        distances.reserve(mbbs.size());
+        for (u32 i = 0; i < mbbs.size(); ++i) {
+            distances.emplace_back(distance(mbbs[i]), i);
+        }
+
+        // Partition the n farthest entries to the front and
+        // reinsert them in order of increasing distance ("close reinsert").
+        auto greater = [](const auto& a, const auto& b) { return a > b; };
+        std::nth_element(distances.begin(), distances.begin() + (n - 1), distances.end(), greater);
+        std::sort(distances.begin(), distances.begin() + n);
+
+        std::vector<u32> result;
+        result.reserve(n);
+        for (u32 i = 0; i < n; ++i) {
+            result.push_back(distances[i].second);
+        }
+        return result;
+    }
+
+    /// Recomputes the entries of all nodes in `path` (bottom-up),
+    /// starting with the entry for `child` in the last node of `path`.
+    /// Used after entries have been removed from `child`'s subtree,
+    /// since postings can only be grown incrementally.
+    template<typename NodePointer>
+    void refresh_path(NodePointer child, gsl::span<const internal_ptr> path) {
+        node_summary summary = summarize(child);
+        while (!path.empty()) {
+            internal_ptr parent = back(path);
+            replace_entry(parent, summary);
+            pop_back(path);
+            if (!path.empty()) {
+                summary = summarize(parent);
+            }
+        }
+    }
+
+    /// Forced reinsertion for a full leaf (R*-Tree).
+    /// Removes the entries farthest from the leaf's center (the new value `v`
+    /// included) and inserts them again, starting at the root.
+    /// Returns false (without modifying the tree) if the leaf must be split instead.
+    ///
+    /// \param path     The parents of `leaf`. Must not be empty.
+    bool reinsert_entries(leaf_ptr leaf, const value_type& v, gsl::span<const internal_ptr> path) {
+        geodb_assert(!path.empty(), "the root cannot use forced reinsertion");
+
+        std::vector<value_type> entries = get_entries(leaf, v);
+        const u32 n = reinsert_count(1, entries.size(), State::min_leaf_entries());
+        if (n == 0) {
+            return false;
+        }
+
+        std::vector<bounding_box> mbbs;
+        mbbs.reserve(entries.size());
+        for (const value_type& e : entries) {
+            mbbs.push_back(state.get_mbb(e));
+        }
+
+        const std::vector<u32> selected = select_reinsert(mbbs, n);
+        std::vector<bool> removed(entries.size(), false);
+        for (u32 i : selected) {
+            removed[i] = true;
+        }
+
+        // Keep the remaining entries in the leaf.
+        u32 count = 0;
+        for (u32 i = 0; i < entries.size(); ++i) {
+            if (!removed[i]) {
+                storage.set_data(leaf, count++, entries[i]);
+            }
+        }
+        storage.set_count(leaf, count);
+        for (u32 i = count; i < State::max_leaf_entries(); ++i) {
+            storage.set_data(leaf, i, value_type());
+        }
+        refresh_path(leaf, path);
+
+        std::vector<internal_ptr> reinsert_path;
+        for (u32 i : selected) {
+            insert_value(entries[i], reinsert_path);
+        }
+        return true;
+    }
+
+    /// Forced reinsertion for a full internal node (R*-Tree).
+    /// Removes the child entries farthest from the node's center (the new entry `child` included)
+    /// and inserts the subtrees again, starting at the root.
+    /// Returns false (without modifying the tree) if the node must be split instead.
+    ///
+    /// \param level    The level of `internal` (the root has level 1).
+    /// \param path     The parents of `internal`. Must not be empty.
+    bool reinsert_entries(internal_ptr internal, const node_summary& child, size_t level,
+                          gsl::span<const internal_ptr> path)
+    {
+        geodb_assert(!path.empty(), "the root cannot use forced reinsertion");
+        geodb_assert(level < storage.get_height(), "internal node cannot be at leaf level");
+
+        const size_t height = storage.get_height() - level + 1;
+        const u32 count = storage.get_count(internal);
+        const u32 n = reinsert_count(height, count + 1, State::min_internal_entries());
+        if (n == 0) {
+            return false;
+        }
+
+        std::vector<bounding_box> mbbs;
+        mbbs.reserve(count + 1);
+        for (u32 i = 0; i < count; ++i) {
+            mbbs.push_back(storage.get_mbb(internal, i));
+        }
+        mbbs.push_back(child.mbb);
+
+        const std::vector<u32> selected = select_reinsert(mbbs, n);
+        std::vector<bool> removed(count, false);
+
+        // Summarize the removed subtrees before their entries disappear.
+        std::vector<node_summary> subtrees;
+        subtrees.reserve(n);
+        bool child_removed = false;
+        for (u32 i : selected) {
+            if (i == count) {
+                child_removed = true;
+                subtrees.push_back(summarize(child.ptr, height - 1));
+            } else {
+                removed[i] = true;
+                subtrees.push_back(summarize(storage.get_child(internal, i), height - 1));
+            }
+        }
+
+        remove_entries(internal, removed);
+        if (!child_removed) {
+            insert_entry(internal, child);
+        }
+        refresh_path(internal, path);
+
+        for (const node_summary& subtree : subtrees) {
+            insert_subtree_impl(subtree, height - 1);
+        }
+        return true;
+    }
+
+    /// Removes the marked child entries from the internal node.
+    /// The remaining entries (and their postings) are renumbered.
+    void remove_entries(internal_ptr internal, const std::vector<bool>& removed) {
+        const u32 count = storage.get_count(internal);
+        geodb_assert(removed.size() == count, "one flag per entry");
+
+        std::vector<u32> new_index(count, u32(-1));
+        u32 new_count = 0;
+        for (u32 i = 0; i < count; ++i) {
+            if (!removed[i]) {
+                new_index[i] = new_count;
+                if (new_count != i) {
+                    storage.set_mbb(internal, new_count, storage.get_mbb(internal, i));
+                    storage.set_child(internal, new_count, storage.get_child(internal, i));
+                }
+                ++new_count;
+            }
+        }
+        storage.set_count(internal, new_count);
+        for (u32 i = new_count; i < State::max_internal_entries(); ++i) {
+            storage.set_mbb(internal, i, bounding_box());
+            storage.set_child(internal, i, node_ptr());
+        }
+
+        std::vector<posting_type> kept;
+        kept.reserve(State::max_internal_entries());
+        auto filter_list = [&](list_ptr list) {
+            kept.clear();
+            for (const posting_type& p : *list) {
+                const u32 index = new_index[p.node()];
+                if (index != u32(-1)) {
+                    kept.push_back(posting_type(index, p.count(), p.id_set()));
+                }
+            }
+            list->assign(kept.begin(), kept.end());
+        };
+
+        index_ptr index = storage.index(internal);
+        for (const auto& entry : *index) {
+            filter_list(entry.postings_list());
+        }
+        filter_list(index->total());
+    }
+
     /// Update the parent node to reflect the insertion of `entry`.
     /// The bounding box for the given child and its inverted index entries will be expanded.
     void update_parent(internal_ptr parent, u32 child_index, const value_type& entry) {
@@ -7,6 +7,8 @@
 #include "geodb/irwi/inverted_index.hpp"
 #include "geodb/irwi/inverted_index_internal.hpp"
 
+#include <boost/optional.hpp>
+
 /// \file
 /// Internal storage backend for IRWI Trees.
 /// Everything is kept in RAM.
@@ -115,6 +117,10 @@ public:
 
     void set_root(node_ptr n) { m_root = n; }
 
+    const boost::optional<tree_params>& get_params() const { return m_params; }
+
+    void set_params(const tree_params& params) { m_params = params; }
+
     internal_ptr create_internal() {
         ++m_internals;
         return tpie::tpie_new<internal>();
@@ -199,6 +205,7 @@ public:
         : m_height(other.m_height)
         , m_size(other.m_size)
         , m_root(other.m_root)
+        , m_params(other.m_params)
     {
         other.m_height = other.m_size = 0;
         other.m_root = nullptr;
@@ -235,6 +242,7 @@ private:
     size_t m_leaves = 0;    ///< Number of leaf nodes.
     size_t m_internals = 0; ///< Number of internal nodes.
     base* m_root = nullptr;
+    boost::optional<tree_params> m_params;  ///< Cost function parameters (if set).
 };
 
 /// Instructs the irwi tree to use internal memory for storage.
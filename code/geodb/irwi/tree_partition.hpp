@@ -6,12 +6,17 @@
 #include "geodb/irwi/base.hpp"
 #include "geodb/irwi/label_count.hpp"
 #include "geodb/irwi/posting.hpp"
+#include "geodb/irwi/tree_state.hpp"
 #include "geodb/utility/range_utils.hpp"
 
 #include <boost/container/static_vector.hpp>
 
+#include <algorithm>
 #include <array>
 #include <map>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
 #include <unordered_set>
 
 /// \file
@@ -102,8 +107,8 @@ public:
 
 
     /// Partitions the entries of a single node into two groups.
-    /// Implements the quadradic node splitting algorithm for R-Trees
-    /// (extended for spatio-textual trajectories).
+    /// Uses the split algorithm configured in the tree state
+    /// (see \ref split_strategy).
     ///
     /// \param level
     ///     The level of the node whose entries we're partitioning.
@@ -119,8 +124,8 @@ public:
     }
 
     /// Partitions the entries of a single node into two groups.
-    /// Implements the quadradic node splitting algorithm for R-Trees
-    /// (extended for spatio-textual trajectories).
+    /// Uses the split algorithm configured in the tree state
+    /// (see \ref split_strategy).
     ///
     /// \param level
     ///     The level of the node whose entries we're partitioning.
@@ -138,6 +143,22 @@ public:
 private:
     template<typename Entries>
     void partition_impl(const Entries& e, size_t min_elements, std::vector<split_element>& split)
+    {
+        switch (state.split()) {
+        case split_strategy::quadratic:
+            quadratic_partition(e, min_elements, split);
+            return;
+        case split_strategy::rstar:
+            rstar_partition(e, min_elements, split);
+            return;
+        }
+        unreachable("invalid split strategy");
+    }
+
+    /// Implements the quadradic node splitting algorithm for R-Trees
+    /// (extended for spatio-textual trajectories).
+    template<typename Entries>
+    void quadratic_partition(const Entries& e, size_t min_elements, std::vector<split_element>& split)
     {
         const u32 N = get_count(e);
         const u32 limit = N - min_elements;
@@ -249,7 +270,222 @@ private:
         }
     }
 
+    /// Implements a sort-based node split in the style of the R*-Tree.
+    ///
+    /// For every axis, the entries are sorted by their lower and by their
+    /// upper coordinate. Every distribution of a sorted sequence into
+    /// a prefix and a suffix that satisfies the `min_elements` constraint is
+    /// a candidate. The split axis is the one with the smallest sum of
+    /// (normalized) margins over all its candidates.
+    /// The distribution along that axis is then chosen using the weighted
+    /// cost function of the tree: the spatial part is the overlap of
+    /// both groups (or their total volume, if no candidate overlaps) and
+    /// the textual part is the fraction of units that do not have the
+    /// dominant label of their group.
+    ///
+    /// Runs in O(n log n + n * L) for n entries and L distinct labels.
+    template<typename Entries>
+    void rstar_partition(const Entries& e, size_t min_elements, std::vector<split_element>& split)
+    {
+        const u32 N = get_count(e);
+
+        geodb_assert(N >= 2 * min_elements, "Not enough items for min_elements constraint");
+        geodb_assert(min_elements >= 1, "Both parts must be non-empty");
+
+        // The left group of a candidate contains the first k entries
+        // of the sorted sequence, where k in [first, last].
+        const u32 first = min_elements;
+        const u32 last = N - min_elements;
+
+        std::vector<bounding_box> mbbs(N);
+        for (u32 i = 0; i < N; ++i) {
+            mbbs[i] = get_mbb(e, i);
+        }
+
+        // Widths of the node's bounding box, used to make the
+        // margins of the different dimensions comparable.
+        std::array<double, 3> norm_widths;
+        {
+            bounding_box total = mbbs[0];
+            for (u32 i = 1; i < N; ++i) {
+                total = total.extend(mbbs[i]);
+            }
+            const vector3 widths = total.widths();
+            norm_widths[0] = state.inverse(widths.x());
+            norm_widths[1] = state.inverse(widths.y());
+            norm_widths[2] = state.inverse(widths.t());
+        }
+        auto margin = [&](const bounding_box& b) {
+            const vector3 widths = b.widths();
+            return double(widths.x()) * norm_widths[0]
+                    + double(widths.y()) * norm_widths[1]
+                    + double(widths.t()) * norm_widths[2];
+        };
+
+        std::vector<u32> order(N);
+        std::vector<bounding_box> prefix(N);
+        std::vector<bounding_box> suffix(N);
+
+        // Sorts the entries along the given axis (by lower or upper coordinate)
+        // and computes the bounding boxes of all prefixes and suffixes.
+        auto sort_axis = [&](size_t axis, bool upper) {
+            auto key = [&](u32 i) {
+                const double lo = coordinate(mbbs[i].min(), axis);
+                const double hi = coordinate(mbbs[i].max(), axis);
+                return upper ? std::make_tuple(hi, lo, i) : std::make_tuple(lo, hi, i);
+            };
+
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+                return key(a) < key(b);
+            });
+
+            prefix[0] = mbbs[order[0]];
+            for (u32 i = 1; i < N; ++i) {
+                prefix[i] = prefix[i - 1].extend(mbbs[order[i]]);
+            }
+            suffix[N - 1] = mbbs[order[N - 1]];
+            for (u32 i = N - 1; i > 0; --i) {
+                suffix[i - 1] = suffix[i].extend(mbbs[order[i - 1]]);
+            }
+        };
+
+        // Choose the split axis.
+        size_t axis = 0;
+        {
+            double best_margin = std::numeric_limits<double>::infinity();
+            for (size_t a = 0; a < 3; ++a) {
+                double sum = 0;
+                for (bool upper : {false, true}) {
+                    sort_axis(a, upper);
+                    for (u32 k = first; k <= last; ++k) {
+                        sum += margin(prefix[k - 1]) + margin(suffix[k]);
+                    }
+                }
+                if (sum < best_margin) {
+                    best_margin = sum;
+                    axis = a;
+                }
+            }
+        }
+
+        // Map the labels of all entries to dense indices so that
+        // the label counts of a group can be maintained in an array.
+        std::unordered_map<label_type, u32> label_index;
+        std::vector<u32> label_offsets;              // Entry i has labels [offsets[i], offsets[i + 1]).
+        std::vector<std::pair<u32, u64>> labels;     // (dense label, count)
+        std::vector<u64> label_totals;               // Units per label in the whole node.
+        u64 total_units = 0;
+
+        label_offsets.reserve(N + 1);
+        for (u32 i = 0; i < N; ++i) {
+            label_offsets.push_back(labels.size());
+            for (const auto& lc : get_labels(e, i)) {
+                auto pos = label_index.emplace(lc.label, label_totals.size()).first;
+                if (pos->second == label_totals.size()) {
+                    label_totals.push_back(0);
+                }
+                labels.emplace_back(pos->second, lc.count);
+                label_totals[pos->second] += lc.count;
+            }
+            total_units += get_total_units(e, i);
+        }
+        label_offsets.push_back(labels.size());
+
+        struct candidate {
+            bool upper;
+            u32 k;
+            double overlap;
+            double volume;
+            double textual;
+        };
+
+        std::vector<candidate> candidates;
+        candidates.reserve(2 * (last - first + 1));
+
+        std::vector<u64> left_counts(label_totals.size());
+        for (bool upper : {false, true}) {
+            sort_axis(axis, upper);
+            std::fill(left_counts.begin(), left_counts.end(), 0);
+
+            for (u32 k = 1; k <= last; ++k) {
+                const u32 index = order[k - 1];
+                for (u32 l = label_offsets[index]; l < label_offsets[index + 1]; ++l) {
+                    left_counts[labels[l].first] += labels[l].second;
+                }
+                if (k < first) {
+                    continue;
+                }
+
+                u64 left_max = 0;
+                u64 right_max = 0;
+                for (size_t l = 0; l < left_counts.size(); ++l) {
+                    left_max = std::max(left_max, left_counts[l]);
+                    right_max = std::max(right_max, label_totals[l] - left_counts[l]);
+                }
+
+                const bounding_box& lb = prefix[k - 1];
+                const bounding_box& rb = suffix[k];
+
+                candidate c;
+                c.upper = upper;
+                c.k = k;
+                c.overlap = lb.intersection(rb).size();
+                c.volume = lb.size() + rb.size();
+                c.textual = 1.0 - double(left_max + right_max) * state.inverse(double(total_units));
+                candidates.push_back(c);
+            }
+        }
+        geodb_assert(!candidates.empty(), "There must be at least one candidate");
+
+        // Choose the distribution with the smallest cost.
+        // Overlap is used for the spatial part unless no candidate
+        // overlaps, in which case the combined volume is used instead.
+        double max_overlap = 0;
+        double max_volume = 0;
+        for (const candidate& c : candidates) {
+            max_overlap = std::max(max_overlap, c.overlap);
+            max_volume = std::max(max_volume, c.volume);
+        }
+        const bool use_overlap = max_overlap > 0;
+        const double norm = state.inverse(use_overlap ? max_overlap : max_volume);
+
+        const candidate* best = nullptr;
+        double best_cost = 0;
+        for (const candidate& c : candidates) {
+            const double spatial = (use_overlap ? c.overlap : c.volume) * norm;
+            const double cost = state.cost(spatial, c.textual, level(e));
+            if (!best || cost < best_cost || (cost == best_cost && c.volume < best->volume)) {
+                best = &c;
+                best_cost = cost;
+            }
+        }
+
+        // Emit the chosen partition.
+        sort_axis(axis, best->upper);
+
+        split.clear();
+        split.reserve(N);
+        for (u32 i = 0; i < N; ++i) {
+            if (i < best->k) {
+                split.push_back(split_element(order[i], i, left));
+            } else {
+                split.push_back(split_element(order[i], i - best->k, right));
+            }
+        }
+    }
+
 private:
+    /// Returns the coordinate of the given axis (0: x, 1: y, 2: t).
+    static double coordinate(const vector3& v, size_t axis) {
+        switch (axis) {
+        case 0: return v.x();
+        case 1: return v.y();
+        case 2: return v.t();
+        }
+        unreachable("invalid axis");
+    }
+
     bounding_box get_mbb(const leaf_entries& n, u32 index) const {
         geodb_assert(index < n.entries.size(), "index out of bounds");
         return state.get_mbb(n.entries[index]);
@@ -1,247 +1,176 @@
 #ifndef GEODB_IRWI_TREE_QUICKLOAD_HPP
 #define GEODB_IRWI_TREE_QUICKLOAD_HPP
 
-#include "geodb/external_list.hpp"
 #include "geodb/hybrid_buffer.hpp"
 #include "geodb/hybrid_map.hpp"
 #include "geodb/irwi/base.hpp"
-#include "geodb/irwi/block_collection.hpp"
 #include "geodb/irwi/inverted_index.hpp"
-#include "geodb/irwi/inverted_index_external.hpp"
-#include "geodb/utility/as_const.hpp"
-#include "geodb/utility/file_allocator.hpp"
-#include "geodb/utility/shared_values.hpp"
-#include "geodb/utility/temp_dir.hpp"
+#include "geodb/irwi/postings_list.hpp"
+#include "geodb/utility/arena.hpp"
 
-#include <boost/container/static_vector.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <tpie/memory.h>
+
+#include <algorithm>
+#include <array>
+#include <new>
+#include <type_traits>
+#include <vector>
 
 /// \file
 /// Storage implementation for the quickload algorithm.
-/// Data is only temporary, many entries are kept in RAM.
+/// The tree is only temporary and lives entirely in internal memory.
 
 namespace geodb {
 
 namespace quickload {
 
-template<size_t block_size, u32 fanout_leaf, u32 fanout_internal = fanout_leaf>
+template<u32 fanout_leaf, u32 fanout_internal = fanout_leaf>
 class tree_storage;
 
-template<size_t block_size, u32 fanout_leaf, u32 fanout_internal, typename LeafData>
+template<u32 fanout_leaf, u32 fanout_internal, typename LeafData>
 class tree_storage_impl;
 
-template<size_t block_size, size_t max_posting_entries>
+template<size_t max_posting_entries>
 class index_storage;
 
-template<size_t block_size, size_t max_posting_entries>
+template<size_t max_posting_entries>
 class index_storage_impl;
 
-template<size_t block_size, size_t max_entries>
+template<size_t max_entries>
 class postings_list_storage;
 
-template<size_t block_size, size_t max_entries>
+template<size_t max_entries>
 class postings_list_storage_impl;
 
-#pragma pack(push, 1)
-
+/// A postings list with a fixed capacity. The entries are stored inline.
 template<size_t max_entries>
-struct postings_list_entry {
-    u32 count = 0;
-    posting<0> postings[max_entries];
-};
-
-#pragma pack(pop)
-
-template<size_t block_size, size_t max_entries>
-using postings_list_backend = external_list<postings_list_entry<max_entries>, block_size>;
-
-template<size_t block_size, size_t max_entries>
 class postings_list_storage_impl {
 private:
     using posting_type = posting<0>;
 
 public:
-    using entry = postings_list_entry<max_entries>;
-
-    using backend_type = postings_list_backend<block_size, max_entries>;
-
-    using posting_vector = boost::container::static_vector<posting_type, max_entries>;
-
-    using iterator = typename posting_vector::const_iterator;
-
-public:
-    /// Constructs a posting list storage backend that has its
-    /// data at the given index.
-    postings_list_storage_impl(backend_type& list, u64 index)
-        : m_list(list)
-        , m_index(index)
-    {
-
-        // state.postings is not aligned.
-        entry state = m_list[index];
-        for (u32 i = 0; i < state.count; ++i) {
-            m_postings.push_back(state.postings[i]);
-        }
-    }
-
-    postings_list_storage_impl(postings_list_storage_impl&& other) noexcept
-        : m_list(other.m_list)
-        , m_index(other.m_index)
-        , m_dirty(other.m_dirty)
-        , m_postings(other.m_postings)
-    {
-        other.m_dirty = false;
-    }
-
-    ~postings_list_storage_impl() {
-        if (m_dirty) {
-            // Write back the changes to the list.
-            entry state;
-            state.count = size();
-            for (u32 i = 0; i < state.count; ++i) {
-                memcpy(&state.postings[i], &m_postings[i], sizeof(posting_type));
-            }
-
-            m_list.set(m_index, state);
-        }
-    }
+    using iterator = const posting_type*;
 
 public:
-    iterator begin() const { return m_postings.begin(); }
+    iterator begin() const { return m_postings; }
 
-    iterator end() const { return m_postings.end(); }
+    iterator end() const { return m_postings + m_size; }
 
     void push_back(const posting_type& value) {
         geodb_assert(size() < max_entries, "Too many entries in postings list");
-        m_postings.push_back(value);
-        m_dirty = true;
+        m_postings[m_size++] = value;
     }
 
     void pop_back() {
         geodb_assert(size() > 0, "Must not be empty.");
-        m_postings.pop_back();
-        m_dirty = true;
+        --m_size;
     }
 
     void clear() {
-        if (!m_postings.empty()) {
-            m_postings.clear();
-            m_dirty = true;
-        }
+        m_size = 0;
     }
 
     void set(iterator pos, const posting_type& value) {
         geodb_assert(pos != end(), "Writing to the end iterator");
-        u32 index = pos - begin();
-        m_postings[index] = value;
-        m_dirty = true;
+        m_postings[pos - begin()] = value;
     }
 
     size_t size() const {
-        return m_postings.size();
+        return m_size;
     }
 
 private:
-    /// The shared list stores multiple postings lists per block.
-    backend_type& m_list;
-
-    /// The index in the shared list.
-    u64 m_index;
-
-    /// True if any value changed over the existance of this instance.
-    bool m_dirty = false;
-
-    /// Cached entry data. The inverted index guarantees that this list instance is the
-    /// only one modifying it.
-    posting_vector m_postings;
+    u32 m_size = 0;
+    posting_type m_postings[max_entries];
 };
 
-template<size_t block_size, size_t max_entries>
+template<size_t max_entries>
 class postings_list_storage {
-    postings_list_backend<block_size, max_entries>& list;
-    u64 index;
-
 public:
-    postings_list_storage(postings_list_backend<block_size, max_entries>& list, u64 index)
-        : list(list), index(index)
-    {}
+    postings_list_storage() = default;
 
 private:
     template<typename StorageSpec, u32 Lambda>
-    friend class postings_list;
+    friend class geodb::postings_list;
 
     template<typename Posting>
-    using implementation = postings_list_storage_impl<block_size, max_entries>;
+    using implementation = postings_list_storage_impl<max_entries>;
 
     template<typename Posting>
     implementation<Posting> construct() const {
         static_assert(std::is_same<Posting, posting<0>>::value, "Unsupported posting type.");
-        return {list, index};
+        return {};
     }
 };
 
-template<size_t block_size, size_t max_posting_entries>
-class index_storage_impl : boost::noncopyable {
+/// An inverted index in internal memory.
+/// Labels are kept in a flat array, sorted by label.
+/// The postings lists are allocated from an arena that is shared by all nodes of the tree.
+template<size_t max_posting_entries>
+class index_storage_impl {
 public:
-    using list_backend_type = postings_list_backend<block_size, max_posting_entries>;
-
-    using list_storage_type = postings_list_storage<block_size, max_posting_entries>;
+    using list_storage_type = postings_list_storage<max_posting_entries>;
 
     using list_type = postings_list<list_storage_type, 0>;
 
-    // Key: index into the shared list.
-    using list_instances_type = shared_instances<u64, list_type>;
+    using list_ptr = list_type*;
 
-    using list_ptr = typename list_instances_type::pointer;
+    using const_list_ptr = const list_type*;
 
-    using const_list_ptr = typename list_instances_type::const_pointer;
+    static_assert(std::is_trivially_destructible<list_type>::value,
+                  "Lists are never destroyed, their memory is released by the arena.");
 
 private:
-    // TODO: Hybrid storage.
-    /// Maps label to its list's index in the shared backend.
-    using map_type = hybrid_map<label_type, u64, block_size>;
+    struct label_entry {
+        label_type label;
+        list_type* list;
+    };
+
+    using entries_type = std::vector<label_entry, tpie::allocator<label_entry>>;
 
 public:
-    using iterator_type = typename map_type::const_iterator;
+    using iterator_type = typename entries_type::const_iterator;
 
     iterator_type begin() const { return m_lists.begin(); }
 
     iterator_type end() const { return m_lists.end(); }
 
     iterator_type find(label_type label) const {
-        return m_lists.find(label);
+        auto pos = lower_bound(label);
+        return pos != m_lists.end() && pos->label == label ? pos : m_lists.end();
     }
 
     label_type label(iterator_type pos) const {
         geodb_assert(pos != end(), "dereferencing invalid iterator");
-        return pos->first;
+        return pos->label;
     }
 
     iterator_type create(label_type label) {
-        geodb_assert(m_lists.find(label) == m_lists.end(), "already have label");
-        u64 index = create_list();
+        auto pos = lower_bound(label);
+        geodb_assert(pos == m_lists.end() || pos->label != label, "already have label");
 
-        bool inserted = m_lists.insert(label, index);
-        (void) inserted;
-        geodb_assert(inserted, "already stored the label.");
-        return m_lists.find(label);
+        void* memory = m_arena->allocate(sizeof(list_type), alignof(list_type));
+        return m_lists.insert(pos, label_entry{label, new (memory) list_type()});
     }
 
     list_ptr list(iterator_type pos) {
         geodb_assert(pos != end(), "dereferencing invalid iterator");
-        return open_list(pos->second);
+        return pos->list;
     }
 
     const_list_ptr const_list(iterator_type pos) const {
         geodb_assert(pos != end(), "dereferencing invalid iterator");
-        return open_list(pos->second);
+        return pos->list;
     }
 
     list_ptr total_list() {
-        return open_list(m_total_index);
+        return &m_total;
     }
 
     const_list_ptr const_total_list() const {
-        return open_list(m_total_index);
+        return &m_total;
     }
 
     size_t size() const {
@@ -249,74 +178,64 @@ public:
     }
 
 public:
-    index_storage_impl(const fs::path& path, list_backend_type& postings_lists)
-        : m_postings_lists(postings_lists)
-        , m_total_index(create_list())
-        , m_lists(path)
+    index_storage_impl(arena& lists)
+        : m_arena(&lists)
     {}
 
-    ~index_storage_impl() {}
+    index_storage_impl(index_storage_impl&&) noexcept = default;
 
 private:
-    u64 create_list() {
-        // Create a new list initialized with its zero state.
-        u64 index = m_postings_lists.size();
-        m_postings_lists.append(postings_list_entry<max_posting_entries>());
-        return index;
-    }
-
-    const_list_ptr open_list(u64 index) const {
-        return m_open_lists.open(index, [&]{
-            return list_type(list_storage_type(m_postings_lists, index));
+    iterator_type lower_bound(label_type label) const {
+        return std::lower_bound(m_lists.begin(), m_lists.end(), label,
+                                [](const label_entry& e, label_type l) {
+            return e.label < l;
         });
     }
 
-    list_ptr open_list(u64 index) {
-        return m_open_lists.convert(as_const(this)->open_list(index));
-    }
-
 private:
-    list_backend_type& m_postings_lists;
-    u64 m_total_index;
-    map_type m_lists;
-    mutable list_instances_type m_open_lists;
+    arena* m_arena;
+    list_type m_total;
+    entries_type m_lists;
 };
 
-template<size_t block_size, size_t max_posting_entries>
+template<size_t max_posting_entries>
 class index_storage {
-    fs::path path;
-    postings_list_backend<block_size, max_posting_entries>& backend;
+    arena& lists;
 
 public:
-    index_storage(const fs::path& path,
-                  postings_list_backend<block_size, max_posting_entries>& backend)
-        : path(path), backend(backend) {}
+    index_storage(arena& lists)
+        : lists(lists) {}
 
 private:
     template<typename StorageSpec, u32 Lambda>
-    friend class inverted_index;
+    friend class geodb::inverted_index;
 
     template<u32 Lambda>
-    using implementation = index_storage_impl<block_size, max_posting_entries>;
+    using implementation = index_storage_impl<max_posting_entries>;
 
     template<u32 Lambda>
-    movable_adapter<implementation<Lambda>>
-    construct() const {
+    implementation<Lambda> construct() const {
         static_assert(Lambda == 0, "Lambda must be 0.");
-        return { in_place_t(), path, backend };
+        return { lists };
     }
 };
 
-/// Storage backend for the quickload algorithm. Mostly uses internal memory.
-template<size_t block_size, u32 fanout_leaf, u32 fanout_internal, typename LeafData>
+/// Storage backend for the quickload algorithm. The tree lives in internal memory.
+///
+/// Nodes and postings lists are allocated from arenas instead of being allocated
+/// individually. Internal nodes and their postings lists live until the storage is destroyed,
+/// leaves are released all at once by \ref cut_leaves().
+/// The arenas register their memory with TPIE, so the tree counts against the memory limit.
+template<u32 fanout_leaf, u32 fanout_internal, typename LeafData>
 class tree_storage_impl : boost::noncopyable {
     /// Every list can have at most fanout_internal entries,
     /// because an internal node cannot have more children than that.
     static constexpr size_t max_posting_entries = fanout_internal;
 
-    using index_storage_type = index_storage<block_size, max_posting_entries>;
+    using index_storage_type = index_storage<max_posting_entries>;
 
-    using dir_alloc_t = directory_allocator<u64>;
+    /// Size of the chunks allocated by the arenas.
+    static constexpr size_t chunk_size = 256 * 1024;
 
 public:
     static constexpr u32 max_internal_entries() { return fanout_internal; }
@@ -343,13 +262,12 @@ private:
     };
 
     struct internal : base {
-        internal(const fs::path& path,
-                 postings_list_backend<block_size, fanout_internal>& lists_backend)
-            : index(index_storage_type(path, lists_backend))
+        internal(arena& lists)
+            : index(index_storage_type(lists))
             , count(0)
         {}
 
-        /// The index is stored inline and remains open.
+        /// The index is stored inline, its lists are allocated from the tree's arena.
         index_type index;
 
         /// Total number of entries.
@@ -421,26 +339,35 @@ public:
 
     void set_root(node_ptr n) { m_root = n; }
 
+    const boost::optional<tree_params>& get_params() const { return m_params; }
+
+    void set_params(const tree_params& params) { m_params = params; }
+
     internal_ptr create_internal() {
         ++m_internals;
-
-        fs::path path = m_directory.path() / fmt::format("node-{}", m_internals);
-        return tpie::tpie_new<internal>(path, m_lists_backend);
+        return construct<internal>(m_internal_arena, m_lists_arena);
     }
 
     leaf_ptr create_leaf() {
         geodb_assert(!m_leaves_cut, "leaves have been cut off");
         ++m_leaves;
-        return tpie::tpie_new<leaf>();
+        return construct<leaf>(m_leaf_arena);
     }
 
 private:
+    template<typename Node, typename... Args>
+    static Node* construct(arena& a, Args&&... args) {
+        void* memory = a.allocate(sizeof(Node), alignof(Node));
+        return new (memory) Node(std::forward<Args>(args)...);
+    }
+
+    // The memory of destroyed nodes is released by their arena.
     void destroy_internal(internal_ptr i) {
-        tpie::tpie_delete(i);
+        i->~internal();
     }
 
     void destroy_leaf(leaf_ptr l) {
-        tpie::tpie_delete(l);
+        l->~leaf();
     }
 
 public:
@@ -503,12 +430,18 @@ public:
         if (m_root) {
             destroy_leaves(m_root, 1);
         }
+        m_leaf_arena.reset();
     }
 
     bool leaves_cut() const {
         return m_leaves_cut;
     }
 
+    /// Returns the number of bytes reserved for nodes and postings lists.
+    size_t memory() const {
+        return m_internal_arena.allocated() + m_leaf_arena.allocated() + m_lists_arena.allocated();
+    }
+
     template<typename Key, typename Value>
     using map_type = internal_map<Key, Value>;
 
@@ -526,10 +459,10 @@ public:
     }
 
 public:
-    tree_storage_impl(size_t postings_cache_blocks)
-        : m_directory("quickload-tree")
-        , m_lists_backend(ensure_directory(m_directory.path() / "posting_lists"),
-                          postings_cache_blocks)
+    tree_storage_impl()
+        : m_internal_arena(chunk_size, 0, true)
+        , m_leaf_arena(chunk_size, 0, true)
+        , m_lists_arena(chunk_size, 0, true)
     {
     }
 
@@ -586,10 +519,9 @@ private:
     }
 
 private:
-    temp_dir m_directory;
-
-    /// Shared external storage for all postings lists.
-    postings_list_backend<block_size, fanout_internal> m_lists_backend;
+    arena m_internal_arena;     ///< Memory for internal nodes.
+    arena m_leaf_arena;         ///< Memory for leaf nodes, released when the leaves are cut.
+    arena m_lists_arena;        ///< Memory for the postings lists of all internal nodes.
 
     size_t m_height = 0;    ///< 0: Tree is empty. 1: Root is leaf, 2: Everything else
     size_t m_size = 0;      ///< Number of data items inside the tree.
@@ -597,40 +529,33 @@ private:
     size_t m_internals = 0; ///< Number of internal nodes.
     base* m_root = nullptr;
     bool m_leaves_cut = false;
+    boost::optional<tree_params> m_params;  ///< Cost function parameters (if set).
 };
 
 /// Storage for the quickload algorithm.
 ///
-/// \tparam block_size
-///     The block size in external storage.
 /// \tparam fanout_leaf
 ///     The maximum number of children in leaf nodes.
 /// \tparam fanout_internal
 ///     The maximum number of children in internal nodes.
 ///     Defaults to fanout_leaf.
-template<size_t block_size, u32 fanout_leaf, u32 fanout_internal>
+template<u32 fanout_leaf, u32 fanout_internal>
 class tree_storage {
-private:
-    size_t postings_cache_blocks;
-
 public:
-    /// \param postings_cache_blocks
-    ///     The number of cached blocks (for posting lists) used accross all internal nodes.
-    tree_storage(size_t postings_cache_blocks)
-        : postings_cache_blocks(postings_cache_blocks) {}
+    tree_storage() = default;
 
 private:
     template<typename StorageSpec, typename Value, typename Accessor, u32 Lambda>
-    friend class tree_state;
+    friend class geodb::tree_state;
 
     template<typename LeafData, u32 Lambda>
-    using implementation = tree_storage_impl<block_size, fanout_leaf, fanout_internal, LeafData>;
+    using implementation = tree_storage_impl<fanout_leaf, fanout_internal, LeafData>;
 
     template<typename LeafData, u32 Lambda>
     movable_adapter<implementation<LeafData, Lambda>>
     construct() const {
         static_assert(Lambda == 0, "quickload only uses Lambda == 0.");
-        return {in_place_t(), postings_cache_blocks};
+        return {in_place_t()};
     }
 };
 
@@ -19,6 +19,33 @@
 
 namespace geodb {
 
+/// Selects the algorithm used to split overflowing nodes.
+enum class split_strategy {
+    /// The quadratic split algorithm of the original R-Tree,
+    /// extended for spatio-textual entries.
+    quadratic,
+
+    /// A sort-based split in the style of the R*-Tree
+    /// (choose the split axis by margin, then the distribution by cost).
+    /// Runs in O(n log n) instead of O(n^2).
+    rstar,
+};
+
+/// Returns the beta strategy selected at compile time
+/// (see the `GEODB_BETA_*` definitions).
+/// It is used for trees that do not have a recorded strategy.
+constexpr beta_strategy default_beta_strategy() {
+#ifdef GEODB_BETA_INCREASING
+    return beta_strategy::increasing;
+#elif GEODB_BETA_DECREASING
+    return beta_strategy::decreasing;
+#elif GEODB_BETA_NORMAL
+    return beta_strategy::normal;
+#else
+#error Must define a weighting strategy.
+#endif
+}
+
 /// A tree_state contains the basic state of a tree, including its storage.
 /// It does not implement complex insert, delete or query operations.
 ///
@@ -92,14 +119,42 @@ private:
     /// between spatial and textual insertion cost.
     double m_weight = 0;
 
+    /// Determines how the weight changes with the level of a node.
+    beta_strategy m_strategy = default_beta_strategy();
+
+    /// The algorithm used when nodes overflow.
+    split_strategy m_split = split_strategy::quadratic;
+
+    /// Fraction of the entries of an overflowing node that are
+    /// reinserted before the node is split. 0 disables forced reinsertion.
+    double m_reinsert = 0;
+
 public:
-    tree_state(const StorageSpec& s, Accessor accessor, double weight)
+    /// Constructs the tree state.
+    /// An explicit `weight` takes precedence over the weight recorded in the storage
+    /// and is recorded if it differs. Without an explicit weight, the recorded one is used
+    /// (or 0.5 if there is none). The recorded beta strategy is always kept;
+    /// storages without recorded parameters use the default strategy.
+    tree_state(const StorageSpec& s, Accessor accessor, boost::optional<double> weight)
         : m_storage(s.template construct<Value, Lambda>())
         , m_accessor(std::move(accessor))
-        , m_weight(weight)
+        , m_weight(weight.value_or(0.5))
     {
         if (m_weight < 0 || m_weight > 1)
             throw std::invalid_argument("weight must be in [0, 1]");
+
+        if (const auto& params = storage().get_params()) {
+            if (params->weight < 0 || params->weight > 1)
+                throw std::invalid_argument("recorded weight must be in [0, 1]");
+            m_strategy = params->strategy;
+            if (!weight) {
+                m_weight = params->weight;
+            } else if (*weight != params->weight) {
+                storage().set_params(tree_params(m_weight, m_strategy));
+            }
+        } else {
+            storage().set_params(tree_params(m_weight, m_strategy));
+        }
     }
 
     storage_type& storage() {
@@ -114,6 +169,53 @@ public:
         return m_weight;
     }
 
+    /// Changes the weight used for future operations and records it in the storage.
+    /// \pre `0 <= weight <= 1`.
+    void weight(double weight) {
+        if (weight < 0 || weight > 1)
+            throw std::invalid_argument("weight must be in [0, 1]");
+        m_weight = weight;
+        storage().set_params(tree_params(m_weight, m_strategy));
+    }
+
+    /// Returns the strategy that determines the weight on every level.
+    beta_strategy strategy() const {
+        return m_strategy;
+    }
+
+    /// Changes the beta strategy used for future operations and records it in the storage.
+    void strategy(beta_strategy strategy) {
+        m_strategy = strategy;
+        storage().set_params(tree_params(m_weight, m_strategy));
+    }
+
+    /// Returns the algorithm used for node splits.
+    split_strategy split() const {
+        return m_split;
+    }
+
+    /// Changes the algorithm used for future node splits.
+    /// Existing nodes are not affected.
+    void split(split_strategy s) {
+        m_split = s;
+    }
+
+    /// Returns the fraction of entries that are removed from an overflowing
+    /// node and then reinserted into the tree (R*-Tree forced reinsertion).
+    /// Forced reinsertion happens at most once per level and insert operation.
+    /// A value of 0 means that overflowing nodes are always split.
+    double reinsert_fraction() const {
+        return m_reinsert;
+    }
+
+    /// Changes the fraction of entries used for forced reinsertion.
+    /// \pre `0 <= fraction < 1`.
+    void reinsert_fraction(double fraction) {
+        if (fraction < 0 || fraction >= 1)
+            throw std::invalid_argument("reinsert fraction must be in [0, 1)");
+        m_reinsert = fraction;
+    }
+
     /// Returns the trajectory the given entry belongs to.
     trajectory_id_type get_id(const value_type& v) const {
         return m_accessor.get_id(v);
@@ -303,15 +405,16 @@ public:
         // both will have height 1 in the following variable.
         double height = std::max(1.0, double(storage().get_height() - level));
         double beta = this->weight();
-#ifdef GEODB_BETA_INCREASING
-        beta = std::pow(beta, 1.0f / height);
-#elif GEODB_BETA_DECREASING
-        beta = std::pow(beta, height);
-#elif GEODB_BETA_NORMAL
-        (void) height;
-#else
-#error Must define a weighting strategy.
-#endif
+        switch (m_strategy) {
+        case beta_strategy::increasing:
+            beta = std::pow(beta, 1.0f / height);
+            break;
+        case beta_strategy::decreasing:
+            beta = std::pow(beta, height);
+            break;
+        case beta_strategy::normal:
+            break;
+        }
         return avg(spatial, textual, beta);
     }
 
@@ -5,6 +5,9 @@
 #include <boost/geometry/geometries/segment.hpp>
 #include <boost/geometry/algorithms/intersects.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 namespace geodb {
 
 bool trajectory_unit::intersects(const bounding_box& b) const {
@@ -25,4 +28,39 @@ bool trajectory_unit::intersects(const bounding_box& b) const {
     return bg::intersects(box, line);
 }
 
+double trajectory_unit::spatial_distance(const vector2d& p, const interval<time_type>& window) const {
+    // The segment is parameterized by s in [0, 1].
+    // Restrict s to the range that falls into the time window.
+    double s_begin = 0;
+    double s_end = 1;
+    if (start.t() != end.t()) {
+        const double t0 = start.t();
+        const double t1 = end.t();
+
+        double a = (double(window.begin()) - t0) / (t1 - t0);
+        double b = (double(window.end()) - t0) / (t1 - t0);
+        if (a > b) {
+            std::swap(a, b);
+        }
+        s_begin = std::max(s_begin, a);
+        s_end = std::min(s_end, b);
+    }
+    geodb_assert(s_begin <= s_end, "unit does not overlap the time window");
+
+    // Project p onto the line and clamp the result to the restricted segment.
+    const double dx = double(end.x()) - double(start.x());
+    const double dy = double(end.y()) - double(start.y());
+    const double length2 = dx * dx + dy * dy;
+
+    double s = s_begin;
+    if (length2 > 0) {
+        s = ((p.x() - start.x()) * dx + (p.y() - start.y()) * dy) / length2;
+        s = std::min(std::max(s, s_begin), s_end);
+    }
+
+    const double cx = start.x() + s * dx;
+    const double cy = start.y() + s * dy;
+    return std::hypot(p.x() - cx, p.y() - cy);
+}
+
 } // namespace geodb
@@ -3,6 +3,7 @@
 
 #include "geodb/bounding_box.hpp"
 #include "geodb/common.hpp"
+#include "geodb/interval.hpp"
 #include "geodb/vector.hpp"
 
 #include <tpie/serialization2.h>
@@ -50,6 +51,11 @@ struct trajectory_unit {
     /// Returns true iff this line segment intersects the given bounding box.
     bool intersects(const bounding_box& b) const;
 
+    /// Returns the minimum spatial distance between `p` and the part of
+    /// this line segment that lies within the time interval `window`.
+    /// \pre The time interval of this unit overlaps `window`.
+    double spatial_distance(const vector2d& p, const interval<time_type>& window) const;
+
     /// Returns the minimum bounding box for this trajectory unit.
     bounding_box get_bounding_box() const {
         return { vector3::min(start, end), vector3::max(start, end) };
@@ -0,0 +1,241 @@
+#ifndef GEODB_UTILITY_ARENA_HPP
+#define GEODB_UTILITY_ARENA_HPP
+
+#include "geodb/common.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <tpie/memory.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/// \file
+/// A monotonic memory arena for short lived allocations.
+
+namespace geodb {
+
+/// A monotonic memory arena. Allocations are served from large chunks
+/// by bumping a pointer, deallocation is a no-op. Memory is reclaimed
+/// all at once by rewinding the arena to an earlier position (see \ref mark()),
+/// chunks are kept for later allocations.
+///
+/// Arenas that hold long lived data can register their chunks with the memory manager
+/// of TPIE, so that they count against its memory limit.
+///
+/// \note This class is not thread-safe. Use one arena per thread (see \ref thread_arena()).
+class arena : boost::noncopyable {
+public:
+    /// A position within the arena.
+    struct mark_type {
+        size_t chunk = 0;
+        size_t used = 0;
+    };
+
+public:
+    /// Constructs an empty arena.
+    ///
+    /// \param chunk_size
+    ///     The size of a single chunk. Larger allocations get a chunk of their own.
+    /// \param max_retained
+    ///     The number of bytes that are kept when the arena is rewound to its start.
+    ///     Additional chunks are freed.
+    /// \param track_memory
+    ///     If true, all chunks are registered with TPIE's memory manager.
+    explicit arena(size_t chunk_size = 64 * 1024, size_t max_retained = 4 * 1024 * 1024,
+                   bool track_memory = false)
+        : m_chunk_size(chunk_size)
+        , m_max_retained(max_retained)
+        , m_track_memory(track_memory)
+    {
+        geodb_assert(chunk_size > 0, "chunk size must be positive");
+    }
+
+    ~arena() {
+        if (m_track_memory && m_allocated > 0) {
+            tpie::get_memory_manager().register_deallocation(m_allocated);
+        }
+    }
+
+    /// Allocates `size` bytes with the given alignment.
+    /// \pre `alignment` is a power of two.
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        geodb_assert(alignment > 0 && (alignment & (alignment - 1)) == 0, "alignment must be a power of two");
+
+        if (m_current < m_chunks.size()) {
+            if (void* p = bump(m_chunks[m_current], size, alignment)) {
+                return p;
+            }
+        }
+
+        // Continue with the next chunk that is large enough.
+        // Chunks that are too small are skipped (and reused after the next rewind).
+        const size_t required = size + alignment;
+        while (++m_current < m_chunks.size()) {
+            m_used = 0;
+            if (m_chunks[m_current].size >= required) {
+                return bump(m_chunks[m_current], size, alignment);
+            }
+        }
+
+        chunk c;
+        c.size = std::max(m_chunk_size, required);
+        c.data.reset(new char[c.size]);
+        m_chunks.push_back(std::move(c));
+        m_current = m_chunks.size() - 1;
+        m_used = 0;
+        m_allocated += m_chunks.back().size;
+        if (m_track_memory) {
+            tpie::get_memory_manager().register_allocation(m_chunks.back().size);
+        }
+        return bump(m_chunks.back(), size, alignment);
+    }
+
+    /// Deallocation is a no-op, memory is reclaimed by \ref rewind().
+    void deallocate(void* p, size_t size) {
+        unused(p, size);
+    }
+
+    /// Returns the current position of the arena.
+    mark_type mark() const {
+        return { m_current, m_used };
+    }
+
+    /// Rewinds the arena to a previous position. All memory allocated after
+    /// that position becomes invalid.
+    void rewind(const mark_type& m) {
+        geodb_assert(m.chunk < m_current || (m.chunk == m_current && m.used <= m_used)
+                     || m_chunks.empty(), "mark is not a previous position");
+        m_current = m.chunk;
+        m_used = m.used;
+        if (m_current == 0 && m_used == 0) {
+            release();
+        }
+    }
+
+    /// Rewinds the arena to its start.
+    void reset() { rewind(mark_type()); }
+
+    /// Returns the number of bytes currently reserved by this arena.
+    size_t allocated() const { return m_allocated; }
+
+private:
+    struct chunk {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+    };
+
+    /// Allocates from the given chunk if there is enough space left.
+    void* bump(chunk& c, size_t size, size_t alignment) {
+        const uintptr_t base = reinterpret_cast<uintptr_t>(c.data.get());
+        const uintptr_t begin = (base + m_used + alignment - 1) & ~uintptr_t(alignment - 1);
+        if (begin + size > base + c.size) {
+            return nullptr;
+        }
+        m_used = begin + size - base;
+        return reinterpret_cast<void*>(begin);
+    }
+
+    /// Frees chunks that exceed the retention limit.
+    void release() {
+        size_t retained = 0;
+        auto pos = m_chunks.begin();
+        for (; pos != m_chunks.end(); ++pos) {
+            if (retained + pos->size > m_max_retained && pos != m_chunks.begin()) {
+                break;
+            }
+            retained += pos->size;
+        }
+        m_chunks.erase(pos, m_chunks.end());
+        if (m_track_memory && m_allocated > retained) {
+            tpie::get_memory_manager().register_deallocation(m_allocated - retained);
+        }
+        m_allocated = retained;
+    }
+
+private:
+    size_t m_chunk_size;
+    size_t m_max_retained;
+    bool m_track_memory;
+    std::vector<chunk> m_chunks;
+    size_t m_current = 0;   ///< Index of the current chunk.
+    size_t m_used = 0;      ///< Number of bytes used in the current chunk.
+    size_t m_allocated = 0; ///< Sum of all chunk sizes.
+};
+
+/// Rewinds an arena to its current position when it goes out of scope.
+/// Scopes can be nested.
+class arena_scope : boost::noncopyable {
+public:
+    explicit arena_scope(arena& a)
+        : m_arena(a)
+        , m_mark(a.mark())
+    {}
+
+    ~arena_scope() {
+        m_arena.rewind(m_mark);
+    }
+
+private:
+    arena& m_arena;
+    arena::mark_type m_mark;
+};
+
+/// Returns the arena of the calling thread.
+inline arena& thread_arena() {
+    static thread_local arena instance;
+    return instance;
+}
+
+/// A standard allocator that allocates from an \ref arena.
+template<typename T>
+class arena_allocator {
+public:
+    using value_type = T;
+
+public:
+    /// Allocates from the arena of the calling thread.
+    arena_allocator(): m_arena(&thread_arena()) {}
+
+    arena_allocator(arena& a): m_arena(&a) {}
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U>& other): m_arena(other.m_arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        m_arena->deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const arena_allocator<U>& other) const { return m_arena == other.m_arena; }
+
+    template<typename U>
+    bool operator!=(const arena_allocator<U>& other) const { return m_arena != other.m_arena; }
+
+private:
+    template<typename U>
+    friend class arena_allocator;
+
+    arena* m_arena;
+};
+
+/// A vector that allocates from an arena.
+template<typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+/// An unordered map that allocates from an arena.
+template<typename Key, typename Value>
+using arena_unordered_map = std::unordered_map<Key, Value, std::hash<Key>, std::equal_to<Key>,
+                                               arena_allocator<std::pair<const Key, Value>>>;
+
+} // namespace geodb
+
+#endif // GEODB_UTILITY_ARENA_HPP
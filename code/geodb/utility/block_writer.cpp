@@ -0,0 +1,230 @@
+#include "geodb/utility/block_writer.hpp"
+
+#include <tpie/memory.h>
+#include <tpie/stats.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace geodb {
+
+namespace {
+
+/// Alignment of buffers and offsets required for direct I/O.
+constexpr size_t direct_alignment = 4096;
+
+/// Number of bytes written between two attempts to drop the page cache.
+constexpr u64 drop_interval = 16 * 1024 * 1024;
+
+std::system_error errno_error(const std::string& what) {
+    return std::system_error(errno, std::system_category(), what);
+}
+
+} // namespace
+
+void block_writer::buffer_deleter::operator()(char* p) const {
+    std::free(p);
+}
+
+block_writer::block_writer(const fs::path& path, size_t block_size, block_writer_options options)
+    : m_block_size(block_size)
+    , m_options(options)
+{
+    geodb_assert(block_size > 0, "invalid block size");
+    geodb_assert(options.queue_blocks > 0, "queue must not be empty");
+
+#ifdef O_DIRECT
+    if (options.direct_io && block_size % direct_alignment == 0) {
+        m_fd = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+        m_direct_io = m_fd != -1;
+    }
+#endif
+    if (m_fd == -1) {
+        m_fd = ::open(path.c_str(), O_WRONLY);
+    }
+    if (m_fd == -1) {
+        throw errno_error("Failed to open " + path.string() + " for writing");
+    }
+
+    m_thread = std::thread([this]{ run(); });
+}
+
+block_writer::~block_writer() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_changed.notify_all();
+    }
+    m_thread.join();
+    drop_written();
+    ::close(m_fd);
+
+    // Errors must not get lost, the file is incomplete.
+    if (m_error && !m_error_reported) {
+        std::cerr << "Unreported error in block writer";
+        try {
+            std::rethrow_exception(m_error);
+        } catch (const std::exception& e) {
+            std::cerr << ": " << e.what();
+        } catch (...) {}
+        std::cerr << "." << std::endl;
+        std::abort();
+    }
+
+    tpie::get_memory_manager().register_deallocation(m_buffers * m_block_size);
+}
+
+void block_writer::write(u64 offset, const void* data) {
+    geodb_assert(offset % m_block_size == 0, "offset must be a multiple of the block size");
+
+    std::unique_ptr<request> r = std::make_unique<request>();
+    r->offset = offset;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [&]{
+        return m_error || m_queue.size() + m_in_flight < m_options.queue_blocks;
+    });
+    rethrow_error();
+
+    if (m_free_buffers.empty()) {
+        r->data = allocate_buffer();
+    } else {
+        r->data = std::move(m_free_buffers.back());
+        m_free_buffers.pop_back();
+    }
+    std::memcpy(r->data.get(), data, m_block_size);
+
+    m_latest[offset] = r.get();
+    m_queue.push_back(std::move(r));
+    m_changed.notify_all();
+}
+
+bool block_writer::read_pending(u64 offset, void* data) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto pos = m_latest.find(offset);
+    if (pos == m_latest.end()) {
+        return false;
+    }
+    std::memcpy(data, pos->second->data.get(), m_block_size);
+    return true;
+}
+
+bool block_writer::pending(u64 offset) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_latest.count(offset) > 0;
+}
+
+void block_writer::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [&]{
+        return m_error || (m_queue.empty() && m_in_flight == 0);
+    });
+    rethrow_error();
+}
+
+void block_writer::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (1) {
+        m_changed.wait(lock, [&]{ return m_stop || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return; // Stopped and drained.
+        }
+
+        std::unique_ptr<request> r = std::move(m_queue.front());
+        m_queue.pop_front();
+        ++m_in_flight;
+
+        // The request stays visible to readers until it has been written.
+        // Requests are discarded after an error.
+        const bool failed = static_cast<bool>(m_error);
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            if (!failed) {
+                write_block(*r);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+
+        if (error) {
+            m_error = error;
+        }
+
+        auto pos = m_latest.find(r->offset);
+        if (pos != m_latest.end() && pos->second == r.get()) {
+            m_latest.erase(pos);
+        }
+        m_free_buffers.push_back(std::move(r->data));
+        --m_in_flight;
+        m_changed.notify_all();
+    }
+}
+
+void block_writer::write_block(const request& r) {
+    const char* data = r.data.get();
+    size_t done = 0;
+    while (done < m_block_size) {
+        ssize_t n = ::pwrite(m_fd, data + done, m_block_size - done, r.offset + done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw errno_error("Failed to write block");
+        }
+        done += n;
+    }
+    tpie::increment_bytes_written(m_block_size);
+
+    if (m_options.drop_cache && !m_direct_io) {
+        if (m_written_begin == m_written_end) {
+            m_written_begin = r.offset;
+            m_written_end = r.offset + m_block_size;
+        } else {
+            m_written_begin = std::min(m_written_begin, r.offset);
+            m_written_end = std::max(m_written_end, r.offset + m_block_size);
+        }
+        if (m_written_end - m_written_begin >= drop_interval) {
+            drop_written();
+        }
+    }
+}
+
+void block_writer::drop_written() {
+    if (m_written_begin == m_written_end) {
+        return;
+    }
+
+    // Dirty pages cannot be dropped, write them back first.
+    // Failures only affect the page cache and are ignored.
+    ::fdatasync(m_fd);
+    ::posix_fadvise(m_fd, m_written_begin, m_written_end - m_written_begin, POSIX_FADV_DONTNEED);
+    m_written_begin = m_written_end = 0;
+}
+
+block_writer::buffer_type block_writer::allocate_buffer() {
+    void* p = nullptr;
+    if (::posix_memalign(&p, direct_alignment, m_block_size) != 0) {
+        throw std::bad_alloc();
+    }
+    tpie::get_memory_manager().register_allocation(m_block_size);
+    ++m_buffers;
+    return buffer_type(static_cast<char*>(p));
+}
+
+void block_writer::rethrow_error() {
+    if (m_error) {
+        m_error_reported = true;
+        std::rethrow_exception(m_error);
+    }
+}
+
+} // namespace geodb
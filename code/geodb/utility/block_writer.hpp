@@ -0,0 +1,123 @@
+#ifndef GEODB_UTILITY_BLOCK_WRITER_HPP
+#define GEODB_UTILITY_BLOCK_WRITER_HPP
+
+#include "geodb/common.hpp"
+#include "geodb/filesystem.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// \file
+/// Asynchronous write-behind for block files.
+
+namespace geodb {
+
+/// Options for a \ref block_writer.
+struct block_writer_options {
+    /// The maximum number of blocks that wait for their write.
+    /// Writers block while the queue is full.
+    size_t queue_blocks = 256;
+
+    /// Bypass the page cache of the operating system (O_DIRECT).
+    /// Falls back to normal writes if the file system does not support it.
+    bool direct_io = false;
+
+    /// Drop written pages from the page cache of the operating system
+    /// (posix_fadvise) so that a large output does not evict other data.
+    bool drop_cache = false;
+};
+
+/// Writes fixed size blocks to an existing file in a background thread.
+///
+/// Blocks are copied into a bounded queue and written in order of submission,
+/// so later writes to the same position win. Blocks that are still queued can be
+/// read back using \ref read_pending(), which must be consulted before reading
+/// the file through another handle.
+///
+/// Errors of the background thread are rethrown by the next call to
+/// \ref write() or \ref flush(). An error that was never rethrown
+/// aborts the program when the writer is destroyed.
+class block_writer : boost::noncopyable {
+public:
+    /// Opens the file at `path` for writing.
+    /// \pre The file exists.
+    block_writer(const fs::path& path, size_t block_size, block_writer_options options = block_writer_options());
+
+    /// Waits until all queued blocks have been written.
+    /// Aborts if a write failed and the error has not been reported by
+    /// \ref write() or \ref flush().
+    ~block_writer();
+
+    /// Queues a copy of the block at the given byte offset.
+    /// \pre `offset` is a multiple of the block size.
+    void write(u64 offset, const void* data);
+
+    /// Copies the content of a queued block into `data`.
+    /// Returns false if there is no queued block at that offset.
+    bool read_pending(u64 offset, void* data) const;
+
+    /// Returns true if a block at the given offset is still queued.
+    bool pending(u64 offset) const;
+
+    /// Waits until all queued blocks have been written.
+    void flush();
+
+    /// Returns true if the page cache is bypassed.
+    bool direct_io() const { return m_direct_io; }
+
+    /// Returns the size of a single block.
+    size_t block_size() const { return m_block_size; }
+
+private:
+    struct buffer_deleter {
+        void operator()(char* p) const;
+    };
+
+    using buffer_type = std::unique_ptr<char, buffer_deleter>;
+
+    struct request {
+        u64 offset = 0;
+        buffer_type data;
+    };
+
+    void run();
+    void write_block(const request& r);
+    void drop_written();
+    buffer_type allocate_buffer();
+    void rethrow_error();
+
+private:
+    size_t m_block_size;
+    block_writer_options m_options;
+    int m_fd = -1;
+    bool m_direct_io = false;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<request>> m_queue;
+    std::unordered_map<u64, const request*> m_latest;
+    std::vector<buffer_type> m_free_buffers;
+    size_t m_buffers = 0;
+    size_t m_in_flight = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+    bool m_error_reported = false;
+
+    /// Range of bytes written since the page cache was dropped (writer thread only).
+    u64 m_written_begin = 0;
+    u64 m_written_end = 0;
+
+    std::thread m_thread;
+};
+
+} // namespace geodb
+
+#endif // GEODB_UTILITY_BLOCK_WRITER_HPP
@@ -0,0 +1,184 @@
+#include "geodb/utility/memory_budget.hpp"
+
+#include <tpie/memory.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace geodb {
+
+memory_budget::consumer::consumer(memory_budget& budget, std::string name)
+    : m_budget(&budget)
+    , m_name(std::move(name))
+{
+    std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+    m_budget->m_consumers.push_back(this);
+}
+
+memory_budget::consumer::~consumer() {
+    std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+    m_budget->release(*this);
+
+    auto& consumers = m_budget->m_consumers;
+    consumers.erase(std::find(consumers.begin(), consumers.end(), this));
+}
+
+bool memory_budget::consumer::grow(size_t bytes) {
+    return m_budget->grow(*this, bytes);
+}
+
+void memory_budget::consumer::spilled() {
+    m_budget->spilled(*this);
+}
+
+size_t memory_budget::consumer::bytes() const {
+    std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+    return m_bytes;
+}
+
+bool memory_budget::consumer::spill_requested() const {
+    std::lock_guard<std::mutex> lock(m_budget->m_mutex);
+    return m_spill_requested;
+}
+
+memory_budget::memory_budget(size_t limit)
+    : m_limit(limit)
+{}
+
+memory_budget::memory_budget() {}
+
+memory_budget::~memory_budget() {
+    geodb_assert(m_consumers.empty(), "budget destroyed before its consumers");
+}
+
+memory_budget& memory_budget::global() {
+    static memory_budget instance;
+    return instance;
+}
+
+size_t memory_budget::used() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_used;
+}
+
+size_t memory_budget::available() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return available_locked();
+}
+
+u64 memory_budget::spills() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_spills;
+}
+
+u64 memory_budget::spilled_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_spilled_bytes;
+}
+
+void memory_budget::listener(listener_type listener) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listener = std::move(listener);
+}
+
+bool memory_budget::grow(consumer& c, size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // The number of bytes by which the limit would be exceeded.
+    const size_t overcommit = overcommit_locked(bytes);
+    if (overcommit > 0) {
+        // Memory that has already been granted on credit is still held
+        // by the consumers that were asked to spill. No further credit
+        // is given until they have released it.
+        for (consumer* other : m_consumers) {
+            if (other->m_spill_requested && other->m_bytes > 0) {
+                return false;
+            }
+        }
+
+        // Flag the largest consumers first, but only those that are larger
+        // than the requester. If they cannot cover the overcommitted memory,
+        // the requester has to spill itself.
+        std::vector<consumer*> candidates;
+        for (consumer* other : m_consumers) {
+            if (other != &c && !other->m_spill_requested && other->m_bytes > c.m_bytes) {
+                candidates.push_back(other);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](consumer* a, consumer* b) {
+            return a->m_bytes > b->m_bytes;
+        });
+
+        size_t pending = 0;
+        auto pos = candidates.begin();
+        for (; pos != candidates.end() && pending < overcommit; ++pos) {
+            pending += (*pos)->m_bytes;
+        }
+        if (pending < overcommit) {
+            return false;
+        }
+        for (auto i = candidates.begin(); i != pos; ++i) {
+            (*i)->m_spill_requested = true;
+        }
+    }
+
+    c.m_bytes += bytes;
+    m_used += bytes;
+    if (!m_limit) {
+        tpie::get_memory_manager().register_allocation(bytes);
+    }
+    return true;
+}
+
+void memory_budget::release(consumer& c) {
+    if (!m_limit && c.m_bytes > 0) {
+        tpie::get_memory_manager().register_deallocation(c.m_bytes);
+    }
+    m_used -= c.m_bytes;
+    c.m_bytes = 0;
+    c.m_spill_requested = false;
+}
+
+void memory_budget::spilled(consumer& c) {
+    spill_event event;
+    listener_type listener;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        event.name = c.m_name;
+        event.bytes = c.m_bytes;
+        event.requested = c.m_spill_requested;
+        release(c);
+
+        ++m_spills;
+        m_spilled_bytes += event.bytes;
+        listener = m_listener;
+    }
+    if (listener) {
+        listener(event);
+    }
+}
+
+size_t memory_budget::overcommit_locked(size_t bytes) const {
+    if (m_limit) {
+        return m_used + bytes > *m_limit ? m_used + bytes - *m_limit : 0;
+    }
+
+    const tpie::memory_manager& manager = tpie::get_memory_manager();
+    if (manager.limit() == 0) {
+        return 0;
+    }
+    const size_t used = manager.used();
+    return used + bytes > manager.limit() ? used + bytes - manager.limit() : 0;
+}
+
+size_t memory_budget::available_locked() const {
+    if (m_limit) {
+        return *m_limit > m_used ? *m_limit - m_used : 0;
+    }
+
+    // TPIE does not enforce a limit of zero.
+    const tpie::memory_manager& manager = tpie::get_memory_manager();
+    return manager.limit() == 0 ? std::numeric_limits<size_t>::max() : manager.available();
+}
+
+} // namespace geodb
@@ -0,0 +1,149 @@
+#ifndef GEODB_UTILITY_MEMORY_BUDGET_HPP
+#define GEODB_UTILITY_MEMORY_BUDGET_HPP
+
+#include "geodb/common.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// \file
+/// A memory budget shared by containers that can move their content to disk.
+
+namespace geodb {
+
+/// A memory budget that is shared by a number of consumers,
+/// usually containers that can move their content to external storage
+/// (see \ref hybrid_map and \ref hybrid_buffer).
+///
+/// Consumers request memory before they grow. If the budget is exhausted,
+/// the largest consumers are asked to spill first: if the requesting consumer
+/// is the largest one, the request is denied and the consumer is expected
+/// to spill itself. Otherwise, larger consumers are flagged (see \ref consumer::spill_requested())
+/// and the request is granted on credit if their memory covers the amount
+/// by which the limit is exceeded. Flagged consumers spill at their next insertion,
+/// which means that a consumer never invalidates the iterators of another.
+///
+/// The limit is therefore not a hard bound: \ref used() exceeds it only while
+/// flagged consumers still hold their memory, and by at most that amount.
+/// A flagged consumer that does not insert anymore (e.g. because it is only
+/// iterated) keeps its memory until it is destroyed. While memory granted on credit
+/// is outstanding, every request that does not fit into the limit is denied,
+/// so the requesters spill themselves instead of growing further.
+///
+/// A budget either has a fixed limit or negotiates with the memory manager
+/// of TPIE. In the latter case, all granted memory is registered with TPIE
+/// and the available memory is whatever TPIE reports as available.
+///
+/// All member functions are thread-safe.
+class memory_budget : boost::noncopyable {
+public:
+    /// Reported whenever a consumer moves its content to external storage.
+    struct spill_event {
+        /// The name of the consumer.
+        std::string name;
+
+        /// The number of bytes released by the consumer.
+        size_t bytes = 0;
+
+        /// True if the consumer was asked to spill by the budget
+        /// because of another consumer's request.
+        bool requested = false;
+    };
+
+    using listener_type = std::function<void(const spill_event&)>;
+
+    /// A consumer of memory. Consumers must be registered (i.e. constructed)
+    /// before they can request memory. All memory held by a consumer
+    /// is released when it is destroyed.
+    class consumer : boost::noncopyable {
+    public:
+        /// Registers a new consumer with the given budget.
+        consumer(memory_budget& budget, std::string name);
+
+        ~consumer();
+
+        /// Requests an additional `bytes` bytes from the budget.
+        /// Returns false if the request was denied.
+        bool grow(size_t bytes);
+
+        /// Reports that this consumer has moved its content to external
+        /// storage and releases all of its memory.
+        void spilled();
+
+        /// Returns the number of bytes currently held by this consumer.
+        size_t bytes() const;
+
+        /// Returns true if the budget asked this consumer to spill.
+        bool spill_requested() const;
+
+        /// Returns the name of this consumer.
+        const std::string& name() const { return m_name; }
+
+        /// Returns the budget of this consumer.
+        memory_budget& budget() const { return *m_budget; }
+
+    private:
+        friend class memory_budget;
+
+        memory_budget* m_budget;
+        std::string m_name;
+        size_t m_bytes = 0;
+        bool m_spill_requested = false;
+    };
+
+public:
+    /// Constructs a budget with a fixed limit (in bytes).
+    explicit memory_budget(size_t limit);
+
+    /// Constructs a budget that uses the memory available to TPIE.
+    memory_budget();
+
+    ~memory_budget();
+
+    /// Returns the budget shared by all containers of the process.
+    /// It uses the memory available to TPIE.
+    static memory_budget& global();
+
+    /// Returns the number of bytes held by all consumers.
+    size_t used() const;
+
+    /// Returns the number of bytes that can still be granted.
+    size_t available() const;
+
+    /// Returns the number of spill events reported so far.
+    u64 spills() const;
+
+    /// Returns the number of bytes released by all spill events so far.
+    u64 spilled_bytes() const;
+
+    /// Sets the function that is invoked for every spill event (optional).
+    void listener(listener_type listener);
+
+private:
+    bool grow(consumer& c, size_t bytes);
+    void release(consumer& c);
+    void spilled(consumer& c);
+    size_t overcommit_locked(size_t bytes) const;
+    size_t available_locked() const;
+
+private:
+    mutable std::mutex m_mutex;
+
+    /// The fixed limit (if any). Otherwise, TPIE's memory manager is used.
+    boost::optional<size_t> m_limit;
+
+    size_t m_used = 0;
+    u64 m_spills = 0;
+    u64 m_spilled_bytes = 0;
+    std::vector<consumer*> m_consumers;
+    listener_type m_listener;
+};
+
+} // namespace geodb
+
+#endif // GEODB_UTILITY_MEMORY_BUDGET_HPP
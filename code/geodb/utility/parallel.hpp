@@ -0,0 +1,94 @@
+#ifndef GEODB_UTILITY_PARALLEL_HPP
+#define GEODB_UTILITY_PARALLEL_HPP
+
+#include "geodb/common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \file
+/// Helper functions for simple data parallel loops.
+
+namespace geodb {
+
+/// Returns the number of threads that can run concurrently
+/// on this machine (at least 1).
+inline size_t hardware_threads() {
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+/// Invokes `fn(i)` for every `i` in `[0, count)` using up to `threads` threads
+/// (including the calling thread). Indices are handed out dynamically,
+/// so the order of invocations is unspecified and `fn` must be safe
+/// to call concurrently for different indices.
+///
+/// If an invocation throws, no further indices will be started
+/// and the first exception is rethrown in the calling thread
+/// once all threads have finished.
+template<typename Function>
+void parallel_for(size_t count, size_t threads, Function&& fn) {
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+            error = std::move(e);
+        }
+        failed = true;
+    };
+
+    auto work = [&]{
+        while (!failed) {
+            const size_t i = next++;
+            if (i >= count) {
+                break;
+            }
+
+            try {
+                fn(i);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    try {
+        for (size_t t = 1; t < threads; ++t) {
+            workers.emplace_back(work);
+        }
+    } catch (...) {
+        // Could not start a thread. The threads that are
+        // already running must be joined before we can bail out.
+        fail(std::current_exception());
+    }
+
+    work();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace geodb
+
+#endif // GEODB_UTILITY_PARALLEL_HPP
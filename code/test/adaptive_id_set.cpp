@@ -0,0 +1,184 @@
+#include <catch.hpp>
+
+#include "geodb/adaptive_id_set.hpp"
+
+#include <random>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+using namespace geodb;
+
+using set_t = adaptive_id_set<8>;
+using kind = set_t::representation;
+
+namespace {
+
+set_t make_set(const std::set<u64>& ids) {
+    set_t set;
+    for (u64 id : ids) {
+        set.add(id);
+    }
+    return set;
+}
+
+// The set must contain every id in `ids` (false positives are allowed).
+void require_superset(const set_t& set, const std::set<u64>& ids) {
+    for (u64 id : ids) {
+        INFO("id " << id);
+        REQUIRE(set.contains(id));
+    }
+}
+
+// Returns the number of false positives in [first, last].
+u64 false_positives(const set_t& set, const std::set<u64>& ids, u64 first, u64 last) {
+    u64 result = 0;
+    for (u64 id = first; id <= last; ++id) {
+        result += set.contains(id) && !ids.count(id);
+    }
+    return result;
+}
+
+std::set<u64> dense_ids(std::mt19937& engine, u64 offset) {
+    // A few long runs of consecutive ids.
+    std::set<u64> ids;
+    std::uniform_int_distribution<u64> start(0, 5000);
+    for (int run = 0; run < 5; ++run) {
+        const u64 begin = offset + start(engine);
+        for (u64 id = begin; id < begin + 100; ++id) {
+            ids.insert(id);
+        }
+    }
+    return ids;
+}
+
+std::set<u64> scattered_ids(std::mt19937& engine, u64 offset) {
+    std::set<u64> ids;
+    std::uniform_int_distribution<u64> id(0, 100000);
+    while (ids.size() < 60) {
+        ids.insert(offset + id(engine));
+    }
+    return ids;
+}
+
+} // namespace
+
+TEST_CASE("adaptive id set layout", "[adaptive-id-set]") {
+    static_assert(std::is_trivially_copyable<set_t>::value, "must be trivially copyable");
+    static_assert(sizeof(set_t) == 8 + 8 * sizeof(interval<u64>), "same budget as 8 intervals");
+    REQUIRE(set_t::max_ids() == 16);
+    REQUIRE(set_t::max_intervals() == 8);
+    REQUIRE(set_t::filter_bits() == 14 * 64);
+}
+
+TEST_CASE("adaptive id set stores small sets exactly", "[adaptive-id-set]") {
+    set_t set;
+    REQUIRE(set.empty());
+    REQUIRE(set.kind() == kind::exact);
+
+    REQUIRE(set.add(17));
+    REQUIRE(set.add(3));
+    REQUIRE(!set.add(17));
+    REQUIRE(set.add(1000000));
+    REQUIRE(set.kind() == kind::exact);
+    REQUIRE(set.size() == 3);
+    REQUIRE(set.contains(3));
+    REQUIRE(!set.contains(4));
+    REQUIRE(set == set_t({1000000, 17, 3}));
+
+    // An exact list never has false positives, not even between distant ids.
+    std::set<u64> ids;
+    for (u64 id = 0; id < set_t::max_ids(); ++id)
+        ids.insert(id * 1000);
+    set_t full = make_set(ids);
+    REQUIRE(full.kind() == kind::exact);
+    REQUIRE(false_positives(full, ids, 0, 16000) == 0);
+
+    // One more id changes the representation.
+    ids.insert(999999);
+    full.add(999999);
+    REQUIRE(full.kind() != kind::exact);
+    require_superset(full, ids);
+}
+
+TEST_CASE("adaptive id set chooses intervals for dense ids", "[adaptive-id-set]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    for (int i = 0; i < 10; ++i) {
+        const std::set<u64> ids = dense_ids(engine, 0);
+        const set_t set = make_set(ids);
+        REQUIRE(set.kind() == kind::intervals);
+        require_superset(set, ids);
+        REQUIRE(false_positives(set, ids, 0, 6000) == 0);
+    }
+}
+
+TEST_CASE("adaptive id set chooses a filter for scattered ids", "[adaptive-id-set]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    for (int i = 0; i < 10; ++i) {
+        const std::set<u64> ids = scattered_ids(engine, 0);
+        const set_t set = make_set(ids);
+        REQUIRE(set.kind() == kind::bloom);
+        require_superset(set, ids);
+
+        // Merging 60 scattered ids into 8 intervals would cover most of the span,
+        // the filter has a much lower error rate.
+        REQUIRE(false_positives(set, ids, 0, 100000) < 10000);
+        REQUIRE(!set.contains(100001));
+    }
+}
+
+TEST_CASE("adaptive id set operations across representations", "[adaptive-id-set]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+
+    std::vector<std::set<u64>> truth;
+    truth.push_back({5, 7, 20000});
+    truth.push_back({7, 20000, 50000});
+    truth.push_back(dense_ids(engine, 0));
+    truth.push_back(dense_ids(engine, 2000));
+    truth.push_back(scattered_ids(engine, 0));
+    truth.push_back(scattered_ids(engine, 0));
+
+    std::vector<set_t> sets;
+    for (const auto& ids : truth)
+        sets.push_back(make_set(ids));
+    REQUIRE(sets[0].kind() == kind::exact);
+    REQUIRE(sets[2].kind() == kind::intervals);
+    REQUIRE(sets[4].kind() == kind::bloom);
+
+    for (size_t i = 0; i < sets.size(); ++i) {
+        for (size_t j = 0; j < sets.size(); ++j) {
+            INFO("sets " << i << " and " << j);
+
+            std::set<u64> u = truth[i], n;
+            u.insert(truth[j].begin(), truth[j].end());
+            for (u64 id : truth[i])
+                if (truth[j].count(id))
+                    n.insert(id);
+
+            require_superset(sets[i].union_with(sets[j]), u);
+            require_superset(sets[i].intersection_with(sets[j]), n);
+            REQUIRE(sets[i].intersection_with(sets[j]) == sets[j].intersection_with(sets[i]));
+        }
+    }
+
+    std::set<u64> all;
+    for (const auto& ids : truth)
+        all.insert(ids.begin(), ids.end());
+    require_superset(set_t::set_union(sets), all);
+
+    // Exact lists filter precisely.
+    REQUIRE(sets[0].intersection_with(sets[1]) == set_t({7, 20000}));
+    REQUIRE(set_t({1, 2}).intersection_with(set_t({3, 4})).empty());
+    REQUIRE(set_t::set_intersection(sets).empty());
+}
+
+TEST_CASE("adaptive id set of all ids", "[adaptive-id-set]") {
+    const set_t all = set_t::all();
+    const set_t some{1, 2, {10, 20}};
+    REQUIRE(all.contains(0));
+    REQUIRE(all.contains(12345678));
+    REQUIRE(!all.empty());
+    REQUIRE(all.union_with(some) == all);
+    REQUIRE(all.intersection_with(some) == some);
+    REQUIRE(some.intersection_with(all) == some);
+}
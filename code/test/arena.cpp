@@ -0,0 +1,99 @@
+#include <catch.hpp>
+
+#include "geodb/utility/arena.hpp"
+
+#include <cstdint>
+
+using namespace geodb;
+
+TEST_CASE("arena allocations are aligned", "[arena]") {
+    arena a(1024);
+    for (size_t align : {1, 2, 4, 8, 16, 64}) {
+        void* p = a.allocate(3, align);
+        REQUIRE(reinterpret_cast<uintptr_t>(p) % align == 0);
+    }
+}
+
+TEST_CASE("arena grows and reuses chunks", "[arena]") {
+    arena a(1024, 4096);
+
+    char* first = static_cast<char*>(a.allocate(100, 1));
+    char* second = static_cast<char*>(a.allocate(100, 1));
+    REQUIRE(second == first + 100);
+    REQUIRE(a.allocated() == 1024);
+
+    // Large allocations get a chunk of their own.
+    void* big = a.allocate(10000, 8);
+    REQUIRE(big != nullptr);
+    REQUIRE(a.allocated() >= 1024 + 10000);
+
+    // Fill several chunks, then rewind to the start.
+    for (int i = 0; i < 20; ++i) {
+        a.allocate(500, 1);
+    }
+    a.reset();
+    REQUIRE(a.allocated() <= 4096 + 10008);
+
+    // The first chunk is always retained and reused.
+    REQUIRE(a.allocate(100, 1) == first);
+}
+
+TEST_CASE("arena registers its chunks with tpie", "[arena]") {
+    const size_t used = tpie::get_memory_manager().used();
+    {
+        arena a(1024, 0, true);
+        a.allocate(100, 1);
+        a.allocate(2000, 1);
+        REQUIRE(a.allocated() > 1024 + 2000);
+        REQUIRE(tpie::get_memory_manager().used() == used + a.allocated());
+
+        // Only the first chunk is retained.
+        a.reset();
+        REQUIRE(a.allocated() == 1024);
+        REQUIRE(tpie::get_memory_manager().used() == used + 1024);
+    }
+    REQUIRE(tpie::get_memory_manager().used() == used);
+}
+
+TEST_CASE("arena scopes rewind the arena", "[arena]") {
+    arena a(1024);
+    void* outer = a.allocate(16);
+    void* next;
+    {
+        arena_scope s1(a);
+        next = a.allocate(16);
+        {
+            arena_scope s2(a);
+            for (int i = 0; i < 100; ++i) {
+                a.allocate(64);
+            }
+        }
+        REQUIRE(a.allocate(16) != next);
+    }
+    REQUIRE(a.allocate(16) == next);
+    REQUIRE(outer != next);
+}
+
+TEST_CASE("arena allocator in standard containers", "[arena]") {
+    arena a(256);
+    arena_scope scope(a);
+
+    arena_vector<int> vec{arena_allocator<int>(a)};
+    for (int i = 0; i < 1000; ++i) {
+        vec.push_back(i);
+    }
+    REQUIRE(vec.size() == 1000);
+    REQUIRE(vec[999] == 999);
+
+    arena_unordered_map<int, arena_vector<int>> map{0, std::hash<int>(), std::equal_to<int>(),
+                                                    arena_allocator<int>(a)};
+    for (int i = 0; i < 100; ++i) {
+        map[i % 10].push_back(i);
+    }
+    REQUIRE(map.size() == 10);
+    REQUIRE(map[3].size() == 10);
+    REQUIRE(map[3].back() == 93);
+
+    REQUIRE(arena_allocator<int>(a) == arena_allocator<double>(a));
+    REQUIRE(arena_allocator<int>() != arena_allocator<int>(a));
+}
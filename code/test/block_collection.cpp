@@ -0,0 +1,150 @@
+#include <catch.hpp>
+
+#include "geodb/irwi/block_collection.hpp"
+#include "geodb/utility/temp_dir.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace geodb;
+
+namespace {
+
+using collection_type = block_collection<4096>;
+using handle_type = collection_type::handle_type;
+
+void fill(collection_type& blocks, handle_type handle, u64 value) {
+    char* data = blocks.read_block(handle)->get();
+    std::memset(data, 0, 4096);
+    std::memcpy(data, &value, sizeof(value));
+    blocks.write_block(handle);
+}
+
+u64 value_of(collection_type& blocks, handle_type handle) {
+    u64 value;
+    std::memcpy(&value, blocks.read_block(handle)->get(), sizeof(value));
+    return value;
+}
+
+void run_blocks_test(const block_writer_options* options) {
+    temp_dir dir;
+    const fs::path path = dir.path() / "test.blocks";
+
+    std::vector<handle_type> handles;
+    {
+        // The cache holds only 4 blocks, most blocks are evicted.
+        collection_type blocks(path, 4);
+        if (options) {
+            blocks.write_behind(*options);
+            REQUIRE(blocks.is_write_behind());
+        }
+
+        for (u64 i = 0; i < 200; ++i) {
+            handle_type handle = blocks.get_free_block();
+            fill(blocks, handle, i);
+            handles.push_back(handle);
+        }
+
+        // Blocks are read back while they may still wait for their write.
+        for (u64 i = 0; i < 200; i += 7) {
+            REQUIRE(value_of(blocks, handles[i]) == i);
+            fill(blocks, handles[i], i * 1000);
+        }
+
+        blocks.free_block(handles.back());
+        handles.pop_back();
+
+        blocks.write_through();
+        REQUIRE(!blocks.is_write_behind());
+    }
+
+    collection_type blocks(path, 4);
+    for (u64 i = 0; i < handles.size(); ++i) {
+        const u64 expected = i % 7 == 0 ? i * 1000 : i;
+        REQUIRE(value_of(blocks, handles[i]) == expected);
+    }
+}
+
+} // namespace
+
+TEST_CASE("block collection with synchronous writes", "[block-collection]") {
+    run_blocks_test(nullptr);
+}
+
+TEST_CASE("block collection with write-behind", "[block-collection]") {
+    block_writer_options options;
+    options.queue_blocks = 8;
+    run_blocks_test(&options);
+}
+
+TEST_CASE("block collection with direct io", "[block-collection]") {
+    block_writer_options options;
+    options.queue_blocks = 8;
+    options.direct_io = true;
+    options.drop_cache = true;
+
+    // The writer silently falls back to buffered writes if the file system
+    // of the temporary directory (e.g. tmpfs) does not support O_DIRECT.
+    {
+        temp_dir dir;
+        const fs::path path = dir.path() / "probe.blocks";
+        std::ofstream(path.string()).close();
+
+        block_writer writer(path, 4096, options);
+        if (!writer.direct_io()) {
+            WARN("O_DIRECT is not supported in " << dir.path() << ", skipping the test.");
+            return;
+        }
+    }
+    run_blocks_test(&options);
+}
+
+TEST_CASE("block collection allocates contiguous extents", "[block-collection]") {
+    temp_dir dir;
+    collection_type blocks(dir.path() / "test.blocks", 4);
+
+    std::vector<handle_type> handles;
+    for (int i = 0; i < 8; ++i) {
+        handles.push_back(blocks.get_free_block());
+    }
+    blocks.free_block(handles[1]);
+    blocks.free_block(handles[3]);
+    blocks.free_block(handles[4]);
+
+    // Blocks 3 and 4 form a run, but it is too short.
+    {
+        block_extent<4096> extent(blocks);
+        extent.reserve(3);
+        REQUIRE(extent.remaining() == 3);
+
+        handle_type first = extent.get_free_block();
+        REQUIRE(first.index() == 8);
+        fill(blocks, first, 42);
+        REQUIRE(value_of(blocks, first) == 42);
+        REQUIRE(extent.get_free_block().index() == 9);
+        REQUIRE(extent.remaining() == 1);
+    }
+
+    // The unused block comes first, then the old free list in its original order.
+    REQUIRE(blocks.get_free_block().index() == 10);
+    REQUIRE(blocks.get_free_block() == handles[4]);
+    REQUIRE(blocks.get_free_block() == handles[3]);
+    REQUIRE(blocks.get_free_block() == handles[1]);
+    REQUIRE(blocks.get_free_block().index() == 11);
+
+    // A contiguous run in the free list is reused.
+    blocks.free_block(handle_type(11));
+    blocks.free_block(handle_type(10));
+    {
+        block_extent<4096> extent(blocks);
+        extent.reserve(4);
+        REQUIRE(extent.get_free_block().index() == 10);
+        REQUIRE(extent.get_free_block().index() == 11);
+        REQUIRE(extent.get_free_block().index() == 12);
+        REQUIRE(extent.get_free_block().index() == 13);
+
+        // Exhausted extents fall back to the free list.
+        REQUIRE(extent.get_free_block().index() == 14);
+    }
+}
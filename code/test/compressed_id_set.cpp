@@ -0,0 +1,157 @@
+#include <catch.hpp>
+
+#include "geodb/compressed_id_set.hpp"
+#include "geodb/interval_set.hpp"
+
+#include <random>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+using namespace geodb;
+
+using set_t = compressed_id_set<40>;
+using kind = set_t::representation;
+
+namespace {
+
+set_t make_set(const std::set<u64>& ids) {
+    set_t set;
+    for (u64 id : ids) {
+        set.add(id);
+    }
+    return set;
+}
+
+// Trajectory ids of a full leaf: up to 113 ids from a large id space.
+std::set<u64> leaf_ids(std::mt19937& engine) {
+    std::uniform_int_distribution<u64> id(0, 1000000);
+    std::set<u64> ids;
+    while (ids.size() < 113) {
+        ids.insert(id(engine));
+    }
+    return ids;
+}
+
+} // namespace
+
+TEST_CASE("compressed id set layout", "[compressed-id-set]") {
+    static_assert(std::is_trivially_copyable<set_t>::value, "must be trivially copyable");
+    static_assert(sizeof(set_t) == sizeof(inline_interval_set<u64, 40>), "same budget as 40 intervals");
+    REQUIRE(set_t::max_bytes() == 640);
+}
+
+TEST_CASE("compressed id set stores leaf sized sets exactly", "[compressed-id-set]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    for (int i = 0; i < 10; ++i) {
+        const std::set<u64> ids = leaf_ids(engine);
+        const set_t set = make_set(ids);
+        REQUIRE(set.kind() == kind::exact);
+        REQUIRE(set.size() == ids.size());
+
+        // No false positives at all.
+        for (u64 id = 0; id <= 1000001; ++id) {
+            if (set.contains(id) != (ids.count(id) > 0)) {
+                FAIL("wrong result for id " << id);
+            }
+        }
+
+        // Interval sets of the same size have plenty of false positives.
+        std::vector<interval<u64>> points(ids.begin(), ids.end());
+        const inline_interval_set<u64, 40> intervals(points.begin(), points.end());
+        REQUIRE(intervals.size() == 40);
+    }
+}
+
+TEST_CASE("compressed id set falls back to intervals", "[compressed-id-set]") {
+    set_t set;
+    REQUIRE(set.empty());
+
+    // Consecutive ids take one byte each.
+    for (u64 id = 0; id < set_t::max_bytes(); ++id) {
+        REQUIRE(set.add(id));
+    }
+    REQUIRE(set.kind() == kind::exact);
+    REQUIRE(!set.add(5));
+
+    REQUIRE(set.add(1000));
+    REQUIRE(set.kind() == kind::intervals);
+    REQUIRE(set == set_t({{0, set_t::max_bytes() - 1}, 1000}));
+    REQUIRE(set.contains(1000));
+    REQUIRE(!set.contains(999));
+
+    // Ids beyond 32 bits are stored as intervals.
+    const set_t large{u64(1) << 40};
+    REQUIRE(large.kind() == kind::intervals);
+    REQUIRE(large.contains(u64(1) << 40));
+
+    // Large sets behave like interval sets.
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_int_distribution<u64> id(0, 100000);
+    std::vector<inline_interval_set<u64, 40>> expected;
+    std::vector<set_t> sets;
+    for (int i = 0; i < 20; ++i) {
+        const u64 p = id(engine);
+        expected.push_back({p});
+        sets.push_back({p});
+    }
+    for (int i = 0; i < 1000; ++i) {
+        const u64 p = id(engine);
+        expected.push_back({p});
+        sets.push_back({p});
+    }
+    const auto a = inline_interval_set<u64, 40>::set_union(expected);
+    const set_t b = set_t::set_union(sets);
+    REQUIRE(b.kind() == kind::intervals);
+    REQUIRE(b == set_t(a.begin(), a.end()));
+}
+
+TEST_CASE("compressed id set operations", "[compressed-id-set]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+
+    std::vector<std::set<u64>> truth;
+    truth.push_back({5, 7, 20000});
+    truth.push_back({7, 20000, 50000});
+    truth.push_back(leaf_ids(engine));
+    truth.push_back(leaf_ids(engine));
+    truth.push_back({});
+
+    std::set<u64> dense;
+    for (u64 i = 0; i < 5000; i += 3)
+        dense.insert(i);
+    truth.push_back(dense);
+
+    std::vector<set_t> sets;
+    for (const auto& ids : truth)
+        sets.push_back(make_set(ids));
+    REQUIRE(sets[5].kind() == kind::intervals);
+
+    for (size_t i = 0; i < sets.size(); ++i) {
+        for (size_t j = 0; j < sets.size(); ++j) {
+            INFO("sets " << i << " and " << j);
+
+            std::set<u64> u = truth[i], n;
+            u.insert(truth[j].begin(), truth[j].end());
+            for (u64 id : truth[i])
+                if (truth[j].count(id))
+                    n.insert(id);
+
+            const set_t su = sets[i].union_with(sets[j]);
+            const set_t sn = sets[i].intersection_with(sets[j]);
+            for (u64 id : u)
+                REQUIRE(su.contains(id));
+            for (u64 id : n)
+                REQUIRE(sn.contains(id));
+
+            // Exact inputs produce exact results.
+            if (sets[i].kind() == kind::exact && sets[j].kind() == kind::exact) {
+                REQUIRE(sn == make_set(n));
+                if (su.kind() == kind::exact)
+                    REQUIRE(su == make_set(u));
+            }
+        }
+    }
+
+    REQUIRE(sets[0].intersection_with(sets[1]) == set_t({7, 20000}));
+    REQUIRE(set_t::set_intersection(sets).empty());
+}
@@ -0,0 +1,93 @@
+#include <catch.hpp>
+
+#include "geodb/external_list.hpp"
+#include "geodb/utility/temp_dir.hpp"
+
+#include <vector>
+
+using namespace geodb;
+
+namespace {
+
+// 8 values per block.
+using list_type = external_list<u64, 64>;
+
+std::vector<u64> read_all(const list_type& list, u64 first, u64 count) {
+    std::vector<u64> result(count);
+    list.read(first, gsl::make_span(result));
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("external list append and batched reads", "[external-list]") {
+    temp_dir dir;
+
+    std::vector<u64> expected;
+    {
+        list_type list(dir.path(), 1);
+        for (u64 i = 0; i < 100; ++i) {
+            list.append(i * 3);
+            expected.push_back(i * 3);
+            REQUIRE(list[i] == i * 3);
+        }
+        REQUIRE(list.size() == 100);
+        REQUIRE(list.blocks() == 13);
+
+        list.set(5, 1234);
+        expected[5] = 1234;
+        list.set(99, 4321);
+        expected[99] = 4321;
+
+        REQUIRE(read_all(list, 0, 100) == expected);
+        REQUIRE(read_all(list, 7, 10) == std::vector<u64>(expected.begin() + 7, expected.begin() + 17));
+        REQUIRE(read_all(list, 100, 0).empty());
+    }
+
+    // The tail block is written when the list is closed.
+    list_type list(dir.path(), 1);
+    REQUIRE(list.size() == 100);
+    REQUIRE(read_all(list, 0, 100) == expected);
+
+    list.append(7);
+    expected.push_back(7);
+    REQUIRE(read_all(list, 90, 11) == std::vector<u64>(expected.begin() + 90, expected.end()));
+}
+
+TEST_CASE("external list pinned ranges", "[external-list]") {
+    temp_dir dir;
+    list_type list(dir.path(), 1);
+    for (u64 i = 0; i < 30; ++i) {
+        list.append(i);
+    }
+
+    // Pin a range that includes the tail, then grow the list beyond it.
+    list.pin(4, 30);
+    list.pin(10, 12);
+    list.set(4, 100);
+    list.set(29, 200);
+    for (u64 i = 30; i < 50; ++i) {
+        list.append(i);
+    }
+    list.set(28, 300);
+
+    // Access other blocks to evict everything from the cache.
+    for (u64 i = 40; i < 50; ++i) {
+        REQUIRE(list[i] == i);
+    }
+
+    REQUIRE(list[4] == 100);
+    REQUIRE(list[28] == 300);
+    REQUIRE(list[29] == 200);
+
+    list.unpin(4, 30);
+    REQUIRE(list[11] == 11);
+    list.unpin(10, 12);
+
+    // Modifications of pinned blocks are written back.
+    std::vector<u64> values = read_all(list, 0, 50);
+    for (u64 i = 0; i < 50; ++i) {
+        const u64 expected = i == 4 ? 100 : i == 28 ? 300 : i == 29 ? 200 : i;
+        REQUIRE(values[i] == expected);
+    }
+}
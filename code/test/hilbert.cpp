@@ -134,3 +134,27 @@ TEST_CASE("hilbert index round trip", "[hilbert]") {
         }
     }
 }
+
+TEST_CASE("four dimensional hilbert curve", "[hilbert]") {
+    using curve4 = hilbert_curve<4, 3>;
+
+    curve4::point_t last = curve4::hilbert_index_inverse(0);
+    for (curve4::index_t index = 0; index < curve4::index_count; ++index) {
+        curve4::point_t point = curve4::hilbert_index_inverse(index);
+        curve4::index_t computed = curve4::hilbert_index(point);
+        if (index != computed) {
+            FAIL("Expected " << index << ", got " << computed);
+        }
+
+        // Consecutive points differ by exactly one step in exactly one dimension.
+        if (index > 0) {
+            u64 distance = 0;
+            for (u32 d = 0; d < curve4::dimension; ++d) {
+                u64 a = point[d].to_ullong(), b = last[d].to_ullong();
+                distance += a > b ? a - b : b - a;
+            }
+            REQUIRE(distance == 1);
+        }
+        last = point;
+    }
+}
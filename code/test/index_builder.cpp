@@ -87,3 +87,73 @@ TEST_CASE("bulk load inverted index") {
         ++j;
     }
 }
+
+TEST_CASE("bulk load inverted index into a reserved extent") {
+    using builder_type = inverted_index_external_builder<block_size, Lambda>;
+    using handle_type = block_handle<block_size>;
+
+    temp_dir dir;
+    tpie::temp_file block_file;
+
+    // Leave some scattered blocks in the free list.
+    block_collection<block_size> blocks(block_file.path());
+    std::vector<handle_type> handles;
+    for (int i = 0; i < 10; ++i) {
+        handles.push_back(blocks.get_free_block());
+    }
+    blocks.free_block(handles[2]);
+    blocks.free_block(handles[5]);
+    blocks.free_block(handles[7]);
+
+    const u32 list_count = 100;
+    const u32 list_size = 20;
+    const size_t required = builder_type::required_blocks(list_size) * (list_count + 1);
+    REQUIRE(builder_type::required_blocks(list_size) > 1);
+    {
+        builder_type builder(dir.path(), blocks);
+        builder.reserve(required + 5);
+
+        list_type& total = builder.total();
+        for (u32 j = 0; j < list_size; ++j) {
+            total.append(posting_type(j));
+        }
+
+        for (label_type i = 1; i <= list_count; ++i) {
+            list_type list = builder.push(i);
+            for (u32 j = 0; j < list_size; ++j) {
+                posting_type p(j);
+                p.count(i);
+                list.append(p);
+            }
+        }
+        builder.build();
+    }
+
+    // The lists occupy a contiguous range at the end of the file,
+    // followed by the unused blocks of the extent and the old free list.
+    for (size_t i = 0; i < 5; ++i) {
+        REQUIRE(blocks.get_free_block().index() == 10 + required + i);
+    }
+    REQUIRE(blocks.get_free_block() == handles[7]);
+    REQUIRE(blocks.get_free_block() == handles[5]);
+    REQUIRE(blocks.get_free_block() == handles[2]);
+
+    index_type index(index_storage(dir.path(), blocks));
+    REQUIRE(index.total()->size() == list_size);
+    label_type i = 1;
+    for (const auto& entry : index) {
+        REQUIRE(entry.label() == i);
+
+        list_ptr list = entry.postings_list();
+        REQUIRE(list->size() == list_size);
+
+        u32 j = 0;
+        for (auto&& p : *list) {
+            REQUIRE(p.node() == j);
+            REQUIRE(p.count() == i);
+            ++j;
+        }
+        ++i;
+    }
+    REQUIRE(i == list_count + 1);
+}
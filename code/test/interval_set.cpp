@@ -2,7 +2,10 @@
 
 #include "geodb/interval_set.hpp"
 
+#include <cstring>
+#include <random>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 
 using namespace geodb;
@@ -360,3 +363,65 @@ TEST_CASE("set display", "[interval-set]") {
     REQUIRE(str(small_set({{1, 5}, 7})) == "{[1-5][7]}");
     REQUIRE(str(small_set({1, {3, 5}, {6, 9}})) == "{[1][3-9]}");
 }
+
+TEST_CASE("inline interval set behaves like static interval set", "[interval-set]") {
+    using inline_set = inline_interval_set<int, 5>;
+    using static_set = static_interval_set<int, 5>;
+
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_int_distribution<int> point(0, 200);
+
+    std::vector<inline_set> inline_sets;
+    std::vector<static_set> static_sets;
+    for (int i = 0; i < 20; ++i) {
+        inline_set a;
+        static_set b;
+        for (int j = 0; j < 30; ++j) {
+            const int p = point(engine);
+            REQUIRE(a.add(p) == b.add(p));
+            REQUIRE(boost::equal(a, b));
+            REQUIRE(a.contains(p));
+        }
+        for (int p = 0; p <= 200; ++p) {
+            REQUIRE(a.contains(p) == b.contains(p));
+        }
+        inline_sets.push_back(a);
+        static_sets.push_back(b);
+    }
+
+    for (size_t i = 0; i + 1 < inline_sets.size(); ++i) {
+        const inline_set& a = inline_sets[i];
+        const inline_set& b = inline_sets[i + 1];
+        REQUIRE(boost::equal(a.union_with(b), static_sets[i].union_with(static_sets[i + 1])));
+        REQUIRE(boost::equal(a.intersection_with(b), static_sets[i].intersection_with(static_sets[i + 1])));
+    }
+    REQUIRE(boost::equal(inline_set::set_union(inline_sets), static_set::set_union(static_sets)));
+    REQUIRE(boost::equal(inline_set::set_intersection(inline_sets), static_set::set_intersection(static_sets)));
+}
+
+TEST_CASE("inline interval set storage", "[interval-set]") {
+    using inline_set = inline_interval_set<int, 3>;
+
+    static_assert(std::is_trivially_copyable<inline_set>::value, "must be trivially copyable");
+    static_assert(sizeof(inline_set) == sizeof(size_t) + 3 * sizeof(interval<int>), "unexpected layout");
+
+    inline_set a{1, 5, {7, 9}};
+    inline_set b{1, 5, 7, 8, 9};    // merged to fit the capacity.
+    REQUIRE(a == b);
+    REQUIRE(a.size() == 3);
+    REQUIRE(a[2] == interval<int>(7, 9));
+
+    // Equal sets have equal binary representations.
+    b.clear();
+    b.assign(a.begin(), a.end());
+    REQUIRE(std::memcmp(&a, &b, sizeof(inline_set)) == 0);
+
+    a.trim(1);
+    REQUIRE(a.size() == 1);
+    REQUIRE(a[0] == interval<int>(1, 9));
+    REQUIRE(a != b);
+
+    std::stringstream ss;
+    ss << b;
+    REQUIRE(ss.str() == "{[1][5][7-9]}");
+}
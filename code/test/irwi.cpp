@@ -1,10 +1,17 @@
 #include "catch.hpp"
 
+#include "irwi_fixture.hpp"
+
+#include "geodb/irwi/bulk_load_hilbert.hpp"
+#include "geodb/irwi/bulk_load_quickload.hpp"
+#include "geodb/irwi/bulk_load_str.hpp"
 #include "geodb/irwi/tree.hpp"
 #include "geodb/irwi/tree_external.hpp"
 #include "geodb/irwi/tree_internal.hpp"
 #include "geodb/utility/temp_dir.hpp"
 
+#include <tpie/memory.h>
+
 #include <map>
 #include <random>
 #include <set>
@@ -196,13 +203,6 @@ void insert(Tree& tree, const point_trajectory& t) {
     }
 }
 
-using internal = tree_internal<8>;
-using external = tree_external<512>;
-constexpr u32 Lambda = 8;
-
-using internal_tree = tree<internal, Lambda>;
-using external_tree = tree<external, Lambda>;
-
 template<typename Func>
 void tree_test(Func&& f) {
 
@@ -442,3 +442,416 @@ TEST_CASE("opening resource more than once returns same handle", "[irwi]") {
         REQUIRE(&*i1 == &*i2);
     });
 }
+
+TEST_CASE("irwi tree nearest neighbor query", "[irwi]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < 50; ++id) {
+        for (u32 unit_index = 0; unit_index < 20; ++unit_index) {
+            const time_type t = time(engine);
+            trajectory_unit unit(vector3(coord(engine), coord(engine), t),
+                                 vector3(coord(engine), coord(engine), t + 10),
+                                 unit_index % 4);
+            entries.push_back(tree_entry(id, unit_index, unit));
+        }
+    }
+
+    // Computes the expected distances by looking at every unit.
+    auto brute_force = [&](const nearest_query& q) {
+        std::map<trajectory_id_type, double> distances;
+        for (const tree_entry& e : entries) {
+            const bounding_box b = e.unit.get_bounding_box();
+            if (!q.time.overlaps({b.min().t(), b.max().t()}))
+                continue;
+            if (!q.labels.empty() && q.labels.count(e.unit.label) == 0)
+                continue;
+
+            const double d = e.unit.spatial_distance(q.point, q.time);
+            auto pos = distances.find(e.trajectory_id);
+            if (pos == distances.end())
+                distances.emplace(e.trajectory_id, d);
+            else
+                pos->second = std::min(pos->second, d);
+        }
+
+        std::vector<double> result;
+        for (const auto& pair : distances)
+            result.push_back(pair.second);
+        std::sort(result.begin(), result.end());
+        if (result.size() > q.k)
+            result.resize(q.k);
+        return result;
+    };
+
+    tree_test([&](auto&& tree) {
+        for (const tree_entry& e : entries)
+            tree.insert(e);
+
+        std::vector<nearest_query> queries;
+        queries.push_back(nearest_query{vector2d(500, 500), interval<time_type>(0, 1010), {}, 5});
+        queries.push_back(nearest_query{vector2d(100, 900), interval<time_type>(300), {}, 3});
+        queries.push_back(nearest_query{vector2d(0, 0), interval<time_type>(200, 600), {1, 2}, 10});
+        queries.push_back(nearest_query{vector2d(750, 250), interval<time_type>(0, 1010), {3}, 100});
+        queries.push_back(nearest_query{vector2d(750, 250), interval<time_type>(0, 1010), {7}, 4});
+
+        for (const nearest_query& q : queries) {
+            const std::vector<double> expected = brute_force(q);
+            const std::vector<nearest_match> result = tree.find_nearest(q);
+
+            REQUIRE(result.size() == expected.size());
+
+            std::set<trajectory_id_type> ids;
+            for (size_t i = 0; i < result.size(); ++i) {
+                REQUIRE(result[i].distance == Approx(expected[i]));
+                REQUIRE(ids.insert(result[i].id).second);
+
+                const tree_entry& e = entries.at(result[i].id * 20 + result[i].unit.index);
+                REQUIRE(e.unit == result[i].unit.unit);
+                REQUIRE((q.labels.empty() || q.labels.count(e.unit.label) > 0));
+            }
+        }
+    });
+}
+
+TEST_CASE("irwi tree aggregate query", "[irwi]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_real_distribution<float> offset(-5, 5);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < 50; ++id) {
+        for (u32 unit_index = 0; unit_index < 40; ++unit_index) {
+            const vector3 start(coord(engine), coord(engine), time(engine));
+            const vector3 end(start.x() + offset(engine), start.y() + offset(engine), start.t() + 3);
+            entries.push_back(tree_entry(id, unit_index, trajectory_unit(start, end, unit_index % 5)));
+        }
+    }
+
+    auto brute_force = [&](const bounding_box& rect, const std::unordered_set<label_type>& labels,
+                           const aggregate_grid& grid) {
+        aggregate_result result(rect, grid);
+        for (const tree_entry& e : entries) {
+            size_t cell;
+            if ((labels.empty() || labels.count(e.unit.label))
+                    && result.find_cell(e.unit.get_bounding_box().center(), cell))
+                result.add(cell, 1);
+        }
+        return result;
+    };
+
+    tree_test([&](auto&& tree) {
+        for (const tree_entry& e : entries)
+            tree.insert(e);
+
+        {
+            const bounding_box rect(vector3(-10, -10, 0), vector3(1010, 1010, 1010));
+            aggregate_result result = tree.aggregate(rect, {}, aggregate_grid{1, 1, 1});
+            REQUIRE(result.total() == entries.size());
+            REQUIRE(result.count(0, 0, 0) == entries.size());
+        }
+
+        {
+            const bounding_box rect(vector3(100, 200, 100), vector3(800, 700, 900));
+            const std::unordered_set<label_type> labels{1, 3};
+            const aggregate_grid grid{4, 3, 2};
+
+            aggregate_result expected = brute_force(rect, labels, grid);
+            aggregate_result result = tree.aggregate(rect, labels, grid);
+            REQUIRE(expected.total() > 0);
+            REQUIRE(result.counts() == expected.counts());
+        }
+
+        {
+            const bounding_box rect(vector3(0, 0, 0), vector3(1000, 1000, 1010));
+            const aggregate_grid grid{2, 2, 1};
+
+            aggregate_result expected = brute_force(rect, {}, grid);
+            aggregate_result result = tree.aggregate(rect, {}, grid);
+            REQUIRE(result.counts() == expected.counts());
+            REQUIRE(result.count(1, 1, 0) == expected.count(1, 1, 0));
+        }
+    });
+}
+
+TEST_CASE("irwi tree candidate query", "[irwi]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < 60; ++id) {
+        for (u32 unit_index = 0; unit_index < 20; ++unit_index) {
+            const time_type t = time(engine);
+            trajectory_unit unit(vector3(coord(engine), coord(engine), t),
+                                 vector3(coord(engine), coord(engine), t + 5),
+                                 (id + unit_index) % 6);
+            entries.push_back(tree_entry(id, unit_index, unit));
+        }
+    }
+
+    std::vector<sequenced_query> queries;
+    {
+        sequenced_query q;
+        q.queries.push_back(simple_query{bounding_box(vector3(0, 0, 0), vector3(500, 500, 1005)), {1}});
+        queries.push_back(q);
+    }
+    {
+        sequenced_query q;
+        q.queries.push_back(simple_query{bounding_box(vector3(0, 0, 0), vector3(600, 600, 500)), {0, 2}});
+        q.queries.push_back(simple_query{bounding_box(vector3(300, 300, 400), vector3(1000, 1000, 1005)), {}});
+        queries.push_back(q);
+    }
+    {
+        sequenced_query q;
+        q.queries.push_back(simple_query{bounding_box(vector3(0, 0, 0), vector3(1000, 1000, 1005)), {42}});
+        queries.push_back(q);
+    }
+
+    tree_test([&](auto&& tree) {
+        for (const tree_entry& e : entries)
+            tree.insert(e);
+        REQUIRE(tree.height() > 2);
+
+        for (const sequenced_query& q : queries) {
+            const std::vector<trajectory_match> matches = tree.find(q);
+
+            for (size_t level = 0; level <= tree.height() + 1; ++level) {
+                auto result = tree.find_candidates(q, level);
+                REQUIRE(result.level >= 2);
+                REQUIRE(result.level <= tree.height());
+                REQUIRE(result.max_matches >= matches.size());
+
+                for (const trajectory_match& m : matches) {
+                    REQUIRE(result.ids.contains(m.id));
+                }
+            }
+        }
+    });
+}
+
+TEST_CASE("irwi tree query with time gaps", "[irwi]") {
+    const bounding_box zone_a(vector3(0, 0, 0), vector3(10, 10, 10000));
+    const bounding_box zone_b(vector3(100, 100, 0), vector3(110, 110, 10000));
+
+    // Trajectory i visits zone a at time 100 * i and zone b at time 100 * i + 10 * i.
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < 30; ++id) {
+        const time_type ta = 100 * id;
+        const time_type tb = ta + 10 * id;
+        entries.push_back(tree_entry(id, 0, trajectory_unit(vector3(5, 5, ta), vector3(6, 6, ta), 1)));
+        entries.push_back(tree_entry(id, 1, trajectory_unit(vector3(50, 50, ta + 1), vector3(51, 51, ta + 1), 2)));
+        entries.push_back(tree_entry(id, 2, trajectory_unit(vector3(105, 105, tb + 2), vector3(106, 106, tb + 2), 3)));
+    }
+
+    tree_test([&](auto&& tree) {
+        for (const tree_entry& e : entries)
+            tree.insert(e);
+
+        sequenced_query q;
+        q.queries.push_back(simple_query{zone_a, {}});
+        q.queries.push_back(simple_query{zone_b, {}});
+
+        REQUIRE(tree.find(q).size() == 30);
+
+        // B must follow A within 52 to 152 time units.
+        q.gaps.push_back(time_gap(52, 152));
+        std::vector<trajectory_match> result = tree.find(q);
+        REQUIRE(result.size() == 11);
+        for (size_t i = 0; i < result.size(); ++i) {
+            REQUIRE(result[i].id == 5 + i);
+            REQUIRE(result[i].units.size() == 2);
+            REQUIRE(result[i].units[0].index == 0);
+            REQUIRE(result[i].units[1].index == 2);
+        }
+
+        // Candidates are a superset.
+        auto candidates = tree.find_candidates(q, tree.height());
+        for (const trajectory_match& m : result)
+            REQUIRE(candidates.ids.contains(m.id));
+
+        // Impossible constraint.
+        q.gaps[0] = time_gap(5000, 6000);
+        REQUIRE(tree.find(q).empty());
+
+        // Invalid number of gaps.
+        q.gaps.push_back(time_gap());
+        REQUIRE_THROWS(tree.find(q));
+    });
+}
+
+// Random trajectories (deterministic) for comparing trees built with different options.
+static std::vector<trajectory> random_trajectories(trajectory_id_type count, u32 units) {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+
+    std::vector<trajectory> trajectories;
+    for (trajectory_id_type id = 0; id < count; ++id) {
+        trajectory t;
+        t.id = id;
+        for (u32 unit_index = 0; unit_index < units; ++unit_index) {
+            const time_type start = time(engine);
+            t.units.push_back(trajectory_unit(vector3(coord(engine), coord(engine), start),
+                                              vector3(coord(engine), coord(engine), start + 5),
+                                              (id + unit_index) % 7));
+        }
+        trajectories.push_back(std::move(t));
+    }
+    return trajectories;
+}
+
+// Builds a tree with the default options and makes sure that `tree` (which must already
+// contain the same trajectories) is valid and returns the same query results.
+template<typename Tree>
+static void compare_with_reference(const Tree& tree, const std::vector<trajectory>& trajectories) {
+    std::vector<sequenced_query> queries;
+    {
+        sequenced_query q;
+        q.queries.push_back(simple_query{bounding_box(vector3(0, 0, 0), vector3(400, 400, 1005)), {1}});
+        queries.push_back(q);
+    }
+    {
+        sequenced_query q;
+        q.queries.push_back(simple_query{bounding_box(vector3(0, 0, 0), vector3(700, 700, 500)), {0, 3}});
+        q.queries.push_back(simple_query{bounding_box(vector3(200, 200, 300), vector3(1000, 1000, 1005)), {}});
+        queries.push_back(q);
+    }
+
+    internal_tree reference;
+    for (const trajectory& t : trajectories)
+        insert(reference, t);
+
+    std::set<std::pair<trajectory_id_type, u32>> seen;
+    visit(tree.root(), trajectories, seen);
+    REQUIRE(contains_all(trajectories, seen));
+    REQUIRE(tree.size() == seen.size());
+
+    size_t internal_nodes = 0;
+    size_t leaf_nodes = 0;
+    auto cursor = tree.root();
+    count_nodes(cursor, internal_nodes, leaf_nodes);
+    REQUIRE(internal_nodes == tree.internal_node_count());
+    REQUIRE(leaf_nodes == tree.leaf_node_count());
+
+    for (const sequenced_query& q : queries) {
+        REQUIRE(to_map(tree.find(q)) == to_map(reference.find(q)));
+    }
+}
+
+TEST_CASE("irwi tree with rstar split", "[irwi]") {
+    const std::vector<trajectory> trajectories = random_trajectories(50, 24);
+
+    tree_test([&](auto&& tree) {
+        REQUIRE(tree.split() == split_strategy::quadratic);
+        tree.split(split_strategy::rstar);
+        REQUIRE(tree.split() == split_strategy::rstar);
+
+        for (const trajectory& t : trajectories)
+            insert(tree, t);
+        REQUIRE(tree.height() > 2);
+
+        compare_with_reference(tree, trajectories);
+    });
+}
+
+TEST_CASE("irwi tree with forced reinsertion", "[irwi]") {
+    const std::vector<trajectory> trajectories = random_trajectories(50, 24);
+
+    tree_test([&](auto&& tree) {
+        REQUIRE(tree.reinsert_fraction() == 0);
+        REQUIRE_THROWS(tree.reinsert_fraction(1.0));
+        REQUIRE_THROWS(tree.reinsert_fraction(-0.1));
+
+        tree.reinsert_fraction(0.3);
+        for (const trajectory& t : trajectories)
+            insert(tree, t);
+        REQUIRE(tree.height() > 2);
+
+        compare_with_reference(tree, trajectories);
+    });
+}
+
+TEST_CASE("irwi bulk loading with parallel node building", "[irwi]") {
+    const std::vector<trajectory> trajectories = random_trajectories(50, 24);
+
+    tpie::file_stream<tree_entry> entries;
+    entries.open();
+    for (const trajectory& t : trajectories) {
+        u32 index = 0;
+        for (const trajectory_unit& unit : t.units) {
+            entries.write(tree_entry(t.id, index++, unit));
+        }
+    }
+
+    // The loaders plan their memory usage according to tpie's memory limit.
+    struct memory_limit_guard {
+        size_t old_limit = tpie::get_memory_manager().limit();
+
+        memory_limit_guard() { tpie::get_memory_manager().set_limit(64 * 1024 * 1024); }
+        ~memory_limit_guard() { tpie::get_memory_manager().set_limit(old_limit); }
+    } memory_limit;
+
+    // The bulk loaders require external storage.
+    auto check = [&](auto&& make_loader) {
+        temp_dir dir;
+        external_tree tree(external(dir.path()));
+
+        auto loader = make_loader(tree);
+        REQUIRE(loader.threads() == 1);
+        REQUIRE_THROWS(loader.threads(0));
+        loader.threads(4);
+
+        loader.load(entries);
+        REQUIRE(tree.height() > 2);
+        compare_with_reference(tree, trajectories);
+    };
+
+    {
+        INFO("hilbert");
+        check([](external_tree& tree) { return hilbert_loader<external_tree>(tree); });
+    }
+    {
+        INFO("str");
+        check([](external_tree& tree) { return str_loader<external_tree>(tree); });
+    }
+    {
+        INFO("quickload");
+        check([](external_tree& tree) { return quick_loader<external_tree>(tree, 4); });
+    }
+}
+
+TEST_CASE("irwi tree records cost parameters", "[irwi]") {
+    temp_dir dir;
+    {
+        external_tree t(external(dir.path()), 0.25);
+        REQUIRE(t.weight() == 0.25);
+        REQUIRE(t.strategy() == default_beta_strategy());
+
+        t.strategy(beta_strategy::decreasing);
+        REQUIRE_THROWS(t.weight(1.5));
+    }
+    {
+        // An explicit weight takes precedence and is recorded.
+        external_tree t(external(dir.path()), 0.75);
+        REQUIRE(t.weight() == 0.75);
+        REQUIRE(t.strategy() == beta_strategy::decreasing);
+    }
+    {
+        // Otherwise, the recorded values are used.
+        external_tree t(external(dir.path()));
+        REQUIRE(t.weight() == 0.75);
+        REQUIRE(t.strategy() == beta_strategy::decreasing);
+
+        t.weight(0.5);
+        t.strategy(beta_strategy::increasing);
+    }
+    {
+        external_tree t(external(dir.path()));
+        REQUIRE(t.weight() == 0.5);
+        REQUIRE(t.strategy() == beta_strategy::increasing);
+    }
+}
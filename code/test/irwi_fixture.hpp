@@ -0,0 +1,37 @@
+#ifndef TEST_IRWI_FIXTURE_HPP
+#define TEST_IRWI_FIXTURE_HPP
+
+#include "geodb/irwi/tree.hpp"
+#include "geodb/irwi/tree_external.hpp"
+#include "geodb/irwi/tree_internal.hpp"
+
+#include <map>
+#include <set>
+#include <vector>
+
+/// \file
+/// Tree types and helpers shared by the tests of irwi trees and forests.
+
+using internal = geodb::tree_internal<8>;
+using external = geodb::tree_external<512>;
+constexpr geodb::u32 Lambda = 8;
+
+using internal_tree = geodb::tree<internal, Lambda>;
+using external_tree = geodb::tree<external, Lambda>;
+
+/// Maps the id of every matching trajectory to the indices of its matching units.
+using result_type = std::map<geodb::trajectory_id_type, std::set<geodb::u32>>;
+
+/// Converts query results into a form that does not depend on the order
+/// of trajectories and units.
+inline result_type to_map(const std::vector<geodb::trajectory_match>& matches) {
+    result_type result;
+    for (const geodb::trajectory_match& m : matches) {
+        for (const geodb::unit_match& u : m.units) {
+            result[m.id].insert(u.index);
+        }
+    }
+    return result;
+}
+
+#endif // TEST_IRWI_FIXTURE_HPP
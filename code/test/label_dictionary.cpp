@@ -0,0 +1,96 @@
+#include <catch.hpp>
+
+#include "geodb/irwi/label_dictionary.hpp"
+#include "geodb/irwi/string_map.hpp"
+#include "geodb/irwi/string_map_internal.hpp"
+
+#include <boost/optional/optional_io.hpp>
+#include <fmt/format.h>
+#include <tpie/tempname.h>
+
+#include <algorithm>
+
+using namespace geodb;
+
+static std::vector<label_type> sorted(std::vector<label_type> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+TEST_CASE("label dictionary lookup", "[label-dictionary]") {
+    string_map<string_map_internal> strings;
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back(fmt::format("label-{}", i));
+        strings.insert(names.back());
+    }
+    const label_type bus = strings.insert("bus");
+    const label_type bike = strings.insert("bike");
+    const label_type bicycle = strings.insert("bicycle");
+    const label_type walk = strings.insert("walk");
+
+    tpie::temp_file tmp;
+    label_dictionary::build(tmp.path(), strings);
+
+    label_dictionary dict(tmp.path());
+    REQUIRE(dict.size() == strings.size());
+
+    SECTION("name to id") {
+        for (const std::string& name : names) {
+            auto id = dict.find(name);
+            REQUIRE(id);
+            REQUIRE(*id == strings.label_id(name));
+        }
+        REQUIRE(dict.find("bus") == bus);
+        REQUIRE(dict.find("walk") == walk);
+
+        REQUIRE(!dict.find(""));
+        REQUIRE(!dict.find("bu"));
+        REQUIRE(!dict.find("label-1000"));
+        REQUIRE(!dict.find("car"));
+    }
+
+    SECTION("id to name") {
+        for (const auto& mapping : strings) {
+            auto name = dict.name(mapping.id);
+            REQUIRE(name);
+            REQUIRE(*name == mapping.name);
+        }
+        REQUIRE(!dict.name(0));
+        REQUIRE(!dict.name(strings.size() + 1));
+    }
+
+    SECTION("prefix") {
+        REQUIRE(dict.find_prefix("bi") == std::vector<label_type>({bicycle, bike}));
+        REQUIRE(dict.find_prefix("bus") == std::vector<label_type>({bus}));
+        REQUIRE(dict.find_prefix("c").empty());
+        REQUIRE(dict.find_prefix("z").empty());
+        REQUIRE(dict.find_prefix("label-99").size() == 11);
+        REQUIRE(dict.find_prefix("label-").size() == names.size());
+        REQUIRE(dict.find_prefix("").size() == strings.size());
+    }
+
+    SECTION("range") {
+        REQUIRE(sorted(dict.find_range("b", "c")) == sorted({bicycle, bike, bus}));
+        REQUIRE(dict.find_range("bike", "bus") == std::vector<label_type>({bike}));
+        REQUIRE(dict.find_range("m", "walk").empty());
+        REQUIRE(dict.find_range("m", "x") == std::vector<label_type>({walk}));
+    }
+}
+
+TEST_CASE("empty label dictionary", "[label-dictionary]") {
+    tpie::temp_file tmp;
+    label_dictionary::build(tmp.path(), std::vector<label_mapping>());
+
+    label_dictionary dict(tmp.path());
+    REQUIRE(dict.empty());
+    REQUIRE(!dict.find("a"));
+    REQUIRE(!dict.name(1));
+    REQUIRE(dict.find_prefix("").empty());
+}
+
+TEST_CASE("label dictionary rejects duplicates", "[label-dictionary]") {
+    tpie::temp_file tmp;
+    REQUIRE_THROWS(label_dictionary::build(tmp.path(), {{1, "a"}, {2, "a"}}));
+    REQUIRE_THROWS(label_dictionary::build(tmp.path(), {{1, "a"}, {1, "b"}}));
+}
@@ -0,0 +1,127 @@
+#include <catch.hpp>
+
+#include "irwi_fixture.hpp"
+
+#include "geodb/irwi/label_forest.hpp"
+#include "geodb/utility/temp_dir.hpp"
+
+#include <map>
+#include <random>
+
+using namespace geodb;
+
+namespace {
+
+// Deterministic entries with a skewed label distribution:
+// label 0 makes up half of all units, label 1 a quarter.
+std::vector<tree_entry> skewed_entries(trajectory_id_type count, u32 units) {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+    std::uniform_int_distribution<u32> rare(2, 9);
+    std::uniform_int_distribution<u32> percent(0, 99);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < count; ++id) {
+        for (u32 index = 0; index < units; ++index) {
+            const u32 p = percent(engine);
+            const label_type label = p < 50 ? 0 : p < 75 ? 1 : rare(engine);
+            const time_type start = time(engine);
+            entries.push_back(tree_entry(id, index, trajectory_unit(
+                vector3(coord(engine), coord(engine), start),
+                vector3(coord(engine), coord(engine), start + 5),
+                label)));
+        }
+    }
+    return entries;
+}
+
+template<typename Func>
+void forest_test(const std::vector<label_type>& labels, Func&& f) {
+    {
+        INFO("internal");
+        label_forest<internal, Lambda> forest([](const std::string&) { return internal(); }, labels);
+        f(forest);
+    }
+    {
+        INFO("external");
+        temp_dir dir;
+        label_forest<external, Lambda> forest([&](const std::string& name) {
+            return external(dir.path() / name);
+        }, labels);
+        f(forest);
+    }
+}
+
+} // namespace
+
+TEST_CASE("dominant label selection", "[label-forest]") {
+    std::map<label_type, u64> counts{{1, 50}, {2, 30}, {3, 15}, {4, 5}, {5, 0}};
+    REQUIRE(dominant_labels(counts, 0.25) == std::vector<label_type>({1, 2}));
+    REQUIRE(dominant_labels(counts, 0.05) == std::vector<label_type>({1, 2, 3, 4}));
+    REQUIRE(dominant_labels(counts, 1.0).empty());
+    REQUIRE_THROWS(dominant_labels(counts, 0));
+    REQUIRE_THROWS(dominant_labels(counts, 1.5));
+}
+
+TEST_CASE("label forest routes units by label", "[label-forest]") {
+    const std::vector<tree_entry> entries = skewed_entries(10, 20);
+
+    forest_test({0, 1}, [&](auto&& forest) {
+        REQUIRE(forest.labels() == std::vector<label_type>({0, 1}));
+        REQUIRE(forest.is_dominant(0));
+        REQUIRE(!forest.is_dominant(2));
+
+        for (const tree_entry& e : entries)
+            forest.insert(e);
+        REQUIRE(forest.size() == entries.size());
+
+        std::map<label_type, size_t> counts;
+        for (const tree_entry& e : entries)
+            ++counts[e.unit.label];
+        REQUIRE(forest.partition(0).size() == counts[0]);
+        REQUIRE(forest.partition(1).size() == counts[1]);
+        REQUIRE(forest.tail().size() == entries.size() - counts[0] - counts[1]);
+    });
+}
+
+TEST_CASE("label forest query results equal a single tree", "[label-forest]") {
+    const std::vector<tree_entry> entries = skewed_entries(60, 20);
+
+    internal_tree reference;
+    for (const tree_entry& e : entries)
+        reference.insert(e);
+
+    const bounding_box all(vector3(0, 0, 0), vector3(1000, 1000, 1005));
+    const bounding_box low(vector3(0, 0, 0), vector3(600, 600, 600));
+    const bounding_box high(vector3(300, 300, 300), vector3(1000, 1000, 1005));
+
+    std::vector<sequenced_query> queries;
+    auto add = [&](std::vector<simple_query> simple, std::vector<time_gap> gaps = {}) {
+        sequenced_query q;
+        q.queries = std::move(simple);
+        q.gaps = std::move(gaps);
+        queries.push_back(std::move(q));
+    };
+    add({simple_query{low, {0}}});
+    add({simple_query{low, {3}}});
+    add({simple_query{all, {0, 3, 4}}});
+    add({simple_query{low, {}}});
+    add({simple_query{low, {1}}, simple_query{high, {5}}});
+    add({simple_query{low, {2, 0}}, simple_query{high, {}}});
+    add({simple_query{all, {7}}, simple_query{all, {1}}}, {time_gap(0, 200)});
+    add({simple_query{low, {42}}});
+
+    forest_test({0, 1}, [&](auto&& forest) {
+        for (const tree_entry& e : entries)
+            forest.insert(e);
+
+        size_t non_empty = 0;
+        for (const sequenced_query& q : queries) {
+            const result_type expected = to_map(reference.find(q));
+            REQUIRE(to_map(forest.find(q)) == expected);
+            non_empty += !expected.empty();
+        }
+        REQUIRE(non_empty >= queries.size() - 1);
+    });
+}
@@ -0,0 +1,166 @@
+#include <catch.hpp>
+
+#include "geodb/hybrid_buffer.hpp"
+#include "geodb/hybrid_map.hpp"
+#include "geodb/utility/memory_budget.hpp"
+
+#include <boost/range/algorithm/equal.hpp>
+
+using namespace geodb;
+
+TEST_CASE("memory budget grants and releases memory", "[memory-budget]") {
+    memory_budget budget(1000);
+
+    {
+        memory_budget::consumer a(budget, "a");
+        REQUIRE(a.grow(600));
+        REQUIRE(a.bytes() == 600);
+        REQUIRE(budget.used() == 600);
+        REQUIRE(budget.available() == 400);
+
+        // Nobody is larger than `a`, it has to spill itself.
+        REQUIRE(!a.grow(500));
+        REQUIRE(a.bytes() == 600);
+        REQUIRE(!a.spill_requested());
+
+        a.spilled();
+        REQUIRE(a.bytes() == 0);
+        REQUIRE(budget.used() == 0);
+        REQUIRE(budget.spills() == 1);
+        REQUIRE(budget.spilled_bytes() == 600);
+
+        REQUIRE(a.grow(300));
+    }
+    REQUIRE(budget.used() == 0);
+    REQUIRE(budget.spills() == 1);
+}
+
+TEST_CASE("memory budget asks the largest consumers to spill", "[memory-budget]") {
+    memory_budget budget(1000);
+
+    std::vector<memory_budget::spill_event> events;
+    budget.listener([&](const memory_budget::spill_event& e) {
+        events.push_back(e);
+    });
+
+    memory_budget::consumer large(budget, "large");
+    memory_budget::consumer medium(budget, "medium");
+    memory_budget::consumer small(budget, "small");
+
+    REQUIRE(large.grow(500));
+    REQUIRE(medium.grow(300));
+    REQUIRE(small.grow(100));
+
+    // Only the largest consumer is flagged, it can cover the request alone.
+    REQUIRE(small.grow(400));
+    REQUIRE(budget.used() == 1300);
+    REQUIRE(large.spill_requested());
+    REQUIRE(!medium.spill_requested());
+    REQUIRE(!small.spill_requested());
+
+    // The memory of `large` has already been granted to `small`.
+    // No further credit is given until it has been released.
+    REQUIRE(!small.grow(100));
+    REQUIRE(!medium.grow(50));
+    REQUIRE(!medium.spill_requested());
+    REQUIRE(budget.used() == 1300);
+
+    large.spilled();
+    REQUIRE(budget.used() == 800);
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].name == "large");
+    REQUIRE(events[0].bytes == 500);
+    REQUIRE(events[0].requested);
+
+    // `small` is the largest consumer now.
+    REQUIRE(small.grow(200));
+    REQUIRE(!small.grow(100));
+}
+
+TEST_CASE("memory budget covers the overcommitted memory", "[memory-budget]") {
+    memory_budget budget(1000);
+
+    memory_budget::consumer large(budget, "large");
+    memory_budget::consumer medium(budget, "medium");
+    memory_budget::consumer small(budget, "small");
+
+    REQUIRE(large.grow(400));
+    REQUIRE(medium.grow(350));
+    REQUIRE(small.grow(200));
+
+    // The limit would be exceeded by 450 bytes, `large` alone cannot cover that.
+    REQUIRE(small.grow(500));
+    REQUIRE(large.spill_requested());
+    REQUIRE(medium.spill_requested());
+    REQUIRE(budget.used() == 1450);
+
+    // Releasing only part of the credit is not enough for another one.
+    large.spilled();
+    REQUIRE(budget.used() == 1050);
+    REQUIRE(!small.grow(1));
+
+    medium.spilled();
+    REQUIRE(budget.used() == 700);
+    REQUIRE(small.grow(300));
+    REQUIRE(budget.available() == 0);
+}
+
+TEST_CASE("hybrid map with memory budget", "[memory-budget][hybrid-map]") {
+    using map_t = hybrid_map<int, int, 512>;
+
+    const size_t step = map_t::limit_for_blocks(1);
+    memory_budget budget(4 * step * map_t::item_bytes());
+
+    map_t map(budget);
+    REQUIRE(map.limit() == 0);
+
+    const int count = 5 * step;
+    for (int i = 0; i < count; ++i) {
+        map.insert(i, i * 2);
+        if (size_t(i) < 4 * step) {
+            REQUIRE(map.is_internal());
+            REQUIRE(map.limit() >= map.size());
+        }
+    }
+    REQUIRE(map.is_external());
+    REQUIRE(map.size() == size_t(count));
+    REQUIRE(budget.used() == 0);
+    REQUIRE(budget.spills() == 1);
+
+    for (int i = 0; i < count; ++i) {
+        auto pos = map.find(i);
+        REQUIRE(pos != map.end());
+        REQUIRE(pos->second == i * 2);
+    }
+}
+
+TEST_CASE("hybrid containers spill cooperatively", "[memory-budget]") {
+    using buffer_t = hybrid_buffer<int, 512>;
+
+    const size_t step = 512 / sizeof(int);
+    memory_budget budget(4 * step * sizeof(int));
+
+    buffer_t large(budget);
+    buffer_t small(budget);
+
+    std::vector<int> expected;
+    for (size_t i = 0; i < 4 * step; ++i) {
+        large.append(i);
+        expected.push_back(i);
+    }
+    REQUIRE(large.is_internal());
+    REQUIRE(budget.available() == 0);
+
+    // The small buffer is granted memory, the large one is asked to spill.
+    small.append(1);
+    REQUIRE(small.is_internal());
+    REQUIRE(large.is_internal());
+
+    // The large buffer spills at its next append, without losing items.
+    large.append(-1);
+    expected.push_back(-1);
+    REQUIRE(large.is_external());
+    REQUIRE(boost::equal(large, expected));
+    REQUIRE(budget.used() == step * sizeof(int));
+    REQUIRE(budget.spills() == 1);
+}
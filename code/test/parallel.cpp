@@ -0,0 +1,43 @@
+#include <catch.hpp>
+
+#include "geodb/utility/parallel.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace geodb;
+
+TEST_CASE("parallel for visits every index once", "[parallel]") {
+    for (size_t threads : {1, 2, 4, 16}) {
+        std::vector<std::atomic<int>> visited(1000);
+        for (auto& v : visited) {
+            v = 0;
+        }
+
+        parallel_for(visited.size(), threads, [&](size_t i) {
+            ++visited[i];
+        });
+
+        for (size_t i = 0; i < visited.size(); ++i) {
+            if (visited[i] != 1) {
+                FAIL("Index " << i << " was visited " << visited[i] << " times (threads: " << threads << ")");
+            }
+        }
+    }
+
+    parallel_for(0, 4, [&](size_t) {
+        FAIL("Must not be called for an empty range");
+    });
+}
+
+TEST_CASE("parallel for propagates exceptions", "[parallel]") {
+    std::atomic<size_t> calls{0};
+    REQUIRE_THROWS_AS(parallel_for(100, 4, [&](size_t i) {
+        ++calls;
+        if (i == 10) {
+            throw std::runtime_error("failed");
+        }
+    }), std::runtime_error);
+    REQUIRE(calls <= 100);
+}
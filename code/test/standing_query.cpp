@@ -0,0 +1,173 @@
+#include "catch.hpp"
+
+#include "geodb/irwi/standing_query.hpp"
+#include "geodb/irwi/tree.hpp"
+#include "geodb/irwi/tree_internal.hpp"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+
+using namespace geodb;
+
+static sequenced_query make_query(std::vector<simple_query> queries) {
+    sequenced_query q;
+    q.queries = std::move(queries);
+    return q;
+}
+
+TEST_CASE("standing queries respect the query order", "[standing-query]") {
+    const bounding_box zone_a(vector3(0, 0, 0), vector3(10, 10, 1000));
+    const bounding_box zone_b(vector3(100, 100, 0), vector3(110, 110, 1000));
+
+    std::vector<standing_match> matches;
+    standing_query_index index([&](const standing_match& m) { matches.push_back(m); });
+
+    standing_query_id a_then_b = index.add(make_query({simple_query{zone_a, {1}}, simple_query{zone_b, {}}}));
+    standing_query_id b_then_a = index.add(make_query({simple_query{zone_b, {}}, simple_query{zone_a, {1}}}));
+    REQUIRE(index.size() == 2);
+
+    // Trajectory 1 visits a, then b.
+    // Units are probed out of order.
+    index.probe(tree_entry(1, 5, trajectory_unit(vector3(105, 105, 50), vector3(106, 106, 51), 2)));
+    REQUIRE(matches.empty());
+    index.probe(tree_entry(1, 0, trajectory_unit(vector3(5, 5, 10), vector3(6, 6, 11), 1)));
+    REQUIRE(matches.size() == 1);
+    REQUIRE(matches[0].query == a_then_b);
+    REQUIRE(matches[0].trajectory == 1);
+    REQUIRE(matches[0].units.size() == 2);
+    REQUIRE(matches[0].units[0].index == 0);
+    REQUIRE(matches[0].units[1].index == 5);
+
+    // The same trajectory is not reported twice.
+    index.probe(tree_entry(1, 6, trajectory_unit(vector3(105, 105, 52), vector3(106, 106, 53), 2)));
+    REQUIRE(matches.size() == 1);
+
+    // Wrong label in zone a.
+    index.probe(tree_entry(2, 0, trajectory_unit(vector3(105, 105, 10), vector3(106, 106, 11), 2)));
+    index.probe(tree_entry(2, 1, trajectory_unit(vector3(5, 5, 20), vector3(6, 6, 21), 3)));
+    REQUIRE(matches.size() == 1);
+
+    index.probe(tree_entry(2, 2, trajectory_unit(vector3(5, 5, 30), vector3(6, 6, 31), 1)));
+    REQUIRE(matches.size() == 2);
+    REQUIRE(matches[1].query == b_then_a);
+    REQUIRE(matches[1].trajectory == 2);
+
+    index.remove(b_then_a);
+    REQUIRE(index.size() == 1);
+    index.probe(tree_entry(3, 0, trajectory_unit(vector3(105, 105, 10), vector3(106, 106, 11), 2)));
+    index.probe(tree_entry(3, 1, trajectory_unit(vector3(5, 5, 20), vector3(6, 6, 21), 1)));
+    REQUIRE(matches.size() == 2);
+}
+
+TEST_CASE("standing queries discard finished trajectories", "[standing-query]") {
+    const bounding_box zone_a(vector3(0, 0, 0), vector3(10, 10, 1000));
+    const bounding_box zone_b(vector3(100, 100, 0), vector3(110, 110, 1000));
+
+    std::vector<standing_match> matches;
+    standing_query_index index([&](const standing_match& m) { matches.push_back(m); });
+    index.add(make_query({simple_query{zone_a, {}}, simple_query{zone_b, {}}}));
+
+    // Units outside of all queries do not create any state.
+    index.probe(tree_entry(1, 0, trajectory_unit(vector3(50, 50, 10), vector3(51, 51, 11), 1)));
+    REQUIRE(index.trajectories() == 0);
+
+    index.probe(tree_entry(1, 1, trajectory_unit(vector3(5, 5, 10), vector3(6, 6, 11), 1)));
+    index.probe(tree_entry(2, 0, trajectory_unit(vector3(5, 5, 20), vector3(6, 6, 21), 1)));
+    index.probe(tree_entry(3, 0, trajectory_unit(vector3(5, 5, 30), vector3(6, 6, 31), 1)));
+    index.probe(tree_entry(3, 1, trajectory_unit(vector3(105, 105, 40), vector3(106, 106, 41), 1)));
+    REQUIRE(matches.size() == 1);
+    REQUIRE(index.trajectories() == 3);
+
+    // Trajectory 3 has been reported, its marker is dropped as well.
+    index.finish(3);
+    REQUIRE(index.trajectories() == 2);
+
+    // Trajectory 2 was seen at time 21.
+    index.probe(tree_entry(1, 2, trajectory_unit(vector3(50, 50, 50), vector3(51, 51, 51), 1)));
+    index.expire(25);
+    REQUIRE(index.trajectories() == 1);
+
+    // The partial match of trajectory 2 is gone.
+    index.probe(tree_entry(2, 1, trajectory_unit(vector3(105, 105, 60), vector3(106, 106, 61), 1)));
+    REQUIRE(matches.size() == 1);
+
+    // Trajectory 1 kept its progress.
+    index.probe(tree_entry(1, 3, trajectory_unit(vector3(105, 105, 60), vector3(106, 106, 61), 1)));
+    REQUIRE(matches.size() == 2);
+    REQUIRE(matches[1].trajectory == 1);
+}
+
+TEST_CASE("standing queries respect time gaps", "[standing-query]") {
+    const bounding_box zone_a(vector3(0, 0, 0), vector3(10, 10, 1000));
+    const bounding_box zone_b(vector3(100, 100, 0), vector3(110, 110, 1000));
+
+    std::vector<standing_match> matches;
+    standing_query_index index([&](const standing_match& m) { matches.push_back(m); });
+
+    sequenced_query q = make_query({simple_query{zone_a, {}}, simple_query{zone_b, {}}});
+    q.gaps.push_back(time_gap(0, 30));
+    index.add(q);
+
+    // Too late.
+    index.probe(tree_entry(1, 0, trajectory_unit(vector3(5, 5, 10), vector3(6, 6, 11), 1)));
+    index.probe(tree_entry(1, 3, trajectory_unit(vector3(105, 105, 50), vector3(106, 106, 51), 1)));
+    REQUIRE(matches.empty());
+
+    // A later visit of zone a satisfies the constraint.
+    index.probe(tree_entry(1, 2, trajectory_unit(vector3(5, 5, 40), vector3(6, 6, 41), 1)));
+    REQUIRE(matches.size() == 1);
+    REQUIRE(matches[0].units.size() == 2);
+    REQUIRE(matches[0].units[0].index == 2);
+    REQUIRE(matches[0].units[1].index == 3);
+}
+
+TEST_CASE("standing queries agree with tree queries", "[standing-query]") {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 100);
+    std::uniform_int_distribution<time_type> time(0, 1000);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < 40; ++id) {
+        for (u32 unit_index = 0; unit_index < 20; ++unit_index) {
+            const time_type t = time(engine);
+            trajectory_unit unit(vector3(coord(engine), coord(engine), t),
+                                 vector3(coord(engine), coord(engine), t + 5),
+                                 unit_index % 3);
+            entries.push_back(tree_entry(id, unit_index, unit));
+        }
+    }
+    std::shuffle(entries.begin(), entries.end(), engine);
+
+    std::vector<sequenced_query> queries;
+    queries.push_back(make_query({simple_query{bounding_box(vector3(0, 0, 0), vector3(20, 20, 1005)), {0}}}));
+    queries.push_back(make_query({simple_query{bounding_box(vector3(0, 0, 0), vector3(30, 30, 1005)), {1}},
+                                  simple_query{bounding_box(vector3(60, 60, 0), vector3(100, 100, 1005)), {2}}}));
+    queries.push_back(make_query({simple_query{bounding_box(vector3(50, 0, 0), vector3(100, 50, 1005)), {}},
+                                  simple_query{bounding_box(vector3(0, 50, 0), vector3(50, 100, 1005)), {}},
+                                  simple_query{bounding_box(vector3(50, 0, 0), vector3(100, 50, 1005)), {0, 1}}}));
+
+    std::map<standing_query_id, std::set<trajectory_id_type>> reported;
+    standing_query_index index([&](const standing_match& m) {
+        REQUIRE(reported[m.query].insert(m.trajectory).second);
+    });
+
+    std::vector<standing_query_id> ids;
+    for (const sequenced_query& q : queries)
+        ids.push_back(index.add(q));
+
+    tree<tree_internal<8>, 8> tree;
+    tree.standing_queries(&index);
+    for (const tree_entry& e : entries)
+        tree.insert(e);
+
+    for (size_t i = 0; i < queries.size(); ++i) {
+        std::set<trajectory_id_type> expected;
+        for (const trajectory_match& m : tree.find(queries[i]))
+            expected.insert(m.id);
+
+        REQUIRE(!expected.empty());
+        REQUIRE(reported[ids[i]] == expected);
+    }
+}
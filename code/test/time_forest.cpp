@@ -0,0 +1,149 @@
+#include <catch.hpp>
+
+#include "irwi_fixture.hpp"
+
+#include "geodb/irwi/time_forest.hpp"
+#include "geodb/utility/temp_dir.hpp"
+
+#include <random>
+
+using namespace geodb;
+
+namespace {
+
+// Deterministic trajectories that move forward in time (t in [0, 2000)).
+std::vector<tree_entry> timed_entries(trajectory_id_type count, u32 units) {
+    std::mt19937 engine;   // no seed. this is deterministic.
+    std::uniform_real_distribution<float> coord(0, 1000);
+    std::uniform_int_distribution<time_type> start(0, 1000);
+    std::uniform_int_distribution<time_type> step(1, 80);
+    std::uniform_int_distribution<label_type> label(0, 5);
+
+    std::vector<tree_entry> entries;
+    for (trajectory_id_type id = 0; id < count; ++id) {
+        time_type t = start(engine);
+        for (u32 index = 0; index < units; ++index) {
+            const time_type next = t + step(engine);
+            entries.push_back(tree_entry(id, index, trajectory_unit(
+                vector3(coord(engine), coord(engine), t),
+                vector3(coord(engine), coord(engine), next),
+                label(engine))));
+            t = next;
+        }
+    }
+    return entries;
+}
+
+std::vector<sequenced_query> test_queries() {
+    const bounding_box early(vector3(0, 0, 0), vector3(1000, 1000, 300));
+    const bounding_box middle(vector3(0, 0, 400), vector3(600, 600, 900));
+    const bounding_box late(vector3(200, 200, 1000), vector3(1000, 1000, 2500));
+
+    std::vector<sequenced_query> queries;
+    auto add = [&](std::vector<simple_query> simple, std::vector<time_gap> gaps = {}) {
+        sequenced_query q;
+        q.queries = std::move(simple);
+        q.gaps = std::move(gaps);
+        queries.push_back(std::move(q));
+    };
+    add({simple_query{early, {}}});
+    add({simple_query{middle, {2}}});
+    add({simple_query{early, {0, 1}}, simple_query{late, {}}});
+    add({simple_query{middle, {}}, simple_query{late, {3, 4}}}, {time_gap(100, 800)});
+    add({simple_query{late, {1}}, simple_query{early, {1}}});
+    add({simple_query{middle, {42}}});
+    return queries;
+}
+
+} // namespace
+
+TEST_CASE("time forest partitions units by time", "[time-forest]") {
+    const std::vector<tree_entry> entries = timed_entries(20, 20);
+
+    time_forest<internal, Lambda> forest([](const std::string&) { return internal(); }, 250);
+    REQUIRE_THROWS(forest.threads(0));
+    for (const tree_entry& e : entries)
+        forest.insert(e);
+    REQUIRE(forest.size() == entries.size());
+
+    u64 total = 0;
+    for (const time_partition& p : forest.catalog()) {
+        REQUIRE(p.size == forest.partition(p.slice).size());
+        REQUIRE(p.mbb.min().t() >= p.slice * 250);
+        REQUIRE(p.mbb.min().t() < (p.slice + 1) * 250);
+        total += p.size;
+    }
+    REQUIRE(total == entries.size());
+
+    // Inserting directly into a partition requires a refresh of its catalog entry.
+    const u64 slice = forest.catalog().front().slice;
+    const time_partition before = forest.catalog().front();
+    forest.partition(slice).insert(tree_entry(1000, 0, trajectory_unit(
+        vector3(5000, 5000, slice * 250), vector3(5001, 5001, slice * 250 + 1), 99)));
+    forest.refresh(slice);
+    const time_partition after = forest.catalog().front();
+    REQUIRE(after.size == before.size + 1);
+    REQUIRE(after.labels.at(99) == 1);
+    REQUIRE(after.mbb.contains(before.mbb));
+    REQUIRE(after.mbb.max().x() == 5001);
+
+    REQUIRE(forest.drop(slice));
+    REQUIRE(!forest.drop(slice));
+    REQUIRE(!forest.contains(slice));
+    REQUIRE(forest.size() == entries.size() - before.size);
+}
+
+TEST_CASE("time forest query results equal a single tree", "[time-forest]") {
+    const std::vector<tree_entry> entries = timed_entries(60, 20);
+    const std::vector<sequenced_query> queries = test_queries();
+
+    internal_tree reference;
+    for (const tree_entry& e : entries)
+        reference.insert(e);
+
+    std::vector<result_type> expected;
+    for (const sequenced_query& q : queries)
+        expected.push_back(to_map(reference.find(q)));
+
+    auto check = [&](const auto& forest) {
+        for (size_t i = 0; i < queries.size(); ++i) {
+            REQUIRE(to_map(forest.find(queries[i])) == expected[i]);
+        }
+    };
+
+    SECTION("internal") {
+        for (size_t threads : {1, 4}) {
+            time_forest<internal, Lambda> forest([](const std::string&) { return internal(); }, 200);
+            forest.threads(threads);
+            for (const tree_entry& e : entries)
+                forest.insert(e);
+            check(forest);
+        }
+    }
+
+    SECTION("external") {
+        temp_dir dir;
+        auto storage = [&](const std::string& name) {
+            return external(dir.path() / name);
+        };
+
+        std::vector<time_partition> catalog;
+        {
+            time_forest<external, Lambda> forest(storage, 200);
+            forest.threads(4);
+            for (const tree_entry& e : entries)
+                forest.insert(e);
+            check(forest);
+            catalog = forest.catalog();
+        }
+
+        // Reopen the forest using its catalog.
+        time_forest<external, Lambda> forest(storage, 200, catalog);
+        forest.threads(3);
+        REQUIRE(forest.size() == entries.size());
+        check(forest);
+    }
+
+    REQUIRE(expected.back().empty());
+    REQUIRE(!expected.front().empty());
+}
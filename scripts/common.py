@@ -140,7 +140,8 @@ resource.setrlimit(resource.RLIMIT_NOFILE, (64000, limits[1]))
 # entries it will insert (offset None means "start at the beginning", limit
 # None means "insert everything up to EOF").
 def build_tree(algorithm, tree_path, entries_path, logfile, beta=0.5,
-               memory=64, offset=None, limit=None, keep_existing=False):
+               memory=64, offset=None, limit=None, keep_existing=False,
+               split="quadratic", reinsert=0, tune=None, label_weight=None):
     if not keep_existing:
         # Make sure the tree does not exist yet.
         remove(tree_path)
@@ -155,6 +156,8 @@ def build_tree(algorithm, tree_path, entries_path, logfile, beta=0.5,
         "--entries", str(entries_path),
         "--tree", str(tree_path),
         "--beta", str(beta),
+        "--split", split,
+        "--reinsert", str(reinsert),
         "--tmp", str(tpie_temp_path),
         "--stats", str(stats_path),
         "--max-memory", str(memory)
@@ -163,6 +166,10 @@ def build_tree(algorithm, tree_path, entries_path, logfile, beta=0.5,
         args.extend(["--offset", str(offset)])
     if limit is not None:
         args.extend(["--limit", str(limit)])
+    if tune is not None:
+        args.extend(["--tune", str(tune)])
+    if label_weight is not None:
+        args.extend(["--label-weight", str(label_weight)])
 
     subprocess.check_call(args, stdout=logfile)
     print("\n\n", file=logfile, flush=True)
@@ -186,12 +193,16 @@ def compile(type="Release",
             leaf_fanout=0,
             internal_fanout=0,
             bloom_filters=False,
+            adaptive_id_sets=False,
+            compressed_id_sets=False,
             naive_node_building=False,
             cheap_quickload=False,
             debug_stats=False):
     defines = {
         "CMAKE_BUILD_TYPE": type,
         "USE_BLOOM": bool_str(bloom_filters),
+        "USE_ADAPTIVE_ID_SETS": bool_str(adaptive_id_sets),
+        "USE_COMPRESSED_ID_SETS": bool_str(compressed_id_sets),
         "USE_NAIVE_NODE_BUILDING": bool_str(naive_node_building),
         "BLOCK_SIZE": str(block_size),
         "BETA": beta,
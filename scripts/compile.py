@@ -39,6 +39,16 @@ if __name__ == "__main__":
                         action="store_true",
                         default=argparse.SUPPRESS,
                         help="Enable the use of bloom filters")
+    parser.add_argument("--adaptive-id-sets",
+                        dest="adaptive_id_sets",
+                        action="store_true",
+                        default=argparse.SUPPRESS,
+                        help="Choose the id set representation for every posting")
+    parser.add_argument("--compressed-id-sets",
+                        dest="compressed_id_sets",
+                        action="store_true",
+                        default=argparse.SUPPRESS,
+                        help="Store small id sets exactly")
     parser.add_argument("--naive-node-building",
                         dest="naive_node_building",
                         action="store_true",
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# Compares the plain hilbert loader against the label aware variant
+# (label frequency rank as the fourth curve dimension) for different label weights.
+
+import json
+
+import common
+from common import RESULT_PATH, OUTPUT_PATH
+from common import GEOLIFE, OSM_ROUTES
+from common import compile
+from eval_query import get_geolife_queries, get_osm_queries, measure_queries
+from lib.prettytable import PrettyTable
+
+if __name__ == "__main__":
+    tree_dir = common.reset_dir(OUTPUT_PATH / "hilbert_labels")
+
+    variants = [("hilbert", None),
+                ("hilbert-lf", 0.25),
+                ("hilbert-lf", 1.0)]
+    datasets = [("geolife", GEOLIFE, get_geolife_queries()),
+                ("osm", OSM_ROUTES, get_osm_queries())]
+
+    def tree_path(dataset, algorithm, weight):
+        return tree_dir / "{}-{}-{}".format(dataset, algorithm, weight)
+
+    compile()
+
+    results = []
+    with (OUTPUT_PATH / "hilbert_labels.log").open("w") as logfile:
+        for dataset_name, (entries, data_path), query_set in datasets:
+            for algorithm, weight in variants:
+                print("{} (label weight: {}) on {} entries from {}".format(
+                    algorithm, weight, entries, dataset_name))
+
+                path = tree_path(dataset_name, algorithm, weight)
+                build = common.build_tree(algorithm, path, data_path,
+                                          logfile, label_weight=weight)
+                index_size = (common.file_size(path)
+                              - common.file_size(path / "tree.blocks"))
+                results.append({
+                    "dataset": dataset_name,
+                    "algorithm": algorithm,
+                    "label_weight": weight,
+                    "entries": entries,
+                    "build": build,
+                    "index_size": index_size,
+                    "queries": measure_queries(path, query_set, logfile),
+                })
+
+    with (RESULT_PATH / "hilbert_labels.json").open("w") as outfile:
+        json.dump(results, outfile, indent=4, sort_keys=True)
+
+    with (RESULT_PATH / "hilbert_labels.txt").open("w") as outfile:
+        table = PrettyTable([
+            "Dataset", "Algorithm", "Label Weight", "Entries", "Build I/O",
+            "Build Duration", "Index Size", "Avg. Query I/O"
+        ])
+        for key in ["Entries", "Build I/O", "Build Duration",
+                    "Index Size", "Avg. Query I/O"]:
+            table.align[key] = "r"
+
+        def average_io(result):
+            sets = result["queries"].values()
+            return sum(s["total_io"]["avg"] for s in sets) / max(len(sets), 1)
+
+        for result in results:
+            table.add_row([
+                result["dataset"],
+                result["algorithm"],
+                "-" if result["label_weight"] is None else result["label_weight"],
+                result["entries"],
+                result["build"]["total_io"],
+                result["build"]["duration"],
+                result["index_size"],
+                "{:.2f}".format(average_io(result)),
+            ])
+
+        print(table, file=outfile)
@@ -427,6 +427,22 @@ def run_query(tree, query, results=None, logfile=None):
         return json.load(stats_file)
 
 
+# Writes the queries in the format expected by the loader's --tune option.
+def write_workload(queries, path):
+    workload = []
+    for query in queries:
+        workload.append({
+            "queries": [{
+                "rect": [sq.mbb.min[0], sq.mbb.max[0],
+                         sq.mbb.min[1], sq.mbb.max[1],
+                         sq.mbb.min[2], sq.mbb.max[2]],
+                "labels": list(sq.labels),
+            } for sq in query.queries]
+        })
+    with open(str(path), "w") as outfile:
+        json.dump(workload, outfile, indent=4)
+
+
 def tree_stats(tree):
     output = subprocess.check_output([
         str(STATS),
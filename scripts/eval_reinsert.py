@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Compares one-by-one insertion with and without forced reinsertion
+# by building trees and comparing the node overlap and query performance.
+
+import json
+
+import common
+from common import RESULT_PATH, OUTPUT_PATH
+from common import GEOLIFE, OSM_ROUTES
+from common import compile
+from eval_query import get_geolife_queries, get_osm_queries, measure_queries, tree_stats
+from lib.prettytable import PrettyTable
+
+if __name__ == "__main__":
+    tree_dir = common.reset_dir(OUTPUT_PATH / "reinsert")
+
+    fractions = [0, 0.3]
+    datasets = [("geolife", GEOLIFE, get_geolife_queries()),
+                ("osm", OSM_ROUTES, get_osm_queries())]
+
+    def tree_path(dataset, fraction):
+        return tree_dir / "{}-obo-reinsert-{}".format(dataset, fraction)
+
+    compile()
+
+    results = []
+    with (OUTPUT_PATH / "reinsert.log").open("w") as logfile:
+        for dataset_name, (entries, data_path), query_set in datasets:
+            for fraction in fractions:
+                print("obo (reinsert: {}) on {} entries from {}".format(
+                    fraction, entries, dataset_name))
+
+                path = tree_path(dataset_name, fraction)
+                build = common.build_tree("obo", path, data_path,
+                                          logfile, reinsert=fraction)
+                results.append({
+                    "dataset": dataset_name,
+                    "reinsert": fraction,
+                    "entries": entries,
+                    "build": build,
+                    "stats": tree_stats(path),
+                    "queries": measure_queries(path, query_set, logfile),
+                })
+
+    with (RESULT_PATH / "reinsert.json").open("w") as outfile:
+        json.dump(results, outfile, indent=4, sort_keys=True)
+
+    with (RESULT_PATH / "reinsert.txt").open("w") as outfile:
+        table = PrettyTable([
+            "Dataset", "Reinsert", "Entries", "Build I/O", "Build Duration",
+            "Internal Area Ratio (per level)", "Avg. Query I/O"
+        ])
+        for key in ["Entries", "Build I/O", "Build Duration", "Avg. Query I/O"]:
+            table.align[key] = "r"
+
+        def average_io(result):
+            sets = result["queries"].values()
+            return sum(s["total_io"]["avg"] for s in sets) / max(len(sets), 1)
+
+        for result in results:
+            ratios = result["stats"]["internal_area_ratio_level"]
+            table.add_row([
+                result["dataset"],
+                result["reinsert"],
+                result["entries"],
+                result["build"]["total_io"],
+                result["build"]["duration"],
+                ", ".join("{:.3f}".format(r) for r in ratios),
+                "{:.2f}".format(average_io(result)),
+            ])
+
+        print(table, file=outfile)
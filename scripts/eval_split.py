@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Compares the quadratic node split against the R*-style split
+# by building trees with both algorithms and measuring
+# the construction cost as well as the resulting query performance.
+
+import json
+
+import common
+from common import RESULT_PATH, OUTPUT_PATH
+from common import GEOLIFE, OSM_ROUTES
+from common import compile
+from eval_query import get_geolife_queries, get_osm_queries, measure_queries
+from lib.prettytable import PrettyTable
+
+if __name__ == "__main__":
+    tree_dir = common.reset_dir(OUTPUT_PATH / "split")
+
+    splits = ["quadratic", "rstar"]
+    algorithms = ["obo", "quickload"]
+    datasets = [("geolife", GEOLIFE, get_geolife_queries()),
+                ("osm", OSM_ROUTES, get_osm_queries())]
+
+    def tree_path(dataset, algorithm, split):
+        return tree_dir / "{}-{}-{}".format(dataset, algorithm, split)
+
+    compile()
+
+    results = []
+    with (OUTPUT_PATH / "split.log").open("w") as logfile:
+        for dataset_name, (entries, data_path), query_set in datasets:
+            for algorithm in algorithms:
+                for split in splits:
+                    print("{} (split: {}) on {} entries from {}".format(
+                        algorithm, split, entries, dataset_name))
+
+                    path = tree_path(dataset_name, algorithm, split)
+                    build = common.build_tree(algorithm, path, data_path,
+                                              logfile, split=split)
+                    queries = measure_queries(path, query_set, logfile)
+                    results.append({
+                        "dataset": dataset_name,
+                        "algorithm": algorithm,
+                        "split": split,
+                        "entries": entries,
+                        "build": build,
+                        "queries": queries,
+                    })
+
+    with (RESULT_PATH / "split.json").open("w") as outfile:
+        json.dump(results, outfile, indent=4, sort_keys=True)
+
+    with (RESULT_PATH / "split.txt").open("w") as outfile:
+        table = PrettyTable([
+            "Dataset", "Algorithm", "Split", "Entries",
+            "Build I/O", "Build Duration", "Avg. Query I/O", "Avg. Query Duration"
+        ])
+        for key in ["Entries", "Build I/O", "Build Duration",
+                    "Avg. Query I/O", "Avg. Query Duration"]:
+            table.align[key] = "r"
+
+        def average(result, key):
+            sets = result["queries"].values()
+            return sum(s[key]["avg"] for s in sets) / max(len(sets), 1)
+
+        for result in results:
+            table.add_row([
+                result["dataset"],
+                result["algorithm"],
+                result["split"],
+                result["entries"],
+                result["build"]["total_io"],
+                result["build"]["duration"],
+                "{:.2f}".format(average(result, "total_io")),
+                "{:.4f}".format(average(result, "duration")),
+            ])
+
+        print(table, file=outfile)